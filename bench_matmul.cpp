@@ -0,0 +1,78 @@
+// Times jo_gemm against a plain triple loop on square matrices, in GFLOP/s.
+//
+//   make bench_matmul && ./bench_matmul [max size] [max naive size]
+//
+// The naive loop stops at 1024 by default, as at 4096 it takes minutes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include "jo_stdcpp.h"
+
+static void naive_matmul(size_t n, const double *a, const double *b, double *c) {
+    for(size_t i = 0; i < n; ++i) {
+        for(size_t j = 0; j < n; ++j) {
+            double sum = 0;
+            for(size_t p = 0; p < n; ++p) {
+                sum += a[i*n + p] * b[p*n + j];
+            }
+            c[i*n + j] = sum;
+        }
+    }
+}
+
+// repeats small sizes so each measurement runs for a while
+static double gflops(size_t n, double seconds, int reps) {
+    return 2.0 * n * n * n * reps / seconds / 1e9;
+}
+
+int main(int argc, char **argv) {
+    size_t max_n = argc > 1 ? atoi(argv[1]) : 4096;
+    size_t max_naive = argc > 2 ? atoi(argv[2]) : 1024;
+    printf("%d threads, %s\n", jo_hardware_concurrency(), jo_simd_has_avx2() ? "avx2" : "no avx2");
+    printf("%6s %12s %12s %12s %10s\n", "n", "naive", "gemm 1T", "gemm MT", "max err");
+    for(size_t n = 64; n <= max_n; n *= 2) {
+        double *a = new double[n*n], *b = new double[n*n], *c = new double[n*n], *ref = new double[n*n];
+        for(size_t i = 0; i < n*n; ++i) {
+            a[i] = (double)(rand() % 1000) / 1000.0;
+            b[i] = (double)(rand() % 1000) / 1000.0;
+        }
+        int reps = n <= 256 ? (int)(256 / n * 256 / n * 4) : 1;
+        double naive = 0, t;
+        if(n <= max_naive) {
+            t = jo_time();
+            for(int r = 0; r < reps; ++r) {
+                naive_matmul(n, a, b, ref);
+            }
+            naive = gflops(n, jo_time() - t, reps);
+        }
+        double single = 0, multi = 0;
+        for(int threads = 1; threads >= 0; --threads) {
+            t = jo_time();
+            for(int r = 0; r < reps; ++r) {
+                memset(c, 0, n*n*sizeof(double));
+                jo_gemm(n, n, n, a, n, b, n, c, n, threads);
+            }
+            (threads ? single : multi) = gflops(n, jo_time() - t, reps);
+        }
+        double err = 0;
+        if(n <= max_naive) {
+            for(size_t i = 0; i < n*n; ++i) {
+                double d = fabs(c[i] - ref[i]);
+                err = d > err ? d : err;
+            }
+        }
+        // without the naive loop's result there is nothing to check against
+        char naive_s[32] = "-", err_s[32] = "-";
+        if(n <= max_naive) {
+            snprintf(naive_s, sizeof(naive_s), "%.2f", naive);
+            snprintf(err_s, sizeof(err_s), "%.2g", err);
+        }
+        printf("%6d %12s %12.2f %12.2f %10s\n", (int)n, naive_s, single, multi, err_s);
+        fflush(stdout);
+        delete[] a; delete[] b; delete[] c; delete[] ref;
+    }
+    return 0;
+}
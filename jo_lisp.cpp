@@ -7,14 +7,15 @@
 #include <string>
 #include <map>
 #include <unordered_map>
+#include <new>
 #include "debugbreak.h"
 #include "jo_stdcpp.h"
 
 //#define debugf printf
-#define debugf sizeof
+#define debugf(...) ((void)sizeof(printf(__VA_ARGS__)))
 
 //#define warnf printf
-#define warnf sizeof
+#define warnf(...) ((void)sizeof(printf(__VA_ARGS__)))
 
 static double time_program_start = jo_time();
 
@@ -59,10 +60,16 @@ enum {
 	NODE_VECTOR,
 	NODE_SET,
 	NODE_MAP,
+	NODE_SORTED_SET,
+	NODE_SORTED_MAP,
+	NODE_VECTOR_OF,
+	NODE_TENSOR,
 	NODE_NATIVE_FUNCTION,
 	NODE_FUNC,
 	NODE_VAR,
 	NODE_DELAY,
+	NODE_FUTURE,
+	NODE_IO,
 
 	// node flags
 	NODE_FLAG_MACRO        = 1<<0,
@@ -70,6 +77,8 @@ enum {
 	NODE_FLAG_LAZY         = 1<<2, // unused
 	NODE_FLAG_LITERAL      = 1<<3,
 	NODE_FLAG_LITERAL_ARGS = 1<<4,
+	NODE_FLAG_TRANSIENT    = 1<<5, // editable in place until persistent!
+	NODE_FLAG_ELEMENTWISE  = 1<<7, // native maps itself over the numbers of a vector-of
 };
 
 struct env_t;
@@ -97,13 +106,242 @@ typedef jo_shared_ptr<vector_t> vector_ptr_t;
 typedef jo_persistent_unordered_map<node_idx_t, node_idx_t> map_t;
 typedef jo_shared_ptr<map_t> map_ptr_t;
 
-typedef jo_shared_ptr<env_t> env_ptr_t;
+// a set is a map from each element to itself, so it shares the map's trie
+typedef map_t set_t;
+typedef map_ptr_t set_ptr_t;
+
+// sorted maps and sorted sets share one tree, a sorted set maps each element to itself
+typedef jo_persistent_sorted_map<node_idx_t, node_idx_t> sorted_map_t;
+typedef jo_shared_ptr<sorted_map_t> sorted_map_ptr_t;
+
+// vector-of keeps its numbers unboxed, in leaves of raw doubles, ints or bytes
+enum {
+	VECTOR_OF_DOUBLE,
+	VECTOR_OF_INT,
+	VECTOR_OF_BYTE,
+};
+
+typedef jo_persistent_vector<double> vector_double_t;
+typedef jo_persistent_vector<int> vector_int_t;
+typedef jo_persistent_vector<unsigned char> vector_byte_t;
+
+// Only the vector matching kind is allocated. Elements go in and out as doubles,
+// which holds any int exactly.
+struct vector_of_t {
+	int kind;
+	jo_shared_ptr<vector_double_t> doubles;
+	jo_shared_ptr<vector_int_t> ints;
+	jo_shared_ptr<vector_byte_t> bytes;
+
+	vector_of_t(int kind) : kind(kind), doubles(), ints(), bytes() {
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: doubles = new vector_double_t(); break;
+		case VECTOR_OF_INT:    ints = new vector_int_t(); break;
+		case VECTOR_OF_BYTE:   bytes = new vector_byte_t(); break;
+		}
+	}
+
+	size_t size() const {
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: return doubles->size();
+		case VECTOR_OF_INT:    return ints->size();
+		case VECTOR_OF_BYTE:   return bytes->size();
+		}
+		return 0;
+	}
+
+	double nth(size_t i) const {
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: return doubles->nth(i);
+		case VECTOR_OF_INT:    return ints->nth(i);
+		case VECTOR_OF_BYTE:   return bytes->nth(i);
+		}
+		return 0;
+	}
+
+	// a copy with its own vector header, which push_back_inplace can then edit
+	// without disturbing this. The trees stay shared until written to.
+	vector_of_t *clone() const {
+		vector_of_t *ret = new vector_of_t(*this);
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: ret->doubles = doubles->clone(); break;
+		case VECTOR_OF_INT:    ret->ints = ints->clone(); break;
+		case VECTOR_OF_BYTE:   ret->bytes = bytes->clone(); break;
+		}
+		return ret;
+	}
+
+	// appends, mutating this, so only on a fresh vector or clone()
+	void push_back_inplace(double value) {
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: doubles->push_back_inplace(value); break;
+		case VECTOR_OF_INT:    ints->push_back_inplace((int)value); break;
+		case VECTOR_OF_BYTE:   bytes->push_back_inplace((unsigned char)(int)value); break;
+		}
+	}
+
+	// a copy with element i replaced, or value appended when i is size()
+	vector_of_t *assoc(size_t i, double value) const {
+		vector_of_t *ret = new vector_of_t(*this);
+		bool append = i == size();
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: ret->doubles = append ? doubles->push_back(value) : doubles->assoc(i, value); break;
+		case VECTOR_OF_INT:    ret->ints = append ? ints->push_back((int)value) : ints->assoc(i, (int)value); break;
+		case VECTOR_OF_BYTE:   ret->bytes = append ? bytes->push_back((unsigned char)(int)value) : bytes->assoc(i, (unsigned char)(int)value); break;
+		}
+		return ret;
+	}
+
+	vector_of_t *subvec(size_t start, size_t end) const {
+		vector_of_t *ret = new vector_of_t(*this);
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: ret->doubles = doubles->subvec(start, end); break;
+		case VECTOR_OF_INT:    ret->ints = ints->subvec(start, end); break;
+		case VECTOR_OF_BYTE:   ret->bytes = bytes->subvec(start, end); break;
+		}
+		return ret;
+	}
+
+	// calls f(double) on each element in order, walking the leaves directly
+	template<typename F>
+	void each(F f) const {
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: for(vector_double_t::iterator it = doubles->begin(); it; ++it) f(*it); break;
+		case VECTOR_OF_INT:    for(vector_int_t::iterator it = ints->begin(); it; ++it) f(*it); break;
+		case VECTOR_OF_BYTE:   for(vector_byte_t::iterator it = bytes->begin(); it; ++it) f(*it); break;
+		}
+	}
+
+	bool equals(const vector_of_t &other) const {
+		if(kind != other.kind) {
+			return false;
+		}
+		auto eq = [](double a, double b) { return a == b; };
+		switch(kind) {
+		case VECTOR_OF_DOUBLE: return doubles->equals(*other.doubles, eq);
+		case VECTOR_OF_INT:    return ints->equals(*other.ints, eq);
+		case VECTOR_OF_BYTE:   return bytes->equals(*other.bytes, eq);
+		}
+		return false;
+	}
+};
+typedef jo_shared_ptr<vector_of_t> vector_of_ptr_t;
+
+enum {
+	TENSOR_MAX_RANK = 8,
+};
+
+typedef jo_vector<double> tensor_data_t;
+
+// A dense n-dimensional array of doubles, row-major in one block. Views such as transpose
+// and slices share the block with their source, and only differ in offset, shape and strides.
+struct tensor_t {
+	jo_shared_ptr<tensor_data_t> data;
+	size_t offset;
+	int rank;
+	size_t shape[TENSOR_MAX_RANK];
+	size_t strides[TENSOR_MAX_RANK];
+
+	tensor_t() : data(), offset(), rank(), shape(), strides() {}
+
+	// zero filled
+	tensor_t(int rank, const size_t *dims) : data(), offset(), rank(rank), shape(), strides() {
+		for(int i = 0; i < rank; i++) {
+			shape[i] = dims[i];
+		}
+		set_row_major_strides();
+		data = new tensor_data_t(size());
+	}
+
+	void set_row_major_strides() {
+		size_t stride = 1;
+		for(int i = rank - 1; i >= 0; i--) {
+			strides[i] = stride;
+			stride *= shape[i];
+		}
+	}
+
+	size_t size() const {
+		size_t n = 1;
+		for(int i = 0; i < rank; i++) {
+			n *= shape[i];
+		}
+		return n;
+	}
+
+	bool is_contiguous() const {
+		size_t stride = 1;
+		for(int i = rank - 1; i >= 0; i--) {
+			if(shape[i] != 1 && strides[i] != stride) {
+				return false;
+			}
+			stride *= shape[i];
+		}
+		return true;
+	}
+
+	double *ptr() const {
+		return data.ptr->data() + offset;
+	}
+
+	// calls f(index, value) for each element, in row-major order
+	template<typename F>
+	void each(F f) const {
+		size_t n = size();
+		if(n == 0) {
+			return;
+		}
+		size_t index[TENSOR_MAX_RANK] = {};
+		double *base = ptr();
+		for(size_t i = 0; i < n; i++) {
+			size_t off = 0;
+			for(int d = 0; d < rank; d++) {
+				off += index[d] * strides[d];
+			}
+			f((const size_t *)index, base[off]);
+			for(int d = rank - 1; d >= 0; d--) {
+				if(++index[d] < shape[d]) {
+					break;
+				}
+				index[d] = 0;
+			}
+		}
+	}
+
+	// this, or a row-major copy of it
+	tensor_t contiguous() const {
+		if(is_contiguous()) {
+			return *this;
+		}
+		tensor_t ret(rank, shape);
+		double *out = ret.ptr();
+		each([&](const size_t *index, double x) { *out++ = x; });
+		return ret;
+	}
+
+	// element i along the first axis, sharing the data
+	tensor_t slice(size_t i) const {
+		tensor_t ret = *this;
+		ret.offset += i * strides[0];
+		ret.rank--;
+		for(int d = 0; d < ret.rank; d++) {
+			ret.shape[d] = shape[d+1];
+			ret.strides[d] = strides[d+1];
+		}
+		return ret;
+	}
+};
+typedef jo_shared_ptr<tensor_t> tensor_ptr_t;
+
+typedef jo_intrusive_ptr<env_t> env_ptr_t;
 
 typedef node_idx_t (*native_function_t)(env_ptr_t env, list_ptr_t args);
 
 static list_ptr_t new_list() { return list_ptr_t(new list_t()); }
 static vector_ptr_t new_vector() { return vector_ptr_t(new vector_t()); }
 static map_ptr_t new_map() { return map_ptr_t(new map_t()); }
+static set_ptr_t new_set() { return set_ptr_t(new set_t()); }
+static sorted_map_ptr_t new_sorted_map() { return sorted_map_ptr_t(new sorted_map_t()); }
 
 static inline node_t *get_node(node_idx_t idx);
 static inline int get_node_type(node_idx_t idx);
@@ -124,7 +362,7 @@ static bool node_lte(env_ptr_t env, node_idx_t n1i, node_idx_t n2i);
 static node_idx_t eval_node(env_ptr_t env, node_idx_t root);
 static node_idx_t eval_node_list(env_ptr_t env, list_ptr_t list);
 
-struct env_t {
+struct env_t : jo_refcounted {
 	// for iterating them all, otherwise unused.
 	list_ptr_t vars;
 	// TODO: need persistent version of vars_map
@@ -136,13 +374,18 @@ struct env_t {
 	};
 	std::unordered_map<std::string, fast_val_t> vars_map;
 	env_ptr_t parent;
+	// lookups may run concurrently from several threads, def/set take it exclusively
+	mutable jo_rwlock lock;
 
-	env_t(env_ptr_t p) : vars(new_list()), vars_map(), parent(p) {}
+	env_t(env_ptr_t p) : vars(new_list()), vars_map(), parent(p), lock() {}
 
 	fast_val_t find(const jo_string &name) const {
-		auto it = vars_map.find(name.c_str());
-		if(it != vars_map.end()) {
-			return it->second;
+		{
+			jo_shared_lock_guard guard(lock);
+			auto it = vars_map.find(name.c_str());
+			if(it != vars_map.end()) {
+				return it->second;
+			}
 		}
 		if(parent.ptr) {
 			return parent->find(name);
@@ -159,11 +402,14 @@ struct env_t {
 	}
 
 	void remove(const jo_string &name) {
-		auto it = vars_map.find(name.c_str());
-		if(it != vars_map.end()) {
-			vars = vars->erase(it->second.var);
-			vars_map.erase(it);
-			return;
+		{
+			jo_unique_lock_guard guard(lock);
+			auto it = vars_map.find(name.c_str());
+			if(it != vars_map.end()) {
+				vars = vars->erase(it->second.var);
+				vars_map.erase(it);
+				return;
+			}
 		}
 		if(parent.ptr) {
 			parent->remove(name);
@@ -175,12 +421,14 @@ struct env_t {
 			remove(name);
 		}
 		node_idx_t idx = new_node_var(name, value);
+		jo_unique_lock_guard guard(lock);
 		vars = vars->push_front(idx);
 		vars_map[name.c_str()] = fast_val_t(idx, value);
 	}
 
 	// sets the map only, but cannot iterate it. for dotimes and stuffs.
 	void set_temp(const jo_string &name, node_idx_t value) {
+		jo_unique_lock_guard guard(lock);
 		vars_map[name.c_str()] = fast_val_t(NIL_NODE, value);
 	}
 
@@ -188,7 +436,8 @@ struct env_t {
 		for(list_t::iterator k = key_list->begin(), v = value_list->begin(); k && v; k++,v++) {
 			node_idx_t key_idx = *k;
 			node_idx_t value_idx = *v;
-			if(get_node_type(key_idx) == NODE_LIST && get_node_type(value_idx) == NODE_LIST) {
+			int key_type = get_node_type(key_idx), value_type = get_node_type(value_idx);
+			if((key_type == NODE_LIST || key_type == NODE_VECTOR) && (value_type == NODE_LIST || value_type == NODE_VECTOR)) {
 				set_temp(get_node_list(key_idx), get_node_list(value_idx));
 			} else {
 				set_temp(get_node_string(key_idx), value_idx);
@@ -199,18 +448,96 @@ struct env_t {
 
 static env_ptr_t new_env(env_ptr_t parent) { return env_ptr_t(new env_t(parent)); }
 
+// shared state of a future or promise, filled in by whichever thread computes (or delivers) it
+struct future_t {
+	jo_mutex mutex;
+	jo_condition_variable cv;
+	volatile int done; // read with jo_atomic_load, set once under mutex
+	node_idx_t value;
+	// what to compute, released once done
+	env_ptr_t env;
+	list_ptr_t body;
+	bool is_future; // made by future, not by promise
+
+	future_t(bool is_future = false) : mutex(), cv(), done(false), value(NIL_NODE), env(), body(), is_future(is_future) {}
+};
+
+typedef jo_shared_ptr<future_t> future_ptr_t;
+
+// an open file, or stdin, behind a reader or writer
+struct io_t {
+	jo_mutex mutex;
+	FILE *fp;
+	bool owned; // fp is closed with this, which stdin is not
+	// read ahead, the bytes of the file from offset buf_pos on
+	jo_vector<char> buf;
+	long long buf_pos;
+	bool eof;
+	// where read-line picks up
+	long long pos;
+	// written, but not yet passed on to fp
+	jo_byte_buffer out;
+	bool failed;
+
+	io_t(FILE *fp, bool owned) : mutex(), fp(fp), owned(owned), buf(), buf_pos(), eof(), pos(), out(), failed() {}
+	~io_t() { close(); }
+
+	void flush() {
+		if(fp && out.size) {
+			failed |= fwrite(out.data, 1, out.size, fp) != out.size;
+		}
+		out.clear();
+	}
+
+	// false if anything written was lost
+	bool close() {
+		flush();
+		if(fp && owned) {
+			failed |= fclose(fp) != 0;
+		}
+		fp = NULL;
+		return !failed;
+	}
+};
+
+typedef jo_shared_ptr<io_t> io_ptr_t;
+
+// less than for the keys of a sorted collection
+struct sorted_lt_t {
+	env_ptr_t env;
+	node_idx_t comparator;
+
+	sorted_lt_t(env_ptr_t env, node_idx_t comparator) : env(env), comparator(comparator) {}
+	sorted_lt_t(env_ptr_t env, const node_t *coll);
+
+	bool operator()(node_idx_t a, node_idx_t b) const;
+};
+
 struct node_t {
 	int type;
 	int flags;
 	jo_string t_string;
 	list_ptr_t t_list;
 	vector_ptr_t t_vector;
-	map_ptr_t t_map;
+	map_ptr_t t_map; // also holds the elements of a set
+	// cached jo_hash_value of a string or collection, 0 until known. Read and written
+	// with jo_atomic_load/store, as threads sharing the node may fill it in at once.
+	size_t t_hash;
 	struct {
 		list_ptr_t args;
 		list_ptr_t body;
 		env_ptr_t env;
 	} t_func;
+	// The handle of the types which have one. Only the member for the node's type is ever
+	// constructed, so it may only be assigned once type is set, and type never changes
+	// after. For any other type, all of it reads as null.
+	union {
+		sorted_map_ptr_t t_sorted; // sorted map or sorted set, ordered by t_comparator
+		vector_of_ptr_t t_vector_of;
+		tensor_ptr_t t_tensor;
+		future_ptr_t t_future;
+		io_ptr_t t_io;
+	};
 	union {
 		node_idx_t t_var; // link to the variable
 		bool t_bool;
@@ -220,25 +547,101 @@ struct node_t {
 		node_idx_t t_delay; // cached result
 		node_idx_t t_lazy_fn;
 		native_function_t t_native_function;
+		node_idx_t t_comparator; // nil for the default ordering
 	};
 
+	node_t(int type = NODE_NIL) : type(type), flags(), t_string(), t_list(), t_vector(), t_map(), t_hash(), t_func(), t_float() {
+		handle_copy(NULL);
+	}
+	node_t(const node_t &other) : type(other.type), flags(other.flags), t_string(other.t_string), t_list(other.t_list), t_vector(other.t_vector), t_map(other.t_map), t_hash(other.t_hash), t_func(other.t_func) {
+		memcpy(&t_float, &other.t_float, sizeof(t_float));
+		handle_copy(&other);
+	}
+	~node_t() { handle_release(); }
+
+	node_t &operator=(const node_t &other) {
+		if(this != &other) {
+			handle_release();
+			type = other.type;
+			flags = other.flags;
+			t_string = other.t_string;
+			t_list = other.t_list;
+			t_vector = other.t_vector;
+			t_map = other.t_map;
+			t_hash = other.t_hash;
+			t_func = other.t_func;
+			memcpy(&t_float, &other.t_float, sizeof(t_float));
+			handle_copy(&other);
+		}
+		return *this;
+	}
+
+	// constructs the handle member for type, as a copy of other's or null
+	void handle_copy(const node_t *other) {
+		switch(type) {
+		case NODE_SORTED_SET:
+		case NODE_SORTED_MAP: new(&t_sorted) sorted_map_ptr_t(other ? other->t_sorted : sorted_map_ptr_t()); break;
+		case NODE_VECTOR_OF:  new(&t_vector_of) vector_of_ptr_t(other ? other->t_vector_of : vector_of_ptr_t()); break;
+		case NODE_TENSOR:     new(&t_tensor) tensor_ptr_t(other ? other->t_tensor : tensor_ptr_t()); break;
+		case NODE_FUTURE:     new(&t_future) future_ptr_t(other ? other->t_future : future_ptr_t()); break;
+		case NODE_IO:         new(&t_io) io_ptr_t(other ? other->t_io : io_ptr_t()); break;
+		default:              new(&t_sorted) sorted_map_ptr_t(); break;
+		}
+	}
+
+	void handle_release() {
+		switch(type) {
+		case NODE_SORTED_SET:
+		case NODE_SORTED_MAP: t_sorted.~sorted_map_ptr_t(); break;
+		case NODE_VECTOR_OF:  t_vector_of.~vector_of_ptr_t(); break;
+		case NODE_TENSOR:     t_tensor.~tensor_ptr_t(); break;
+		case NODE_FUTURE:     t_future.~future_ptr_t(); break;
+		case NODE_IO:         t_io.~io_ptr_t(); break;
+		}
+	}
+
 	bool is_symbol() const { return type == NODE_SYMBOL; }
 	bool is_keyword() const { return type == NODE_KEYWORD; }
 	bool is_list() const { return type == NODE_LIST; }
 	bool is_vector() const { return type == NODE_VECTOR; }
 	bool is_map() const { return type == NODE_MAP; }
+	bool is_set() const { return type == NODE_SET; }
+	bool is_sorted_map() const { return type == NODE_SORTED_MAP; }
+	bool is_sorted_set() const { return type == NODE_SORTED_SET; }
+	bool is_sorted() const { return is_sorted_map() || is_sorted_set(); }
 	bool is_lazy_list() const { return type == NODE_LAZY_LIST; }
+	bool is_vector_of() const { return type == NODE_VECTOR_OF; }
+	bool is_tensor() const { return type == NODE_TENSOR; }
 	bool is_string() const { return type == NODE_STRING; }
 	bool is_func() const { return type == NODE_FUNC; }
 	bool is_macro() const { return flags & NODE_FLAG_MACRO;}
 	bool is_float() const { return type == NODE_FLOAT; }
 	bool is_int() const { return type == NODE_INT; }
+	bool is_future() const { return type == NODE_FUTURE; }
+	bool is_io() const { return type == NODE_IO; }
+	bool is_transient() const { return flags & NODE_FLAG_TRANSIENT; }
+
+	bool is_seq() const { return is_list() || is_lazy_list() || is_map() || is_vector() || is_set() || is_sorted() || is_vector_of() || is_tensor(); }
 
-	bool is_seq() const { return is_list() || is_lazy_list() || is_map() || is_vector(); }
+	// O(1) element count of the collections which keep one, false for lazy lists
+	bool known_size(size_t &n) {
+		switch(type) {
+		case NODE_LIST:        n = t_list->size(); return true;
+		case NODE_VECTOR:      n = t_vector->size(); return true;
+		case NODE_SET:
+		case NODE_MAP:         n = t_map->size(); return true;
+		case NODE_SORTED_SET:
+		case NODE_SORTED_MAP:  n = t_sorted->size(); return true;
+		case NODE_VECTOR_OF:   n = t_vector_of->size(); return true;
+		case NODE_TENSOR:      n = t_tensor->shape[0]; return true;
+		}
+		return false;
+	}
 
 	list_ptr_t &as_list() { return t_list; }
 	vector_ptr_t &as_vector() { return t_vector; }
 	map_ptr_t &as_map() { return t_map; }
+	set_ptr_t &as_set() { return t_map; }
 
 	bool as_bool() const {
 		switch(type) {
@@ -252,7 +655,11 @@ struct node_t {
 			case NODE_LAZY_LIST:
 			case NODE_VECTOR:
 			case NODE_SET:
-			case NODE_MAP:    return true; // TODO
+			case NODE_MAP:
+			case NODE_SORTED_SET:
+			case NODE_SORTED_MAP:
+			case NODE_VECTOR_OF:
+			case NODE_TENSOR: return true; // TODO
 			default:          return false;
 		}
 	}
@@ -310,8 +717,15 @@ struct node_t {
 		case NODE_VECTOR:  return "vector";
 		case NODE_SET:     return "set";
 		case NODE_MAP:     return "map";
+		case NODE_SORTED_SET: return "sorted-set";
+		case NODE_SORTED_MAP: return "sorted-map";
+		case NODE_VECTOR_OF: return "vector-of";
+		case NODE_TENSOR: return "tensor";
 		case NODE_NATIVE_FUNCTION: return "native_function";
 		case NODE_VAR:	   return "var";
+		case NODE_DELAY:   return "delay";
+		case NODE_FUTURE:  return "future";
+		case NODE_IO:      return "io";
 		case NODE_SYMBOL:  return "symbol";
 		case NODE_KEYWORD: return "keyword";
 		}
@@ -319,8 +733,21 @@ struct node_t {
 	}
 };
 
-static jo_vector<node_t> nodes;
-static jo_vector<node_idx_t> free_nodes; // available for allocation...
+// Nodes live in fixed size pages which never move, so a node_t* stays valid while other threads allocate.
+// Each thread hands out indices from its own block and only touches shared state to grab a new block.
+enum {
+	NODE_PAGE_SHIFT = 12,
+	NODE_PAGE_SIZE = 1 << NODE_PAGE_SHIFT,
+	NODE_PAGE_MASK = NODE_PAGE_SIZE - 1,
+	NODE_MAX_PAGES = 1 << 16,
+	NODE_BLOCK_SIZE = 256, // must divide NODE_PAGE_SIZE
+};
+
+static node_t *node_pages[NODE_MAX_PAGES];
+static volatile int num_nodes; // indices handed out so far, across all threads
+static jo_mutex node_pages_mutex;
+static thread_local int tl_node_next, tl_node_end;
+static thread_local jo_vector<node_idx_t> free_nodes; // available for allocation...
 
 static void print_node(node_idx_t node, int depth = 0, bool same_line=false);
 static void print_node_type(node_idx_t node);
@@ -328,8 +755,79 @@ static void print_node_list(list_ptr_t nodes, int depth = 0);
 static void print_node_vector(vector_ptr_t nodes, int depth = 0);
 static void print_node_map(map_ptr_t nodes, int depth = 0);
 
+// Output. print and friends don't go through printf, but append to this thread's tl_out,
+// which out_commit then hands on once per call: to the with-out-str capturing it, if
+// any, or else to out_stdout. That goes out in OUT_FLUSH_SIZE blocks, or at once when
+// stdout is a terminal, and out_flush sends whatever is left.
+enum {
+	OUT_FLUSH_SIZE = 1 << 16,
+};
+
+static jo_mutex out_mutex;
+static jo_byte_buffer out_stdout; // under out_mutex
+static thread_local jo_byte_buffer tl_out;
+static thread_local jo_byte_buffer *tl_out_capture;
+
+static inline void out_write(const char *s, size_t n) {
+	tl_out.write(s, n);
+}
+
+static inline void out_str(const char *s) {
+	out_write(s, strlen(s));
+}
+
+static inline void out_char(char c) {
+	tl_out.put(c);
+}
+
+static inline void out_int(long long v) {
+	char buf[24];
+	out_write(buf, jo_format_int(buf, v));
+}
+
+static inline void out_float(double v) {
+	char buf[JO_FORMAT_FLOAT_MAX];
+	out_write(buf, jo_format_float(buf, v));
+}
+
+static void out_printf(const char *fmt, ...) {
+	char buf[1024];
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	out_write(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+}
+
+static void out_flush() {
+	jo_lock_guard guard(out_mutex);
+	if(out_stdout.size) {
+		fwrite(out_stdout.data, 1, out_stdout.size, stdout);
+	}
+	out_stdout.clear();
+	fflush(stdout);
+}
+
+static void out_commit() {
+	if(tl_out_capture) {
+		tl_out_capture->write(tl_out.data, tl_out.size);
+		tl_out.clear();
+		return;
+	}
+	static const bool tty = jo_isatty(stdout);
+	{
+		jo_lock_guard guard(out_mutex);
+		out_stdout.write(tl_out.data, tl_out.size);
+		tl_out.clear();
+		if(out_stdout.size < OUT_FLUSH_SIZE && !tty) {
+			return;
+		}
+	}
+	out_flush();
+}
+
 static inline node_t *get_node(node_idx_t idx) {
-	return &nodes[idx];
+	return &node_pages[idx >> NODE_PAGE_SHIFT][idx & NODE_PAGE_MASK];
 }
 
 static inline int get_node_type(node_idx_t idx) {
@@ -352,8 +850,17 @@ static inline bool get_node_bool(node_idx_t idx) {
 	return get_node(idx)->as_bool();
 }
 
+// vectors are converted, so binding forms can be written either way
 static inline list_ptr_t get_node_list(node_idx_t idx) {
-	return get_node(idx)->as_list();
+	node_t *n = get_node(idx);
+	if(n->is_vector()) {
+		list_ptr_t res = new_list();
+		for(vector_t::iterator it = n->t_vector->begin(); it; it++) {
+			res->push_back_inplace(*it);
+		}
+		return res;
+	}
+	return n->as_list();
 }
 
 static inline int get_node_int(node_idx_t idx) {
@@ -374,10 +881,21 @@ static inline node_idx_t alloc_node() {
 		free_nodes.pop_back();
 		return idx;
 	}
-	node_idx_t idx = nodes.size();
-	nodes.push_back(node_t());
-	//nodes.shrink_to_fit();
-	return idx;
+	if(tl_node_next == tl_node_end) {
+		int start = jo_atomic_add(&num_nodes, NODE_BLOCK_SIZE) - NODE_BLOCK_SIZE;
+		int page = start >> NODE_PAGE_SHIFT;
+		if(page >= NODE_MAX_PAGES) {
+			fprintf(stderr, "out of nodes\n");
+			exit(1);
+		}
+		jo_lock_guard lock(node_pages_mutex);
+		if(!node_pages[page]) {
+			node_pages[page] = new node_t[NODE_PAGE_SIZE];
+		}
+		tl_node_next = start;
+		tl_node_end = start + NODE_BLOCK_SIZE;
+	}
+	return tl_node_next++;
 }
 
 static inline void free_node(node_idx_t idx) {
@@ -386,14 +904,9 @@ static inline void free_node(node_idx_t idx) {
 
 // TODO: Should prefer to allocate nodes next to existing nodes which will be linked (for cache coherence)
 static inline node_idx_t new_node(const node_t *n) {
-	if(free_nodes.size()) {
-		int ni = free_nodes.pop_back();
-		nodes[ni] = *n;
-		return ni;
-	}
-	nodes.push_back(*n);
-	//nodes.shrink_to_fit();
-	return nodes.size()-1;
+	node_idx_t idx = alloc_node();
+	*get_node(idx) = *n;
+	return idx;
 }
 
 static node_idx_t new_node(int type) {
@@ -417,11 +930,57 @@ static node_idx_t new_node_map(map_ptr_t nodes, int flags = 0) {
 	return idx;
 }
 
+// vectors built at runtime hold values, so unlike parsed vector forms they evaluate to themselves
 static node_idx_t new_node_vector(vector_ptr_t nodes, int flags = 0) {
 	node_idx_t idx = new_node(NODE_VECTOR);
 	node_t *n = get_node(idx);
 	n->t_vector = nodes;
-	n->flags |= flags;
+	n->flags |= flags | NODE_FLAG_LITERAL;
+	return idx;
+}
+
+static node_idx_t new_node_set(set_ptr_t nodes, int flags = 0) {
+	node_idx_t idx = new_node(NODE_SET);
+	node_t *n = get_node(idx);
+	n->t_map = nodes;
+	n->flags |= flags | NODE_FLAG_LITERAL;
+	return idx;
+}
+
+// type is NODE_SORTED_MAP or NODE_SORTED_SET, comparator is nil or a function of two keys
+static node_idx_t new_node_sorted(int type, sorted_map_ptr_t nodes, node_idx_t comparator, int flags = 0) {
+	node_idx_t idx = new_node(type);
+	node_t *n = get_node(idx);
+	n->t_sorted = nodes;
+	n->t_comparator = comparator;
+	n->flags |= flags | NODE_FLAG_LITERAL;
+	return idx;
+}
+
+// sorted maps present their entries as [key value] vectors, sorted sets as the elements
+static node_idx_t new_node_sorted_entry(int type, const sorted_map_t::entry_t &entry) {
+	if(type == NODE_SORTED_SET) {
+		return entry.first;
+	}
+	vector_ptr_t ret = new_vector();
+	ret->push_back_inplace(entry.first);
+	ret->push_back_inplace(entry.second);
+	return new_node_vector(ret);
+}
+
+static node_idx_t new_node_vector_of(vector_of_ptr_t nums, int flags = 0) {
+	node_idx_t idx = new_node(NODE_VECTOR_OF);
+	node_t *n = get_node(idx);
+	n->t_vector_of = nums;
+	n->flags |= flags | NODE_FLAG_LITERAL;
+	return idx;
+}
+
+static node_idx_t new_node_tensor(tensor_ptr_t tensor, int flags = 0) {
+	node_idx_t idx = new_node(NODE_TENSOR);
+	node_t *n = get_node(idx);
+	n->t_tensor = tensor;
+	n->flags |= flags | NODE_FLAG_LITERAL;
 	return idx;
 }
 
@@ -470,11 +1029,37 @@ static node_idx_t new_node_float(double f) {
 	return new_node(&n);
 }
 
+// element i of a vector-of, boxed
+static node_idx_t new_node_vector_of_nth(const vector_of_t *nums, size_t i) {
+	if(nums->kind == VECTOR_OF_DOUBLE) {
+		return new_node_float(nums->nth(i));
+	}
+	return new_node_int((int)nums->nth(i));
+}
+
+// row i of a tensor, which is a number for 1-d tensors, otherwise a view of the row
+static node_idx_t new_node_tensor_nth(const tensor_t *tensor, size_t i) {
+	if(tensor->rank == 1) {
+		return new_node_float(tensor->ptr()[i * tensor->strides[0]]);
+	}
+	return new_node_tensor(new tensor_t(tensor->slice(i)));
+}
+
 static node_idx_t new_node_string(const jo_string &s) {
-	node_t n = {NODE_STRING};
-	n.t_string = s;
-	n.flags |= NODE_FLAG_LITERAL | NODE_FLAG_STRING;
-	return new_node(&n);
+	node_idx_t idx = new_node(NODE_STRING);
+	node_t *n = get_node(idx);
+	n->t_string = s;
+	n->flags |= NODE_FLAG_LITERAL | NODE_FLAG_STRING;
+	return idx;
+}
+
+// takes over the buffer of a string built only to become a node, so it isn't copied again
+static node_idx_t new_node_string(jo_string &&s) {
+	node_idx_t idx = new_node(NODE_STRING);
+	node_t *n = get_node(idx);
+	n->t_string = std::move(s);
+	n->flags |= NODE_FLAG_LITERAL | NODE_FLAG_STRING;
+	return idx;
 }
 
 static node_idx_t new_node_symbol(const jo_string &s) {
@@ -511,39 +1096,76 @@ enum token_type_t {
 	TOK_SEPARATOR,
 };
 
+// A slice of the source, or of a fixed name for the reader shorthands. Tokens are only
+// copied out into strings when the node they become needs one.
 struct token_t {
 	token_type_t type;
-	jo_string str;
+	const char *ptr;
+	size_t len;
 	int line;
+
+	jo_string str() const { return jo_string(ptr, len); }
+	bool is(const char *s) const { return strlen(s) == len && !memcmp(ptr, s, len); }
 };
 
+// The lexer runs over one span of bytes, typically a memory mapped file, so reading a
+// character is a pointer bump and tokens point straight into the source.
 struct parse_state_t {
-	FILE *fp;
+	const char *pos;
+	const char *end;
 	int line_num;
+	// set once get_token runs off the end, as opposed to parse_next stopping on an error
+	bool eof;
+	// string literals with escapes don't match their source, so are unescaped into here
+	jo_string scratch;
+
+	parse_state_t(const char *pos, const char *end, int line_num) : pos(pos), end(end), line_num(line_num), eof(false), scratch() {}
+
 	int getc() {
-		int c = fgetc(fp);
+		if(pos >= end) {
+			return EOF;
+		}
+		int c = (unsigned char)*pos++;
 		if(c == '\n') {
 			line_num++;
 		}
 		return c;
 	}
 	void ungetc(int c) {
+		if(c == EOF) {
+			return;
+		}
 		if(c == '\n') {
 			line_num--;
 		}
-		::ungetc(c, fp);
+		pos--;
 	}
 };
 
+static void set_token(token_t &tok, token_type_t type, const char *ptr, size_t len) {
+	tok.type = type;
+	tok.ptr = ptr;
+	tok.len = len;
+	debugf("token: %.*s\n", (int)len, ptr);
+}
+
+// The byte classes of is_whitespace and is_separator, for the SIMD scanners. The reader
+// finds the end of each run of whitespace, symbol or string 16 or 32 bytes at a time.
+static const char lex_space_chars[] = " \t\r\n,";
+static const char lex_delim_chars[] = " \t\r\n()[]{},";
+static const char lex_string_chars[] = "\"\\";
+
+// up to the next whitespace or separator
+static const char *scan_symbol(const char *p, const char *end) {
+	return jo_simd_find_first_of(p, end, lex_delim_chars, sizeof(lex_delim_chars) - 1);
+}
+
 static token_t get_token(parse_state_t *state) {
 	// skip leading whitepsace and comma
-	do {
-		int c = state->getc();
-		if(!is_whitespace(c) && c != ',') {
-			state->ungetc(c);
-			break;
-		}
-	} while(true);
+	const char *p = state->pos, *end = state->end;
+	p = jo_simd_find_first_not_of(p, end, lex_space_chars, sizeof(lex_space_chars) - 1);
+	state->line_num += (int)jo_simd_count(state->pos, p, '\n');
+	state->pos = p;
 
 	token_t tok;
 	tok.line = state->line_num;
@@ -552,122 +1174,116 @@ static token_t get_token(parse_state_t *state) {
 	
 	// handle special case of end of file reached
 	if(c == EOF) {
-		tok.type = TOK_EOF;
-		debugf("token: EOF\n");
+		state->eof = true;
+		set_token(tok, TOK_EOF, "", 0);
 		return tok;
 	}
  
 	if(c == '\\') {
-		tok.type = TOK_SYMBOL;
 		int val = state->getc();
-		tok.str = va("%i", val);
+		state->scratch = va("%i", val);
+		set_token(tok, TOK_SYMBOL, state->scratch.c_str(), state->scratch.size());
 		return tok;
 	}
 	if(c == '"') {
-		tok.type = TOK_STRING;
 		// string literal
-		do {
-			int C = state->getc();
-			if (C == EOF) {
-				fprintf(stderr, "unterminated string on line %i\n", state->line_num);
-				exit(__LINE__);
+		const char *start = state->pos;
+		bool escaped = false;
+		for(p = start; ; p += 2) {
+			const char *q = jo_simd_find_first_of(p, end, lex_string_chars, sizeof(lex_string_chars) - 1);
+			state->line_num += (int)jo_simd_count(p, q, '\n');
+			p = q;
+			if(p >= end || *p == '"') {
+				break;
 			}
 			// escape next character
-			if(C == '\\') {
-				C = state->getc();
-				if(C == EOF) {
-					fprintf(stderr, "unterminated string on line %i\n", state->line_num);
-					exit(__LINE__);
-				}
-			} else if(C == '"') {
+			escaped = true;
+			if(p + 1 >= end) {
+				p = end;
 				break;
 			}
-			tok.str += C;
-		} while (true);
-		debugf("token: %s\n", tok.str.c_str());
+			state->line_num += p[1] == '\n';
+		}
+		if(p >= end) {
+			fprintf(stderr, "unterminated string on line %i\n", state->line_num);
+			exit(__LINE__);
+		}
+		state->pos = p + 1;
+		if(!escaped) {
+			set_token(tok, TOK_STRING, start, p - start);
+			return tok;
+		}
+		state->scratch = jo_string(start, p);
+		char *s = state->scratch.str;
+		size_t w = 0;
+		for(size_t r = 0; s[r]; ) {
+			if(s[r] == '\\') {
+				r++;
+			}
+			s[w++] = s[r++];
+		}
+		s[w] = 0;
+		set_token(tok, TOK_STRING, s, w);
 		return tok;
 	}
 	if(c == '#') {
 		int C = state->getc();
 		if(C == '(') {
 			// shorthand for inline function
-			tok.type = TOK_SEPARATOR;
-			tok.str = "__fn";
-			debugf("token: %s\n", tok.str.c_str());
+			set_token(tok, TOK_SEPARATOR, "__fn", 4);
+			return tok;
+		} else if(C == '{') {
+			set_token(tok, TOK_SEPARATOR, "__set", 5);
 			return tok;
 		} else {
 			state->ungetc(C);
 		}
 	}
+	if(c == '@') {
+		// shorthand for deref
+		set_token(tok, TOK_SEPARATOR, "@", 1);
+		return tok;
+	}
 	if(c == '\'') {
-		int C = state->getc();
-		if(C == '(') {
-			tok.type = TOK_SEPARATOR;
-			tok.str = "quote";
-			debugf("token: %s\n", tok.str.c_str());
+		if(state->pos < end && *state->pos == '(') {
+			state->pos++;
+			set_token(tok, TOK_SEPARATOR, "quote", 5);
 			return tok;
 		}
-		tok.type = TOK_STRING;
 		// string literal of a symbol
-		do {
-			if(is_whitespace(C) || is_separator(C) || C == EOF) {
-				state->ungetc(C);
-				break;
-			}
-			tok.str += C;
-			C = state->getc();
-		} while (true);
-		debugf("token: %s\n", tok.str.c_str());
+		const char *start = state->pos;
+		state->pos = scan_symbol(start, end);
+		set_token(tok, TOK_STRING, start, state->pos - start);
 		return tok;
 	}
 	if(c == ':') {
-		tok.type = TOK_KEYWORD;
 		// string literal of a keyword
-		int C = state->getc();
-		do {
-			if(is_whitespace(C) || is_separator(C) || C == EOF) {
-				state->ungetc(C);
-				break;
-			}
-			tok.str += C;
-			C = state->getc();
-		} while (true);
-		debugf("token: %s\n", tok.str.c_str());
+		const char *start = state->pos;
+		state->pos = scan_symbol(start, end);
+		set_token(tok, TOK_KEYWORD, start, state->pos - start);
 		return tok;
 	}
 	if(c == ';') {
 		// comment (skip)
-		do {
-			int C = state->getc();
-			if (C == EOF) {
-				fprintf(stderr, "unterminated comment\n");
-				exit(__LINE__);
-			}
-			if(C == '\n') break;
-		} while(true);
+		const char *nl = (const char *)memchr(state->pos, '\n', end - state->pos);
+		if(!nl) {
+			fprintf(stderr, "unterminated comment\n");
+			exit(__LINE__);
+		}
+		state->pos = nl + 1;
+		state->line_num++;
 		return get_token(state); // recurse
 	}
 	if(is_separator(c)) {
-		tok.type = TOK_SEPARATOR;
 		// vector, list, map
-		tok.str += c;
-		debugf("token: %s\n", tok.str.c_str());
+		set_token(tok, TOK_SEPARATOR, state->pos - 1, 1);
 		return tok;
 	}
 
 	// while not whitespace, or separator, get characters
-	tok.type = TOK_SYMBOL;
-	do {
-		if(is_whitespace(c) || is_separator(c) || c == EOF) {
-			state->ungetc(c);
-			break;
-		}
-		tok.str += (char)c;
-		c = state->getc();
-	} while(true);
-	
-	debugf("token: %s\n", tok.str.c_str());
-
+	const char *start = state->pos - 1;
+	state->pos = scan_symbol(state->pos, end);
+	set_token(tok, TOK_SYMBOL, start, state->pos - start);
 	return tok;
 }
 
@@ -677,7 +1293,8 @@ static list_ptr_t get_symbols_list_r(list_ptr_t list) {
 		if(get_node_type(*it) == NODE_SYMBOL) {
 			symbol_list->push_back_inplace(*it);			
 		} else if(get_node_type(*it) == NODE_MAP) {
-			printf("TODO: map @ %i\n", __LINE__);
+			out_printf("TODO: map @ %i\n", __LINE__);
+			out_commit();
 		} else {
 			if(get_node(*it)->t_list.ptr) {
 				list_ptr_t sub_list = get_symbols_list_r(get_node(*it)->t_list);
@@ -692,17 +1309,15 @@ static list_ptr_t get_symbols_list_r(list_ptr_t list) {
 
 static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_sep) {
 	token_t tok = get_token(state);
-	debugf("parse_next \"%s\", with '%c'\n", tok.str.c_str(), stop_on_sep);
+	debugf("parse_next \"%.*s\", with '%c'\n", (int)tok.len, tok.ptr, stop_on_sep);
 
 	if(tok.type == TOK_EOF) {
 		// end of list
 		return INV_NODE;
 	}
 
-	const char *tok_ptr = tok.str.c_str();
-	const char *tok_ptr_end = tok_ptr + tok.str.size();
-	int c = tok_ptr[0];
-	int c2 = tok_ptr[1];
+	int c = tok.len > 0 ? tok.ptr[0] : 0;
+	int c2 = tok.len > 1 ? tok.ptr[1] : 0;
 
 	if(c == stop_on_sep) {
 		// end of list
@@ -722,12 +1337,23 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 	//if(c == '#' && c2 == '"') return parse_regex(state);
 	// parse number...
 	if(tok.type == TOK_STRING) {
-		debugf("string: %s\n", tok.str.c_str());
-		return new_node_string(tok.str.c_str());
+		debugf("string: %.*s\n", (int)tok.len, tok.ptr);
+		return new_node_string(tok.str());
 	} 
 	if(is_num(c) || (c == '-' && is_num(c2))) {
+		// the token isn't 0 terminated, and numbers are short, so copy it out to parse
+		char num_buf[64];
+		jo_string num_str;
+		const char *tok_ptr = num_buf;
+		if(tok.len < sizeof(num_buf)) {
+			memcpy(num_buf, tok.ptr, tok.len);
+			num_buf[tok.len] = 0;
+		} else {
+			num_str = tok.str();
+			tok_ptr = num_str.c_str();
+		}
 		// floating point
-		if(tok.str.find('.') != jo_string_npos) {
+		if(memchr(tok.ptr, '.', tok.len)) {
 			float float_val = atof(tok_ptr);
 			debugf("float: %f\n", float_val);
 			return new_node_float(float_val);
@@ -757,7 +1383,7 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 			}
 		}
 		// 0 octal
-		else if(c == '0' && tok.str.size() > 1) {
+		else if(c == '0' && tok.len > 1) {
 			tok_ptr += 1;
 			// parse octal from tok_ptr
 			while(is_alnum(*tok_ptr)) {
@@ -774,34 +1400,34 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 		return new_node_int(int_val);
 	} 
 	if(tok.type == TOK_KEYWORD) {
-		debugf("keyword: %s\n", tok.str.c_str());
-		if(tok.str == "else") return K_ELSE_NODE;
-		if(tok.str == "when") return K_WHEN_NODE;
-		if(tok.str == "while") return K_WHILE_NODE;
-		if(tok.str == "let") return K_LET_NODE;
-		return new_node_keyword(tok.str.c_str());
+		debugf("keyword: %.*s\n", (int)tok.len, tok.ptr);
+		if(tok.is("else")) return K_ELSE_NODE;
+		if(tok.is("when")) return K_WHEN_NODE;
+		if(tok.is("while")) return K_WHILE_NODE;
+		if(tok.is("let")) return K_LET_NODE;
+		return new_node_keyword(tok.str());
 	}
 	if(tok.type == TOK_SYMBOL) {
-		debugf("symbol: %s\n", tok.str.c_str());
-		if(env->has(tok.str.c_str())) {
-			//debugf("pre-resolve symbol: %s\n", tok.str.c_str());
-			return env->get(tok.str.c_str());
+		jo_string name = tok.str();
+		debugf("symbol: %s\n", name.c_str());
+		if(env->has(name)) {
+			//debugf("pre-resolve symbol: %s\n", name.c_str());
+			return env->get(name);
 		}
 		// fixed symbols
-		if(tok.str == "%") return PCT_NODE;
-		if(tok.str == "%1") return PCT1_NODE;
-		if(tok.str == "%2") return PCT2_NODE;
-		if(tok.str == "%3") return PCT3_NODE;
-		if(tok.str == "%4") return PCT4_NODE;
-		if(tok.str == "%5") return PCT5_NODE;
-		if(tok.str == "%6") return PCT6_NODE;
-		if(tok.str == "%7") return PCT7_NODE;
-		if(tok.str == "%8") return PCT8_NODE;
-		return new_node_symbol(tok.str.c_str());
+		if(tok.is("%")) return PCT_NODE;
+		if(tok.is("%1")) return PCT1_NODE;
+		if(tok.is("%2")) return PCT2_NODE;
+		if(tok.is("%3")) return PCT3_NODE;
+		if(tok.is("%4")) return PCT4_NODE;
+		if(tok.is("%5")) return PCT5_NODE;
+		if(tok.is("%6")) return PCT6_NODE;
+		if(tok.is("%7")) return PCT7_NODE;
+		if(tok.is("%8")) return PCT8_NODE;
+		return new_node_symbol(name);
 	} 
 
-	// parse quote shorthand
-	if(tok.type == TOK_SEPARATOR && tok.str == "quote") {
+	if(tok.type == TOK_SEPARATOR && tok.is("quote")) {
 		debugf("list begin\n");
 		node_idx_t next = parse_next(env, state, ')');
 		if(next == INV_NODE) {
@@ -818,9 +1444,22 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 		return new_node(&n);
 	}
 
+	// deref shorthand, @x => (deref x)
+	if(tok.type == TOK_SEPARATOR && tok.is("@")) {
+		node_idx_t next = parse_next(env, state, stop_on_sep);
+		if(next == INV_NODE) {
+			return INV_NODE;
+		}
+		node_t n = {NODE_LIST};
+		n.t_list = new_list();
+		n.t_list->push_back_inplace(env->get("deref"));
+		n.t_list->push_back_inplace(next);
+		return new_node(&n);
+	}
+
 	// anonymous function shorthand. 
 	// Note: Analyze the function tree at parse time? I think this is correct?
-	if(tok.type == TOK_SEPARATOR && tok.str == "__fn") {
+	if(tok.type == TOK_SEPARATOR && tok.is("__fn")) {
 		debugf("list begin\n");
 		node_idx_t next = parse_next(env, state, ')');
 		if(next == INV_NODE) {
@@ -872,6 +1511,10 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 		n.t_list = new_list();
 		int common_flags = ~0;
 		bool is_native_fn = get_node_type(next) == NODE_NATIVE_FUNCTION;
+		// ([1 2 3] 0) and (#{1 2} 1) are calls, not data
+		if(get_node_type(next) == NODE_VECTOR || get_node_type(next) == NODE_SET) {
+			common_flags = 0;
+		}
 		while(next != INV_NODE) {
 			common_flags &= get_node_flags(next);
 			n.t_list->push_back_inplace(next);
@@ -893,23 +1536,19 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 		debugf("vector begin\n");
 		node_idx_t next = parse_next(env, state, ']');
 		if(next == INV_NODE) {
-			return EMPTY_LIST_NODE;
+			return new_node_vector(new_vector());
 		}
-		node_t n = {NODE_LIST};
-		n.t_list = new_list(); // TODO: actually vector pls
+		node_t n = {NODE_VECTOR};
+		n.t_vector = new_vector();
 		int common_flags = ~0;
-		bool is_native_fn = get_node_type(next) == NODE_NATIVE_FUNCTION;
 		while(next != INV_NODE) {
 			common_flags &= get_node_flags(next);
-			n.t_list->push_back_inplace(next);
+			n.t_vector->push_back_inplace(next);
 			next = parse_next(env, state, ']');
 		}
+		// a vector of literals evaluates to itself
 		if(common_flags & NODE_FLAG_LITERAL) {
-			if(is_native_fn) {
-				n.flags |= NODE_FLAG_LITERAL_ARGS;
-			} else {
-				n.flags |= NODE_FLAG_LITERAL;
-			}
+			n.flags |= NODE_FLAG_LITERAL;
 		}
 		// @ If its all the same type, convert to simple array of values of type
 		debugf("vector end\n");
@@ -936,10 +1575,291 @@ static node_idx_t parse_next(env_ptr_t env, parse_state_t *state, int stop_on_se
 	}
 
 	// parse set
+	if(tok.type == TOK_SEPARATOR && tok.is("__set")) {
+		debugf("set begin\n");
+		node_t n = {NODE_SET};
+		n.t_map = new_set();
+		int common_flags = ~0;
+		node_idx_t next = parse_next(env, state, '}');
+		while(next != INV_NODE) {
+			common_flags &= get_node_flags(next);
+			n.t_map->assoc_inplace(next, next, [env](const node_idx_t &a, const node_idx_t &b) {
+				return node_eq(env, a, b);
+			});
+			next = parse_next(env, state, '}');
+		}
+		if(common_flags & NODE_FLAG_LITERAL) {
+			n.flags |= NODE_FLAG_LITERAL;
+		}
+		debugf("set end\n");
+		return new_node(&n);
+	}
 
 	return INV_NODE;
 }
 
+enum {
+	// smaller files parse faster than threads start
+	PARSE_PARALLEL_MIN_BYTES = 1 << 20,
+};
+
+// Cut points which split [p, end) into about n pieces, each a run of whole top level forms.
+// A cut goes only after a closing delimiter that brings the depth back to 0, and delimiters
+// inside strings, comments and character literals don't count.
+static void split_top_level_forms(const char *p, const char *end, int n, jo_vector<const char *> &cuts) {
+	static const char interesting[] = "()[]{}\";\\";
+	size_t piece = (end - p) / n + 1;
+	const char *next_cut = p + piece;
+	int depth = 0;
+	while((p = jo_simd_find_first_of(p, end, interesting, sizeof(interesting) - 1)) < end) {
+		switch(*p++) {
+		case '(': case '[': case '{':
+			depth++;
+			break;
+		case ')': case ']': case '}':
+			if(--depth <= 0) {
+				depth = 0;
+				if(p >= next_cut) {
+					cuts.push_back(p);
+					next_cut = p + piece;
+				}
+			}
+			break;
+		case '"':
+			for(;; p += 2) {
+				p = jo_simd_find_first_of(p, end, lex_string_chars, sizeof(lex_string_chars) - 1);
+				if(p >= end || *p == '"') {
+					break;
+				}
+			}
+			p++;
+			break;
+		case ';':
+			p = (const char *)memchr(p, '\n', end - p);
+			if(!p) {
+				return;
+			}
+			break;
+		case '\\':
+			// character literal
+			p++;
+			break;
+		}
+	}
+}
+
+struct parse_chunk_t {
+	env_ptr_t env;
+	const char *pos, *end;
+	int line_num;
+	list_ptr_t forms;
+	// parsing stopped on an error before the end of the chunk
+	bool stopped;
+};
+
+static void parse_chunk(void *arg) {
+	parse_chunk_t *chunk = (parse_chunk_t *)arg;
+	parse_state_t state(chunk->pos, chunk->end, chunk->line_num);
+	for(node_idx_t next = parse_next(chunk->env, &state, 0); next != INV_NODE; next = parse_next(chunk->env, &state, 0)) {
+		chunk->forms->push_back_inplace(next);
+	}
+	chunk->stopped = !state.eof;
+}
+
+// Parses every top level form of [p, end) onto the end of forms, in order. Large sources
+// are cut between top level forms and the pieces parsed on separate threads, which is safe
+// as each thread allocates nodes from its own blocks and parsing only reads the env.
+static void parse_forms(env_ptr_t env, const char *p, const char *end, list_ptr_t forms) {
+	int threads = jo_hardware_concurrency();
+	jo_vector<const char *> cuts;
+	if(threads > 1 && end - p >= PARSE_PARALLEL_MIN_BYTES) {
+		split_top_level_forms(p, end, threads, cuts);
+	}
+	cuts.push_back(end);
+	size_t num_chunks = cuts.size();
+	parse_chunk_t *chunks = new parse_chunk_t[num_chunks];
+	for(size_t i = 0, line_num = 1; i < num_chunks; i++) {
+		const char *chunk_end = cuts[i];
+		chunks[i].env = env;
+		chunks[i].pos = p;
+		chunks[i].end = chunk_end;
+		chunks[i].line_num = (int)line_num;
+		chunks[i].forms = new_list();
+		chunks[i].stopped = false;
+		line_num += jo_simd_count(p, chunk_end, '\n');
+		p = chunk_end;
+	}
+	jo_thread **workers = new jo_thread*[num_chunks];
+	for(size_t i = 1; i < num_chunks; i++) {
+		workers[i] = new jo_thread(&parse_chunk, &chunks[i]);
+	}
+	parse_chunk(&chunks[0]);
+	for(size_t i = 1; i < num_chunks; i++) {
+		workers[i]->join();
+		delete workers[i];
+	}
+	delete[] workers;
+	// as if parsed in one go, nothing after an error is kept
+	for(size_t i = 0; i < num_chunks; i++) {
+		forms->conj_inplace(*chunks[i].forms);
+		if(chunks[i].stopped) {
+			break;
+		}
+	}
+	delete[] chunks;
+}
+
+// How far scan_top_level_form got through a form that hasn't ended yet, so that each read
+// only scans the new bytes.
+struct form_scan_t {
+	size_t pos; // from the start of the form
+	int depth;
+	bool in_string;
+};
+
+// End of the first whole top level form starting at base, or NULL if it may still be going
+// when more input arrives. Follows the token rules of get_token closely enough to tell where
+// a form stops; the parser proper then reads it.
+static const char *scan_top_level_form(const char *base, const char *end, form_scan_t &scan) {
+	const char *p = base + scan.pos;
+	int depth = scan.depth;
+	const char *token = p;
+	if(scan.in_string) {
+		goto string;
+	}
+	while(true) {
+		p = jo_simd_find_first_not_of(p, end, lex_space_chars, sizeof(lex_space_chars) - 1);
+		token = p;
+		if(p >= end) {
+			goto more;
+		}
+		{
+			int c = *p++;
+			if(c == ';') {
+				p = (const char *)memchr(p, '\n', end - p);
+				if(!p) {
+					goto more;
+				}
+				continue;
+			}
+			if(c == '"') {
+				goto string;
+			} else if(c == '\\') {
+				// character literal
+				if(p >= end) {
+					goto more;
+				}
+				p++;
+			} else if(c == '(' || c == '[' || c == '{') {
+				depth++;
+				continue;
+			} else if(c == ')' || c == ']' || c == '}') {
+				depth--;
+			} else if(c == '@') {
+				// deref of the next form
+				continue;
+			} else if((c == '#' || c == '\'') && (p >= end || *p == '(' || *p == '{')) {
+				if(p >= end) {
+					goto more;
+				}
+				p++;
+				depth++;
+				continue;
+			} else {
+				// the rest of a symbol, number or keyword, which may carry on in the next read
+				p = scan_symbol(p, end);
+				if(p >= end) {
+					goto more;
+				}
+			}
+		}
+		goto token_done;
+	string:
+		for(;; p += 2) {
+			p = jo_simd_find_first_of(p, end, lex_string_chars, sizeof(lex_string_chars) - 1);
+			if(p >= end || (*p == '\\' && p + 1 >= end)) {
+				// carry on from here, inside the string, next time
+				scan.pos = p - base;
+				scan.depth = depth;
+				scan.in_string = true;
+				return NULL;
+			}
+			if(*p == '"') {
+				break;
+			}
+		}
+		p++;
+	token_done:
+		if(depth <= 0) {
+			scan.pos = 0;
+			scan.depth = 0;
+			scan.in_string = false;
+			return p;
+		}
+	}
+more:
+	// start again from the unfinished token
+	scan.pos = token - base;
+	scan.depth = depth;
+	scan.in_string = false;
+	return NULL;
+}
+
+// Reads fp a line at a time, evaluating each top level form as soon as it is complete, so
+// only the form being read needs to be in memory and output starts straight away. Returns
+// the value of the last form.
+//
+// Symbols naming builtins are resolved as they are parsed. Later forms must not resolve to
+// what earlier forms def'd, as they would not when parsed up front, so forms are parsed
+// against parse_env, which holds only the builtins.
+static node_idx_t eval_stream(env_ptr_t env, env_ptr_t parse_env, FILE *fp) {
+
+	node_idx_t res = NIL_NODE;
+	jo_vector<char> buf;
+	size_t start = 0;
+	int line_num = 1;
+	form_scan_t scan = {};
+	char line[4096];
+	bool stopped = false;
+	while(!stopped) {
+		bool at_eof = !fgets(line, sizeof(line), fp);
+		if(!at_eof) {
+			buf.insert(buf.end(), line, strlen(line));
+		}
+		while(start < buf.size()) {
+			const char *p = buf.data() + start, *end = buf.data() + buf.size();
+			const char *form_end = at_eof ? end : scan_top_level_form(p, end, scan);
+			if(!form_end) {
+				break;
+			}
+			parse_state_t state(p, form_end, line_num);
+			for(node_idx_t next = parse_next(parse_env, &state, 0); next != INV_NODE; next = parse_next(parse_env, &state, 0)) {
+				res = eval_node(env, next);
+			}
+			// a reader on the other end of a pipe sees each form's output as it happens
+			out_flush();
+			// as if parsed in one go, nothing after an error is run
+			stopped = !state.eof;
+			line_num = state.line_num;
+			start = form_end - buf.data();
+			if(stopped) {
+				break;
+			}
+		}
+		if(at_eof) {
+			break;
+		}
+		// drop what has been run
+		if(start > 0 && start >= buf.size() / 2) {
+			size_t rest = buf.size() - start;
+			memmove(buf.data(), buf.data() + start, rest);
+			buf.resize(rest);
+			start = 0;
+		}
+	}
+	return res;
+}
+
 
 // eval a list of nodes
 static node_idx_t eval_list(env_ptr_t env, list_ptr_t list, int list_flags=0) {
@@ -957,6 +1877,8 @@ static node_idx_t eval_list(env_ptr_t env, list_ptr_t list, int list_flags=0) {
 	|| n1_type == NODE_NATIVE_FUNCTION
 	|| n1_type == NODE_FUNC
 	|| n1_type == NODE_MAP
+	|| n1_type == NODE_VECTOR
+	|| n1_type == NODE_SET
 	) {
 		node_idx_t sym_idx = n1i;
 		int sym_type = n1_type;
@@ -964,7 +1886,9 @@ static node_idx_t eval_list(env_ptr_t env, list_ptr_t list, int list_flags=0) {
 		if(n1_type == NODE_LIST) {
 			sym_idx = eval_list(env, get_node(n1i)->t_list);
 			sym_type = get_node_type(sym_idx);
-		} else if(n1_flags & NODE_FLAG_STRING) {
+		} else if(n1_type == NODE_VECTOR || n1_type == NODE_SET) {
+			sym_idx = eval_node(env, n1i);
+		} else if(n1_type != NODE_KEYWORD && (n1_flags & NODE_FLAG_STRING)) {
 			sym_idx = env->get(get_node_string(n1i));
 			sym_type = get_node_type(sym_idx);
 		}
@@ -1014,6 +1938,12 @@ static node_idx_t eval_list(env_ptr_t env, list_ptr_t list, int list_flags=0) {
 						for(list_t::iterator i3 = get_node(*i)->t_list->begin(), i4 = get_node(*i2)->t_list->begin(); i3 && i4; i3++, i4++) {
 							fn_env->set_temp(get_node_string(*i3), eval_node(env, *i4));
 						}
+					} else if(i_type == NODE_VECTOR) {
+						// sequential destructuring of an evaluated list or vector
+						node_idx_t val = eval_node(env, *i2);
+						if(get_node_type(val) == NODE_LIST || get_node_type(val) == NODE_VECTOR) {
+							fn_env->set_temp(get_node_list(*i), get_node_list(val));
+						}
 					} else {
 						fn_env->set_temp(get_node_string(*i), *i2);
 					}
@@ -1041,6 +1971,40 @@ static node_idx_t eval_list(env_ptr_t env, list_ptr_t list, int list_flags=0) {
 				return it2.second;
 			}
 			return n3i;
+		} else if(sym_type == NODE_VECTOR) {
+			// vectors are functions of their indices
+			int n2i = eval_node(env, *it++);
+			vector_ptr_t vec = get_node(sym_idx)->t_vector;
+			int index = get_node_int(n2i);
+			if(index < 0 || index >= (int)vec->size()) {
+				return NIL_NODE;
+			}
+			return vec->nth(index);
+		} else if(sym_type == NODE_VECTOR_OF) {
+			int n2i = eval_node(env, *it++);
+			vector_of_ptr_t nums = get_node(sym_idx)->t_vector_of;
+			int index = get_node_int(n2i);
+			if(index < 0 || index >= (int)nums->size()) {
+				return NIL_NODE;
+			}
+			return new_node_vector_of_nth(nums.ptr, index);
+		} else if(sym_type == NODE_SET) {
+			// sets are functions of their members
+			int n2i = eval_node(env, *it++);
+			auto it2 = get_node(sym_idx)->t_map->find(n2i, [env](const node_idx_t &a, const node_idx_t &b) {
+				return node_eq(env, a, b);
+			});
+			return it2.third ? it2.first : NIL_NODE;
+		} else if(sym_type == NODE_SORTED_MAP || sym_type == NODE_SORTED_SET) {
+			// sorted maps look up their keys, sorted sets test membership
+			int n2i = eval_node(env, *it++);
+			int n3i = it ? eval_node(env, *it++) : NIL_NODE;
+			node_t *coll = get_node(sym_idx);
+			auto it2 = coll->t_sorted->find(n2i, sorted_lt_t(env, coll));
+			if(!it2.third) {
+				return sym_type == NODE_SORTED_MAP ? n3i : NIL_NODE;
+			}
+			return sym_type == NODE_SORTED_MAP ? it2.second : it2.first;
 		} else if(sym_type == NODE_KEYWORD) {
 			// lookup the key in the map
 			int n2i = eval_node(env, *it++);
@@ -1052,6 +2016,12 @@ static node_idx_t eval_list(env_ptr_t env, list_ptr_t list, int list_flags=0) {
 				if(it2.third) {
 					return it2.second;
 				}
+			} else if(get_node_type(n2i) == NODE_SORTED_MAP) {
+				node_t *coll = get_node(n2i);
+				auto it2 = coll->t_sorted->find(sym_idx, sorted_lt_t(env, coll));
+				if(it2.third) {
+					return it2.second;
+				}
 			}
 			return n3i;
 		}
@@ -1070,6 +2040,29 @@ static node_idx_t eval_node(env_ptr_t env, node_idx_t root) {
 	int type = get_node_type(root);
 	if(type == NODE_LIST) {
 		return eval_list(env, get_node(root)->t_list, flags);
+	} else if(type == NODE_VECTOR) {
+		if(flags & NODE_FLAG_LITERAL) {
+			return root;
+		}
+		vector_ptr_t vec = get_node(root)->t_vector;
+		vector_ptr_t res = new_vector();
+		for(vector_t::iterator it = vec->begin(); it; it++) {
+			res->push_back_inplace(eval_node(env, *it));
+		}
+		return new_node_vector(res);
+	} else if(type == NODE_SET) {
+		if(flags & NODE_FLAG_LITERAL) {
+			return root;
+		}
+		set_ptr_t set = get_node(root)->t_map;
+		set_ptr_t res = new_set();
+		for(set_t::iterator it = set->begin(); it; it++) {
+			node_idx_t val = eval_node(env, it->first);
+			res->assoc_inplace(val, val, [env](const node_idx_t &a, const node_idx_t &b) {
+				return node_eq(env, a, b);
+			});
+		}
+		return new_node_set(res);
 	} else if(type == NODE_SYMBOL) {
 		node_idx_t sym_idx = env->get(get_node_string(root));
 		if(sym_idx == NIL_NODE) {
@@ -1095,48 +2088,107 @@ static void print_node(node_idx_t node, int depth, bool same_line) {
 	int flags = get_node_flags(node);
 	if(type == NODE_LIST) {
 		list_ptr_t list = get_node(node)->t_list;
-		printf("(");
+		out_char('(');
 		for(list_t::iterator it = list->begin(); it; it++) {
 			print_node(*it, depth+1, it);
-			printf(",");
+			out_char(',');
 		}
-		printf(")");
+		out_char(')');
+	} else if(type == NODE_VECTOR) {
+		vector_ptr_t vec = get_node(node)->t_vector;
+		out_char('[');
+		for(vector_t::iterator it = vec->begin(); it; it++) {
+			print_node(*it, depth+1, it);
+			out_char(',');
+		}
+		out_char(']');
+	} else if(type == NODE_VECTOR_OF) {
+		vector_of_ptr_t nums = get_node(node)->t_vector_of;
+		out_char('[');
+		for(size_t i = 0; i < nums->size(); i++) {
+			print_node(new_node_vector_of_nth(nums.ptr, i), depth+1, true);
+			out_char(',');
+		}
+		out_char(']');
+	} else if(type == NODE_TENSOR) {
+		tensor_ptr_t tensor = get_node(node)->t_tensor;
+		out_char('[');
+		for(size_t i = 0; i < tensor->shape[0]; i++) {
+			print_node(new_node_tensor_nth(tensor.ptr, i), depth+1, true);
+			out_char(',');
+		}
+		out_char(']');
+	} else if(type == NODE_SET) {
+		set_ptr_t set = get_node(node)->as_set();
+		out_str("#{");
+		for(set_t::iterator it = set->begin(); it; it++) {
+			print_node(it->first, depth+1, it);
+			out_char(',');
+		}
+		out_char('}');
 	} else if(type == NODE_MAP) {
 		map_ptr_t map = get_node(node)->t_map;
 		if(map->size() == 0) {
-			printf("{}");
+			out_str("{}");
 			return;
 		}
-		printf("{");
+		out_char('{');
 		for(map_t::iterator it = map->begin(); it; it++) {
 			print_node(it->first, depth+1, it != map->end());
-			printf(" ");
+			out_char(' ');
 			print_node(it->second, depth+1, it != map->end());
-			printf(",");
-		}
-		printf("}");
+			out_char(',');
+		}
+		out_char('}');
+	} else if(type == NODE_SORTED_SET) {
+		sorted_map_ptr_t set = get_node(node)->t_sorted;
+		out_str("#{");
+		for(sorted_map_t::iterator it = set->begin(); it; it++) {
+			print_node(it->first, depth+1, it);
+			out_char(',');
+		}
+		out_char('}');
+	} else if(type == NODE_SORTED_MAP) {
+		sorted_map_ptr_t map = get_node(node)->t_sorted;
+		out_char('{');
+		for(sorted_map_t::iterator it = map->begin(); it; it++) {
+			print_node(it->first, depth+1, it);
+			out_char(' ');
+			print_node(it->second, depth+1, it);
+			out_char(',');
+		}
+		out_char('}');
 	} else if(type == NODE_SYMBOL) {
-		printf("%s", get_node_string(node).c_str());
+		out_str(get_node(node)->t_string.c_str());
 	} else if(type == NODE_KEYWORD) {
-		printf(":%s", get_node_string(node).c_str());
+		out_char(':');
+		out_str(get_node(node)->t_string.c_str());
 	} else if(type == NODE_STRING) {
-		printf("\"%s\"", get_node_string(node).c_str());
+		out_char('"');
+		out_str(get_node(node)->t_string.c_str());
+		out_char('"');
 	} else if(type == NODE_NATIVE_FUNCTION) {
-		printf("<%s>", get_node_string(node).c_str());
+		out_char('<');
+		out_str(get_node(node)->t_string.c_str());
+		out_char('>');
 	} else if(type == NODE_FUNC) {
-		printf("<function>");
+		out_str("<function>");
 	} else if(type == NODE_DELAY) {
-		printf("<delay>");
+		out_str("<delay>");
+	} else if(type == NODE_FUTURE) {
+		out_str("<future>");
+	} else if(type == NODE_IO) {
+		out_str("<io>");
 	} else if(type == NODE_FLOAT) {
-		printf("%f", get_node_float(node));
+		out_float(get_node(node)->t_float);
 	} else if(type == NODE_INT) {
-		printf("%d", get_node_int(node));
+		out_int(get_node(node)->t_int);
 	} else if(type == NODE_BOOL) {
-		printf("%s", get_node_bool(node) ? "true" : "false");
+		out_str(get_node_bool(node) ? "true" : "false");
 	} else if(type == NODE_NIL) {
-		printf("nil");
+		out_str("nil");
 	} else {
-		printf("<unknown>");
+		out_str("<unknown>");
 	}
 #else
 	node_t *n = get_node(node);
@@ -1178,6 +2230,14 @@ static void print_node(node_idx_t node, int depth, bool same_line) {
 		printf("%*s<map>\n", depth, "");
 	} else if(n->type == NODE_SET) {
 		printf("%*s<set>\n", depth, "");
+	} else if(n->type == NODE_SORTED_MAP) {
+		printf("%*s<sorted-map>\n", depth, "");
+	} else if(n->type == NODE_SORTED_SET) {
+		printf("%*s<sorted-set>\n", depth, "");
+	} else if(n->type == NODE_VECTOR_OF) {
+		printf("%*s<vector-of>\n", depth, "");
+	} else if(n->type == NODE_TENSOR) {
+		printf("%*s<tensor>\n", depth, "");
 	} else if(n->type == NODE_NIL) {
 		printf("%*snil\n", depth, "");
 	} else {
@@ -1193,7 +2253,7 @@ static void print_node_list(list_ptr_t nodes, int depth) {
 }
 
 static void print_node_type(node_idx_t i) {
-	printf("%s", get_node(i)->type_as_string().c_str());
+	out_str(get_node(i)->type_as_string().c_str());
 }
 
 struct lazy_list_iterator_t {
@@ -1250,7 +2310,6 @@ struct lazy_list_iterator_t {
 	}
 
 	node_idx_t nth(int n) {
-		node_idx_t res = val;
 		while(n-- > 0 && !done()) {
 			next();
 		}
@@ -1294,26 +2353,48 @@ struct seq_iterator_t {
 	list_t::iterator it;
 	vector_t::iterator vit;
 	map_t::iterator mit;
+	sorted_map_t::iterator sit;
 	lazy_list_iterator_t lit;
+	vector_of_ptr_t nums;
+	tensor_ptr_t tensor;
+	size_t index; // into nums or tensor
 
-	seq_iterator_t(env_ptr_t env, node_idx_t node_idx) : type(), val(NIL_NODE), is_done(), it(), vit(), mit(), lit(env, node_idx) {
+	seq_iterator_t(env_ptr_t env, node_idx_t node_idx) : type(), val(NIL_NODE), is_done(), it(), vit(), mit(), sit(), lit(env, node_idx), nums(), tensor(), index() {
 		type = get_node_type(node_idx);
 		val = INV_NODE;
 		if(type == NODE_LIST) {
 			it = get_node(node_idx)->as_list()->begin();
 			if(!done()) {
-				val = *it++;
+				val = *it;
 			}
 		} else if(type == NODE_VECTOR) {
 			vit = get_node(node_idx)->as_vector()->begin();
 			if(!done()) {
-				val = *vit++;
+				val = *vit;
 			}
 		} else if(type == NODE_MAP) {
 			mit = get_node(node_idx)->as_map()->begin();
 			if(!done()) {
 				val = mit->second;
 			}
+		} else if(type == NODE_SET) {
+			mit = get_node(node_idx)->as_set()->begin();
+			if(!done()) {
+				val = mit->first;
+			}
+		} else if(type == NODE_SORTED_MAP || type == NODE_SORTED_SET) {
+			sit = get_node(node_idx)->t_sorted->begin();
+			val = sorted_val();
+		} else if(type == NODE_VECTOR_OF) {
+			nums = get_node(node_idx)->t_vector_of;
+			if(!done()) {
+				val = new_node_vector_of_nth(nums.ptr, 0);
+			}
+		} else if(type == NODE_TENSOR) {
+			tensor = get_node(node_idx)->t_tensor;
+			if(!done()) {
+				val = new_node_tensor_nth(tensor.ptr, 0);
+			}
 		} else if(type == NODE_LAZY_LIST) {
 			val = lit.val;
 		} else {
@@ -1326,27 +2407,50 @@ struct seq_iterator_t {
 			return !it;
 		} else if(type == NODE_VECTOR) {
 			return !vit;
-		} else if(type == NODE_MAP) {
+		} else if(type == NODE_MAP || type == NODE_SET) {
 			return !mit;
+		} else if(type == NODE_SORTED_MAP || type == NODE_SORTED_SET) {
+			return !sit;
+		} else if(type == NODE_VECTOR_OF) {
+			return index >= nums->size();
+		} else if(type == NODE_TENSOR) {
+			return index >= tensor->shape[0];
 		} else if(type == NODE_LAZY_LIST) {
 			return lit.done();
 		}
 		return true;
 	}
 
+	// sorted maps are walked as [key value] entries, sorted sets as their elements
+	node_idx_t sorted_val() const {
+		return sit ? new_node_sorted_entry(type, *sit) : INV_NODE;
+	}
+
 	void next() {
 		if(done()) {
 			return;
 		}
 		if(type == NODE_LIST) {
-			val = *it++;
+			it++;
+			val = done() ? INV_NODE : *it;
 		} else if(type == NODE_VECTOR) {
-			val = *vit++;
+			vit++;
+			val = done() ? INV_NODE : *vit;
 		} else if(type == NODE_MAP) {
 			mit++;
-			if(!done()) {
-				val = mit->second;
-			}
+			val = done() ? INV_NODE : mit->second;
+		} else if(type == NODE_SET) {
+			mit++;
+			val = done() ? INV_NODE : mit->first;
+		} else if(type == NODE_SORTED_MAP || type == NODE_SORTED_SET) {
+			sit++;
+			val = sorted_val();
+		} else if(type == NODE_VECTOR_OF) {
+			index++;
+			val = done() ? INV_NODE : new_node_vector_of_nth(nums.ptr, index);
+		} else if(type == NODE_TENSOR) {
+			index++;
+			val = done() ? INV_NODE : new_node_tensor_nth(tensor.ptr, index);
 		} else if(type == NODE_LAZY_LIST) {
 			lit.next();
 			val = lit.val;
@@ -1373,9 +2477,6 @@ struct seq_iterator_t {
 		for(;!done();next()) {
 			res->push_back_inplace(val);
 		}
-		if(val != INV_NODE) {
-			res->push_back_inplace(val);
-		}
 		return res;
 	}
 
@@ -1386,14 +2487,95 @@ struct seq_iterator_t {
 	}
 };
 
+static inline bool node_is_set(const node_t *n) { return n->is_set() || n->is_sorted_set(); }
+static inline bool node_is_map(const node_t *n) { return n->is_map() || n->is_sorted_map(); }
+
+// looks key up in a set or map, hashed or sorted, and gives its value in val
+static bool node_coll_find(env_ptr_t env, node_t *coll, node_idx_t key, node_idx_t &val) {
+	if(coll->is_sorted()) {
+		auto entry = coll->t_sorted->find(key, sorted_lt_t(env, coll));
+		val = entry.second;
+		return entry.third;
+	}
+	auto entry = coll->t_map->find(key, [env](node_idx_t a, node_idx_t b) { return node_eq(env, a, b); });
+	val = entry.second;
+	return entry.third;
+}
+
+// true if both nodes have a cached hash, and they differ
+static inline bool node_hashes_differ(node_t *n1, node_t *n2) {
+	if(n1->is_sorted() != n2->is_sorted() && (node_is_set(n1) != node_is_set(n2) || node_is_map(n1) != node_is_map(n2))) {
+		// a sorted collection hashes like a hashed one, but can also equal a sequential
+		// one, which hashes by order
+		return false;
+	}
+	size_t h1 = jo_atomic_load(&n1->t_hash);
+	size_t h2 = h1 ? jo_atomic_load(&n2->t_hash) : 0;
+	return h2 && h1 != h2;
+}
+
 static bool node_eq(env_ptr_t env, node_idx_t n1i, node_idx_t n2i) {
 	//print_node(n1i);
 	//print_node(n2i);
 	node_t *n1 = get_node(n1i);
 	node_t *n2 = get_node(n2i);
-	if(n1->type == NODE_NIL || n2->type == NODE_NIL) {
+	auto eq = [env](const node_idx_t &a, const node_idx_t &b) {
+		return node_eq(env, a, b);
+	};
+	size_t size1, size2;
+	if(n1i == n2i && n1->type != NODE_FLOAT) {
+		// the same node, NaN aside
+		return true;
+	} else if(n1->type == NODE_NIL || n2->type == NODE_NIL) {
 		return n1->type == NODE_NIL && n2->type == NODE_NIL;
+	} else if(node_hashes_differ(n1, n2)) {
+		// both hashes already known and they differ, no need to walk either value
+		return false;
+	} else if(n1->is_set() || n1->is_map() || n2->is_set() || n2->is_map() || (n1->is_sorted() && n2->is_sorted())) {
+		// sets only equal sets and maps only equal maps, hashed or sorted. Iteration order
+		// depends on insertion order of colliding hashes, or on the comparator, so compare
+		// by membership. A sorted collection against a sequential one compares in order, below.
+		bool is_set = node_is_set(n1);
+		if(is_set != node_is_set(n2) || node_is_map(n1) != node_is_map(n2)) {
+			return false;
+		}
+		if(n1->type == n2->type && !n1->is_sorted()) {
+			if(is_set) {
+				return n1->as_set()->equals(*n2->as_set(), eq, [](const node_idx_t &a, const node_idx_t &b) { return true; });
+			}
+			return n1->as_map()->equals(*n2->as_map(), eq, eq);
+		}
+		if(!n1->known_size(size1) || !n2->known_size(size2) || size1 != size2) {
+			return false;
+		}
+		auto in_n2 = [&](node_idx_t key, node_idx_t val) {
+			node_idx_t val2;
+			return node_coll_find(env, n2, key, val2) && (is_set || node_eq(env, val, val2));
+		};
+		if(n1->is_sorted()) {
+			for(sorted_map_t::iterator it = n1->t_sorted->begin(); it; it++) {
+				if(!in_n2(it->first, it->second)) {
+					return false;
+				}
+			}
+		} else {
+			for(map_t::iterator it = n1->t_map->begin(); it; it++) {
+				if(!in_n2(it->first, it->second)) {
+					return false;
+				}
+			}
+		}
+		return true;
 	} else if(n1->is_seq() && n2->is_seq()) {
+		if(n1->known_size(size1) && n2->known_size(size2) && size1 != size2) {
+			return false;
+		}
+		if(n1->is_vector() && n2->is_vector()) {
+			return n1->as_vector()->equals(*n2->as_vector(), eq);
+		}
+		if(n1->is_vector_of() && n2->is_vector_of() && n1->t_vector_of->kind == n2->t_vector_of->kind) {
+			return n1->t_vector_of->equals(*n2->t_vector_of);
+		}
 		// in this case we want to iterate over the sequences and compare
 		// each element
 		seq_iterator_t i1(env, n1i), i2(env, n2i);
@@ -1402,15 +2584,7 @@ static bool node_eq(env_ptr_t env, node_idx_t n1i, node_idx_t n2i) {
 				return false;
 			}
 		}
-		if(i1.val != INV_NODE || i2.val != INV_NODE) {
-			if(!node_eq(env, i1.val, i2.val)) {
-				return false;
-			}
-		}
-		if(i1 || i2) {
-			return false;
-		}
-		return true;
+		return !i1 && !i2;
 	} else if(n1->type == NODE_BOOL && n2->type == NODE_BOOL) {
 		return n1->t_bool == n2->t_bool;
 	} else if(n1->type == NODE_INT && n2->type == NODE_INT) {
@@ -1437,18 +2611,10 @@ static bool node_lt(env_ptr_t env, node_idx_t n1i, node_idx_t n2i) {
 				return false;
 			}
 		}
-		if(i1.val != INV_NODE || i2.val != INV_NODE) {
-			if(!node_lt(env, i1.val, i2.val)) {
-				return false;
-			}
-		}
-		if(i1 || i2) {
-			return false;
-		}
-		return true;
+		return !i1 && !i2;
 	} else if(n1->type == NODE_BOOL && n2->type == NODE_BOOL) {
 		return n1->t_bool < n2->t_bool;
-	} else if(n1->type == NODE_STRING && n2->type == NODE_STRING) {
+	} else if(n1->type == n2->type && (n1->flags & NODE_FLAG_STRING)) {
 		return n1->t_string < n2->t_string;
 	} else if(n1->type == NODE_INT && n2->type == NODE_INT) {
 		return n1->t_int < n2->t_int;
@@ -1472,18 +2638,10 @@ static bool node_lte(env_ptr_t env, node_idx_t n1i, node_idx_t n2i) {
 				return false;
 			}
 		}
-		if(i1.val != INV_NODE || i2.val != INV_NODE) {
-			if(!node_lte(env, i1.val, i2.val)) {
-				return false;
-			}
-		}
-		if(i1 || i2) {
-			return false;
-		}
-		return true;
+		return !i1 && !i2;
 	} else if(n1->type == NODE_BOOL && n2->type == NODE_BOOL) {
 		return n1->t_bool <= n2->t_bool;
-	} else if(n1->type == NODE_STRING && n2->type == NODE_STRING) {
+	} else if(n1->type == n2->type && (n1->flags & NODE_FLAG_STRING)) {
 		return n1->t_string <= n2->t_string;
 	} else if(n1->type == NODE_INT && n2->type == NODE_INT) {
 		return n1->t_int <= n2->t_int;
@@ -1493,32 +2651,109 @@ static bool node_lte(env_ptr_t env, node_idx_t n1i, node_idx_t n2i) {
 	return false;
 }
 
+// Three way compare, the default ordering of sorted collections. Numbers and strings
+// order as with node_lt, keywords and symbols by name, and sequences element by
+// element with the shorter one first. nil sorts before everything, and otherwise
+// unrelated types order by type, so that any two keys are comparable.
+static int node_cmp(env_ptr_t env, node_idx_t n1i, node_idx_t n2i) {
+	if(n1i == n2i) {
+		return 0;
+	}
+	node_t *n1 = get_node(n1i);
+	node_t *n2 = get_node(n2i);
+	if(n1->type == NODE_NIL || n2->type == NODE_NIL) {
+		return (n2->type == NODE_NIL) - (n1->type == NODE_NIL);
+	}
+	if(n1->is_seq() && n2->is_seq()) {
+		seq_iterator_t i1(env, n1i), i2(env, n2i);
+		for(; i1 && i2; i1.next(), i2.next()) {
+			int c = node_cmp(env, i1.val, i2.val);
+			if(c) {
+				return c;
+			}
+		}
+		return (bool)i1 - (bool)i2;
+	}
+	bool n1_num = n1->is_int() || n1->is_float();
+	bool n2_num = n2->is_int() || n2->is_float();
+	if((n1_num && n2_num) || n1->type == n2->type) {
+		return node_lt(env, n1i, n2i) ? -1 : node_lt(env, n2i, n1i) ? 1 : 0;
+	}
+	return n1->type < n2->type ? -1 : 1;
+}
+
+sorted_lt_t::sorted_lt_t(env_ptr_t env, const node_t *coll) : env(env), comparator(coll->t_comparator) {}
+
+// a comparator may be a predicate like <, or return a negative, zero or positive number like compare
+bool sorted_lt_t::operator()(node_idx_t a, node_idx_t b) const {
+	if(comparator == NIL_NODE) {
+		return node_cmp(env, a, b) < 0;
+	}
+	list_ptr_t call = new_list();
+	call->push_back_inplace(comparator);
+	call->push_back_inplace(a);
+	call->push_back_inplace(b);
+	node_t *res = get_node(eval_list(env, call));
+	if(res->type == NODE_BOOL) {
+		return res->t_bool;
+	}
+	return res->as_int() < 0;
+}
+
 // jo_hash_value of node_idx_t
+// Strings and collections are immutable (transients aside), so their hash is computed
+// once and kept in the node. Using a collection as a key then costs O(size) only once.
 template <>
 size_t jo_hash_value(node_idx_t n) {
 	node_t *n1 = get_node(n);
+	size_t hash = jo_atomic_load(&n1->t_hash);
+	if(hash) {
+		return hash;
+	}
 	if(n1->type == NODE_NIL) {
 		return 0;
+	} else if(n1->is_set() || n1->is_map()) {
+		// order independent, to agree with node_eq, which also finds sorted ones equal
+		uint32_t res = 0;
+		for(map_t::iterator it = n1->t_map->begin(); it; it++) {
+			res += n1->is_set() ? jo_hash_value(it->first) : (jo_hash_value(it->first) * 31) ^ jo_hash_value(it->second);
+		}
+		hash = res;
+	} else if(n1->is_sorted()) {
+		uint32_t res = 0;
+		for(sorted_map_t::iterator it = n1->t_sorted->begin(); it; it++) {
+			res += n1->is_sorted_set() ? jo_hash_value(it->first) : (jo_hash_value(it->first) * 31) ^ jo_hash_value(it->second);
+		}
+		hash = res;
 	} else if(n1->is_seq()) {
 		uint32_t res = 0;
 		seq_iterator_t i(NULL, n);
 		for(; i; i.next()) {
 			res = (res * 31) + jo_hash_value(i.val);
 		}
-		if(i.val != INV_NODE) {
-			res = (res * 31) + jo_hash_value(i.val);
-		}
-		return res;
+		hash = res;
 	} else if(n1->type == NODE_BOOL) {
 		return n1->t_bool ? 1 : 0;
 	} else if(n1->flags & NODE_FLAG_STRING) {
-		return jo_hash_value(n1->t_string.c_str());
+		hash = jo_hash_value(n1->t_string.c_str());
 	} else if(n1->type == NODE_INT) {
 		return n1->t_int;
 	} else if(n1->type == NODE_FLOAT) {
-		return jo_hash_value(n1->as_float());
+		// whole floats hash like ints, as node_eq finds them equal
+		double f = n1->t_float;
+		if(f >= INT_MIN && f <= INT_MAX && f == (double)(int)f) {
+			return (int)f;
+		}
+		return jo_hash_value(f);
+	} else {
+		return 0;
 	}
-	return 0;
+	if(!n1->is_transient()) {
+		// another thread may store the same hash at the same time, which is harmless.
+		// A hash of 0 isn't kept, and is computed again each time.
+		jo_atomic_store(&n1->t_hash, hash);
+	}
+	return hash;
 }
 
 
@@ -1759,19 +2994,59 @@ static node_idx_t native_if(env_ptr_t env, list_ptr_t args) {
 	return eval_node(env, get_node(cond)->as_bool() ? when_true : when_false);
 }
 
-static node_idx_t native_print(env_ptr_t env, list_ptr_t args) {
+// writes to buf what as_string would return, without making the string
+static void out_as_string(jo_byte_buffer &buf, node_idx_t idx) {
+	node_t *n = get_node(idx);
+	if(n->type == NODE_INT) {
+		if(jo_isletter(n->t_int)) {
+			buf.put((char)n->t_int);
+		} else {
+			char tmp[24];
+			buf.write(tmp, jo_format_int(tmp, n->t_int));
+		}
+	} else if(n->type == NODE_FLOAT) {
+		char tmp[JO_FORMAT_FLOAT_MAX];
+		buf.write(tmp, jo_format_float(tmp, n->t_float));
+	} else if(n->type == NODE_BOOL) {
+		buf.write(n->t_bool ? "true" : "false", n->t_bool ? 4 : 5);
+	} else {
+		buf.write(n->t_string.c_str(), n->t_string.size());
+	}
+}
+
+static void out_args(list_ptr_t args) {
 	for(list_t::iterator i = args->begin(); i; i++) {
-		printf("%s", get_node(*i)->as_string().c_str());
+		out_as_string(tl_out, *i);
 	}
+}
+
+static node_idx_t native_print(env_ptr_t env, list_ptr_t args) {
+	out_args(args);
+	out_commit();
 	return NIL_NODE;
 }
 
 static node_idx_t native_println(env_ptr_t env, list_ptr_t args) {
-	native_print(env, args);
-	printf("\n");
+	out_args(args);
+	out_char('\n');
+	out_commit();
 	return NIL_NODE;	
 }
 
+// (with-out-str & body)
+// Evaluates body, and returns what it printed as a string, instead of
+// printing it.
+static node_idx_t native_with_out_str(env_ptr_t env, list_ptr_t args) {
+	jo_byte_buffer captured;
+	jo_byte_buffer *prev = tl_out_capture;
+	tl_out_capture = &captured;
+	for(list_t::iterator i = args->begin(); i; i++) {
+		eval_node(env, *i);
+	}
+	tl_out_capture = prev;
+	return new_node_string(captured.size ? jo_string(captured.data, captured.size) : jo_string());
+}
+
 static node_idx_t native_do(env_ptr_t env, list_ptr_t args) {
 	node_idx_t ret = NIL_NODE;
 	for(list_t::iterator i = args->begin(); i; i++) {
@@ -1813,9 +3088,6 @@ static node_idx_t native_doall(env_ptr_t env, list_ptr_t args) {
 		for(; it && n; it.next(), n--) {
 			ret->push_back_inplace(it.val);
 		}
-		if(it.val != NIL_NODE && n) {
-			ret->push_back_inplace(it.val);
-		}
 		return new_node_list(ret);
 	}
 
@@ -1844,6 +3116,86 @@ static node_idx_t native_list(env_ptr_t env, list_ptr_t args) {
 	return new_node_list(args);
 }
 
+// (vector)(vector a)(vector a b)(vector a b c)(vector a b c d)(vector a b c d e)(vector a b c d e f)(vector a b c d e f & args)
+// Creates a new vector containing the args.
+static node_idx_t native_vector(env_ptr_t env, list_ptr_t args) {
+	vector_ptr_t vec = new_vector();
+	for(list_t::iterator it = args->begin(); it; it++) {
+		vec->push_back_inplace(*it);
+	}
+	return new_node_vector(vec);
+}
+
+// (vec coll)
+// Creates a new vector containing the contents of coll.
+static node_idx_t native_vec(env_ptr_t env, list_ptr_t args) {
+	node_idx_t coll_idx = args->first_value();
+	node_t *coll = get_node(coll_idx);
+	if(coll->is_vector()) {
+		return coll_idx;
+	}
+	vector_ptr_t vec = new_vector();
+	if(coll->is_string()) {
+		jo_string &str = coll->t_string;
+		for(size_t i = 0; i < str.size(); i++) {
+			vec->push_back_inplace(new_node_int(str.c_str()[i]));
+		}
+	} else if(coll->is_seq()) {
+		for(seq_iterator_t it(env, coll_idx); it; it.next()) {
+			vec->push_back_inplace(it.val);
+		}
+	}
+	return new_node_vector(vec);
+}
+
+// (vector? x)
+// Return true if x implements IPersistentVector
+static node_idx_t native_is_vector(env_ptr_t env, list_ptr_t args) {
+	node_t *n = get_node(args->first_value());
+	return new_node_bool(n->is_vector() || n->is_vector_of());
+}
+
+// (subvec v start)(subvec v start end)
+// Returns a persistent vector of the items in vector from
+// start (inclusive) to end (exclusive).  If end is not supplied,
+// defaults to (count vector).
+static node_idx_t native_subvec(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_t *n = get_node(*it++);
+	if(!n->is_vector() && !n->is_vector_of()) {
+		return NIL_NODE;
+	}
+	int size = (int)(n->is_vector_of() ? n->t_vector_of->size() : n->t_vector->size());
+	int start = it ? get_node_int(*it++) : 0;
+	int end = it ? get_node_int(*it++) : size;
+	if(start < 0 || end > size || start > end) {
+		warnf("subvec: index out of bounds\n");
+		return NIL_NODE;
+	}
+	if(n->is_vector_of()) {
+		return new_node_vector_of(n->t_vector_of->subvec(start, end));
+	}
+	return new_node_vector(n->t_vector->subvec(start, end));
+}
+
+// (catvec)(catvec v1)(catvec v1 v2)(catvec v1 v2 & vs)
+// Concatenates the given vectors in O(log n), sharing structure with
+// all of them.
+static node_idx_t native_catvec(env_ptr_t env, list_ptr_t args) {
+	vector_ptr_t ret = new_vector();
+	for(list_t::iterator it = args->begin(); it; it++) {
+		node_t *n = get_node(*it);
+		if(n->is_vector()) {
+			ret->conj_inplace(*n->t_vector);
+		} else if(n->is_seq()) {
+			for(seq_iterator_t sit(env, *it); sit; sit.next()) {
+				ret->push_back_inplace(sit.val);
+			}
+		}
+	}
+	return new_node_vector(ret);
+}
+
 /*
 Usage: (var symbol)
 The symbol must resolve to a var, and the Var object
@@ -1900,7 +3252,7 @@ static node_idx_t native_def(env_ptr_t env, list_ptr_t args) {
 static node_idx_t native_fn(env_ptr_t env, list_ptr_t args) {
 	node_idx_t reti = new_node(NODE_FUNC);
 	node_t *ret = get_node(reti);
-	ret->t_func.args = get_node(args->first_value())->t_list;
+	ret->t_func.args = get_node_list(args->first_value());
 	ret->t_func.body = args->rest();
 	ret->t_func.env = env;
 	return reti;
@@ -1918,10 +3270,12 @@ static node_idx_t native_defn(env_ptr_t env, list_ptr_t args) {
 	jo_string sym_node = get_node(sym_node_idx)->as_string();
 	node_idx_t doc_string = *i++; // ignored for eval purposes if present
 	node_idx_t arg_list;
+	int body_start = 2;
 	if(get_node_type(doc_string) != NODE_STRING) {
 		arg_list = doc_string;
 	} else {
 		arg_list = *i++;
+		body_start = 3;
 	}
 
 	if(get_node_type(sym_node_idx) != NODE_SYMBOL) {
@@ -1931,8 +3285,8 @@ static node_idx_t native_defn(env_ptr_t env, list_ptr_t args) {
 
 	node_idx_t reti = new_node(NODE_FUNC);
 	node_t *ret = get_node(reti);
-	ret->t_func.args = get_node(arg_list)->t_list;
-	ret->t_func.body = args->rest();
+	ret->t_func.args = get_node_list(arg_list);
+	ret->t_func.body = args->drop(body_start);
 	ret->t_func.env = env;
 	env->set(sym_node, reti);
 	return NIL_NODE;
@@ -2028,11 +3382,10 @@ static node_idx_t native_time_now(env_ptr_t env, list_ptr_t args) {
 static node_idx_t native_dotimes(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t binding_idx = *it++;
-	if(!get_node(binding_idx)->is_list()) {
+	if(!get_node(binding_idx)->is_list() && !get_node(binding_idx)->is_vector()) {
 		return NIL_NODE;
 	}
-	node_t *binding = get_node(binding_idx);
-	list_ptr_t binding_list = binding->as_list();
+	list_ptr_t binding_list = get_node_list(binding_idx);
 	if (binding_list->size() != 2) {
 		return NIL_NODE;
 	}
@@ -2063,19 +3416,17 @@ The doseq statement is basically used to iterate over a sequence.
 static node_idx_t native_doseq(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t binding_idx = *it++;
-	if(!get_node(binding_idx)->is_list()) {
+	if(!get_node(binding_idx)->is_list() && !get_node(binding_idx)->is_vector()) {
 		return NIL_NODE;
 	}
-	node_t *binding = get_node(binding_idx);
-	list_ptr_t binding_list = binding->as_list();
+	list_ptr_t binding_list = get_node_list(binding_idx);
 	if (binding_list->size() != 2) {
 		return NIL_NODE;
 	}
 	node_idx_t name_idx = binding_list->first_value();
 	node_idx_t value_idx = binding_list->nth(1);
 	jo_string name = get_node(name_idx)->as_string();
-	node_t *value = get_node(value_idx);
-	list_ptr_t value_list = value->as_list();
+	list_ptr_t value_list = get_node_list(value_idx);
 	node_idx_t ret = NIL_NODE;
 	env_ptr_t env2 = new_env(env);
 	for(list_t::iterator it2 = value_list->begin(); it2; it2++) {
@@ -2116,11 +3467,10 @@ static node_idx_t native_when(env_ptr_t env, list_ptr_t args) {
 static node_idx_t native_when_let(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t binding_idx = *it++;
-	if(!get_node(binding_idx)->is_list()) {
+	if(!get_node(binding_idx)->is_list() && !get_node(binding_idx)->is_vector()) {
 		return NIL_NODE;
 	}
-	node_t *binding = get_node(binding_idx);
-	list_ptr_t binding_list = binding->as_list();
+	list_ptr_t binding_list = get_node_list(binding_idx);
 	if (binding_list->size() & 1) {
 		return NIL_NODE;
 	}
@@ -2131,7 +3481,8 @@ static node_idx_t native_when_let(env_ptr_t env, list_ptr_t args) {
 		if (!get_node(value_idx)->as_bool()) {
 			return NIL_NODE;
 		}
-		if(get_node_type(key_idx) == NODE_LIST && get_node_type(value_idx) == NODE_LIST) {
+		node_t *key = get_node(key_idx), *value = get_node(value_idx);
+		if((key->is_list() || key->is_vector()) && (value->is_list() || value->is_vector())) {
 			env2->set_temp(get_node_list(key_idx), get_node_list(value_idx));
 		} else {
 			env2->set_temp(get_node_string(key_idx), value_idx);
@@ -2162,11 +3513,17 @@ static node_idx_t native_cons(env_ptr_t env, list_ptr_t args) {
 		list_ptr_t second_list = second->as_list();
 		return new_node_list(second_list->cons(first_idx));
 	}
+	if(second->type == NODE_VECTOR) {
+		return new_node_list(get_node_list(second_idx)->cons(first_idx));
+	}
 	if(second->type == NODE_LAZY_LIST) {
 		lazy_list_iterator_t lit(env, second_idx);
 		list_ptr_t second_list = lit.all();
 		return new_node_list(second_list->cons(first_idx));
 	}
+	if(second->type == NODE_NIL) {
+		return new_node_list(new_list()->cons(first_idx));
+	}
 	list_ptr_t ret = new_list();
 	ret->cons(second_idx);
 	ret->cons(first_idx);
@@ -2183,16 +3540,72 @@ static node_idx_t native_conj(env_ptr_t env, list_ptr_t args) {
 		list_ptr_t first_list = first->as_list();
 		return new_node_list(first_list->cons(second_idx));
 	}
-	list_ptr_t ret = new_list();
-	ret->cons(second_idx);
-	ret->cons(first_idx);
-	return new_node_list(ret);
+	if(first->type == NODE_SET) {
+		set_ptr_t set = first->as_set();
+		for(it = args->begin(), it++; it; it++) {
+			set = set->assoc(*it, *it, [env](const node_idx_t &a, const node_idx_t &b) {
+				return node_eq(env, a, b);
+			});
+		}
+		return new_node_set(set);
+	}
+	if(first->is_sorted()) {
+		// sorted maps take [key value] entries
+		sorted_map_ptr_t sorted = first->t_sorted;
+		for(it = args->begin(), it++; it; it++) {
+			node_idx_t key_idx = *it, val_idx = *it;
+			if(first->is_sorted_map()) {
+				if(!get_node(*it)->is_seq()) {
+					continue;
+				}
+				seq_iterator_t entry(env, *it);
+				key_idx = entry.val;
+				val_idx = entry.nth(1);
+			}
+			sorted = sorted->assoc(key_idx, val_idx, sorted_lt_t(env, first));
+		}
+		return new_node_sorted(first->type, sorted, first->t_comparator);
+	}
+	if(first->type == NODE_VECTOR) {
+		// vectors conj at the end
+		vector_ptr_t vec = first->as_vector()->push_back(second_idx);
+		for(; it; it++) {
+			vec->push_back_inplace(*it);
+		}
+		return new_node_vector(vec);
+	}
+	if(first->type == NODE_VECTOR_OF) {
+		vector_of_ptr_t nums = first->t_vector_of->clone();
+		for(it = args->begin(), it++; it; it++) {
+			nums->push_back_inplace(get_node(*it)->as_float());
+		}
+		return new_node_vector_of(nums);
+	}
+	list_ptr_t ret = new_list();
+	ret->cons(second_idx);
+	ret->cons(first_idx);
+	return new_node_list(ret);
 }
 
 static node_idx_t native_pop(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t list_idx = *it++;
 	node_t *list = get_node(list_idx);
+	if(list->is_vector()) {
+		// pops from the end
+		vector_ptr_t vec = list->as_vector();
+		if(vec->size() == 0) {
+			return NIL_NODE;
+		}
+		return new_node_vector(vec->pop_back());
+	}
+	if(list->is_vector_of()) {
+		size_t size = list->t_vector_of->size();
+		if(size == 0) {
+			return NIL_NODE;
+		}
+		return new_node_vector_of(list->t_vector_of->subvec(0, size - 1));
+	}
 	if(!list->is_list()) {
 		return NIL_NODE;
 	}
@@ -2214,6 +3627,20 @@ static node_idx_t native_peek(env_ptr_t env, list_ptr_t args) {
 		}
 		return list_list->first_value();
 	}
+	if(list->is_vector()) {
+		vector_ptr_t vec = list->as_vector();
+		if(vec->size() == 0) {
+			return NIL_NODE;
+		}
+		return vec->last_value();
+	}
+	if(list->is_vector_of()) {
+		size_t size = list->t_vector_of->size();
+		if(size == 0) {
+			return NIL_NODE;
+		}
+		return new_node_vector_of_nth(list->t_vector_of.ptr, size - 1);
+	}
 	if(list->is_string()) {
 		jo_string s = list->as_string();
 		if(s.size() == 0) {
@@ -2234,6 +3661,9 @@ static node_idx_t native_constantly(env_ptr_t env, list_ptr_t args) {
 	return reti;
 }
 
+static bool io_line_seq_count(node_idx_t coll, long long &count);
+static bool io_line_seq_reduce(env_ptr_t env, node_idx_t f_idx, node_idx_t coll, node_idx_t init_idx, node_idx_t &ret);
+
 static node_idx_t native_count(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t list_idx = *it++;
@@ -2245,6 +3675,32 @@ static node_idx_t native_count(env_ptr_t env, list_ptr_t args) {
 		list_ptr_t list_list = list->as_list();
 		return new_node_int(list_list->size());
 	}
+	if(list->is_vector()) {
+		return new_node_int(list->as_vector()->size());
+	}
+	if(list->is_map() || list->is_set()) {
+		return new_node_int(list->as_map()->size());
+	}
+	if(list->is_sorted()) {
+		return new_node_int(list->t_sorted->size());
+	}
+	if(list->is_vector_of()) {
+		return new_node_int(list->t_vector_of->size());
+	}
+	if(list->is_tensor()) {
+		return new_node_int(list->t_tensor->shape[0]);
+	}
+	if(list->is_lazy_list()) {
+		long long lines;
+		if(io_line_seq_count(list_idx, lines)) {
+			return new_node_int((int)lines);
+		}
+		int n = 0;
+		for(lazy_list_iterator_t lit(env, list_idx); !lit.done(); lit.next()) {
+			n++;
+		}
+		return new_node_int(n);
+	}
 	return ZERO_NODE;
 }
 
@@ -2263,6 +3719,21 @@ static node_idx_t native_is_empty(env_ptr_t env, list_ptr_t args) {
 		list_ptr_t list_list = node->as_list();
 		return list_list->size() == 0 ? TRUE_NODE : FALSE_NODE;
 	}
+	if(node->is_vector()) {
+		return node->as_vector()->size() == 0 ? TRUE_NODE : FALSE_NODE;
+	}
+	if(node->is_map() || node->is_set()) {
+		return node->as_map()->size() == 0 ? TRUE_NODE : FALSE_NODE;
+	}
+	if(node->is_sorted()) {
+		return node->t_sorted->size() == 0 ? TRUE_NODE : FALSE_NODE;
+	}
+	if(node->is_vector_of()) {
+		return node->t_vector_of->size() == 0 ? TRUE_NODE : FALSE_NODE;
+	}
+	if(node->is_tensor()) {
+		return node->t_tensor->shape[0] == 0 ? TRUE_NODE : FALSE_NODE;
+	}
 	return FALSE_NODE;
 }
 
@@ -2301,6 +3772,30 @@ static node_idx_t native_first(env_ptr_t env, list_ptr_t args) {
 		}
 		return list_list->first_value();
 	}
+	if(node->is_vector()) {
+		vector_ptr_t vec = node->as_vector();
+		if(vec->size() == 0) {
+			return NIL_NODE;
+		}
+		return vec->first_value();
+	}
+	if(node->is_vector_of()) {
+		if(node->t_vector_of->size() == 0) {
+			return NIL_NODE;
+		}
+		return new_node_vector_of_nth(node->t_vector_of.ptr, 0);
+	}
+	if(node->is_tensor()) {
+		if(node->t_tensor->shape[0] == 0) {
+			return NIL_NODE;
+		}
+		return new_node_tensor_nth(node->t_tensor.ptr, 0);
+	}
+	if(node->is_sorted()) {
+		// the smallest key, without walking the tree
+		seq_iterator_t sit(env, node_idx);
+		return sit ? sit.val : NIL_NODE;
+	}
 	if(node->is_lazy_list()) {
 		lazy_list_iterator_t lit(env, node_idx);
 		return lit.val;
@@ -2326,6 +3821,13 @@ static node_idx_t native_second(env_ptr_t env, list_ptr_t args) {
 		}
 		return list_list->nth(1);
 	}
+	if(node->is_vector()) {
+		vector_ptr_t vec = node->as_vector();
+		if(vec->size() <= 1) {
+			return NIL_NODE;
+		}
+		return vec->nth(1);
+	}
 	if(node->is_lazy_list()) {
 		lazy_list_iterator_t lit(env, node_idx);
 		return lit.nth(1);
@@ -2347,6 +3849,21 @@ static node_idx_t native_last(env_ptr_t env, list_ptr_t args) {
 	if(node->is_list()) {
 		return node->as_list()->last_value();
 	}
+	if(node->is_vector()) {
+		vector_ptr_t vec = node->as_vector();
+		if(vec->size() == 0) {
+			return NIL_NODE;
+		}
+		return vec->last_value();
+	}
+	if(node->is_sorted()) {
+		// the largest key, in O(log n)
+		sorted_map_ptr_t sorted = node->t_sorted;
+		if(sorted->size() == 0) {
+			return NIL_NODE;
+		}
+		return new_node_sorted_entry(node->type, sorted->last());
+	}
 	if(node->is_lazy_list()) {
 		lazy_list_iterator_t lit(env, node_idx);
 		for(; !lit.done(); lit.next()) {}
@@ -2375,6 +3892,13 @@ static node_idx_t native_drop(env_ptr_t env, list_ptr_t args) {
 	if(list->is_list()) {
 		return new_node_list(list_list->drop(n));
 	}
+	if(list->is_vector()) {
+		vector_ptr_t vec = list->as_vector();
+		if(n >= (int)vec->size()) {
+			return new_node_vector(new_vector());
+		}
+		return new_node_vector(vec->drop(jo_max(n, 0)));
+	}
 	if(list->is_lazy_list()) {
 		lazy_list_iterator_t lit(env, list_idx);
 		lit.nth(n);
@@ -2408,6 +3932,24 @@ static node_idx_t native_nth(env_ptr_t env, list_ptr_t args) {
 		}
 		return list->as_list()->nth(n);
 	}
+	if(list->is_vector()) {
+		if(n < 0 || n >= (int)list->as_vector()->size()) {
+			return NIL_NODE;
+		}
+		return list->as_vector()->nth(n);
+	}
+	if(list->is_vector_of()) {
+		if(n < 0 || n >= (int)list->t_vector_of->size()) {
+			return NIL_NODE;
+		}
+		return new_node_vector_of_nth(list->t_vector_of.ptr, n);
+	}
+	if(list->is_tensor()) {
+		if(n < 0 || n >= (int)list->t_tensor->shape[0]) {
+			return NIL_NODE;
+		}
+		return new_node_tensor_nth(list->t_tensor.ptr, n);
+	}
 	if(list->is_lazy_list()) {
 		lazy_list_iterator_t lit(env, list_idx);
 		return lit.nth(n);
@@ -2437,6 +3979,12 @@ static node_idx_t native_rand_nth(env_ptr_t env, list_ptr_t args) {
 			return list->as_list()->nth(n);
 		}
 	}
+	if(list->is_vector()) {
+		size_t vec_size = list->as_vector()->size();
+		if(vec_size > 0) {
+			return list->as_vector()->nth(rand() % vec_size);
+		}
+	}
 	return NIL_NODE;
 }
 
@@ -2501,6 +4049,20 @@ static node_idx_t native_next(env_ptr_t env, list_ptr_t args) {
 		}
 		return new_node_list(list_list->rest());
 	}
+	if(node->is_vector()) {
+		vector_ptr_t vec = node->as_vector();
+		if(vec->size() <= 1) {
+			return NIL_NODE;
+		}
+		return new_node_vector(vec->rest());
+	}
+	if(node->is_vector_of()) {
+		vector_of_ptr_t nums = node->t_vector_of;
+		if(nums->size() <= 1) {
+			return NIL_NODE;
+		}
+		return new_node_vector_of(nums->subvec(1, nums->size()));
+	}
 	if(node->is_lazy_list()) {
 		lazy_list_iterator_t lit(env, node_idx);
 		if(lit.done()) {
@@ -2527,6 +4089,20 @@ static node_idx_t native_rest(env_ptr_t env, list_ptr_t args) {
 		list_ptr_t list_list = node->as_list();
 		return new_node_list(list_list->rest());
 	}
+	if(node->is_vector()) {
+		vector_ptr_t vec = node->as_vector();
+		if(vec->size() == 0) {
+			return new_node_vector(vec);
+		}
+		return new_node_vector(vec->rest());
+	}
+	if(node->is_vector_of()) {
+		vector_of_ptr_t nums = node->t_vector_of;
+		if(nums->size() == 0) {
+			return new_node_vector_of(nums);
+		}
+		return new_node_vector_of(nums->subvec(1, nums->size()));
+	}
 	if(node->is_lazy_list()) {
 		lazy_list_iterator_t lit(env, node_idx);
 		if(lit.done()) {
@@ -2551,13 +4127,15 @@ static node_idx_t native_let(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t node_idx = *it++;
 	node_t *node = get_node(node_idx);
-	if(!node->is_list()) {
-		printf("let: expected list\n");
+	if(!node->is_list() && !node->is_vector()) {
+		out_str("let: expected list\n");
+		out_commit();
 		return NIL_NODE;
 	}
-	list_ptr_t list_list = node->as_list();
+	list_ptr_t list_list = get_node_list(node_idx);
 	if(list_list->size() % 2 != 0) {
-		printf("let: expected even number of elements\n");
+		out_str("let: expected even number of elements\n");
+		out_commit();
 		return NIL_NODE;
 	}
 	env_ptr_t env2 = new_env(env);
@@ -2578,6 +4156,10 @@ static node_idx_t native_apply(env_ptr_t env, list_ptr_t args) {
 		node_t *arg = get_node(arg_idx);
 		if(arg->is_list()) {
 			arg_list->conj_inplace(*arg->as_list().ptr);
+		} else if(arg->is_vector()) {
+			for(vector_t::iterator vit = arg->as_vector()->begin(); vit; vit++) {
+				arg_list->push_back_inplace(*vit);
+			}
 		} else if(arg->is_lazy_list()) {
 			for(lazy_list_iterator_t lit(env, arg_idx); !lit.done(); lit.next()) {
 				arg_list->push_back_inplace(lit.val);
@@ -2589,6 +4171,48 @@ static node_idx_t native_apply(env_ptr_t env, list_ptr_t args) {
 	return eval_list(env, arg_list);
 }
 
+static node_idx_t native_math_min(env_ptr_t env, list_ptr_t args);
+static node_idx_t native_math_max(env_ptr_t env, list_ptr_t args);
+
+// Reducing a vector-of with +, *, Math/min or Math/max runs over the raw numbers, without
+// boxing each one. init_idx is INV_NODE if reduce got no initial value. Returns false for
+// any other f, or an empty vector without init, which then take the boxed route.
+static bool vector_of_reduce(env_ptr_t env, node_idx_t f_idx, const vector_of_t *nums, node_idx_t init_idx, node_idx_t &ret) {
+	node_t *f = get_node(f_idx);
+	if(f->type == NODE_SYMBOL) {
+		f = get_node(env->get(f->t_string));
+	}
+	if(f->type != NODE_NATIVE_FUNCTION) {
+		return false;
+	}
+	native_function_t fn = f->t_native_function;
+	if(fn != &native_add && fn != &native_mul && fn != &native_math_min && fn != &native_math_max) {
+		return false;
+	}
+	bool has_init = init_idx != INV_NODE;
+	if(!has_init && nums->size() == 0) {
+		return false;
+	}
+	bool is_float = nums->kind == VECTOR_OF_DOUBLE || (has_init && get_node_type(init_idx) == NODE_FLOAT);
+	double acc = has_init ? get_node(init_idx)->as_float() : nums->nth(0);
+	bool skip = !has_init;
+	nums->each([&](double x) {
+		if(skip) {
+			skip = false;
+		} else if(fn == &native_add) {
+			acc += x;
+		} else if(fn == &native_mul) {
+			acc *= x;
+		} else if(fn == &native_math_min) {
+			acc = x < acc ? x : acc;
+		} else {
+			acc = x > acc ? x : acc;
+		}
+	});
+	ret = is_float ? new_node_float(acc) : new_node_int((int)acc);
+	return true;
+}
+
 // (reduce f coll)
 // (reduce f val coll)
 // f should be a function of 2 arguments. 
@@ -2609,6 +4233,18 @@ static node_idx_t native_reduce(env_ptr_t env, list_ptr_t args) {
 	if(args->size() == 2) {
 		node_idx_t coll_idx = eval_node(env, *it++);
 		node_t *coll = get_node(coll_idx);
+		node_idx_t reti;
+		if(coll->is_vector_of() && vector_of_reduce(env, f_idx, coll->t_vector_of.ptr, INV_NODE, reti)) {
+			return reti;
+		}
+		if(io_line_seq_reduce(env, f_idx, coll_idx, INV_NODE, reti)) {
+			return reti;
+		}
+		if(coll->is_set() || coll->is_sorted() || coll->is_vector_of()) {
+			seq_iterator_t sit(env, coll_idx);
+			coll_idx = new_node_list(sit.all());
+			coll = get_node(coll_idx);
+		}
 		if(coll->is_list()) {
 			list_ptr_t list_list = coll->as_list();
 			if(list_list->size() == 0) {
@@ -2628,6 +4264,25 @@ static node_idx_t native_reduce(env_ptr_t env, list_ptr_t args) {
 			}
 			return reti;
 		}
+		if(coll->is_vector()) {
+			vector_ptr_t vec = coll->as_vector();
+			if(vec->size() == 0) {
+				list_ptr_t arg_list = new_list();
+				arg_list->push_back_inplace(f_idx);
+				return eval_list(env, arg_list);
+			}
+			vector_t::iterator it2 = vec->begin();
+			node_idx_t reti = *it2++;
+			while(it2) {
+				node_idx_t arg_idx = *it2++;
+				list_ptr_t arg_list = new_list();
+				arg_list->push_back_inplace(f_idx);
+				arg_list->push_back_inplace(reti);
+				arg_list->push_back_inplace(arg_idx);
+				reti = eval_list(env, arg_list);
+			}
+			return reti;
+		}
 		if(coll->is_lazy_list()) {
 			lazy_list_iterator_t lit(env, coll_idx);
 			node_idx_t reti = lit.val;
@@ -2641,7 +4296,7 @@ static node_idx_t native_reduce(env_ptr_t env, list_ptr_t args) {
 			}
 			return reti;
 		}
-		warnf("reduce: expected list or lazy list\n");
+		warnf("reduce: expected list, vector or lazy list\n");
 		return NIL_NODE;
 	}
 	// (reduce f val coll)
@@ -2652,6 +4307,17 @@ static node_idx_t native_reduce(env_ptr_t env, list_ptr_t args) {
 		node_idx_t reti = eval_node(env, *it++);
 		node_idx_t coll = eval_node(env, *it++);
 		node_t *coll_node = get_node(coll);
+		if(coll_node->is_vector_of() && vector_of_reduce(env, f_idx, coll_node->t_vector_of.ptr, reti, reti)) {
+			return reti;
+		}
+		if(io_line_seq_reduce(env, f_idx, coll, reti, reti)) {
+			return reti;
+		}
+		if(coll_node->is_set() || coll_node->is_sorted() || coll_node->is_vector_of()) {
+			seq_iterator_t sit(env, coll);
+			coll = new_node_list(sit.all());
+			coll_node = get_node(coll);
+		}
 		if(coll_node->is_list()) {
 			list_ptr_t list_list = coll_node->as_list();
 			if(list_list->size() == 0) {
@@ -2668,6 +4334,17 @@ static node_idx_t native_reduce(env_ptr_t env, list_ptr_t args) {
 			}
 			return reti;
 		}
+		if(coll_node->is_vector()) {
+			vector_ptr_t vec = coll_node->as_vector();
+			for(vector_t::iterator it2 = vec->begin(); it2; it2++) {
+				list_ptr_t arg_list = new_list();
+				arg_list->push_back_inplace(f_idx);
+				arg_list->push_back_inplace(reti);
+				arg_list->push_back_inplace(*it2);
+				reti = eval_list(env, arg_list);
+			}
+			return reti;
+		}
 		if(coll_node->is_lazy_list()) {
 			lazy_list_iterator_t lit(env, coll);
 			for(; !lit.done(); lit.next()) {
@@ -2680,7 +4357,7 @@ static node_idx_t native_reduce(env_ptr_t env, list_ptr_t args) {
 			}
 			return reti;
 		}
-		warnf("reduce: expected list or lazy list\n");
+		warnf("reduce: expected list, vector or lazy list\n");
 		return NIL_NODE;
 	}
 	return NIL_NODE;
@@ -2774,6 +4451,13 @@ static node_idx_t native_reverse(env_ptr_t env, list_ptr_t args) {
 		list_ptr_t list_list = node->as_list();
 		return new_node_list(list_list->reverse());
 	}
+	if(node->is_vector()) {
+		list_ptr_t ret = new_list();
+		for(vector_t::iterator vit = node->as_vector()->begin(); vit; vit++) {
+			ret->push_front_inplace(*vit);
+		}
+		return new_node_list(ret);
+	}
 	return NIL_NODE;
 }
 
@@ -2782,6 +4466,174 @@ static node_idx_t native_eval(env_ptr_t env, list_ptr_t args) {
 	return eval_node(env, args->first_value());
 }
 
+// A transient node owns a private header of its collection. The trie nodes are still shared with
+// the persistent original, and are copied on first write. After that this transient is their only
+// owner (ref_count 1), so later writes mutate them in place instead of copying the path again.
+static node_idx_t new_node_transient(node_idx_t coll_idx) {
+	node_t *coll = get_node(coll_idx);
+	if(coll->is_map()) {
+		return new_node_map(map_ptr_t(new map_t(*coll->t_map)), NODE_FLAG_TRANSIENT);
+	}
+	if(coll->is_vector()) {
+		return new_node_vector(vector_ptr_t(new vector_t(*coll->t_vector)), NODE_FLAG_TRANSIENT);
+	}
+	if(coll->is_set()) {
+		return new_node_set(set_ptr_t(new set_t(*coll->t_map)), NODE_FLAG_TRANSIENT);
+	}
+	return NIL_NODE;
+}
+
+static void transient_assoc(env_ptr_t env, node_t *t, node_idx_t key_idx, node_idx_t val_idx) {
+	if(t->is_map()) {
+		t->t_map->assoc_inplace(key_idx, val_idx, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		});
+	} else if(t->is_vector()) {
+		t->t_vector->assoc_inplace(get_node_int(key_idx), val_idx);
+	}
+}
+
+// conj for maps takes another map, or a [key value] pair
+static void transient_conj(env_ptr_t env, node_t *t, node_idx_t x_idx) {
+	if(t->is_vector()) {
+		t->t_vector->push_back_inplace(x_idx);
+		return;
+	}
+	if(t->is_set()) {
+		t->t_map->assoc_inplace(x_idx, x_idx, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		});
+		return;
+	}
+	node_t *x = get_node(x_idx);
+	if(x->is_map()) {
+		for(map_t::iterator it = x->t_map->begin(); it; it++) {
+			transient_assoc(env, t, it->first, it->second);
+		}
+	} else if(x->is_vector() && x->t_vector->size() == 2) {
+		transient_assoc(env, t, x->t_vector->nth(0), x->t_vector->nth(1));
+	} else if(x->is_list() && x->t_list->size() == 2) {
+		transient_assoc(env, t, x->t_list->nth(0), x->t_list->nth(1));
+	}
+}
+
+// (transient coll)
+// Returns a new, transient version of the collection, in constant time.
+static node_idx_t native_transient(env_ptr_t env, list_ptr_t args) {
+	node_idx_t coll_idx = args->first_value();
+	if(get_node(coll_idx)->is_transient()) {
+		return coll_idx;
+	}
+	return new_node_transient(coll_idx);
+}
+
+// (persistent! coll)
+// Returns a new, persistent version of the transient collection, in
+// constant time. The transient collection cannot be used after this
+// call, any such use will throw an exception.
+static node_idx_t native_persistent(env_ptr_t env, list_ptr_t args) {
+	node_idx_t t_idx = args->first_value();
+	node_t *t = get_node(t_idx);
+	if(!t->is_transient()) {
+		warnf("persistent!: expected a transient\n");
+		return NIL_NODE;
+	}
+	// the transient node itself becomes the persistent collection, so it can no longer be edited
+	t->flags &= ~NODE_FLAG_TRANSIENT;
+	return t_idx;
+}
+
+// (conj!)(conj! coll)(conj! coll x)
+// Adds x to the transient collection, and return coll. The 'addition'
+// may happen at different 'places' depending on the concrete type.
+static node_idx_t native_conj_bang(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	if(!it) {
+		return new_node_transient(new_node_vector(new_vector()));
+	}
+	node_idx_t t_idx = *it++;
+	node_t *t = get_node(t_idx);
+	if(!t->is_transient()) {
+		warnf("conj!: transient used after persistent! call\n");
+		return NIL_NODE;
+	}
+	for(; it; it++) {
+		transient_conj(env, t, *it);
+	}
+	return t_idx;
+}
+
+// (assoc! coll key val)(assoc! coll key val & kvs)
+// When applied to a transient map, adds mapping of key(s) to
+// val(s). When applied to a transient vector, sets the val at index.
+// Note - index must be <= (count vector). Returns coll.
+static node_idx_t native_assoc_bang(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t t_idx = *it++;
+	node_t *t = get_node(t_idx);
+	if(!t->is_transient()) {
+		warnf("assoc!: transient used after persistent! call\n");
+		return NIL_NODE;
+	}
+	while(it) {
+		node_idx_t key_idx = *it++;
+		node_idx_t val_idx = it ? *it++ : NIL_NODE;
+		transient_assoc(env, t, key_idx, val_idx);
+	}
+	return t_idx;
+}
+
+// (dissoc! map key)(dissoc! map key & ks)
+// Returns a transient map that doesn't contain a mapping for key(s).
+static node_idx_t native_dissoc_bang(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t t_idx = *it++;
+	node_t *t = get_node(t_idx);
+	if(!t->is_transient() || !t->is_map()) {
+		warnf("dissoc!: expected a transient map\n");
+		return NIL_NODE;
+	}
+	for(; it; it++) {
+		t->t_map->erase_inplace(*it, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		});
+	}
+	return t_idx;
+}
+
+// (disj! set)(disj! set key)(disj! set key & ks)
+// disj[oin]. Returns a transient set of the same (hashed/sorted) type, that
+// does not contain key(s).
+static node_idx_t native_disj_bang(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t t_idx = *it++;
+	node_t *t = get_node(t_idx);
+	if(!t->is_transient() || !t->is_set()) {
+		warnf("disj!: expected a transient set\n");
+		return NIL_NODE;
+	}
+	for(; it; it++) {
+		t->t_map->erase_inplace(*it, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		});
+	}
+	return t_idx;
+}
+
+// (pop! coll)
+// Removes the last item from a transient vector. If
+// the collection is empty, throws an exception. Returns coll
+static node_idx_t native_pop_bang(env_ptr_t env, list_ptr_t args) {
+	node_idx_t t_idx = args->first_value();
+	node_t *t = get_node(t_idx);
+	if(!t->is_transient() || !t->is_vector() || t->t_vector->size() == 0) {
+		warnf("pop!: expected a non-empty transient vector\n");
+		return NIL_NODE;
+	}
+	t->t_vector->pop_back_inplace();
+	return t_idx;
+}
+
 // (into) 
 // (into to)
 // (into to from)
@@ -2798,28 +4650,81 @@ static node_idx_t native_into(env_ptr_t env, list_ptr_t args) {
 			for(list_t::iterator it = get_node(from)->t_list->begin(); it; it++) {
 				ret->push_front_inplace(*it);
 			}
-		} else if(get_node_type(from) == NODE_LAZY_LIST) {
-			for(lazy_list_iterator_t lit(env, from); !lit.done(); lit.next()) {
-				ret->push_front_inplace(lit.val);
+		} else if(get_node_type(from) == NODE_VECTOR) {
+			for(vector_t::iterator it = get_node(from)->t_vector->begin(); it; it++) {
+				ret->push_front_inplace(*it);
 			}
-		} else if(get_node_type(from) == NODE_MAP) {
-			map_ptr_t from_map = get_node(from)->t_map;
-			for(map_t::iterator it = from_map->begin(); it != from_map->end(); it++) {
-				ret->push_front_inplace(it->second);
+		} else if(get_node(from)->is_seq()) {
+			for(seq_iterator_t sit(env, from); sit; sit.next()) {
+				ret->push_front_inplace(sit.val);
 			}
 		}
 		return new_node_list(ret);
 	}
-	if(get_node_type(to) == NODE_MAP) {
-		map_ptr_t ret = new map_t(*get_node(to)->t_map);
-		if(get_node_type(from) == NODE_LIST) {
-			for(list_t::iterator it = get_node(from)->t_list->begin(); it; it++) {
-				if(get_node_type(*it) == NODE_MAP) {
-					ret = ret->conj(get_node(*it)->t_map.ptr);
+	if(get_node(to)->is_sorted()) {
+		// a private header shares the tree with to, so only the first insert along each path copies
+		node_t *to_node = get_node(to);
+		sorted_lt_t lt(env, to_node);
+		sorted_map_ptr_t ret = new sorted_map_t(*to_node->t_sorted);
+		if(get_node_type(from) == NODE_MAP && to_node->is_sorted_map()) {
+			map_ptr_t from_map = get_node(from)->t_map;
+			for(map_t::iterator it = from_map->begin(); it; it++) {
+				ret->assoc_inplace(it->first, it->second, lt);
+			}
+		} else if(get_node(from)->is_seq()) {
+			for(seq_iterator_t sit(env, from); sit; sit.next()) {
+				node_idx_t key_idx = sit.val, val_idx = sit.val;
+				if(to_node->is_sorted_map()) {
+					if(!get_node(sit.val)->is_seq()) {
+						continue;
+					}
+					seq_iterator_t entry(env, sit.val);
+					key_idx = entry.val;
+					val_idx = entry.nth(1);
+				}
+				ret->assoc_inplace(key_idx, val_idx, lt);
+			}
+		}
+		return new_node_sorted(to_node->type, ret, to_node->t_comparator);
+	}
+	if(get_node_type(to) == NODE_VECTOR_OF) {
+		vector_of_ptr_t ret = get_node(to)->t_vector_of->clone();
+		if(get_node(from)->is_vector_of()) {
+			get_node(from)->t_vector_of->each([&](double x) { ret->push_back_inplace(x); });
+		} else if(get_node(from)->is_seq()) {
+			for(seq_iterator_t sit(env, from); sit; sit.next()) {
+				ret->push_back_inplace(get_node(sit.val)->as_float());
+			}
+		}
+		return new_node_vector_of(ret);
+	}
+	if(get_node_type(to) == NODE_VECTOR && get_node_type(from) == NODE_VECTOR) {
+		// a vector onto a vector is a concatenation
+		return new_node_vector(get_node(to)->t_vector->conj(*get_node(from)->t_vector));
+	}
+	if(get_node_type(to) == NODE_VECTOR || get_node_type(to) == NODE_MAP || get_node_type(to) == NODE_SET) {
+		// batch the whole load through a transient, then hand it back as persistent
+		node_idx_t ret_idx = new_node_transient(to);
+		node_t *ret = get_node(ret_idx);
+		if(get_node_type(from) == NODE_MAP) {
+			map_ptr_t from_map = get_node(from)->t_map;
+			for(map_t::iterator it = from_map->begin(); it; it++) {
+				if(ret->is_map()) {
+					transient_assoc(env, ret, it->first, it->second);
+				} else {
+					vector_ptr_t entry = new_vector();
+					entry->push_back_inplace(it->first);
+					entry->push_back_inplace(it->second);
+					transient_conj(env, ret, new_node_vector(entry));
 				}
 			}
+		} else if(get_node(from)->is_seq()) {
+			for(seq_iterator_t sit(env, from); sit; sit.next()) {
+				transient_conj(env, ret, sit.val);
+			}
 		}
-		return new_node_map(ret);
+		ret->flags &= ~NODE_FLAG_TRANSIENT;
+		return ret_idx;
 	}
 	return NIL_NODE;
 }
@@ -2828,7 +4733,7 @@ static node_idx_t native_into(env_ptr_t env, list_ptr_t args) {
 static node_idx_t native_time(env_ptr_t env, list_ptr_t args) {
 	double time_start = jo_time();
 	for(list_t::iterator it = args->begin(); it; it++) {
-		node_idx_t node_idx = eval_node(env, *it);
+		eval_node(env, *it);
 	}
 	double time_end = jo_time();
 	return new_node_float(time_end - time_start);
@@ -2841,18 +4746,18 @@ static node_idx_t native_time(env_ptr_t env, list_ptr_t args) {
 // equal, they are handled as if by repeated uses of assoc.
 static node_idx_t native_hash_map(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
-	map_ptr_t map = new_map();
+	node_idx_t ret_idx = new_node_map(new_map(), NODE_FLAG_TRANSIENT);
+	node_t *ret = get_node(ret_idx);
 	while(it) {
 		node_idx_t k = eval_node(env, *it++);
 		if(!it) {
 			break;
 		}
 		node_idx_t v = eval_node(env, *it++);
-		map->assoc_inplace(k, v, [env](node_idx_t k, node_idx_t v) {
-			return node_eq(env, k, v);
-		});
+		transient_assoc(env, ret, k, v);
 	}
-	return new_node_map(map);
+	ret->flags &= ~NODE_FLAG_TRANSIENT;
+	return ret_idx;
 }
 
 // (assoc map key val)(assoc map key val & kvs)
@@ -2878,9 +4783,47 @@ static node_idx_t native_assoc(env_ptr_t env, list_ptr_t args) {
 		vector_ptr_t vector = map_node->t_vector->assoc(key_node->as_int(), val_idx);
 		return new_node_vector(vector);
 	}
+	if(map_node->is_vector_of()) {
+		int index = key_node->as_int();
+		if(index < 0 || index > (int)map_node->t_vector_of->size()) {
+			warnf("assoc: index out of bounds\n");
+			return NIL_NODE;
+		}
+		return new_node_vector_of(map_node->t_vector_of->assoc(index, val_node->as_float()));
+	}
+	if(map_node->is_sorted_map()) {
+		sorted_map_ptr_t sorted = map_node->t_sorted->assoc(key_idx, val_idx, sorted_lt_t(env, map_node));
+		return new_node_sorted(NODE_SORTED_MAP, sorted, map_node->t_comparator);
+	}
 	return NIL_NODE;
 }
 
+// (dissoc map)(dissoc map key)(dissoc map key & ks)
+// dissoc[iate]. Returns a new map of the same (hashed/sorted) type,
+// that does not contain a mapping for key(s).
+static node_idx_t native_dissoc(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t map_idx = *it++;
+	node_t *map_node = get_node(map_idx);
+	if(map_node->is_sorted_map()) {
+		sorted_map_ptr_t sorted = map_node->t_sorted;
+		for(; it; it++) {
+			sorted = sorted->erase(*it, sorted_lt_t(env, map_node));
+		}
+		return new_node_sorted(NODE_SORTED_MAP, sorted, map_node->t_comparator);
+	}
+	if(!map_node->is_map()) {
+		return map_idx;
+	}
+	map_ptr_t map = map_node->t_map;
+	for(; it; it++) {
+		map = map->erase(*it, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		});
+	}
+	return new_node_map(map);
+}
+
 // (get map key)(get map key not-found)
 // Returns the value mapped to key, not-found or nil if key not present.
 static node_idx_t native_get(env_ptr_t env, list_ptr_t args) {
@@ -2902,17 +4845,150 @@ static node_idx_t native_get(env_ptr_t env, list_ptr_t args) {
 	}
 	if(map_node->is_vector()) {
 		int vec_idx = key_node->as_int();
-		if(vec_idx < 0 || vec_idx > map_node->t_vector->size()) {
+		if(vec_idx < 0 || vec_idx >= (int)map_node->t_vector->size()) {
 			return not_found_idx;
 		}
 		return map_node->t_vector->nth(key_node->as_int());
 	}
+	if(map_node->is_vector_of()) {
+		int index = key_node->as_int();
+		if(index < 0 || index >= (int)map_node->t_vector_of->size()) {
+			return not_found_idx;
+		}
+		return new_node_vector_of_nth(map_node->t_vector_of.ptr, index);
+	}
+	if(map_node->is_tensor()) {
+		int index = key_node->as_int();
+		if(index < 0 || index >= (int)map_node->t_tensor->shape[0]) {
+			return not_found_idx;
+		}
+		return new_node_tensor_nth(map_node->t_tensor.ptr, index);
+	}
+	if(map_node->is_set()) {
+		auto entry = map_node->as_set()->find(key_idx, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		});
+		if(entry.third) {
+			return entry.first;
+		}
+		return not_found_idx;
+	}
+	if(map_node->is_sorted()) {
+		auto entry = map_node->t_sorted->find(key_idx, sorted_lt_t(env, map_node));
+		if(entry.third) {
+			return map_node->is_sorted_map() ? entry.second : entry.first;
+		}
+		return not_found_idx;
+	}
 	return NIL_NODE;
 }
 
-// (comp)(comp f)(comp f g)(comp f g & fs)
-// Takes a set of functions and returns a fn that is the composition
-// of those fns.  The returned fn takes a variable number of args,
+// (contains? coll key)
+// Returns true if key is present in the given collection, otherwise
+// returns false.  Note that for numerically indexed collections like
+// vectors and Java arrays, this tests if the numeric key is within the
+// range of indexes. 'contains?' operates constant or logarithmic time;
+// it will not perform a linear search for a value.  See also 'some'.
+static node_idx_t native_contains(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t coll_idx = *it++;
+	node_idx_t key_idx = *it++;
+	node_t *coll = get_node(coll_idx);
+	if(coll->is_map() || coll->is_set()) {
+		return new_node_bool(coll->t_map->find(key_idx, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		}).third);
+	}
+	if(coll->is_sorted()) {
+		return new_node_bool(coll->t_sorted->find(key_idx, sorted_lt_t(env, coll)).third);
+	}
+	if(coll->is_vector()) {
+		int index = get_node_int(key_idx);
+		return new_node_bool(index >= 0 && index < (int)coll->t_vector->size());
+	}
+	if(coll->is_string()) {
+		int index = get_node_int(key_idx);
+		return new_node_bool(index >= 0 && index < (int)coll->t_string.size());
+	}
+	return FALSE_NODE;
+}
+
+// (set coll)
+// Returns a set of the distinct elements of coll.
+static node_idx_t native_set(env_ptr_t env, list_ptr_t args) {
+	node_idx_t coll_idx = args->first_value();
+	node_t *coll = get_node(coll_idx);
+	if(coll->is_set()) {
+		return coll_idx;
+	}
+	node_idx_t ret_idx = new_node_set(new_set(), NODE_FLAG_TRANSIENT);
+	node_t *ret = get_node(ret_idx);
+	if(coll->is_map()) {
+		// map entries as [key value] pairs
+		for(map_t::iterator it = coll->t_map->begin(); it; it++) {
+			vector_ptr_t entry = new_vector();
+			entry->push_back_inplace(it->first);
+			entry->push_back_inplace(it->second);
+			transient_conj(env, ret, new_node_vector(entry));
+		}
+	} else if(coll->is_string()) {
+		for(size_t i = 0; i < coll->t_string.size(); i++) {
+			transient_conj(env, ret, new_node_int(coll->t_string.c_str()[i]));
+		}
+	} else if(coll->is_seq()) {
+		for(seq_iterator_t sit(env, coll_idx); sit; sit.next()) {
+			transient_conj(env, ret, sit.val);
+		}
+	}
+	ret->flags &= ~NODE_FLAG_TRANSIENT;
+	return ret_idx;
+}
+
+// (hash-set)(hash-set & keys)
+// Returns a new hash set with supplied keys.  Any equal keys are
+// handled as if by repeated uses of conj.
+static node_idx_t native_hash_set(env_ptr_t env, list_ptr_t args) {
+	list_ptr_t set_args = new_list();
+	set_args->push_back_inplace(new_node_list(args));
+	return native_set(env, set_args);
+}
+
+// (set? x)
+// Returns true if x implements IPersistentSet
+static node_idx_t native_is_set(env_ptr_t env, list_ptr_t args) {
+	node_t *n = get_node(args->first_value());
+	return new_node_bool(n->is_set() || n->is_sorted_set());
+}
+
+// (disj set)(disj set key)(disj set key & ks)
+// disj[oin]. Returns a new set of the same (hashed/sorted) type, that
+// does not contain key(s).
+static node_idx_t native_disj(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t set_idx = *it++;
+	node_t *set_node = get_node(set_idx);
+	if(set_node->is_sorted_set()) {
+		sorted_map_ptr_t sorted = set_node->t_sorted;
+		for(; it; it++) {
+			sorted = sorted->erase(*it, sorted_lt_t(env, set_node));
+		}
+		return new_node_sorted(NODE_SORTED_SET, sorted, set_node->t_comparator);
+	}
+	if(!set_node->is_set()) {
+		return set_idx;
+	}
+	set_ptr_t set = set_node->as_set();
+	for(; it; it++) {
+		set = set->erase(*it, [env](node_idx_t k, node_idx_t v) {
+			return node_eq(env, k, v);
+		});
+	}
+	return new_node_set(set);
+}
+
+// (comp)(comp f)(comp f g)(comp f g & fs)
+// Takes a set of functions and returns a fn that is the composition
+// of those fns.  The returned fn takes a variable number of args,
 // applies the rightmost of fns to the args, the next
 // fn (right-to-left) to the result, etc.
 static node_idx_t native_comp(env_ptr_t env, list_ptr_t args) {
@@ -2922,9 +4998,16 @@ static node_idx_t native_comp(env_ptr_t env, list_ptr_t args) {
 		list_t::iterator it = rargs->begin();
 		node_idx_t ret = NIL_NODE;
 		if(it) {
-			ret = eval_list(env, new_list()->push_back_inplace(*it++)->conj_inplace(*args));
+			// build each call in a list_ptr_t, so the list has exactly one owner
+			list_ptr_t call = new_list();
+			call->push_back_inplace(*it++);
+			call->conj_inplace(*args);
+			ret = eval_list(env, call);
 			while(it) {
-				ret = eval_list(env, new_list()->push_back_inplace(*it++)->push_back_inplace(ret));
+				call = new_list();
+				call->push_back_inplace(*it++);
+				call->push_back_inplace(ret);
+				ret = eval_list(env, call);
 			}
 		}
 		return ret;
@@ -2992,129 +5075,32 @@ static node_idx_t native_is(env_ptr_t env, list_ptr_t args) {
 	node_t *msg_node = get_node(eval_node(env, msg_idx));
 	if(!form_node->as_bool()) {
 		if(msg_node->is_string()) {
-			printf("%s\n", msg_node->t_string.c_str());
+			out_str(msg_node->t_string.c_str());
+			out_char('\n');
 		} else {
-			printf("Assertion failed\n");
+			out_str("Assertion failed\n");
 			print_node(form_idx);
-			printf("\n");
+			out_char('\n');
 		}
+		out_commit();
 	}
 	return NIL_NODE;
 }
 
+#include "jo_lisp_tensor.h"
 #include "jo_lisp_math.h"
 #include "jo_lisp_string.h"
+#include "jo_lisp_io.h"
 #include "jo_lisp_system.h"
 #include "jo_lisp_lazy.h"
-
-#ifdef _MSC_VER
-#pragma comment(lib,"AdvApi32.lib")
-#pragma comment(lib,"User32.lib")
-//#pragma comment(lib,"Comdlg32.lib")
-//#pragma comment(lib,"Shell32.lib")
-//#pragma comment(lib,"legacy_stdio_definitions.lib")
-static char real_exe_path[MAX_PATH];
-static bool IsRegistered(const char *ext) {
-	HKEY hKey;
-	char keystr[256];
-	sprintf(keystr, "%s.Document\\shell\\open\\command", ext);
-	LONG ret = RegOpenKeyExA(HKEY_CLASSES_ROOT, keystr, 0, KEY_READ, &hKey);
-	if (ret == ERROR_SUCCESS) {
-		DWORD n = 4;
-		ret = RegQueryValueExA(hKey, NULL, NULL, NULL, 0, &n);
-		if (ret == ERROR_SUCCESS) {
-			char *reg_data = (char *)malloc(n);
-			ret = RegQueryValueExA(hKey, NULL, NULL, NULL, (unsigned char *)reg_data, &n);
-			if (ret == ERROR_SUCCESS && strstr(reg_data, real_exe_path)) {
-				return true;
-			}
-		}
-	}
-	return false;
-}
-#endif
-
-int main(int argc, char **argv) {
-#ifdef _MSC_VER
-    {
-		GetModuleFileNameA(GetModuleHandle(NULL), real_exe_path, MAX_PATH);
-		bool register_clj = !IsRegistered("CLJ") && (MessageBoxA(0, "Do you want to register .CLJ files with this program?", "JO_LISP", MB_OKCANCEL) == 1);
-		if(register_clj) {
-			char tmp[128];
-			sprintf(tmp, "%s.reg", tmpnam(0));
-			FILE *fp = fopen(tmp, "w");
-			if (fp) {
-				char exe_path[MAX_PATH * 2] = {0};
-				for (int i = 0, j = 0; real_exe_path[i]; ++i, ++j) {
-					exe_path[j] = real_exe_path[i];
-					if (exe_path[j] == '\\') {
-						exe_path[++j] = '\\';
-					}
-				}
-				fprintf(fp, "Windows Registry Editor Version 5.00\n\n");
-				if (register_clj) {
-					fprintf(fp, "[HKEY_CLASSES_ROOT\\.clj]\n@=\"CLJ.Document\"\n\n");
-					fprintf(fp, "[HKEY_CLASSES_ROOT\\CLJ.Document\\shell\\open\\command]\n@=\"%s %%1\"\n\n", exe_path);
-				}
-				fclose(fp);
-				system(tmp);
-				remove(tmp);
-			}
-		}
-	}
-#endif
-
-	if(argc <= 1) {
-		fprintf(stderr, "usage: %s <file>\n", argv[0]);
-		return 1;
-	}
-
-	if(0) {
-		// test persistent vectors
-		jo_persistent_vector<int> *pv = new jo_persistent_vector<int>();
-		for(int i = 0; i < 100; i++) { pv->push_back_inplace(i); }
-		for(int i = 0; i < 33; i++) { pv->pop_front_inplace(); }
-		for(int i = 0; i < 10; i++) { pv->pop_back_inplace(); }
-
-		// test iterators
-		jo_persistent_vector<int>::iterator it = pv->begin();
-		for(int i = 0; it; it++, ++i) {
-			if(*it != 33 + i) {
-				fprintf(stderr, "iterator test failed\n");
-				return 1;
-			}
-			//printf("%d\n", *it);
-		}
-
-		delete pv;
-
-		printf("\n");
-		// test persistent vectors
-
-	}
-
-	if(0) {
-		// test bidirectional persistent vectors
-		jo_persistent_vector_bidirectional<int> *pv = new jo_persistent_vector_bidirectional<int>();
-		for(int i = 0; i < 10; i++) { pv->push_front_inplace(-i); }
-		for(int i = 0; i < 1; i++) { pv->push_back_inplace(i); }
-		//for(int i = 0; i < 1; i++) { pv->pop_front_inplace(); }
-		for(int i = 0; i < 3; i++) { pv->pop_back_inplace(); }
-		for(int i = 0; i < 3; i++) { pv->push_back_inplace(i); }
-		//for(int i = 0; i < 1; i++) { pv->push_front_inplace(-i); }
-		jo_persistent_vector_bidirectional<int>::iterator it = pv->begin();
-		for(; it; it++) {
-			printf("%d\n", *it);
-		}
-		delete pv;
-		printf("\n");
-		exit(0);
-	}
-
-	debugf("Setting up environment...\n");
-
-	env_ptr_t env = new_env(NULL);
-
+#include "jo_lisp_async.h"
+#include "jo_lisp_sorted.h"
+#include "jo_lisp_vector_of.h"
+#include "jo_lisp_freeze.h"
+#include "jo_lisp_image.h"
+
+// the special nodes, then every builtin, in the order the special node indices expect
+static void jo_lisp_init(env_ptr_t env) {
 	// first thing first, alloc special nodes
 	{
 		get_node(new_node(NODE_NIL))->flags |= NODE_FLAG_LITERAL;
@@ -3163,6 +5149,7 @@ int main(int argc, char **argv) {
 	env->set("eval", new_node_native_function("eval", &native_eval, false));
 	env->set("print", new_node_native_function("print", &native_print, false));
 	env->set("println", new_node_native_function("println", &native_println, false));
+	env->set("with-out-str", new_node_native_function("with-out-str", &native_with_out_str, true));
 	env->set("+", new_node_native_function("+", &native_add, false));
 	env->set("-", new_node_native_function("-", &native_sub, false));
 	env->set("*", new_node_native_function("*", &native_mul, false));
@@ -3206,6 +5193,11 @@ int main(int argc, char **argv) {
 	env->set("next", new_node_native_function("next", &native_next, false));
 	env->set("rest", new_node_native_function("rest", &native_rest, false));
 	env->set("list", new_node_native_function("list", &native_list, false));
+	env->set("vector", new_node_native_function("vector", &native_vector, false));
+	env->set("vec", new_node_native_function("vec", &native_vec, false));
+	env->set("vector?", new_node_native_function("vector?", &native_is_vector, false));
+	env->set("subvec", new_node_native_function("subvec", &native_subvec, false));
+	env->set("catvec", new_node_native_function("catvec", &native_catvec, false));
 	env->set("hash-map", new_node_native_function("hash-map", &native_hash_map, false));
 	env->set("upper-case", new_node_native_function("upper-case", &native_upper_case, false));
 	env->set("concat", new_node_native_function("concat", &native_concat, false));
@@ -3236,7 +5228,20 @@ int main(int argc, char **argv) {
 	env->set("Time/now", new_node_native_function("Time/now", &native_time_now, false));
 	env->set("time", new_node_native_function("time", &native_time, true));
 	env->set("assoc", new_node_native_function("assoc", &native_assoc, false));
+	env->set("dissoc", new_node_native_function("dissoc", &native_dissoc, false));
 	env->set("get", new_node_native_function("get", &native_get, false));
+	env->set("transient", new_node_native_function("transient", &native_transient, false));
+	env->set("persistent!", new_node_native_function("persistent!", &native_persistent, false));
+	env->set("conj!", new_node_native_function("conj!", &native_conj_bang, false));
+	env->set("assoc!", new_node_native_function("assoc!", &native_assoc_bang, false));
+	env->set("dissoc!", new_node_native_function("dissoc!", &native_dissoc_bang, false));
+	env->set("pop!", new_node_native_function("pop!", &native_pop_bang, false));
+	env->set("disj!", new_node_native_function("disj!", &native_disj_bang, false));
+	env->set("contains?", new_node_native_function("contains?", &native_contains, false));
+	env->set("set", new_node_native_function("set", &native_set, false));
+	env->set("hash-set", new_node_native_function("hash-set", &native_hash_set, false));
+	env->set("set?", new_node_native_function("set?", &native_is_set, false));
+	env->set("disj", new_node_native_function("disj", &native_disj, false));
 	env->set("comp", new_node_native_function("comp", &native_comp, false));
 	env->set("partial", new_node_native_function("partial", &native_partial, false));
 	env->set("shuffle", new_node_native_function("shuffle", &native_shuffle, false));
@@ -3247,32 +5252,190 @@ int main(int argc, char **argv) {
 	jo_lisp_string_init(env);
 	jo_lisp_system_init(env);
 	jo_lisp_lazy_init(env);
-	
-	FILE *fp = fopen(argv[1], "r");
-	if(!fp) {
-		return 0;
+	jo_lisp_async_init(env);
+	jo_lisp_sorted_init(env);
+	jo_lisp_vector_of_init(env);
+	jo_lisp_tensor_init(env);
+	jo_lisp_freeze_init(env);
+	jo_lisp_io_init(env);
+}
+
+#ifdef _MSC_VER
+#pragma comment(lib,"AdvApi32.lib")
+#pragma comment(lib,"User32.lib")
+//#pragma comment(lib,"Comdlg32.lib")
+//#pragma comment(lib,"Shell32.lib")
+//#pragma comment(lib,"legacy_stdio_definitions.lib")
+static char real_exe_path[MAX_PATH];
+static bool IsRegistered(const char *ext) {
+	HKEY hKey;
+	char keystr[256];
+	sprintf(keystr, "%s.Document\\shell\\open\\command", ext);
+	LONG ret = RegOpenKeyExA(HKEY_CLASSES_ROOT, keystr, 0, KEY_READ, &hKey);
+	if (ret == ERROR_SUCCESS) {
+		DWORD n = 4;
+		ret = RegQueryValueExA(hKey, NULL, NULL, NULL, 0, &n);
+		if (ret == ERROR_SUCCESS) {
+			char *reg_data = (char *)malloc(n);
+			ret = RegQueryValueExA(hKey, NULL, NULL, NULL, (unsigned char *)reg_data, &n);
+			if (ret == ERROR_SUCCESS && strstr(reg_data, real_exe_path)) {
+				return true;
+			}
+		}
 	}
-	
-	debugf("Parsing...\n");
+	return false;
+}
+#endif
+
+int main(int argc, char **argv) {
+#ifdef _MSC_VER
+    {
+		GetModuleFileNameA(GetModuleHandle(NULL), real_exe_path, MAX_PATH);
+		bool register_clj = !IsRegistered("CLJ") && (MessageBoxA(0, "Do you want to register .CLJ files with this program?", "JO_LISP", MB_OKCANCEL) == 1);
+		if(register_clj) {
+			char tmp[128];
+			sprintf(tmp, "%s.reg", tmpnam(0));
+			FILE *fp = fopen(tmp, "w");
+			if (fp) {
+				char exe_path[MAX_PATH * 2] = {0};
+				for (int i = 0, j = 0; real_exe_path[i]; ++i, ++j) {
+					exe_path[j] = real_exe_path[i];
+					if (exe_path[j] == '\\') {
+						exe_path[++j] = '\\';
+					}
+				}
+				fprintf(fp, "Windows Registry Editor Version 5.00\n\n");
+				if (register_clj) {
+					fprintf(fp, "[HKEY_CLASSES_ROOT\\.clj]\n@=\"CLJ.Document\"\n\n");
+					fprintf(fp, "[HKEY_CLASSES_ROOT\\CLJ.Document\\shell\\open\\command]\n@=\"%s %%1\"\n\n", exe_path);
+				}
+				fclose(fp);
+				system(tmp);
+				remove(tmp);
+			}
+		}
+	}
+#endif
 
-	parse_state_t parse_state;
-	parse_state.fp = fp;
-	parse_state.line_num = 1;
+	// print buffers its output, which has to go out however the program ends
+	atexit(out_flush);
 
-	// parse the base list
-	list_ptr_t main_list = new_list();
-	for(node_idx_t next = parse_next(env, &parse_state, 0); next != INV_NODE; next = parse_next(env, &parse_state, 0)) {
-		main_list->push_back_inplace(next);
+	// options that take a path come before the script, which they make optional
+	const char *image_path = NULL, *snapshot_path = NULL;
+	while(argc > 2 && (!strcmp(argv[1], "--image") || !strcmp(argv[1], "--snapshot"))) {
+		*(argv[1][2] == 'i' ? &image_path : &snapshot_path) = argv[2];
+		argv += 2;
+		argc -= 2;
 	}
-	fclose(fp);
 
-	debugf("Evaluating...\n");
+	if(argc <= 1 && !image_path && !snapshot_path) {
+		fprintf(stderr, "usage: %s <file>\n", argv[0]);
+		fprintf(stderr, "       %s --stream <file>   evaluate each form as soon as it is read\n", argv[0]);
+		fprintf(stderr, "       %s -                 same, from stdin\n", argv[0]);
+		fprintf(stderr, "       %s --snapshot <image> [file]   save everything defined to image\n", argv[0]);
+		fprintf(stderr, "       %s --image <image> [file]      start from a saved image\n", argv[0]);
+		return 1;
+	}
 
-	node_idx_t res_idx = eval_node_list(env, main_list);
-	print_node(res_idx, 0);
-	printf("\n");
+	if(0) {
+		// test persistent vectors
+		jo_persistent_vector<int> *pv = new jo_persistent_vector<int>();
+		for(int i = 0; i < 100; i++) { pv->push_back_inplace(i); }
+		for(int i = 0; i < 33; i++) { pv->pop_front_inplace(); }
+		for(int i = 0; i < 10; i++) { pv->pop_back_inplace(); }
+
+		// test iterators
+		jo_persistent_vector<int>::iterator it = pv->begin();
+		for(int i = 0; it; it++, ++i) {
+			if(*it != 33 + i) {
+				fprintf(stderr, "iterator test failed\n");
+				return 1;
+			}
+			//printf("%d\n", *it);
+		}
+
+		delete pv;
+
+		printf("\n");
+		// test persistent vectors
+
+	}
+
+	if(0) {
+		// test bidirectional persistent vectors
+		jo_persistent_vector_bidirectional<int> *pv = new jo_persistent_vector_bidirectional<int>();
+		for(int i = 0; i < 10; i++) { pv->push_front_inplace(-i); }
+		for(int i = 0; i < 1; i++) { pv->push_back_inplace(i); }
+		//for(int i = 0; i < 1; i++) { pv->pop_front_inplace(); }
+		for(int i = 0; i < 3; i++) { pv->pop_back_inplace(); }
+		for(int i = 0; i < 3; i++) { pv->push_back_inplace(i); }
+		//for(int i = 0; i < 1; i++) { pv->push_front_inplace(-i); }
+		jo_persistent_vector_bidirectional<int>::iterator it = pv->begin();
+		for(; it; it++) {
+			printf("%d\n", *it);
+		}
+		delete pv;
+		printf("\n");
+		exit(0);
+	}
+
+	debugf("Setting up environment...\n");
+
+	// Sources are parsed against the builtins alone, so names the image or the source
+	// itself defines are looked up when evaluated, and can be shadowed or redefined.
+	env_ptr_t env, builtins;
+	if(image_path) {
+		env = image_load(image_path, builtins);
+		if(!env.ptr) {
+			return 1;
+		}
+	} else {
+		env = new_env(NULL);
+		jo_lisp_init(env);
+		builtins = new_env(NULL);
+		builtins->vars_map = env->vars_map;
+	}
+	
+	node_idx_t res_idx = NIL_NODE;
+	if(argc <= 1) {
+		// nothing to run, only an image to load or save
+	} else if(!strcmp(argv[1], "-") || !strcmp(argv[1], "--stream")) {
+		FILE *fp = stdin;
+		if(argv[1][1] && (argc < 3 || !(fp = fopen(argv[2], "r")))) {
+			return 0;
+		}
+		res_idx = eval_stream(env, builtins, fp);
+		if(fp != stdin) {
+			fclose(fp);
+		}
+	} else {
+		jo_mmap_file source;
+		if(!source.open(argv[1])) {
+			return 0;
+		}
+		
+		debugf("Parsing...\n");
+
+		// parse the base list
+		list_ptr_t main_list = new_list();
+		parse_forms(builtins, source.data, source.data + source.size, main_list);
+		source.close();
+
+		debugf("Evaluating...\n");
+
+		res_idx = eval_node_list(env, main_list);
+	}
+	if(argc > 1) {
+		print_node(res_idx, 0);
+		out_char('\n');
+		out_commit();
+	}
+
+	if(snapshot_path && !image_save(snapshot_path, env, builtins)) {
+		return 1;
+	}
 
-	debugf("nodes.size() = %zu\n", nodes.size());
+	debugf("num_nodes = %d\n", num_nodes);
 	debugf("free_nodes.size() = %zu\n", free_nodes.size());
 
 	/*
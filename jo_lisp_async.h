@@ -0,0 +1,297 @@
+#pragma once
+
+#include "jo_stdcpp.h"
+
+// Futures, promises, pmap and pcalls, all run on a shared work-stealing thread pool.
+
+// the same pool matmul runs its tiles on
+static jo_work_stealing_pool *get_thread_pool() {
+	return jo_shared_pool();
+}
+
+static void future_task(void *arg) {
+	future_ptr_t *fp = (future_ptr_t *)arg;
+	future_t *f = fp->ptr;
+	node_idx_t res = eval_node_list(f->env, f->body);
+	f->env = env_ptr_t();
+	f->body = list_ptr_t();
+	{
+		jo_lock_guard lock(f->mutex);
+		f->value = res;
+		jo_atomic_store(&f->done, 1);
+		f->cv.notify_all();
+	}
+	delete fp;
+}
+
+// evaluates body (a list of forms) on the thread pool
+static node_idx_t new_node_future(env_ptr_t env, list_ptr_t body) {
+	node_idx_t idx = new_node(NODE_FUTURE);
+	future_ptr_t f(new future_t(true));
+	f->env = env;
+	f->body = body;
+	get_node(idx)->t_future = f;
+	get_thread_pool()->submit(&future_task, new future_ptr_t(f));
+	return idx;
+}
+
+// Blocks until f is done, or timeout seconds have passed (if timeout >= 0).
+// While waiting, this thread runs queued tasks, so nested futures can't starve the pool.
+static bool future_wait(future_t *f, double timeout = -1) {
+	jo_work_stealing_pool *pool = get_thread_pool();
+	double deadline = jo_time() + timeout;
+	while(!jo_atomic_load(&f->done)) {
+		if(timeout >= 0 && jo_time() >= deadline) {
+			return false;
+		}
+		if(pool->try_run_one()) {
+			continue;
+		}
+		jo_lock_guard lock(f->mutex);
+		if(!jo_atomic_load(&f->done)) {
+			jo_condition_variable_wait_for(f->cv, f->mutex, 0.001);
+		}
+	}
+	return true;
+}
+
+static node_idx_t future_value(future_t *f) {
+	jo_lock_guard lock(f->mutex);
+	return f->value;
+}
+
+// (future & body)
+// Takes a body of expressions and yields a future object that will
+// invoke the body in another thread, and will cache the result and
+// return it on all subsequent calls to deref/@. If the computation has
+// not yet finished, calls to deref/@ will block, unless the variant of
+// deref with timeout is used.
+static node_idx_t native_future(env_ptr_t env, list_ptr_t args) {
+	return new_node_future(env, args);
+}
+
+// (future-call f)
+// Takes a function of no args and yields a future object that will
+// invoke the function in another thread.
+static node_idx_t native_future_call(env_ptr_t env, list_ptr_t args) {
+	list_ptr_t call = new_list();
+	call->push_back_inplace(args->first_value());
+	list_ptr_t body = new_list();
+	body->push_back_inplace(new_node_list(call));
+	return new_node_future(env, body);
+}
+
+// (promise)
+// Returns a promise object that can be read with deref/@, and set,
+// once only, with deliver. Calls to deref/@ prior to delivery will
+// block.
+static node_idx_t native_promise(env_ptr_t env, list_ptr_t args) {
+	node_idx_t idx = new_node(NODE_FUTURE);
+	get_node(idx)->t_future = future_ptr_t(new future_t());
+	return idx;
+}
+
+// (deliver promise val)
+// Delivers the supplied value to the promise, releasing any pending
+// derefs. A subsequent call to deliver on a promise will have no effect.
+static node_idx_t native_deliver(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t p_idx = *it++;
+	node_idx_t val_idx = it ? *it++ : NIL_NODE;
+	node_t *p = get_node(p_idx);
+	if(!p->is_future()) {
+		return NIL_NODE;
+	}
+	future_t *f = p->t_future.ptr;
+	jo_lock_guard lock(f->mutex);
+	if(!jo_atomic_load(&f->done)) {
+		f->value = val_idx;
+		jo_atomic_store(&f->done, 1);
+		f->cv.notify_all();
+	}
+	return p_idx;
+}
+
+// (deref ref)(deref ref timeout-ms timeout-val)
+// Within a transaction, returns the in-transaction-value of ref, else returns the most-recently-committed value of ref.
+// When applied to a delay, forces it if not already forced.
+// When applied to a future, will block if computation not complete.
+// When applied to a promise, will block until a value is delivered.
+// The variant taking a timeout can be used for blocking references (futures and promises),
+// and will return timeout-val if the timeout (in milliseconds) is reached before a value is available.
+static node_idx_t native_deref(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t ref_idx = *it++;
+	node_t *ref = get_node(ref_idx);
+	if(ref->is_future()) {
+		future_t *f = ref->t_future.ptr;
+		if(it) {
+			double timeout = get_node(*it++)->as_float() / 1000.0;
+			node_idx_t timeout_val = it ? *it++ : NIL_NODE;
+			if(!future_wait(f, timeout)) {
+				return timeout_val;
+			}
+			return future_value(f);
+		}
+		future_wait(f);
+		return future_value(f);
+	}
+	if(ref->type == NODE_DELAY) {
+		if(ref->t_delay == INV_NODE) {
+			node_idx_t res = eval_node_list(ref->t_func.env, ref->t_func.body);
+			get_node(ref_idx)->t_delay = res;
+		}
+		return get_node(ref_idx)->t_delay;
+	}
+	if(ref->type == NODE_VAR) {
+		return ref->t_var;
+	}
+	return ref_idx;
+}
+
+// (realized? x)
+// Returns true if a value has been produced for a promise, delay, future or lazy-seq.
+static node_idx_t native_is_realized(env_ptr_t env, list_ptr_t args) {
+	node_t *n = get_node(args->first_value());
+	if(n->is_future()) {
+		return new_node_bool(jo_atomic_load(&n->t_future->done));
+	}
+	if(n->type == NODE_DELAY) {
+		return new_node_bool(n->t_delay != INV_NODE);
+	}
+	return new_node_bool(!n->is_lazy_list());
+}
+
+static node_idx_t native_is_future(env_ptr_t env, list_ptr_t args) {
+	node_t *n = get_node(args->first_value());
+	return new_node_bool(n->is_future() && n->t_future.ptr && n->t_future->is_future);
+}
+
+static node_idx_t native_is_future_done(env_ptr_t env, list_ptr_t args) {
+	node_t *n = get_node(args->first_value());
+	return new_node_bool(n->is_future() && jo_atomic_load(&n->t_future->done));
+}
+
+// how far ahead of the consumer pmap runs
+static int pmap_window() {
+	return jo_hardware_concurrency() + 2;
+}
+
+// (pmap f coll)(pmap f coll & colls)
+// Like map, except f is applied in parallel. Semi-lazy in that the
+// parallel computation stays ahead of the consumption, but doesn't
+// realize the entire result unless required. Only useful for
+// computationally intensive functions where the time of f dominates
+// the coordination overhead.
+static node_idx_t native_pmap(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t f = *it++;
+	node_idx_t lazy_func_idx = new_node(NODE_LIST);
+	list_ptr_t lazy_func = new_list();
+	lazy_func->push_back_inplace(env->get("pmap-next"));
+	lazy_func->push_back_inplace(f);
+	lazy_func->push_back_inplace(new_node_int(pmap_window()));
+	lazy_func->push_back_inplace(EMPTY_LIST_NODE); // futures in flight
+	for(; it; it++) {
+		node_idx_t coll = *it;
+		int type = get_node_type(coll);
+		if(type != NODE_LIST && type != NODE_LAZY_LIST && get_node(coll)->is_seq()) {
+			seq_iterator_t sit(env, coll);
+			coll = new_node_list(sit.all());
+		}
+		lazy_func->push_back_inplace(coll);
+	}
+	get_node(lazy_func_idx)->t_list = lazy_func;
+	return new_node_lazy_list(lazy_func_idx);
+}
+
+static node_idx_t native_pmap_next(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t f = *it++;
+	node_idx_t window_idx = *it++;
+	int window = get_node(window_idx)->as_int();
+	list_ptr_t in_flight(new list_t(*get_node(*it++)->t_list));
+	jo_vector<node_idx_t> colls;
+	for(; it; it++) {
+		colls.push_back(*it);
+	}
+	// top up the futures in flight
+	bool exhausted = colls.size() == 0;
+	while(!exhausted && in_flight->size() < (size_t)window) {
+		list_ptr_t call = new_list();
+		call->push_back_inplace(f);
+		for(size_t i = 0; i < colls.size() && !exhausted; i++) {
+			node_t *coll = get_node(colls[i]);
+			if(coll->is_list()) {
+				list_ptr_t list_list = coll->as_list();
+				if(list_list->size() == 0) {
+					exhausted = true;
+					break;
+				}
+				call->push_back_inplace(list_list->first_value());
+				colls[i] = new_node_list(list_list->rest());
+			} else if(coll->is_lazy_list()) {
+				lazy_list_iterator_t lit(env, colls[i]);
+				if(lit.done()) {
+					exhausted = true;
+					break;
+				}
+				call->push_back_inplace(lit.val);
+				colls[i] = new_node_lazy_list(lit.next_fn());
+			} else {
+				exhausted = true;
+			}
+		}
+		if(exhausted) {
+			break;
+		}
+		list_ptr_t body = new_list();
+		body->push_back_inplace(new_node_list(call));
+		in_flight->push_back_inplace(new_node_future(env, body));
+	}
+	if(in_flight->size() == 0) {
+		return NIL_NODE;
+	}
+	future_t *first = get_node(in_flight->first_value())->t_future.ptr;
+	future_wait(first);
+	list_ptr_t ret = new_list();
+	ret->push_back_inplace(future_value(first));
+	ret->push_back_inplace(env->get("pmap-next"));
+	ret->push_back_inplace(f);
+	ret->push_back_inplace(window_idx);
+	ret->push_back_inplace(new_node_list(in_flight->rest()));
+	for(size_t i = 0; i < colls.size(); i++) {
+		ret->push_back_inplace(colls[i]);
+	}
+	return new_node_list(ret);
+}
+
+static node_idx_t native_pcalls_invoke(env_ptr_t env, list_ptr_t args) {
+	list_ptr_t call = new_list();
+	call->push_back_inplace(args->first_value());
+	return eval_list(env, call);
+}
+
+// (pcalls & fns)
+// Executes the no-arg fns in parallel, returning a lazy sequence of their values
+static node_idx_t native_pcalls(env_ptr_t env, list_ptr_t args) {
+	list_ptr_t pmap_args = new_list();
+	pmap_args->push_back_inplace(env->get("pcalls-invoke"));
+	pmap_args->push_back_inplace(new_node_list(args));
+	return native_pmap(env, pmap_args);
+}
+
+void jo_lisp_async_init(env_ptr_t env) {
+	env->set("future", new_node_native_function("future", &native_future, true));
+	env->set("future-call", new_node_native_function("future-call", &native_future_call, false));
+	env->set("future?", new_node_native_function("future?", &native_is_future, false));
+	env->set("future-done?", new_node_native_function("future-done?", &native_is_future_done, false));
+	env->set("promise", new_node_native_function("promise", &native_promise, false));
+	env->set("deliver", new_node_native_function("deliver", &native_deliver, false));
+	env->set("deref", new_node_native_function("deref", &native_deref, false));
+	env->set("realized?", new_node_native_function("realized?", &native_is_realized, false));
+	env->set("pmap", new_node_native_function("pmap", &native_pmap, false));
+	env->set("pmap-next", new_node_native_function("pmap-next", &native_pmap_next, true));
+	env->set("pcalls", new_node_native_function("pcalls", &native_pcalls, false));
+	env->set("pcalls-invoke", new_node_native_function("pcalls-invoke", &native_pcalls_invoke, false));
+}
@@ -0,0 +1,488 @@
+#pragma once
+
+#include "jo_stdcpp.h"
+
+// freeze and thaw, a compact binary encoding of data for passing between runs. It reads
+// back several times faster than printed text through the reader.
+//
+// The stream is "JOF" and a version byte, then one value. Each value is a tag byte and
+// its payload: ints as zigzag varints, floats as 8 raw bytes, strings, keywords and
+// symbols as a varint length and bytes, and lists, vectors, maps and sets as a varint
+// count and their elements. Sorted maps and sets put their comparator first, which only
+// has an encoding when it is nil, the default order. A vector-of is its kind, count and
+// unboxed numbers, as doubles, varints or bytes, and a tensor its rank, shape and doubles
+// in row-major order. Strings and collections are numbered in the order they are
+// finished, so a value met again is written as FREEZE_REF and its number, and thaws to
+// the same node. Shared structure stays shared, and is only written once.
+
+#define FREEZE_MAGIC "JOF"
+
+enum {
+	FREEZE_VERSION = 1,
+	// bytes held before the file writer flushes
+	FREEZE_FLUSH_SIZE = 1 << 16,
+};
+
+enum {
+	FREEZE_NIL,
+	FREEZE_TRUE,
+	FREEZE_FALSE,
+	FREEZE_INT,
+	FREEZE_FLOAT,
+	FREEZE_STRING,
+	FREEZE_KEYWORD,
+	FREEZE_SYMBOL,
+	FREEZE_LIST,
+	FREEZE_VECTOR,
+	FREEZE_MAP,
+	FREEZE_SET,
+	FREEZE_REF,
+	FREEZE_SORTED_MAP,
+	FREEZE_SORTED_SET,
+	FREEZE_VECTOR_OF,
+	FREEZE_TENSOR,
+};
+
+// encodes into buf, and if fp is set, streams buf out to it as it fills
+struct freeze_writer_t {
+	env_ptr_t env;
+	FILE *fp;
+	jo_vector<unsigned char> buf;
+	std::unordered_map<int, int> refs;
+	int num_refs;
+
+	freeze_writer_t(env_ptr_t env, FILE *fp) : env(env), fp(fp), buf(), refs(), num_refs() {}
+
+	void flush() {
+		if(fp && buf.size()) {
+			fwrite(buf.data(), 1, buf.size(), fp);
+			buf.clear();
+		}
+	}
+
+	void bytes(const void *data, size_t size) {
+		buf.insert(buf.end(), (const unsigned char *)data, size);
+		if(fp && buf.size() >= FREEZE_FLUSH_SIZE) {
+			flush();
+		}
+	}
+
+	void byte(int b) {
+		unsigned char c = (unsigned char)b;
+		bytes(&c, 1);
+	}
+
+	void varint(unsigned long long v) {
+		unsigned char tmp[10];
+		int n = 0;
+		do {
+			tmp[n] = v & 0x7f;
+			v >>= 7;
+			tmp[n++] |= v ? 0x80 : 0;
+		} while(v);
+		bytes(tmp, n);
+	}
+
+	void zigzag(long long v) {
+		varint(((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+	}
+
+	void str(int tag, const jo_string &s) {
+		byte(tag);
+		varint(s.size());
+		bytes(s.c_str(), s.size());
+	}
+
+	// false for what has no encoding, which becomes nil
+	bool value(node_idx_t idx) {
+		node_t *n = get_node(idx);
+		auto ref = refs.find(idx);
+		if(ref != refs.end()) {
+			byte(FREEZE_REF);
+			varint(ref->second);
+			return true;
+		}
+		bool ok = true;
+		switch(n->type) {
+		case NODE_NIL: byte(FREEZE_NIL); return true;
+		case NODE_BOOL: byte(n->t_bool ? FREEZE_TRUE : FREEZE_FALSE); return true;
+		case NODE_INT:
+			byte(FREEZE_INT);
+			zigzag(n->t_int);
+			return true;
+		case NODE_FLOAT:
+			byte(FREEZE_FLOAT);
+			bytes(&n->t_float, sizeof(n->t_float));
+			return true;
+		case NODE_STRING: str(FREEZE_STRING, n->t_string); break;
+		case NODE_KEYWORD: str(FREEZE_KEYWORD, n->t_string); break;
+		case NODE_SYMBOL: str(FREEZE_SYMBOL, n->t_string); break;
+		case NODE_LIST:
+			byte(FREEZE_LIST);
+			varint(n->t_list->size());
+			for(list_t::iterator it = n->t_list->begin(); it; it++) {
+				ok &= value(*it);
+			}
+			break;
+		case NODE_LAZY_LIST: {
+			// realized into a plain list, counted once it is done
+			jo_vector<node_idx_t> items;
+			for(lazy_list_iterator_t lit(env, idx); !lit.done(); lit.next()) {
+				items.push_back(lit.val);
+			}
+			byte(FREEZE_LIST);
+			varint(items.size());
+			for(size_t i = 0; i < items.size(); i++) {
+				ok &= value(items[i]);
+			}
+			break;
+		}
+		case NODE_VECTOR:
+			byte(FREEZE_VECTOR);
+			varint(n->t_vector->size());
+			for(vector_t::iterator it = n->t_vector->begin(); it; it++) {
+				ok &= value(*it);
+			}
+			break;
+		case NODE_MAP:
+			byte(FREEZE_MAP);
+			varint(n->t_map->size());
+			for(map_t::iterator it = n->t_map->begin(); it; it++) {
+				ok &= value(it->first);
+				ok &= value(it->second);
+			}
+			break;
+		case NODE_SET:
+			byte(FREEZE_SET);
+			varint(n->t_map->size());
+			for(set_t::iterator it = n->t_map->begin(); it; it++) {
+				ok &= value(it->first);
+			}
+			break;
+		case NODE_SORTED_MAP:
+		case NODE_SORTED_SET:
+			byte(n->is_sorted_map() ? FREEZE_SORTED_MAP : FREEZE_SORTED_SET);
+			ok &= value(n->t_comparator);
+			varint(n->t_sorted->size());
+			for(sorted_map_t::iterator it = n->t_sorted->begin(); it; it++) {
+				ok &= value(it->first);
+				if(n->is_sorted_map()) {
+					ok &= value(it->second);
+				}
+			}
+			break;
+		case NODE_VECTOR_OF: {
+			int kind = n->t_vector_of->kind;
+			byte(FREEZE_VECTOR_OF);
+			byte(kind);
+			varint(n->t_vector_of->size());
+			n->t_vector_of->each([&](double x) {
+				switch(kind) {
+				case VECTOR_OF_DOUBLE: bytes(&x, sizeof(x)); break;
+				case VECTOR_OF_INT:    zigzag((int)x); break;
+				case VECTOR_OF_BYTE:   byte((int)x); break;
+				}
+			});
+			break;
+		}
+		case NODE_TENSOR: {
+			const tensor_t *t = n->t_tensor.ptr;
+			byte(FREEZE_TENSOR);
+			byte(t->rank);
+			for(int d = 0; d < t->rank; d++) {
+				varint(t->shape[d]);
+			}
+			t->each([&](const size_t *index, double x) { bytes(&x, sizeof(x)); });
+			break;
+		}
+		default:
+			byte(FREEZE_NIL);
+			return false;
+		}
+		refs[idx] = num_refs++;
+		return ok;
+	}
+
+	bool header_and_value(node_idx_t idx) {
+		bytes(FREEZE_MAGIC, 3);
+		byte(FREEZE_VERSION);
+		return value(idx);
+	}
+};
+
+struct freeze_reader_t {
+	env_ptr_t env;
+	const unsigned char *p, *end;
+	jo_vector<node_idx_t> refs;
+	bool ok;
+
+	freeze_reader_t(env_ptr_t env, const unsigned char *p, const unsigned char *end) : env(env), p(p), end(end), refs(), ok(true) {}
+
+	bool eq(node_idx_t a, node_idx_t b) {
+		return node_eq(env, a, b);
+	}
+
+	unsigned long long varint() {
+		unsigned long long v = 0;
+		for(int shift = 0; shift < 64; shift += 7) {
+			if(p >= end) {
+				ok = false;
+				return 0;
+			}
+			unsigned char c = *p++;
+			v |= (unsigned long long)(c & 0x7f) << shift;
+			if(!(c & 0x80)) {
+				return v;
+			}
+		}
+		ok = false;
+		return 0;
+	}
+
+	// a count of things that each take at least a byte, so a bad one can't run away
+	size_t count() {
+		unsigned long long n = varint();
+		if(n > (unsigned long long)(end - p)) {
+			ok = false;
+			return 0;
+		}
+		return (size_t)n;
+	}
+
+	long long zigzag() {
+		unsigned long long v = varint();
+		return (long long)((v >> 1) ^ (0 - (v & 1)));
+	}
+
+	double f64() {
+		double d = 0;
+		if(end - p < (ptrdiff_t)sizeof(d)) {
+			ok = false;
+			return 0;
+		}
+		memcpy(&d, p, sizeof(d));
+		p += sizeof(d);
+		return d;
+	}
+
+	jo_string str() {
+		size_t n = count();
+		jo_string s((const char *)p, n);
+		p += n;
+		return s;
+	}
+
+	node_idx_t ref(node_idx_t idx) {
+		refs.push_back(idx);
+		return idx;
+	}
+
+	node_idx_t value() {
+		if(p >= end) {
+			ok = false;
+			return NIL_NODE;
+		}
+		int tag = *p++;
+		switch(tag) {
+		case FREEZE_NIL: return NIL_NODE;
+		case FREEZE_TRUE: return TRUE_NODE;
+		case FREEZE_FALSE: return FALSE_NODE;
+		case FREEZE_INT: return new_node_int((int)zigzag());
+		case FREEZE_FLOAT: {
+			double d = f64();
+			return ok ? new_node_float(d) : NIL_NODE;
+		}
+		case FREEZE_STRING: return ref(new_node_string(str()));
+		case FREEZE_KEYWORD: return ref(new_node_keyword(str()));
+		case FREEZE_SYMBOL: return ref(new_node_symbol(str()));
+		case FREEZE_LIST: {
+			list_ptr_t list = new_list();
+			for(size_t i = 0, n = count(); i < n && ok; i++) {
+				list->push_back_inplace(value());
+			}
+			return ref(new_node_list(list));
+		}
+		case FREEZE_VECTOR: {
+			vector_ptr_t vec = new_vector();
+			for(size_t i = 0, n = count(); i < n && ok; i++) {
+				vec->push_back_inplace(value());
+			}
+			return ref(new_node_vector(vec));
+		}
+		case FREEZE_MAP: {
+			map_ptr_t map = new_map();
+			for(size_t i = 0, n = count(); i < n && ok; i++) {
+				node_idx_t k = value();
+				node_idx_t v = value();
+				map->assoc_inplace(k, v, [this](node_idx_t a, node_idx_t b) { return eq(a, b); });
+			}
+			return ref(new_node_map(map));
+		}
+		case FREEZE_SET: {
+			set_ptr_t set = new_set();
+			for(size_t i = 0, n = count(); i < n && ok; i++) {
+				node_idx_t k = value();
+				set->assoc_inplace(k, k, [this](node_idx_t a, node_idx_t b) { return eq(a, b); });
+			}
+			return ref(new_node_set(set));
+		}
+		case FREEZE_SORTED_MAP:
+		case FREEZE_SORTED_SET: {
+			bool is_map = tag == FREEZE_SORTED_MAP;
+			node_idx_t comparator = value();
+			sorted_lt_t lt(env, comparator);
+			sorted_map_ptr_t sorted = new_sorted_map();
+			for(size_t i = 0, n = count(); i < n && ok; i++) {
+				node_idx_t k = value();
+				node_idx_t v = is_map ? value() : k;
+				sorted->assoc_inplace(k, v, lt);
+			}
+			return ref(new_node_sorted(is_map ? NODE_SORTED_MAP : NODE_SORTED_SET, sorted, comparator));
+		}
+		case FREEZE_VECTOR_OF: {
+			int kind = p < end ? *p++ : -1;
+			if(kind != VECTOR_OF_DOUBLE && kind != VECTOR_OF_INT && kind != VECTOR_OF_BYTE) {
+				ok = false;
+				return NIL_NODE;
+			}
+			vector_of_ptr_t nums = new vector_of_t(kind);
+			for(size_t i = 0, n = count(); i < n && ok; i++) {
+				switch(kind) {
+				case VECTOR_OF_DOUBLE: nums->push_back_inplace(f64()); break;
+				case VECTOR_OF_INT:    nums->push_back_inplace((double)zigzag()); break;
+				case VECTOR_OF_BYTE:   nums->push_back_inplace(p < end ? *p++ : (ok = false)); break;
+				}
+			}
+			return ref(new_node_vector_of(nums));
+		}
+		case FREEZE_TENSOR: {
+			int rank = p < end ? *p++ : -1;
+			if(rank < 0 || rank > TENSOR_MAX_RANK) {
+				ok = false;
+				return NIL_NODE;
+			}
+			size_t shape[TENSOR_MAX_RANK], total = 1;
+			for(int d = 0; d < rank; d++) {
+				shape[d] = count();
+				total *= shape[d];
+			}
+			// each element is 8 bytes, so a bad shape can't run away either
+			if(!ok || total > (size_t)(end - p) / sizeof(double)) {
+				ok = false;
+				return NIL_NODE;
+			}
+			tensor_t *t = new tensor_t(rank, shape);
+			double *data = t->ptr();
+			for(size_t i = 0; i < total; i++) {
+				data[i] = f64();
+			}
+			return ref(new_node_tensor(t));
+		}
+		case FREEZE_REF: {
+			unsigned long long i = varint();
+			if(i >= refs.size()) {
+				ok = false;
+				return NIL_NODE;
+			}
+			return refs[(size_t)i];
+		}
+		}
+		ok = false;
+		return NIL_NODE;
+	}
+
+	node_idx_t header_and_value() {
+		if(end - p < 4 || memcmp(p, FREEZE_MAGIC, 3) || p[3] != FREEZE_VERSION) {
+			ok = false;
+			return NIL_NODE;
+		}
+		p += 4;
+		return value();
+	}
+};
+
+// (freeze x)
+// Encodes x as a vector of bytes, which thaw turns back into x. x may be
+// made of nil, booleans, numbers, strings, keywords, symbols, lists,
+// vectors, maps and sets, sorted or not, vector-ofs and tensors. Anything
+// else, such as a function, is frozen as nil.
+static node_idx_t native_freeze(env_ptr_t env, list_ptr_t args) {
+	freeze_writer_t w(env, NULL);
+	if(!w.header_and_value(args->first_value())) {
+		warnf("freeze: some values have no encoding, frozen as nil\n");
+	}
+	vector_of_ptr_t bytes = new vector_of_t(VECTOR_OF_BYTE);
+	for(size_t i = 0; i < w.buf.size(); i++) {
+		bytes->push_back_inplace(w.buf[i]);
+	}
+	return new_node_vector_of(bytes);
+}
+
+static node_idx_t freeze_thaw_bytes(env_ptr_t env, const unsigned char *p, const unsigned char *end, const char *name) {
+	freeze_reader_t r(env, p, end);
+	node_idx_t ret = r.header_and_value();
+	if(!r.ok) {
+		warnf("%s: not frozen data, or corrupt\n", name);
+		return NIL_NODE;
+	}
+	return ret;
+}
+
+// (thaw bytes)
+// Decodes bytes, as made by freeze, back into the value that was frozen.
+static node_idx_t native_thaw(env_ptr_t env, list_ptr_t args) {
+	node_t *n = get_node(args->first_value());
+	jo_vector<unsigned char> buf;
+	if(n->is_vector_of()) {
+		n->t_vector_of->each([&](double x) { buf.push_back((unsigned char)(int)x); });
+	} else if(n->is_vector() || n->is_list()) {
+		for(seq_iterator_t it(env, args->first_value()); it; it.next()) {
+			buf.push_back((unsigned char)get_node(it.val)->as_int());
+		}
+	} else {
+		warnf("thaw: expected a vector of bytes\n");
+		return NIL_NODE;
+	}
+	return freeze_thaw_bytes(env, buf.data(), buf.data() + buf.size(), "thaw");
+}
+
+// (freeze-to-file path x)
+// Freezes x straight into the file at path, without holding all of it in
+// memory first. Returns true on success.
+static node_idx_t native_freeze_to_file(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	jo_string path = get_node(*it++)->as_string();
+	FILE *fp = fopen(path.c_str(), "wb");
+	if(!fp) {
+		warnf("freeze-to-file: can't write %s\n", path.c_str());
+		return FALSE_NODE;
+	}
+	freeze_writer_t w(env, fp);
+	if(!w.header_and_value(*it)) {
+		warnf("freeze-to-file: some values have no encoding, frozen as nil\n");
+	}
+	w.flush();
+	bool ok = !ferror(fp);
+	fclose(fp);
+	return new_node_bool(ok);
+}
+
+// (thaw-from-file path)
+// Thaws the value frozen into the file at path by freeze-to-file.
+static node_idx_t native_thaw_from_file(env_ptr_t env, list_ptr_t args) {
+	jo_string path = get_node(args->first_value())->as_string();
+	jo_mmap_file file;
+	if(!file.open(path.c_str())) {
+		warnf("thaw-from-file: can't read %s\n", path.c_str());
+		return NIL_NODE;
+	}
+	const unsigned char *p = (const unsigned char *)file.data;
+	return freeze_thaw_bytes(env, p, p + file.size, "thaw-from-file");
+}
+
+void jo_lisp_freeze_init(env_ptr_t env) {
+	env->set("freeze", new_node_native_function("freeze", &native_freeze, false));
+	env->set("thaw", new_node_native_function("thaw", &native_thaw, false));
+	env->set("freeze-to-file", new_node_native_function("freeze-to-file", &native_freeze_to_file, false));
+	env->set("thaw-from-file", new_node_native_function("thaw-from-file", &native_thaw_from_file, false));
+}
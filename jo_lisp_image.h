@@ -0,0 +1,582 @@
+#pragma once
+
+#include "jo_stdcpp.h"
+
+// Heap images. jo --snapshot out.img script.clj runs the script, then writes the global env
+// and every node and env reachable from it to out.img. jo --image out.img script.clj reads
+// the image back in place of the builtins and their init, so everything the first run
+// defined is there from the start. The image also keeps the builtins as they were before
+// the first run, as sources are parsed against those alone, so a later script can shadow or
+// redefine what the image defines just as if it had been part of the first script.
+//
+// Loading is a decoder, not a mapping: nodes hold refcounted strings and persistent
+// collections, so each is rebuilt from the file, and a map or set rehashes its keys. It
+// costs time in proportion to what was defined, and saves only what evaluating the source
+// again would cost beyond that, which for plain defns is little.
+//
+// Garbage is left out, and the nodes that are kept are numbered densely, in the order they
+// are reached, starting with the hard coded ones, which keep their indices. The only
+// pointers are native functions, stored as offsets from native_quote, which makes an image
+// good for the binary that wrote it wherever it is loaded. Images from other builds are
+// refused. Persistent collections are written out element by element, losing whatever
+// structure they shared, futures that hadn't finished come back done with nil, and readers
+// and writers on files come back closed.
+
+#define IMAGE_MAGIC "JOIMAGE1"
+#define IMAGE_BUILD __DATE__ " " __TIME__
+
+// which of a node's fields follow it in the image, the rest being empty
+enum {
+	IMAGE_HAS_HASH      = 1<<0,
+	IMAGE_HAS_SCALAR    = 1<<1,
+	IMAGE_HAS_STRING    = 1<<2,
+	IMAGE_HAS_LIST      = 1<<3,
+	IMAGE_HAS_VECTOR    = 1<<4,
+	IMAGE_HAS_MAP       = 1<<5,
+	IMAGE_HAS_SORTED    = 1<<6,
+	IMAGE_HAS_VECTOR_OF = 1<<7,
+	IMAGE_HAS_TENSOR    = 1<<8,
+	IMAGE_HAS_ARGS      = 1<<9,
+	IMAGE_HAS_BODY      = 1<<10,
+	IMAGE_HAS_ENV       = 1<<11,
+	IMAGE_HAS_FUTURE    = 1<<12,
+	IMAGE_HAS_STDIN     = 1<<13,
+};
+
+struct image_writer_t {
+	FILE *fp;
+	// a node's index in the image, by its index now
+	const jo_vector<int> *ids;
+
+	void bytes(const void *data, size_t size) { fwrite(data, 1, size, fp); }
+	void i32(int v) { bytes(&v, sizeof(v)); }
+	void u64(unsigned long long v) { bytes(&v, sizeof(v)); }
+	void f64(double v) { bytes(&v, sizeof(v)); }
+	void idx(int v) { i32(v >= 0 ? (*ids)[v] : v); }
+	void str(const jo_string &s) {
+		size_t len = s.size();
+		i32((int)len);
+		bytes(s.c_str(), len);
+	}
+	// -1 for no list at all, as opposed to an empty one
+	void list(const list_ptr_t &l) {
+		if(!l.ptr) {
+			i32(-1);
+			return;
+		}
+		i32((int)l->size());
+		for(list_t::iterator it = l->begin(); it; it++) {
+			idx(*it);
+		}
+	}
+};
+
+struct image_reader_t {
+	const char *p, *end;
+	bool ok;
+
+	void bytes(void *data, size_t size) {
+		if((size_t)(end - p) < size) {
+			ok = false;
+			memset(data, 0, size);
+			return;
+		}
+		memcpy(data, p, size);
+		p += size;
+	}
+	int i32() { int v; bytes(&v, sizeof(v)); return v; }
+	unsigned long long u64() { unsigned long long v; bytes(&v, sizeof(v)); return v; }
+	double f64() { double v; bytes(&v, sizeof(v)); return v; }
+	jo_string str() {
+		int len = i32();
+		if(len < 0 || end - p < len) {
+			ok = false;
+			return jo_string();
+		}
+		jo_string s(p, (size_t)len);
+		p += len;
+		return s;
+	}
+	list_ptr_t list() {
+		int n = i32();
+		if(n < 0) {
+			return list_ptr_t();
+		}
+		list_ptr_t l = new_list();
+		for(int i = 0; i < n && ok; i++) {
+			l->push_back_inplace(i32());
+		}
+		return l;
+	}
+};
+
+static intptr_t image_native_offset(native_function_t f) {
+	return (intptr_t)f - (intptr_t)&native_quote;
+}
+
+// the node the scalar union refers to, for the types where it is one
+static node_idx_t *image_scalar_ref(node_t *n) {
+	switch(n->type) {
+	case NODE_VAR:        return &n->t_var;
+	case NODE_DELAY:      return &n->t_delay;
+	case NODE_LAZY_LIST:  return &n->t_lazy_fn;
+	case NODE_SORTED_SET:
+	case NODE_SORTED_MAP: return &n->t_comparator;
+	}
+	return NULL;
+}
+
+// What an image holds: the nodes and envs reachable from the global env, each given its
+// index in the image as it is first reached. An env's parents come before it, so a loader
+// can link each to one it already made.
+struct image_graph_t {
+	jo_vector<int> ids; // by node index, -1 if unreached
+	jo_vector<node_idx_t> nodes;
+	jo_vector<env_t *> envs;
+	std::unordered_map<env_t *, int> env_ids;
+	jo_vector<node_idx_t> todo;
+	int open_io;
+
+	image_graph_t(int count) : ids(), nodes(), envs(), env_ids(), todo(), open_io() {
+		ids.resize(count);
+		for(int i = 0; i < count; i++) {
+			ids[i] = -1;
+		}
+	}
+
+	void node(node_idx_t idx) {
+		if(idx < 0 || idx >= (int)ids.size() || ids[idx] >= 0) {
+			return;
+		}
+		ids[idx] = (int)nodes.size();
+		nodes.push_back(idx);
+		todo.push_back(idx);
+	}
+
+	void list(const list_ptr_t &l) {
+		if(l.ptr) {
+			for(list_t::iterator it = l->begin(); it; it++) {
+				node(*it);
+			}
+		}
+	}
+
+	int env(env_t *e) {
+		if(!e) {
+			return -1;
+		}
+		auto it = env_ids.find(e);
+		if(it != env_ids.end()) {
+			return it->second;
+		}
+		env(e->parent.ptr);
+		int id = (int)envs.size();
+		envs.push_back(e);
+		env_ids[e] = id;
+		jo_shared_lock_guard guard(e->lock);
+		for(auto v = e->vars_map.begin(); v != e->vars_map.end(); ++v) {
+			node(v->second.var);
+			node(v->second.value);
+		}
+		list(e->vars);
+		return id;
+	}
+
+	void walk() {
+		while(todo.size()) {
+			node_t *n = get_node(todo.back());
+			todo.pop_back();
+			list(n->t_list);
+			if(n->t_vector.ptr) {
+				for(vector_t::iterator it = n->t_vector->begin(); it; it++) {
+					node(*it);
+				}
+			}
+			if(n->t_map.ptr) {
+				for(map_t::iterator it = n->t_map->begin(); it; it++) {
+					node(it->first);
+					node(it->second);
+				}
+			}
+			if(n->is_sorted() && n->t_sorted.ptr) {
+				for(sorted_map_t::iterator it = n->t_sorted->begin(); it; it++) {
+					node(it->first);
+					node(it->second);
+				}
+			}
+			if(node_idx_t *ref = image_scalar_ref(n)) {
+				node(*ref);
+			}
+			list(n->t_func.args);
+			list(n->t_func.body);
+			env(n->t_func.env.ptr);
+			if(n->is_future() && n->t_future.ptr && jo_atomic_load(&n->t_future->done)) {
+				node(n->t_future->value);
+			}
+			if(n->is_io() && n->t_io.ptr && n->t_io->fp && n->t_io->fp != stdin) {
+				open_io++;
+			}
+		}
+	}
+};
+
+// builtins is what sources are parsed against, and is saved alongside env for the same use
+static bool image_save(const char *path, env_ptr_t env, env_ptr_t builtins) {
+	FILE *fp = fopen(path, "wb");
+	if(!fp) {
+		fprintf(stderr, "snapshot: can't write %s\n", path);
+		return false;
+	}
+
+	// the hard coded nodes first, so they keep their indices
+	image_graph_t g(jo_atomic_load(&num_nodes));
+	for(int i = NIL_NODE; i <= K_LET_NODE; i++) {
+		g.node(i);
+	}
+	g.env(env.ptr);
+	int builtins_id = g.env(builtins.ptr);
+	g.walk();
+	if(g.open_io) {
+		fprintf(stderr, "snapshot: %d open reader(s) or writer(s) will be closed in %s\n", g.open_io, path);
+	}
+	image_writer_t w = {fp, &g.ids};
+	int count = (int)g.nodes.size();
+	jo_vector<env_t *> &envs = g.envs;
+	std::unordered_map<env_t *, int> &env_ids = g.env_ids;
+
+	char build[32] = {};
+	strncpy(build, IMAGE_BUILD, sizeof(build) - 1);
+	w.bytes(IMAGE_MAGIC, 8);
+	w.bytes(build, sizeof(build));
+	w.i32((int)sizeof(node_t));
+	w.i32(count);
+	w.i32((int)envs.size());
+	w.i32(builtins_id);
+
+	for(size_t i = 0; i < envs.size(); i++) {
+		env_t *e = envs[i];
+		jo_shared_lock_guard guard(e->lock);
+		w.i32(e->parent.ptr ? env_ids[e->parent.ptr] : -1);
+		w.i32((int)e->vars_map.size());
+		for(auto it = e->vars_map.begin(); it != e->vars_map.end(); ++it) {
+			w.str(it->first.c_str());
+			w.idx(it->second.var);
+			w.idx(it->second.value);
+		}
+		w.list(e->vars);
+	}
+
+	for(int i = 0; i < count; i++) {
+		node_t *n = get_node(g.nodes[i]);
+		// the union, as raw bits, except for the pointer and the node it can hold
+		unsigned long long raw = 0;
+		if(n->type == NODE_NATIVE_FUNCTION) {
+			raw = (unsigned long long)image_native_offset(n->t_native_function);
+		} else {
+			memcpy(&raw, &n->t_float, sizeof(n->t_float));
+			if(node_idx_t *ref = image_scalar_ref(n)) {
+				node_idx_t id = *ref >= 0 ? node_idx_t(g.ids[*ref]) : *ref;
+				raw = 0;
+				memcpy(&raw, &id, sizeof(id));
+			}
+		}
+		bool done = n->is_future() && n->t_future.ptr && jo_atomic_load(&n->t_future->done);
+
+		int has = 0;
+		has |= n->t_hash ? IMAGE_HAS_HASH : 0;
+		has |= raw ? IMAGE_HAS_SCALAR : 0;
+		has |= n->t_string.size() ? IMAGE_HAS_STRING : 0;
+		has |= n->t_list.ptr ? IMAGE_HAS_LIST : 0;
+		has |= n->t_vector.ptr ? IMAGE_HAS_VECTOR : 0;
+		has |= n->t_map.ptr ? IMAGE_HAS_MAP : 0;
+		has |= n->is_sorted() && n->t_sorted.ptr ? IMAGE_HAS_SORTED : 0;
+		has |= n->is_vector_of() && n->t_vector_of.ptr ? IMAGE_HAS_VECTOR_OF : 0;
+		has |= n->is_tensor() && n->t_tensor.ptr ? IMAGE_HAS_TENSOR : 0;
+		has |= n->t_func.args.ptr ? IMAGE_HAS_ARGS : 0;
+		has |= n->t_func.body.ptr ? IMAGE_HAS_BODY : 0;
+		has |= n->t_func.env.ptr ? IMAGE_HAS_ENV : 0;
+		has |= n->is_future() && n->t_future.ptr ? IMAGE_HAS_FUTURE : 0;
+		// stdin, which can be opened again, unlike a file
+		has |= n->is_io() && n->t_io.ptr && n->t_io->fp == stdin ? IMAGE_HAS_STDIN : 0;
+
+		w.i32(n->type);
+		w.i32(n->flags);
+		w.i32(has);
+		if(has & IMAGE_HAS_HASH) {
+			w.u64(n->t_hash);
+		}
+		if(has & IMAGE_HAS_SCALAR) {
+			w.u64(raw);
+		}
+		if(has & IMAGE_HAS_STRING) {
+			w.str(n->t_string);
+		}
+		if(has & IMAGE_HAS_LIST) {
+			w.list(n->t_list);
+		}
+		if(has & IMAGE_HAS_VECTOR) {
+			w.i32((int)n->t_vector->size());
+			for(vector_t::iterator it = n->t_vector->begin(); it; it++) {
+				w.idx(*it);
+			}
+		}
+		if(has & IMAGE_HAS_MAP) {
+			w.i32((int)n->t_map->size());
+			for(map_t::iterator it = n->t_map->begin(); it; it++) {
+				w.idx(it->first);
+				w.idx(it->second);
+			}
+		}
+		// in order, so the loader needs no comparator
+		if(has & IMAGE_HAS_SORTED) {
+			w.i32((int)n->t_sorted->size());
+			for(sorted_map_t::iterator it = n->t_sorted->begin(); it; it++) {
+				w.idx(it->first);
+				w.idx(it->second);
+			}
+		}
+		if(has & IMAGE_HAS_VECTOR_OF) {
+			w.i32(n->t_vector_of->kind);
+			w.i32((int)n->t_vector_of->size());
+			n->t_vector_of->each([&](double x) { w.f64(x); });
+		}
+		if(has & IMAGE_HAS_TENSOR) {
+			const tensor_t *t = n->t_tensor.ptr;
+			w.i32(t->rank);
+			for(int d = 0; d < t->rank; d++) {
+				w.u64(t->shape[d]);
+			}
+			t->each([&](const size_t *index, double x) { w.f64(x); });
+		}
+		if(has & IMAGE_HAS_ARGS) {
+			w.list(n->t_func.args);
+		}
+		if(has & IMAGE_HAS_BODY) {
+			w.list(n->t_func.body);
+		}
+		if(has & IMAGE_HAS_ENV) {
+			w.i32(env_ids[n->t_func.env.ptr]);
+		}
+		if(has & IMAGE_HAS_FUTURE) {
+			w.idx(done ? (int)n->t_future->value : NIL_NODE);
+			w.i32(n->t_future->is_future);
+		}
+	}
+
+	bool ok = !ferror(fp);
+	fclose(fp);
+	if(!ok) {
+		fprintf(stderr, "snapshot: error writing %s\n", path);
+	}
+	return ok;
+}
+
+// a map or set waiting for its entries, keyed in image_load by node index * 2 + sorted
+struct image_pending_t {
+	int idx;
+	bool sorted;
+	bool built;
+	jo_vector<node_idx_t> pairs;
+
+	image_pending_t() : idx(), sorted(), built(), pairs() {}
+};
+
+static void image_build_map(std::unordered_map<int, image_pending_t *> &pending, image_pending_t *p) {
+	if(p->built) {
+		return;
+	}
+	p->built = true;
+	node_t *n = get_node(p->idx);
+	if(p->sorted) {
+		// already in order, so a key's position is its rank
+		std::unordered_map<int, size_t> rank;
+		for(size_t k = 0; k < p->pairs.size(); k += 2) {
+			rank[p->pairs[k]] = k;
+		}
+		auto lt = [&rank](node_idx_t a, node_idx_t b) { return rank[a] < rank[b]; };
+		n->t_sorted = new_sorted_map();
+		for(size_t k = 0; k < p->pairs.size(); k += 2) {
+			n->t_sorted->assoc_inplace(p->pairs[k], p->pairs[k+1], lt);
+		}
+		return;
+	}
+	// a key that is itself a map may need its entries to be hashed
+	for(size_t k = 0; k < p->pairs.size(); k += 2) {
+		auto key = pending.find(p->pairs[k] * 2);
+		if(key != pending.end() && !get_node(p->pairs[k])->t_hash) {
+			image_build_map(pending, key->second);
+		}
+	}
+	// keys were distinct when written, so identity is equality here
+	n->t_map = new_map();
+	for(size_t k = 0; k < p->pairs.size(); k += 2) {
+		n->t_map->assoc_inplace(p->pairs[k], p->pairs[k+1], [](node_idx_t a, node_idx_t b) { return a == b; });
+	}
+}
+
+// Replaces the node table with the image's and returns its global env, or NULL, with the
+// builtins env that was saved with it in builtins. Must run before any node is allocated.
+static env_ptr_t image_load(const char *path, env_ptr_t &builtins) {
+	jo_mmap_file file;
+	if(!file.open(path)) {
+		fprintf(stderr, "image: can't read %s\n", path);
+		return env_ptr_t();
+	}
+	image_reader_t r = {file.data, file.data + file.size, true};
+	char magic[8], build[32] = {}, expect[32] = {};
+	strncpy(expect, IMAGE_BUILD, sizeof(expect) - 1);
+	r.bytes(magic, sizeof(magic));
+	r.bytes(build, sizeof(build));
+	int node_size = r.i32();
+	if(!r.ok || memcmp(magic, IMAGE_MAGIC, 8) || memcmp(build, expect, sizeof(build)) || node_size != (int)sizeof(node_t)) {
+		fprintf(stderr, "image: %s was not written by this build of jo\n", path);
+		return env_ptr_t();
+	}
+	int count = r.i32();
+	int num_envs = r.i32();
+	int builtins_id = r.i32();
+	if(!r.ok || count < 0 || num_envs < 1 || builtins_id < 0 || builtins_id >= num_envs || count > NODE_MAX_PAGES * NODE_PAGE_SIZE - NODE_BLOCK_SIZE) {
+		fprintf(stderr, "image: %s is corrupt\n", path);
+		return env_ptr_t();
+	}
+
+	// take over the indices, and leave the next allocation to start a fresh block
+	int reserved = (count + NODE_BLOCK_SIZE - 1) / NODE_BLOCK_SIZE * NODE_BLOCK_SIZE;
+	for(int page = 0; page <= (reserved - 1) >> NODE_PAGE_SHIFT && reserved; page++) {
+		if(!node_pages[page]) {
+			node_pages[page] = new node_t[NODE_PAGE_SIZE];
+		}
+	}
+	jo_atomic_store(&num_nodes, reserved);
+	tl_node_next = tl_node_end = 0;
+
+	jo_vector<env_ptr_t> envs;
+	for(int i = 0; i < num_envs && r.ok; i++) {
+		int parent = r.i32();
+		env_ptr_t e = new_env(parent >= 0 && parent < i ? envs[parent] : env_ptr_t());
+		int vars = r.i32();
+		for(int v = 0; v < vars && r.ok; v++) {
+			jo_string name = r.str();
+			int var = r.i32();
+			int value = r.i32();
+			e->vars_map[name.c_str()] = env_t::fast_val_t(var, value);
+		}
+		e->vars = r.list();
+		if(!e->vars.ptr) {
+			e->vars = new_list();
+		}
+		envs.push_back(e);
+	}
+
+	// maps hash their keys, so they are filled in once every node is there
+	std::unordered_map<int, image_pending_t *> pending;
+
+	for(int i = 0; i < count && r.ok; i++) {
+		node_t *n = get_node(i);
+		*n = node_t(r.i32());
+		n->flags = r.i32();
+		int has = r.i32();
+		if(has & IMAGE_HAS_HASH) {
+			n->t_hash = (size_t)r.u64();
+		}
+		if(has & IMAGE_HAS_SCALAR) {
+			unsigned long long raw = r.u64();
+			if(n->type == NODE_NATIVE_FUNCTION) {
+				n->t_native_function = (native_function_t)((intptr_t)&native_quote + (intptr_t)raw);
+			} else {
+				memcpy(&n->t_float, &raw, sizeof(n->t_float));
+			}
+		}
+		if(has & IMAGE_HAS_STRING) {
+			n->t_string = r.str();
+		}
+		if(has & IMAGE_HAS_LIST) {
+			n->t_list = r.list();
+		}
+		if(has & IMAGE_HAS_VECTOR) {
+			int size = r.i32();
+			n->t_vector = new_vector();
+			for(int k = 0; k < size && r.ok; k++) {
+				n->t_vector->push_back_inplace(r.i32());
+			}
+		}
+		for(int sorted = 0; sorted < 2; sorted++) {
+			if(!(has & (sorted ? IMAGE_HAS_SORTED : IMAGE_HAS_MAP))) {
+				continue;
+			}
+			int size = r.i32();
+			image_pending_t *p = new image_pending_t;
+			p->idx = i;
+			p->sorted = sorted;
+			for(int k = 0; k < size * 2 && r.ok; k++) {
+				p->pairs.push_back(r.i32());
+			}
+			pending[i * 2 + sorted] = p;
+		}
+		if(has & IMAGE_HAS_VECTOR_OF) {
+			int kind = r.i32();
+			int size = r.i32();
+			n->t_vector_of = new vector_of_t(kind);
+			for(int k = 0; k < size && r.ok; k++) {
+				n->t_vector_of->push_back_inplace(r.f64());
+			}
+		}
+		if(has & IMAGE_HAS_TENSOR) {
+			int rank = r.i32();
+			if(rank < 0 || rank > TENSOR_MAX_RANK) {
+				r.ok = false;
+				break;
+			}
+			size_t shape[TENSOR_MAX_RANK];
+			for(int d = 0; d < rank; d++) {
+				shape[d] = (size_t)r.u64();
+			}
+			tensor_t *t = new tensor_t(rank, shape);
+			double *data = t->ptr();
+			for(size_t k = 0, total = t->size(); k < total && r.ok; k++) {
+				data[k] = r.f64();
+			}
+			n->t_tensor = t;
+		}
+		if(has & IMAGE_HAS_ARGS) {
+			n->t_func.args = r.list();
+		}
+		if(has & IMAGE_HAS_BODY) {
+			n->t_func.body = r.list();
+		}
+		if(has & IMAGE_HAS_ENV) {
+			int env_id = r.i32();
+			if(env_id < 0 || env_id >= (int)envs.size()) {
+				r.ok = false;
+				break;
+			}
+			n->t_func.env = envs[env_id];
+		}
+		if(has & IMAGE_HAS_FUTURE) {
+			n->t_future = new future_t();
+			n->t_future->value = r.i32();
+			n->t_future->is_future = r.i32() != 0;
+			n->t_future->done = 1;
+		}
+		if(has & IMAGE_HAS_STDIN) {
+			n->t_io = io_stdin();
+		}
+	}
+
+	for(auto it = pending.begin(); it != pending.end(); ++it) {
+		image_build_map(pending, it->second);
+	}
+	for(auto it = pending.begin(); it != pending.end(); ++it) {
+		delete it->second;
+	}
+
+	if(!r.ok) {
+		// give the node table back, as it was before
+		fprintf(stderr, "image: %s is corrupt\n", path);
+		jo_atomic_store(&num_nodes, 0);
+		tl_node_next = tl_node_end = 0;
+		return env_ptr_t();
+	}
+	builtins = envs[builtins_id];
+	return envs[0];
+}
@@ -0,0 +1,513 @@
+#pragma once
+
+#include "jo_stdcpp.h"
+
+// Readers and writers over files and stdin, read and written a chunk at a time.
+//
+// line-seq walks a reader lazily, holding a chunk of the file and not the lines already
+// passed. Each line it hands out is still a node, which stays in memory, but count and
+// reduce over a line-seq read the lines without making its steps.
+//
+// Each step of a line-seq knows the offset of its line, so walking the seq again reads
+// the same lines. A file seeks back to them. Stdin can't, so only its current chunk can
+// be walked again.
+//
+// A writer holds what is written until there is a chunk of it, then writes that out. What
+// is written is text, by one rule for spit, write and write-line alike:
+// - a string, number, keyword and so on is written as str would, strings as they are and
+//   numbers always as numbers
+// - a list, vector, lazy seq or other sequential collection is written an element at a
+//   time, each by the rule above, with nothing between them. A lazy seq streams out
+//   without all being realized.
+// - a collection inside that, and a map or set anywhere, is written in its readable form,
+//   as in [1 "a" (2 3)], {:a 1, :b 2} and #{1 2}.
+
+enum {
+	IO_CHUNK_SIZE = 1 << 16,
+};
+
+static io_ptr_t io_stdin() {
+	static io_ptr_t io = new io_t(stdin, false);
+	return io;
+}
+
+static node_idx_t new_node_io(io_ptr_t io) {
+	node_idx_t idx = new_node(NODE_IO);
+	node_t *n = get_node(idx);
+	n->t_io = io;
+	n->flags |= NODE_FLAG_LITERAL;
+	return idx;
+}
+
+static int io_seek(FILE *fp, long long pos) {
+#ifdef _MSC_VER
+	return _fseeki64(fp, pos, SEEK_SET);
+#else
+	return fseeko(fp, (off_t)pos, SEEK_SET);
+#endif
+}
+
+// Finds the line starting at byte offset pos, reading on as needed, and points line at it
+// in io->buf, without its line ending. next is the offset of the line after it. False past
+// the last line, or if pos can't be gone back to. The caller holds io->mutex, and line is
+// only good until io is read again.
+static bool io_find_line(io_t *io, long long pos, const char *&line, size_t &len, long long &next) {
+	if(pos < io->buf_pos || pos > io->buf_pos + (long long)io->buf.size()) {
+		if(!io->fp || io->fp == stdin || io_seek(io->fp, pos)) {
+			return false;
+		}
+		io->buf.resize(0);
+		io->buf_pos = pos;
+		io->eof = false;
+	}
+	size_t start = (size_t)(pos - io->buf_pos);
+	for(;;) {
+		const char *b = io->buf.data();
+		const char *end = b + io->buf.size();
+		const char *nl = jo_simd_find_first_of(b + start, end, "\n", 1);
+		if(nl == end && !io->eof && io->fp) {
+			// drop what's behind pos, then read another chunk on to the rest
+			size_t keep = io->buf.size() - start;
+			if(keep && start) {
+				memmove(io->buf.data(), b + start, keep);
+			}
+			io->buf_pos = pos;
+			start = 0;
+			if(io->fp == stdin) {
+				// a prompt printed before reading has to be seen first
+				out_flush();
+			}
+			io->buf.resize(keep + IO_CHUNK_SIZE);
+			size_t n = fread(io->buf.data() + keep, 1, IO_CHUNK_SIZE, io->fp);
+			if(n < IO_CHUNK_SIZE) {
+				io->eof = true;
+			}
+			io->buf.resize(keep + n);
+			continue;
+		}
+		if(nl == end && b + start == end) {
+			return false;
+		}
+		next = io->buf_pos + (nl - b) + (nl < end);
+		if(nl > b + start && nl[-1] == '\r') {
+			nl--;
+		}
+		line = b + start;
+		len = nl - line;
+		return true;
+	}
+}
+
+// the line starting at byte offset pos, as io_find_line finds it
+static bool io_read_line_at(io_t *io, long long pos, jo_string &line, long long &next) {
+	jo_lock_guard guard(io->mutex);
+	const char *s;
+	size_t len;
+	if(!io_find_line(io, pos, s, len, next)) {
+		return false;
+	}
+	line = jo_string(s, len);
+	return true;
+}
+
+// the next line for read-line, or nil at the end
+static node_idx_t io_read_line(io_t *io) {
+	jo_string line;
+	long long next;
+	if(!io_read_line_at(io, io->pos, line, next)) {
+		return NIL_NODE;
+	}
+	io->pos = next;
+	return new_node_string(std::move(line));
+}
+
+// (reader)(reader f)
+// Opens the file f for reading, or stdin when no file is given. Read
+// with line-seq or read-line.
+static node_idx_t native_reader(env_ptr_t env, list_ptr_t args) {
+	if(!args->size()) {
+		return new_node_io(io_stdin());
+	}
+	jo_string path = get_node(args->first_value())->as_string();
+	FILE *fp = fopen(path.c_str(), "rb");
+	if(!fp) {
+		warnf("reader: can't read %s\n", path.c_str());
+		return NIL_NODE;
+	}
+	return new_node_io(new io_t(fp, true));
+}
+
+// (line-seq rdr)
+// Returns the lines of text from rdr as a lazy sequence of strings.
+// rdr is read as the sequence is, so only what is being looked at is in memory.
+static node_idx_t native_line_seq(env_ptr_t env, list_ptr_t args) {
+	node_idx_t rdr = args->first_value();
+	node_t *n = get_node(rdr);
+	if(!n->is_io() || !n->t_io.ptr) {
+		warnf("line-seq: expected a reader\n");
+		return NIL_NODE;
+	}
+	// the offset goes in a float, which holds it exactly past 2GB where an int wouldn't
+	node_idx_t lazy_func_idx = new_node(NODE_LIST);
+	get_node(lazy_func_idx)->t_list = new_list();
+	get_node(lazy_func_idx)->t_list->push_back_inplace(env->get("line-seq-next"));
+	get_node(lazy_func_idx)->t_list->push_back_inplace(new_node_float((double)n->t_io->pos));
+	get_node(lazy_func_idx)->t_list->push_back_inplace(rdr);
+	return new_node_lazy_list(lazy_func_idx);
+}
+
+// The offset a step of a line-seq reads from. The first step gets a float. Each after that
+// gets the line before, whose node keeps the offset of the next line in t_float, which
+// strings don't otherwise use. A step then makes just its line and three list cells, ahead
+// of the reader's cell which all the steps share.
+static long long line_seq_pos(node_idx_t at) {
+	node_t *n = get_node(at);
+	return (long long)(n->is_string() ? n->t_float : n->as_float());
+}
+
+static node_idx_t native_line_seq_next(env_ptr_t env, list_ptr_t args) {
+	long long pos = line_seq_pos(args->first_value());
+	list_ptr_t ret = args->rest();
+	io_t *io = get_node(ret->first_value())->t_io.ptr;
+	jo_string line;
+	long long next;
+	if(!io || !io_read_line_at(io, pos, line, next)) {
+		return NIL_NODE;
+	}
+	node_idx_t line_idx = new_node_string(std::move(line));
+	get_node(line_idx)->t_float = (double)next;
+	ret->push_front_inplace(line_idx);
+	ret->push_front_inplace(env->get("line-seq-next"));
+	ret->push_front_inplace(line_idx);
+	return new_node_list(ret);
+}
+
+// The reader and starting offset of a line-seq, so count and reduce can go through its
+// lines without making its steps. False for any other seq.
+static bool io_line_seq_source(node_idx_t coll, io_t *&io, long long &pos) {
+	node_t *n = get_node(coll);
+	if(!n->is_lazy_list() || !get_node(n->t_lazy_fn)->is_list()) {
+		return false;
+	}
+	list_ptr_t form = get_node(n->t_lazy_fn)->t_list;
+	if(form->size() != 3) {
+		return false;
+	}
+	list_t::iterator it = form->begin();
+	node_t *f = get_node(*it++);
+	if(f->type != NODE_NATIVE_FUNCTION || f->t_native_function != &native_line_seq_next) {
+		return false;
+	}
+	pos = line_seq_pos(*it++);
+	node_t *rdr = get_node(*it++);
+	io = rdr->is_io() ? rdr->t_io.ptr : NULL;
+	return io != NULL;
+}
+
+// (count (line-seq rdr)), counting the lines as they're read, without making any nodes
+static bool io_line_seq_count(node_idx_t coll, long long &count) {
+	io_t *io;
+	long long pos;
+	if(!io_line_seq_source(coll, io, pos)) {
+		return false;
+	}
+	jo_lock_guard guard(io->mutex);
+	const char *line;
+	size_t len;
+	long long next;
+	for(count = 0; io_find_line(io, pos, line, len, next); pos = next) {
+		count++;
+	}
+	return true;
+}
+
+// (reduce f init (line-seq rdr)) handing f each line as it's read, without the seq. Only
+// the lines' strings are made. init_idx is INV_NODE if reduce got no initial value, then
+// the first line is. Returns false for any other coll, or no lines and no init.
+static bool io_line_seq_reduce(env_ptr_t env, node_idx_t f_idx, node_idx_t coll, node_idx_t init_idx, node_idx_t &ret) {
+	io_t *io;
+	long long pos;
+	if(!io_line_seq_source(coll, io, pos)) {
+		return false;
+	}
+	jo_string line;
+	long long next;
+	if(init_idx == INV_NODE) {
+		if(!io_read_line_at(io, pos, line, next)) {
+			return false;
+		}
+		init_idx = new_node_string(std::move(line));
+		pos = next;
+	}
+	ret = init_idx;
+	// not holding the reader's lock while f runs, as f may read from it too
+	for(; io_read_line_at(io, pos, line, next); pos = next) {
+		list_ptr_t arg_list = new_list();
+		arg_list->push_back_inplace(f_idx);
+		arg_list->push_back_inplace(ret);
+		arg_list->push_back_inplace(new_node_string(std::move(line)));
+		ret = eval_list(env, arg_list);
+	}
+	return true;
+}
+
+// true if the options after it (:append true ...) ask to add to the end of the file
+static bool io_append_option(list_t::iterator it) {
+	while(it) {
+		node_idx_t key_idx = *it++;
+		node_idx_t value_idx = it ? *it++ : NIL_NODE;
+		if(get_node(key_idx)->as_string() == "append") {
+			return get_node(value_idx)->as_bool();
+		}
+	}
+	return false;
+}
+
+static io_ptr_t io_open_writer(const jo_string &path, bool append) {
+	FILE *fp = fopen(path.c_str(), append ? "ab" : "wb");
+	if(!fp) {
+		return io_ptr_t();
+	}
+	return new io_t(fp, true);
+}
+
+static bool io_is_sequential(const node_t *n) {
+	return n->is_seq() && !n->is_set() && !n->is_map() && !n->is_sorted();
+}
+
+// Appends x to buf as text: as str would, or in its readable form, with strings quoted.
+// Collections are always readable, and so are the elements in them.
+static void io_put(env_ptr_t env, jo_byte_buffer &buf, node_idx_t x, bool readable) {
+	node_t *n = get_node(x);
+	char tmp[JO_FORMAT_FLOAT_MAX];
+	switch(n->type) {
+	case NODE_NIL:
+		if(readable) {
+			buf.write("nil", 3);
+		}
+		return;
+	case NODE_BOOL:    buf.write(n->t_bool ? "true" : "false", n->t_bool ? 4 : 5); return;
+	case NODE_INT:     buf.write(tmp, jo_format_int(tmp, n->t_int)); return;
+	case NODE_FLOAT:   buf.write(tmp, jo_format_float(tmp, n->t_float)); return;
+	case NODE_KEYWORD: buf.put(':'); break;
+	case NODE_STRING:
+		if(readable) {
+			buf.put('"');
+			for(const char *c = n->t_string.c_str(); *c; c++) {
+				if(*c == '"' || *c == '\\') {
+					buf.put('\\');
+				}
+				buf.put(*c);
+			}
+			buf.put('"');
+			return;
+		}
+		break;
+	}
+	if(io_is_sequential(n)) {
+		bool is_vector = n->is_vector() || n->is_vector_of() || n->is_tensor();
+		buf.put(is_vector ? '[' : '(');
+		bool first = true;
+		for(seq_iterator_t it(env, x); it; it.next(), first = false) {
+			if(!first) {
+				buf.put(' ');
+			}
+			io_put(env, buf, it.val, true);
+		}
+		buf.put(is_vector ? ']' : ')');
+		return;
+	}
+	if(n->is_set() || n->is_sorted_set()) {
+		buf.write("#{", 2);
+		bool first = true;
+		for(seq_iterator_t it(env, x); it; it.next(), first = false) {
+			if(!first) {
+				buf.put(' ');
+			}
+			io_put(env, buf, it.val, true);
+		}
+		buf.put('}');
+		return;
+	}
+	if(n->is_map() || n->is_sorted_map()) {
+		buf.put('{');
+		bool first = true;
+		auto entry = [&](node_idx_t k, node_idx_t v) {
+			if(!first) {
+				buf.write(", ", 2);
+			}
+			first = false;
+			io_put(env, buf, k, true);
+			buf.put(' ');
+			io_put(env, buf, v, true);
+		};
+		if(n->is_map()) {
+			for(map_t::iterator it = n->t_map->begin(); it; it++) {
+				entry(it->first, it->second);
+			}
+		} else {
+			for(sorted_map_t::iterator it = n->t_sorted->begin(); it; it++) {
+				entry(it->first, it->second);
+			}
+		}
+		buf.put('}');
+		return;
+	}
+	buf.write(n->t_string.c_str(), n->t_string.size());
+}
+
+// Writes x by the rule at the top of this file. The text is made first, and only then
+// added under the lock, as making it can run code that writes here too.
+static void io_write(env_ptr_t env, io_t *io, node_idx_t x) {
+	jo_byte_buffer text;
+	auto add = [&]() {
+		jo_lock_guard guard(io->mutex);
+		io->out.write(text.data, text.size);
+		if(io->out.size >= IO_CHUNK_SIZE) {
+			io->flush();
+		}
+		text.clear();
+	};
+	if(!io_is_sequential(get_node(x))) {
+		io_put(env, text, x, false);
+		add();
+		return;
+	}
+	for(seq_iterator_t it(env, x); it; it.next()) {
+		io_put(env, text, it.val, false);
+		if(text.size >= IO_CHUNK_SIZE / 16) {
+			add();
+		}
+	}
+	add();
+}
+
+static bool io_close(node_idx_t idx) {
+	node_t *n = get_node(idx);
+	if(!n->is_io() || !n->t_io.ptr) {
+		return false;
+	}
+	io_t *io = n->t_io.ptr;
+	jo_lock_guard guard(io->mutex);
+	return io->close();
+}
+
+// (writer f & options)
+// Opens the file f for writing, emptying it first unless given :append true.
+// Write with write and write-line, and close when done, or use with-open.
+static node_idx_t native_writer(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	jo_string path = get_node(*it++)->as_string();
+	io_ptr_t io = io_open_writer(path, io_append_option(it));
+	if(!io.ptr) {
+		warnf("writer: can't write %s\n", path.c_str());
+		return NIL_NODE;
+	}
+	return new_node_io(io);
+}
+
+static io_t *io_writer_arg(list_ptr_t args) {
+	node_t *n = get_node(args->first_value());
+	if(!n->is_io() || !n->t_io.ptr || !n->t_io->fp || n->t_io->fp == stdin) {
+		return NULL;
+	}
+	return n->t_io.ptr;
+}
+
+// (write w & xs)
+// Writes each x to the writer w, without spaces between them. A string or number
+// is written as str would, and the elements of a list, vector or lazy seq one
+// after another, with any collections in them in their readable form.
+static node_idx_t native_write(env_ptr_t env, list_ptr_t args) {
+	io_t *io = io_writer_arg(args);
+	if(!io) {
+		warnf("write: expected a writer\n");
+		return NIL_NODE;
+	}
+	for(list_t::iterator it = ++args->begin(); it; it++) {
+		io_write(env, io, *it);
+	}
+	return NIL_NODE;
+}
+
+// (write-line w & xs)
+// Same as write, followed by a newline.
+static node_idx_t native_write_line(env_ptr_t env, list_ptr_t args) {
+	io_t *io = io_writer_arg(args);
+	if(!io) {
+		warnf("write-line: expected a writer\n");
+		return NIL_NODE;
+	}
+	for(list_t::iterator it = ++args->begin(); it; it++) {
+		io_write(env, io, *it);
+	}
+	io_write(env, io, new_node_string("\n"));
+	return NIL_NODE;
+}
+
+// (flush)(flush w)
+// Writes out what has been printed, or written to w, and not yet passed on.
+static node_idx_t native_flush(env_ptr_t env, list_ptr_t args) {
+	if(!args->size()) {
+		out_flush();
+		return NIL_NODE;
+	}
+	io_t *io = io_writer_arg(args);
+	if(!io) {
+		warnf("flush: expected a writer\n");
+		return NIL_NODE;
+	}
+	jo_lock_guard guard(io->mutex);
+	io->flush();
+	return new_node_bool(fflush(io->fp) == 0 && !io->failed);
+}
+
+// (close x)
+// Closes the reader or writer x, writing out what is left to be written.
+// Returns false if any of it couldn't be.
+static node_idx_t native_close(env_ptr_t env, list_ptr_t args) {
+	return new_node_bool(io_close(args->first_value()));
+}
+
+// (with-open [name init ...] & body)
+// Evaluates body with each name bound to its init, as let does, then closes
+// them in reverse order. Returns what body did.
+static node_idx_t native_with_open(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t node_idx = *it++;
+	node_t *node = get_node(node_idx);
+	if(!node->is_list() && !node->is_vector()) {
+		warnf("with-open: expected a binding vector\n");
+		return NIL_NODE;
+	}
+	list_ptr_t list_list = get_node_list(node_idx);
+	if(list_list->size() % 2 != 0) {
+		warnf("with-open: expected even number of elements\n");
+		return NIL_NODE;
+	}
+	env_ptr_t env2 = new_env(env);
+	jo_vector<node_idx_t> opened;
+	for(list_t::iterator i = list_list->begin(); i;) {
+		node_idx_t key_idx = *i++;
+		node_idx_t value_idx = eval_node(env2, *i++);
+		env2->set_temp(get_node(key_idx)->as_string(), value_idx);
+		opened.push_back(value_idx);
+	}
+	node_idx_t ret = eval_node_list(env2, args->rest());
+	for(size_t i = opened.size(); i-- > 0;) {
+		io_close(opened[i]);
+	}
+	return ret;
+}
+
+void jo_lisp_io_init(env_ptr_t env) {
+	env->set("reader", new_node_native_function("reader", &native_reader, false));
+	env->set("line-seq", new_node_native_function("line-seq", &native_line_seq, false));
+	env->set("line-seq-next", new_node_native_function("line-seq-next", &native_line_seq_next, true));
+	env->set("writer", new_node_native_function("writer", &native_writer, false));
+	env->set("write", new_node_native_function("write", &native_write, false));
+	env->set("write-line", new_node_native_function("write-line", &native_write_line, false));
+	env->set("flush", new_node_native_function("flush", &native_flush, false));
+	env->set("close", new_node_native_function("close", &native_close, false));
+	env->set("with-open", new_node_native_function("with-open", &native_with_open, true));
+}
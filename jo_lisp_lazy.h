@@ -112,8 +112,6 @@ static node_idx_t native_repeat_next(env_ptr_t env, list_ptr_t args) {
 // (concat x y & zs)
 // Returns a lazy seq representing the concatenation of the elements in the supplied colls.
 static node_idx_t native_concat(env_ptr_t env, list_ptr_t args) {
-	list_t::iterator it = args->begin();
-	node_idx_t x = *it++;
 	node_idx_t lazy_func_idx = new_node(NODE_LIST);
 	get_node(lazy_func_idx)->t_list = new_list();
 	get_node(lazy_func_idx)->t_list->push_back_inplace(env->get("concat-next"));
@@ -139,6 +137,13 @@ concat_next:
 		}
 		val = n->first_value();
 		args->cons_inplace(new_node_list(n->pop()));
+	} else if(ntype == NODE_VECTOR) {
+		vector_ptr_t n = get_node(nidx)->t_vector;
+		if(n->size() == 0) {
+			goto concat_next;
+		}
+		val = n->first_value();
+		args->cons_inplace(new_node_vector(n->rest()));
 	} else if(ntype == NODE_LAZY_LIST) {
 		// call the t_lazy_fn, and grab the first element of the return and return that.
 		node_idx_t reti = eval_node(env, get_node(nidx)->t_lazy_fn);
@@ -227,7 +232,21 @@ static node_idx_t native_map(env_ptr_t env, list_ptr_t args) {
 	get_node(lazy_func_idx)->t_list->push_back_inplace(env->get("map-next"));
 	get_node(lazy_func_idx)->t_list->push_back_inplace(f);
 	while(it) {
-		get_node(lazy_func_idx)->t_list->push_back_inplace(eval_node(env, *it++));
+		node_idx_t coll = eval_node(env, *it++);
+		if(args->size() == 2 && (get_node(coll)->is_vector_of() || get_node(coll)->is_tensor())) {
+			// Math functions over a vector-of or tensor work on the raw numbers, in one go
+			node_t *fn = get_node(get_node_type(f) == NODE_SYMBOL ? env->get(get_node_string(f)) : f);
+			if(fn->type == NODE_NATIVE_FUNCTION && (fn->flags & NODE_FLAG_ELEMENTWISE)) {
+				list_ptr_t fn_args = new_list();
+				fn_args->push_back_inplace(coll);
+				return fn->t_native_function(env, fn_args);
+			}
+		}
+		if(get_node(coll)->is_set() || get_node(coll)->is_sorted() || get_node(coll)->is_vector_of() || get_node(coll)->is_tensor()) {
+			seq_iterator_t sit(env, coll);
+			coll = new_node_list(sit.all());
+		}
+		get_node(lazy_func_idx)->t_list->push_back_inplace(coll);
 	}
 	return new_node_lazy_list(lazy_func_idx);
 }
@@ -251,6 +270,13 @@ static node_idx_t native_map_next(env_ptr_t env, list_ptr_t args) {
 			}
 			arg_list->push_back_inplace(list_list->first_value());
 			next_list->push_back_inplace(new_node_list(list_list->rest()));
+		} else if(arg->is_vector()) {
+			vector_ptr_t vec = arg->as_vector();
+			if(vec->size() == 0) {
+				return NIL_NODE;
+			}
+			arg_list->push_back_inplace(vec->first_value());
+			next_list->push_back_inplace(new_node_vector(vec->rest()));
 		} else if(arg->is_lazy_list()) {
 			lazy_list_iterator_t lit(env, arg_idx);
 			if(lit.done()) {
@@ -272,6 +298,14 @@ static node_idx_t native_take(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t n = eval_node(env, *it++);
 	node_idx_t coll = eval_node(env, *it++);
+	if(get_node_type(coll) == NODE_VECTOR) {
+		int N = get_node(n)->as_int();
+		list_ptr_t ret = new_list();
+		for(vector_t::iterator vit = get_node(coll)->as_vector()->begin(); vit && N > 0; vit++, N--) {
+			ret->push_back_inplace(*vit);
+		}
+		return new_node_list(ret);
+	}
 	if(get_node_type(coll) == NODE_LIST) {
 		// don't do it lazily if not given lazy inputs... thats dumb
 		int N = get_node(n)->as_int();
@@ -327,6 +361,9 @@ static node_idx_t native_take_nth(env_ptr_t env, list_ptr_t args) {
 	}
 	int N = get_node(n)->as_int();
 	node_idx_t coll = eval_node(env, *it++);
+	if(get_node_type(coll) == NODE_VECTOR) {
+		coll = new_node_list(get_node_list(coll));
+	}
 	if(get_node_type(coll) == NODE_LIST) {
 		// don't do it lazily if not given lazy inputs... thats dumb
 		list_ptr_t list_list = get_node(coll)->as_list();
@@ -412,6 +449,14 @@ static node_idx_t native_take_last(env_ptr_t env, list_ptr_t args) {
 		}
 		return new_node_list(list_list->take_last(N));
 	}
+	if(get_node_type(coll) == NODE_VECTOR) {
+		vector_ptr_t vec = get_node(coll)->as_vector();
+		list_ptr_t ret = new_list();
+		for(size_t i = vec->size() > (size_t)N ? vec->size() - N : 0; i < vec->size(); i++) {
+			ret->push_back_inplace(vec->nth(i));
+		}
+		return new_node_list(ret);
+	}
 	if(get_node_type(coll) == NODE_LAZY_LIST) {
 		lazy_list_iterator_t lit(env, coll);
 		list_ptr_t ret = new_list();
@@ -437,35 +482,23 @@ static node_idx_t native_distinct(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t node_idx = *it++;
 	node_t *node = get_node(node_idx);
-	if(node->is_list()) {
-		list_ptr_t list_list = node->as_list();
-		list_ptr_t ret = new_list();
-		for(list_t::iterator it = list_list->begin(); it; it++) {
-			node_idx_t value_idx = eval_node(env, *it);
-			node_t *value = get_node(value_idx);
-			if(!ret->contains([env,value_idx](node_idx_t idx) {
-				return node_eq(env, idx, value_idx);
-			})) {
-				ret->push_back_inplace(value_idx);
-			}
-		}
-		return new_node_list(ret, NODE_FLAG_LITERAL);
+	if(!node->is_seq()) {
+		return NIL_NODE;
 	}
-	if(node->is_lazy_list()) {
-		lazy_list_iterator_t lit(env, node_idx);
-		list_ptr_t ret = new_list();
-		for(; lit; lit.next()) {
-			node_idx_t value_idx = eval_node(env, lit.val);
-			node_t *value = get_node(value_idx);
-			if(!ret->contains([env,value_idx](node_idx_t idx) {
-				return node_eq(env, idx, value_idx);
-			})) {
-				ret->push_back_inplace(value_idx);
-			}
+	// a set of what we've seen makes this O(n), instead of scanning the result for each item
+	set_ptr_t seen = new_set();
+	list_ptr_t ret = new_list();
+	for(seq_iterator_t sit(env, node_idx); sit; sit.next()) {
+		node_idx_t value_idx = eval_node(env, sit.val);
+		size_t seen_size = seen->size();
+		seen->assoc_inplace(value_idx, value_idx, [env](node_idx_t a, node_idx_t b) {
+			return node_eq(env, a, b);
+		});
+		if(seen->size() != seen_size) {
+			ret->push_back_inplace(value_idx);
 		}
-		return new_node_list(ret);
 	}
-	return NIL_NODE;
+	return new_node_list(ret, NODE_FLAG_LITERAL);
 }
 
 // (filter pred)(filter pred coll)
@@ -477,6 +510,9 @@ static node_idx_t native_filter(env_ptr_t env, list_ptr_t args) {
 	node_idx_t pred_idx = eval_node(env, *it++);
 	node_idx_t coll_idx = eval_node(env, *it++);
 	//print_node(coll_idx);
+	if(get_node_type(coll_idx) == NODE_VECTOR) {
+		coll_idx = new_node_list(get_node_list(coll_idx));
+	}
 	if(get_node_type(coll_idx) == NODE_LIST) {
 		// don't do it lazily if not given lazy inputs... thats dumb
 		list_ptr_t list_list = get_node(coll_idx)->as_list();
@@ -518,6 +554,18 @@ static node_idx_t native_filter(env_ptr_t env, list_ptr_t args) {
 		get_node(lazy_func_idx)->t_list->push_back_inplace(coll_idx);
 		return new_node_lazy_list(lazy_func_idx);
 	}
+	if(get_node(coll_idx)->is_seq()) {
+		// sets, sorted collections and the numeric types, in their seq order
+		list_ptr_t ret = new_list();
+		list_ptr_t args = new_list();
+		args->push_back_inplace(pred_idx);
+		for(seq_iterator_t sit(env, coll_idx); sit; sit.next()) {
+			if(get_node_bool(eval_list(env, args->conj(sit.val)))) {
+				ret->push_back_inplace(sit.val);
+			}
+		}
+		return new_node_list(ret);
+	}
 	if(get_node_type(coll_idx) == NODE_STRING) {
 		jo_string str = get_node(coll_idx)->t_string;
 		jo_string ret;
@@ -565,6 +613,9 @@ static node_idx_t native_keep(env_ptr_t env, list_ptr_t args) {
 	list_t::iterator it = args->begin();
 	node_idx_t f_idx = eval_node(env, *it++);
 	node_idx_t coll_idx = eval_node(env, *it++);
+	if(get_node_type(coll_idx) == NODE_VECTOR) {
+		coll_idx = new_node_list(get_node_list(coll_idx));
+	}
 	node_idx_t lazy_func_idx = new_node(NODE_LIST);
 	get_node(lazy_func_idx)->t_list = new_list();
 	get_node(lazy_func_idx)->t_list->push_back_inplace(env->get("keep-next"));
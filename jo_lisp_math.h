@@ -1,53 +1,69 @@
 #pragma once
 
 // TODO:
-// o dot product
 // o cross product
-// o matrix type
-// o tensor type
+
+// Given a vector-of or tensor, the one argument functions work through its numbers without
+// boxing any, and return a vector-of :double or a tensor of the same shape.
+template<typename F>
+static node_idx_t math_unary(list_ptr_t args, F f) {
+	node_t *n = get_node(args->nth(0));
+	if(n->is_vector_of()) {
+		vector_of_ptr_t ret = new vector_of_t(VECTOR_OF_DOUBLE);
+		vector_double_t *doubles = ret->doubles.ptr;
+		n->t_vector_of->each([&](double x) { doubles->push_back_inplace(f(x)); });
+		return new_node_vector_of(ret);
+	}
+	if(n->is_tensor()) {
+		tensor_t *ret = new tensor_t(n->t_tensor->rank, n->t_tensor->shape);
+		double *out = ret->ptr();
+		n->t_tensor->each([&](const size_t *index, double x) { *out++ = f(x); });
+		return new_node_tensor(ret);
+	}
+	return new_node_float(f(n->as_float()));
+}
 
 static node_idx_t native_math_abs(env_ptr_t env, list_ptr_t args) {
 	node_t *n1 = get_node(args->nth(0));
 	if(n1->type == NODE_INT) {
 		return new_node_int(abs(n1->t_int));
-	} else {
-		return new_node_float(fabs(n1->as_float()));
 	}
+	return math_unary(args, [](double x) { return fabs(x); });
 }
 
-static node_idx_t native_math_sqrt(env_ptr_t env, list_ptr_t args) { return new_node_float(sqrt(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_cbrt(env_ptr_t env, list_ptr_t args) { return new_node_float(cbrt(get_node(args->nth(0))->as_float())); }
+static node_idx_t native_math_sqrt(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return sqrt(x); }); }
+static node_idx_t native_math_cbrt(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return cbrt(x); }); }
 static node_idx_t native_math_ceil(env_ptr_t env, list_ptr_t args) { return new_node_int(ceil(get_node(args->nth(0))->as_float())); }
 static node_idx_t native_math_floor(env_ptr_t env, list_ptr_t args) { return new_node_int(floor(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_exp(env_ptr_t env, list_ptr_t args) { return new_node_float(exp(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_exp2(env_ptr_t env, list_ptr_t args) { return new_node_float(exp2(get_node(args->nth(0))->as_float())); }
+static node_idx_t native_math_exp(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return exp(x); }); }
+static node_idx_t native_math_exp2(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return exp2(x); }); }
 static node_idx_t native_math_hypot(env_ptr_t env, list_ptr_t args) { return new_node_float(hypot(get_node(args->nth(0))->as_float(), get_node(args->nth(1))->as_float())); }
-static node_idx_t native_math_log10(env_ptr_t env, list_ptr_t args) { return new_node_float(log10(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_log(env_ptr_t env, list_ptr_t args) { return new_node_float(log(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_log2(env_ptr_t env, list_ptr_t args) { return new_node_float(log2(get_node(args->nth(0))->as_float()));}
-static node_idx_t native_math_log1p(env_ptr_t env, list_ptr_t args) { return new_node_float(log1p(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_sin(env_ptr_t env, list_ptr_t args) { return new_node_float(sin(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_cos(env_ptr_t env, list_ptr_t args) { return new_node_float(cos(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_tan(env_ptr_t env, list_ptr_t args) { return new_node_float(tan(get_node(args->nth(0))->as_float())); }
+static node_idx_t native_math_log10(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return log10(x); }); }
+static node_idx_t native_math_log(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return log(x); }); }
+static node_idx_t native_math_log2(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return log2(x); }); }
+static node_idx_t native_math_log1p(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return log1p(x); }); }
+static node_idx_t native_math_sin(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return sin(x); }); }
+static node_idx_t native_math_cos(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return cos(x); }); }
+static node_idx_t native_math_tan(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return tan(x); }); }
 static node_idx_t native_math_pow(env_ptr_t env, list_ptr_t args) { return new_node_float(pow(get_node(args->nth(0))->as_float(), get_node(args->nth(1))->as_float())); }
-static node_idx_t native_math_sinh(env_ptr_t env, list_ptr_t args) { return new_node_float(sinh(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_cosh(env_ptr_t env, list_ptr_t args) { return new_node_float(cosh(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_tanh(env_ptr_t env, list_ptr_t args) { return new_node_float(tanh(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_asin(env_ptr_t env, list_ptr_t args) { return new_node_float(asin(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_acos(env_ptr_t env, list_ptr_t args) { return new_node_float(acos(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_atan(env_ptr_t env, list_ptr_t args) { return new_node_float(atan(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_asinh(env_ptr_t env, list_ptr_t args) { return new_node_float(asinh(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_acosh(env_ptr_t env, list_ptr_t args) { return new_node_float(acosh(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_atanh(env_ptr_t env, list_ptr_t args) { return new_node_float(atanh(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_erf(env_ptr_t env, list_ptr_t args) { return new_node_float(erf(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_erfc(env_ptr_t env, list_ptr_t args) { return new_node_float(erfc(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_tgamma(env_ptr_t env, list_ptr_t args) { return new_node_float(tgamma(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_lgamma(env_ptr_t env, list_ptr_t args) { return new_node_float(lgamma(get_node(args->nth(0))->as_float())); }
+static node_idx_t native_math_sinh(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return sinh(x); }); }
+static node_idx_t native_math_cosh(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return cosh(x); }); }
+static node_idx_t native_math_tanh(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return tanh(x); }); }
+static node_idx_t native_math_asin(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return asin(x); }); }
+static node_idx_t native_math_acos(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return acos(x); }); }
+static node_idx_t native_math_atan(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return atan(x); }); }
+static node_idx_t native_math_asinh(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return asinh(x); }); }
+static node_idx_t native_math_acosh(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return acosh(x); }); }
+static node_idx_t native_math_atanh(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return atanh(x); }); }
+static node_idx_t native_math_erf(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return erf(x); }); }
+static node_idx_t native_math_erfc(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return erfc(x); }); }
+static node_idx_t native_math_tgamma(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return tgamma(x); }); }
+static node_idx_t native_math_lgamma(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return lgamma(x); }); }
 static node_idx_t native_math_round(env_ptr_t env, list_ptr_t args) { return new_node_int(round(get_node(args->nth(0))->as_float())); }
 static node_idx_t native_math_trunc(env_ptr_t env, list_ptr_t args) { return new_node_int(trunc(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_logb(env_ptr_t env, list_ptr_t args) { return new_node_float(logb(get_node(args->nth(0))->as_float())); }
+static node_idx_t native_math_logb(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return logb(x); }); }
 static node_idx_t native_math_ilogb(env_ptr_t env, list_ptr_t args) { return new_node_int(ilogb(get_node(args->nth(0))->as_float())); }
-static node_idx_t native_math_expm1(env_ptr_t env, list_ptr_t args) { return new_node_float(expm1(get_node(args->nth(0))->as_float())); }
+static node_idx_t native_math_expm1(env_ptr_t env, list_ptr_t args) { return math_unary(args, [](double x) { return expm1(x); }); }
 
 // Computes the minimum value of any number of arguments
 static node_idx_t native_math_min(env_ptr_t env, list_ptr_t args) {
@@ -197,38 +213,45 @@ static node_idx_t native_is_neg(env_ptr_t env, list_ptr_t args) {
     return new_node_bool(node->as_float() < 0);
 }
 
+// a native which map hands a vector-of to whole, see math_unary
+static node_idx_t new_node_elementwise_function(const char *name, native_function_t f) {
+	node_idx_t idx = new_node_native_function(name, f, false);
+	get_node(idx)->flags |= NODE_FLAG_ELEMENTWISE;
+	return idx;
+}
+
 void jo_lisp_math_init(env_ptr_t env) {
 	env->set("even?", new_node_native_function("even?", &native_is_even, false));
 	env->set("odd?", new_node_native_function("odd?", &native_is_odd, false));
 	env->set("pos?", new_node_native_function("pos?", &native_is_pos, false));
 	env->set("neg?", new_node_native_function("neg?", &native_is_neg, false));
-	env->set("Math/abs", new_node_native_function("Math/abs", &native_math_abs, false));
-	env->set("Math/sqrt", new_node_native_function("Math/sqrt", &native_math_sqrt, false));
-	env->set("Math/cbrt", new_node_native_function("Math/cbrt", &native_math_cbrt, false));
-	env->set("Math/sin", new_node_native_function("Math/sin", &native_math_sin, false));
-	env->set("Math/cos", new_node_native_function("Math/cos", &native_math_cos, false));
-	env->set("Math/tan", new_node_native_function("Math/tan", &native_math_tan, false));
-	env->set("Math/asin", new_node_native_function("Math/asin", &native_math_asin, false));
-	env->set("Math/acos", new_node_native_function("Math/acos", &native_math_acos, false));
-	env->set("Math/atan", new_node_native_function("Math/atan", &native_math_atan, false));
-	env->set("Math/sinh", new_node_native_function("Math/sinh", &native_math_sinh, false));
-	env->set("Math/cosh", new_node_native_function("Math/cosh", &native_math_cosh, false));
-	env->set("Math/tanh", new_node_native_function("Math/tanh", &native_math_tanh, false));
-	env->set("Math/asinh", new_node_native_function("Math/asinh", &native_math_asinh, false));
-	env->set("Math/acosh", new_node_native_function("Math/acosh", &native_math_acosh, false));
-	env->set("Math/atanh", new_node_native_function("Math/atanh", &native_math_atanh, false));
-	env->set("Math/exp", new_node_native_function("Math/exp", &native_math_exp, false));
-	env->set("Math/log", new_node_native_function("Math/log", &native_math_log, false));
-	env->set("Math/log10", new_node_native_function("Math/log10", &native_math_log10, false));
-	env->set("Math/log2", new_node_native_function("Math/log2", &native_math_log2, false));
-	env->set("Math/log1p", new_node_native_function("Math/log1p", &native_math_log1p, false));
-	env->set("Math/expm1", new_node_native_function("Math/expm1", &native_math_expm1, false));
+	env->set("Math/abs", new_node_elementwise_function("Math/abs", &native_math_abs));
+	env->set("Math/sqrt", new_node_elementwise_function("Math/sqrt", &native_math_sqrt));
+	env->set("Math/cbrt", new_node_elementwise_function("Math/cbrt", &native_math_cbrt));
+	env->set("Math/sin", new_node_elementwise_function("Math/sin", &native_math_sin));
+	env->set("Math/cos", new_node_elementwise_function("Math/cos", &native_math_cos));
+	env->set("Math/tan", new_node_elementwise_function("Math/tan", &native_math_tan));
+	env->set("Math/asin", new_node_elementwise_function("Math/asin", &native_math_asin));
+	env->set("Math/acos", new_node_elementwise_function("Math/acos", &native_math_acos));
+	env->set("Math/atan", new_node_elementwise_function("Math/atan", &native_math_atan));
+	env->set("Math/sinh", new_node_elementwise_function("Math/sinh", &native_math_sinh));
+	env->set("Math/cosh", new_node_elementwise_function("Math/cosh", &native_math_cosh));
+	env->set("Math/tanh", new_node_elementwise_function("Math/tanh", &native_math_tanh));
+	env->set("Math/asinh", new_node_elementwise_function("Math/asinh", &native_math_asinh));
+	env->set("Math/acosh", new_node_elementwise_function("Math/acosh", &native_math_acosh));
+	env->set("Math/atanh", new_node_elementwise_function("Math/atanh", &native_math_atanh));
+	env->set("Math/exp", new_node_elementwise_function("Math/exp", &native_math_exp));
+	env->set("Math/log", new_node_elementwise_function("Math/log", &native_math_log));
+	env->set("Math/log10", new_node_elementwise_function("Math/log10", &native_math_log10));
+	env->set("Math/log2", new_node_elementwise_function("Math/log2", &native_math_log2));
+	env->set("Math/log1p", new_node_elementwise_function("Math/log1p", &native_math_log1p));
+	env->set("Math/expm1", new_node_elementwise_function("Math/expm1", &native_math_expm1));
 	env->set("Math/pow", new_node_native_function("Math/pow", &native_math_pow, false));
 	env->set("Math/hypot", new_node_native_function("Math/hypot", &native_math_hypot, false));
-	env->set("Math/erf", new_node_native_function("Math/erf", &native_math_erf, false));
-	env->set("Math/erfc", new_node_native_function("Math/erfc", &native_math_erfc, false));
-	env->set("Math/tgamma", new_node_native_function("Math/tgamma", &native_math_tgamma, false));
-	env->set("Math/lgamma", new_node_native_function("Math/lgamma", &native_math_lgamma, false));
+	env->set("Math/erf", new_node_elementwise_function("Math/erf", &native_math_erf));
+	env->set("Math/erfc", new_node_elementwise_function("Math/erfc", &native_math_erfc));
+	env->set("Math/tgamma", new_node_elementwise_function("Math/tgamma", &native_math_tgamma));
+	env->set("Math/lgamma", new_node_elementwise_function("Math/lgamma", &native_math_lgamma));
 	env->set("Math/ceil", new_node_native_function("Math/ceil", &native_math_ceil, false));
 	env->set("Math/floor", new_node_native_function("Math/floor", &native_math_floor, false));
 	env->set("Math/round", new_node_native_function("Math/round", &native_math_round, false));
@@ -236,6 +259,7 @@ void jo_lisp_math_init(env_ptr_t env) {
 	env->set("Math/min", new_node_native_function("Math/min", &native_math_min, false));
 	env->set("Math/max", new_node_native_function("Math/max", &native_math_max, false));
 	env->set("Math/clamp", new_node_native_function("Math/clamp", &native_math_clamp, false));
+	env->set("Math/matmul", new_node_native_function("Math/matmul", &native_matmul, false));
 	env->set("Math/PI", new_node_float(JO_M_PI));
 	env->set("Math/E", new_node_float(JO_M_E));
 	env->set("Math/LN2", new_node_float(JO_M_LN2));
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "jo_stdcpp.h"
+
+// Sorted maps and sets, kept in a persistent AVL tree ordered by node_cmp or a
+// user comparator. subseq and rsubseq seek to the start of the range and walk
+// from there, so a range query costs O(log n + k).
+
+// builds a sorted map (from key/value pairs) or sorted set (from keys)
+static node_idx_t new_node_sorted_from(env_ptr_t env, int type, node_idx_t comparator, list_t::iterator it) {
+	sorted_lt_t lt(env, comparator);
+	sorted_map_ptr_t sorted = new_sorted_map();
+	while(it) {
+		node_idx_t key_idx = *it++;
+		node_idx_t val_idx = key_idx;
+		if(type == NODE_SORTED_MAP) {
+			if(!it) {
+				warnf("sorted-map: no value supplied for key\n");
+				break;
+			}
+			val_idx = *it++;
+		}
+		sorted->assoc_inplace(key_idx, val_idx, lt);
+	}
+	return new_node_sorted(type, sorted, comparator);
+}
+
+// (sorted-map & keyvals)
+// keyval => key val
+// Returns a new sorted map with supplied mappings.  If any keys are
+// equal, they are handled as if by repeated uses of assoc.
+static node_idx_t native_sorted_map(env_ptr_t env, list_ptr_t args) {
+	return new_node_sorted_from(env, NODE_SORTED_MAP, NIL_NODE, args->begin());
+}
+
+// (sorted-map-by comparator & keyvals)
+// keyval => key val
+// Returns a new sorted map with supplied mappings, using the supplied
+// comparator.  If any keys are equal, they are handled as if by
+// repeated uses of assoc.
+static node_idx_t native_sorted_map_by(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t comparator = *it++;
+	return new_node_sorted_from(env, NODE_SORTED_MAP, comparator, it);
+}
+
+// (sorted-set & keys)
+// Returns a new sorted set with supplied keys.  Any equal keys are
+// handled as if by repeated uses of conj.
+static node_idx_t native_sorted_set(env_ptr_t env, list_ptr_t args) {
+	return new_node_sorted_from(env, NODE_SORTED_SET, NIL_NODE, args->begin());
+}
+
+// (sorted-set-by comparator & keys)
+// Returns a new sorted set with supplied keys, using the supplied
+// comparator.  Any equal keys are handled as if by repeated uses of
+// conj.
+static node_idx_t native_sorted_set_by(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	node_idx_t comparator = *it++;
+	return new_node_sorted_from(env, NODE_SORTED_SET, comparator, it);
+}
+
+// (sorted? coll)
+// Returns true if coll implements Sorted
+static node_idx_t native_is_sorted(env_ptr_t env, list_ptr_t args) {
+	return new_node_bool(get_node(args->first_value())->is_sorted());
+}
+
+// The tests of subseq and rsubseq are <, <=, > or >=, taken in the order of the collection.
+static bool sorted_is_test(node_idx_t test, native_function_t f) {
+	node_t *n = get_node(test);
+	return n->type == NODE_NATIVE_FUNCTION && n->t_native_function == f;
+}
+
+static bool sorted_is_upper_test(node_idx_t test) {
+	return sorted_is_test(test, &native_lt) || sorted_is_test(test, &native_lte);
+}
+
+static bool sorted_is_lower_test(node_idx_t test) {
+	return sorted_is_test(test, &native_gt) || sorted_is_test(test, &native_gte);
+}
+
+static bool sorted_is_inclusive_test(node_idx_t test) {
+	return sorted_is_test(test, &native_lte) || sorted_is_test(test, &native_gte);
+}
+
+// does (test k key) hold
+static bool sorted_test(const sorted_lt_t &lt, node_idx_t test, node_idx_t k, node_idx_t key) {
+	if(sorted_is_test(test, &native_lt)) {
+		return lt(k, key);
+	}
+	if(sorted_is_test(test, &native_lte)) {
+		return !lt(key, k);
+	}
+	if(sorted_is_test(test, &native_gt)) {
+		return lt(key, k);
+	}
+	if(sorted_is_test(test, &native_gte)) {
+		return !lt(k, key);
+	}
+	return false;
+}
+
+// Shared by subseq and rsubseq. Splits the arguments into a lower and an upper bound
+// (either may be nil), then walks from the bound on the starting side until the other fails.
+static node_idx_t sorted_subseq(env_ptr_t env, list_ptr_t args, bool reverse) {
+	list_t::iterator it = args->begin();
+	node_idx_t sc_idx = *it++;
+	node_t *sc = get_node(sc_idx);
+	if(!sc->is_sorted()) {
+		warnf("subseq: expected a sorted map or set\n");
+		return NIL_NODE;
+	}
+	node_idx_t lower_test = NIL_NODE, lower_key = NIL_NODE;
+	node_idx_t upper_test = NIL_NODE, upper_key = NIL_NODE;
+	node_idx_t test = it ? *it++ : NIL_NODE;
+	node_idx_t key = it ? *it++ : NIL_NODE;
+	if(sorted_is_upper_test(test)) {
+		upper_test = test;
+		upper_key = key;
+	} else {
+		lower_test = test;
+		lower_key = key;
+	}
+	if(it) {
+		upper_test = *it++;
+		upper_key = it ? *it++ : NIL_NODE;
+	}
+	if((lower_test != NIL_NODE && !sorted_is_lower_test(lower_test)) || (upper_test != NIL_NODE && !sorted_is_upper_test(upper_test))) {
+		warnf("subseq: tests must be one of <, <=, > or >=\n");
+		return NIL_NODE;
+	}
+
+	sorted_lt_t lt(env, sc);
+	sorted_map_ptr_t sorted = sc->t_sorted;
+	sorted_map_t::iterator sit;
+	node_idx_t stop_test = NIL_NODE, stop_key = NIL_NODE;
+	if(!reverse) {
+		sit = lower_test == NIL_NODE ? sorted->begin() : sorted->begin_at(lower_key, sorted_is_inclusive_test(lower_test), lt);
+		stop_test = upper_test;
+		stop_key = upper_key;
+	} else {
+		sit = upper_test == NIL_NODE ? sorted->rbegin() : sorted->rbegin_at(upper_key, sorted_is_inclusive_test(upper_test), lt);
+		stop_test = lower_test;
+		stop_key = lower_key;
+	}
+	list_ptr_t ret = new_list();
+	for(; sit; sit++) {
+		if(stop_test != NIL_NODE && !sorted_test(lt, stop_test, sit->first, stop_key)) {
+			break;
+		}
+		ret->push_back_inplace(new_node_sorted_entry(sc->type, *sit));
+	}
+	return new_node_list(ret);
+}
+
+// (subseq sc test key)(subseq sc start-test start-key end-test end-key)
+// sc must be a sorted collection, test(s) one of <, <=, > or
+// >=. Returns a seq of those entries with keys ek for
+// which (test (.. sc comparator (compare ek key)) 0) is true
+static node_idx_t native_subseq(env_ptr_t env, list_ptr_t args) {
+	return sorted_subseq(env, args, false);
+}
+
+// (rsubseq sc test key)(rsubseq sc start-test start-key end-test end-key)
+// sc must be a sorted collection, test(s) one of <, <=, > or
+// >=. Returns a reverse seq of those entries with keys ek for
+// which (test (.. sc comparator (compare ek key)) 0) is true
+static node_idx_t native_rsubseq(env_ptr_t env, list_ptr_t args) {
+	return sorted_subseq(env, args, true);
+}
+
+void jo_lisp_sorted_init(env_ptr_t env) {
+	env->set("sorted-map", new_node_native_function("sorted-map", &native_sorted_map, false));
+	env->set("sorted-map-by", new_node_native_function("sorted-map-by", &native_sorted_map_by, false));
+	env->set("sorted-set", new_node_native_function("sorted-set", &native_sorted_set, false));
+	env->set("sorted-set-by", new_node_native_function("sorted-set-by", &native_sorted_set_by, false));
+	env->set("sorted?", new_node_native_function("sorted?", &native_is_sorted, false));
+	env->set("subseq", new_node_native_function("subseq", &native_subseq, false));
+	env->set("rsubseq", new_node_native_function("rsubseq", &native_rsubseq, false));
+}
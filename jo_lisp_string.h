@@ -9,16 +9,24 @@ static node_idx_t native_str(env_ptr_t env, list_ptr_t args) {
 		node_t *n = get_node(*it);
 		str += n->as_string();
 	}
-	return new_node_string(str);
+	return new_node_string(std::move(str));
 }
 
 // Returns the substring of ‘s’ beginning at start inclusive, and ending at end (defaults to length of string), exclusive.
+// Only the substring is copied, out of the string node itself.
 static node_idx_t native_subs(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it = args->begin();
     node_t *node = get_node(*it++);
-    node_t *start = get_node(*it++);
-    node_t *end = get_node(*it++);
-    return new_node_string(node->as_string().substr(start->as_int(), end->as_int()));
+    jo_string tmp;
+    const jo_string &str = node->is_string() ? node->t_string : (tmp = node->as_string());
+    size_t len = str.size();
+    int start = get_node(*it++)->as_int();
+    int end = it ? get_node(*it++)->as_int() : (int)len;
+    if(start < 0 || end < start || (size_t)end > len) {
+        warnf("subs: range %d..%d is out of bounds\n", start, end);
+        return NIL_NODE;
+    }
+    return new_node_string(jo_string(str.c_str() + start, end - start));
 }
 
 static node_idx_t native_compare(env_ptr_t env, list_ptr_t args) {
@@ -88,18 +96,17 @@ static node_idx_t native_split_lines(env_ptr_t env, list_ptr_t args) {
 	if(!node->is_string()) {
 		return NIL_NODE;
 	}
-	jo_string str = node->as_string();
+	// lines are cut straight out of the node's string, each copied once
+	const char *p = node->t_string.c_str();
+	const char *end = p + node->t_string.size();
 	list_ptr_t list_list = new_list();
-	int pos = 0;
-	int prev_pos = 0;
-	while(pos != jo_string_npos) {
-		pos = str.find('\n', prev_pos);
-		if(pos == jo_string_npos) {
-			list_list->push_back_inplace(new_node_string(str.substr(prev_pos)));
-		} else {
-			list_list->push_back_inplace(new_node_string(str.substr(prev_pos, pos - prev_pos)));
+	for(;;) {
+		const char *nl = jo_simd_find_first_of(p, end, "\n", 1);
+		list_list->push_back_inplace(new_node_string(jo_string(p, nl - p)));
+		if(nl == end) {
+			break;
 		}
-		prev_pos = pos + 1;
+		p = nl + 1;
 	}
 	return new_node_list(list_list);
 }
@@ -122,7 +129,7 @@ static node_idx_t native_join(env_ptr_t env, list_ptr_t args) {
             str += sep;
         }
     }
-    return new_node_string(str);
+    return new_node_string(std::move(str));
 }
 
 // True if s is nil, empty, or contains only whitespace.
@@ -11,6 +11,7 @@ static node_idx_t native_system_exec(env_ptr_t env, list_ptr_t args) {
 		str += n->as_string();
 	}
 	//printf("system_exec: %s\n", str.c_str());
+	out_flush();
 	int ret = system(str.c_str());
 	return new_node_int(ret);
 }
@@ -114,27 +115,44 @@ static node_idx_t native_system_kbhit(env_ptr_t env, list_ptr_t args) {
 }
 
 static node_idx_t native_system_getch(env_ptr_t env, list_ptr_t args) {
+    out_flush();
     return new_node_int(jo_getch());
 }
 
+// (slurp f)
+// Reads the whole file f into a string. The file is mapped and copied once, straight
+// into the string node.
 static node_idx_t native_system_slurp(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it = args->begin();
     node_idx_t node_idx = *it++;
     node_t *node = get_node(node_idx);
     jo_string path = node->as_string();
-    jo_string contents = (char*)jo_slurp_file(path.c_str());
-    return new_node_string(contents);
-}
-
+    jo_mmap_file file;
+    if(!file.open(path.c_str())) {
+        warnf("slurp: can't read %s\n", path.c_str());
+        return NIL_NODE;
+    }
+    return new_node_string(jo_string(file.data, file.size));
+}
+
+// (spit f content & options)
+// Writes content to the file f, emptying it first unless given :append true.
+// A string or number is written as str would. The elements of a list, vector
+// or lazy seq are written one after another, as they're realized, so a lazy
+// seq streams out without being held in memory. Collections in it, and maps
+// and sets, are written in their readable form. Returns false if anything
+// couldn't be written.
 static node_idx_t native_system_spit(env_ptr_t env, list_ptr_t args) {
     list_t::iterator it = args->begin();
-    node_idx_t node_idx = *it++;
-    node_t *node = get_node(node_idx);
-    jo_string path = node->as_string();
+    jo_string path = get_node(*it++)->as_string();
     node_idx_t contents_idx = *it++;
-    node_t *contents = get_node(contents_idx);
-    jo_string contents_str = contents->as_string();
-    return new_node_bool(jo_spit_file(path.c_str(), contents_str.c_str()) == 0);
+    io_ptr_t io = io_open_writer(path, io_append_option(it));
+    if(!io.ptr) {
+        return new_node_bool(false);
+    }
+    io_write(env, io.ptr, contents_idx);
+    jo_lock_guard guard(io->mutex);
+    return new_node_bool(io->close());
 }
 
 static node_idx_t native_system_date(env_ptr_t env, list_ptr_t args) {
@@ -145,11 +163,15 @@ static node_idx_t native_system_date(env_ptr_t env, list_ptr_t args) {
     return new_node_string(buf);
 }
 
-// reads a single line from stdin
+// (read-line)(read-line rdr)
+// Reads the next line from stdin, or from rdr, of any length and without its line
+// ending. nil at the end.
 static node_idx_t native_system_read_line(env_ptr_t env, list_ptr_t args) {
-    char line[1024];
-    fgets(line, sizeof(line), stdin);
-    return new_node_string(line);
+    if(args->size()) {
+        node_t *n = get_node(args->first_value());
+        return n->is_io() && n->t_io.ptr ? io_read_line(n->t_io.ptr) : NIL_NODE;
+    }
+    return io_read_line(io_stdin().ptr);
 }
 
 static node_idx_t native_system_sleep(env_ptr_t env, list_ptr_t args) {
@@ -0,0 +1,491 @@
+#pragma once
+
+#include "jo_stdcpp.h"
+
+// Dense tensors of doubles. Element-wise ops broadcast like numpy: shapes are lined up from
+// the right, and each pair of dimensions must match or be 1. The innermost loop of every op
+// runs through the SIMD kernels in jo_stdcpp.h. A tensor is a seq of its rows, so count, nth,
+// first and = treat it like nested vectors.
+//
+// Builtins are looked up as the source is parsed, so a global named sum or shape would take
+// the place of any local of that name. All but tensor, tensor? and matmul are under tensor/.
+
+enum {
+	TENSOR_SUM,
+	TENSOR_MEAN,
+	TENSOR_MAX,
+	TENSOR_MIN,
+};
+
+// the shape of nested seqs of numbers, following the first element at each level
+static int tensor_shape_of(env_ptr_t env, node_idx_t idx, size_t *shape) {
+	int rank = 0;
+	node_t *n = get_node(idx);
+	while(n->is_seq() && !n->is_tensor()) {
+		if(rank == TENSOR_MAX_RANK) {
+			return -1;
+		}
+		seq_iterator_t it(env, idx);
+		size_t count = 0;
+		node_idx_t first = it ? it.val : NIL_NODE;
+		for(; it; it.next()) {
+			count++;
+		}
+		shape[rank++] = count;
+		if(count == 0) {
+			return rank;
+		}
+		idx = first;
+		n = get_node(idx);
+	}
+	if(n->is_tensor()) {
+		for(int i = 0; i < n->t_tensor->rank; i++) {
+			if(rank == TENSOR_MAX_RANK) {
+				return -1;
+			}
+			shape[rank++] = n->t_tensor->shape[i];
+		}
+	}
+	return rank;
+}
+
+// copies nested seqs into out, row-major. false if they are ragged.
+static bool tensor_fill(env_ptr_t env, node_idx_t idx, const size_t *shape, int rank, double *&out) {
+	node_t *n = get_node(idx);
+	if(rank == 0) {
+		if(n->is_seq()) {
+			return false;
+		}
+		*out++ = n->as_float();
+		return true;
+	}
+	if(n->is_tensor()) {
+		const tensor_t *t = n->t_tensor.ptr;
+		if(t->rank != rank) {
+			return false;
+		}
+		for(int i = 0; i < rank; i++) {
+			if(t->shape[i] != shape[i]) {
+				return false;
+			}
+		}
+		t->each([&](const size_t *index, double x) { *out++ = x; });
+		return true;
+	}
+	if(!n->is_seq()) {
+		return false;
+	}
+	size_t count = 0;
+	for(seq_iterator_t it(env, idx); it; it.next()) {
+		if(++count > shape[0] || !tensor_fill(env, it.val, shape + 1, rank - 1, out)) {
+			return false;
+		}
+	}
+	return count == shape[0];
+}
+
+// Numbers become 0-d tensors, nested seqs are copied in. false if idx is neither.
+static bool node_to_tensor(env_ptr_t env, node_idx_t idx, tensor_t &out) {
+	node_t *n = get_node(idx);
+	if(n->is_tensor()) {
+		out = *n->t_tensor;
+		return true;
+	}
+	if(n->type == NODE_INT || n->type == NODE_FLOAT) {
+		out = tensor_t(0, NULL);
+		out.ptr()[0] = n->as_float();
+		return true;
+	}
+	if(!n->is_seq()) {
+		return false;
+	}
+	size_t shape[TENSOR_MAX_RANK];
+	int rank = tensor_shape_of(env, idx, shape);
+	if(rank < 0) {
+		return false;
+	}
+	out = tensor_t(rank, shape);
+	double *p = out.ptr();
+	return tensor_fill(env, idx, shape, rank, p);
+}
+
+// 0-d results come back as plain numbers
+static node_idx_t new_node_tensor_or_float(const tensor_t &t) {
+	if(t.rank == 0) {
+		return new_node_float(t.ptr()[0]);
+	}
+	return new_node_tensor(new tensor_t(t));
+}
+
+static bool tensor_broadcast(int op, const tensor_t &a, const tensor_t &b, tensor_t &out) {
+	int rank = a.rank > b.rank ? a.rank : b.rank;
+	size_t shape[TENSOR_MAX_RANK], sa[TENSOR_MAX_RANK], sb[TENSOR_MAX_RANK];
+	for(int d = 0; d < rank; d++) {
+		int da = d - (rank - a.rank), db = d - (rank - b.rank);
+		size_t na = da >= 0 ? a.shape[da] : 1;
+		size_t nb = db >= 0 ? b.shape[db] : 1;
+		if(na != nb && na != 1 && nb != 1) {
+			return false;
+		}
+		shape[d] = na > nb ? na : nb;
+		// a dimension of 1 repeats its one element, by not stepping
+		sa[d] = na == 1 ? 0 : a.strides[da];
+		sb[d] = nb == 1 ? 0 : b.strides[db];
+	}
+	out = tensor_t(rank, shape);
+	size_t inner = rank ? shape[rank-1] : 1;
+	size_t ia = rank ? sa[rank-1] : 0, ib = rank ? sb[rank-1] : 0;
+	size_t outer = inner ? out.size() / inner : 0;
+	size_t index[TENSOR_MAX_RANK] = {};
+	double *pa = a.ptr(), *pb = b.ptr(), *po = out.ptr();
+	for(size_t row = 0; row < outer; row++) {
+		size_t oa = 0, ob = 0;
+		for(int d = 0; d < rank - 1; d++) {
+			oa += index[d] * sa[d];
+			ob += index[d] * sb[d];
+		}
+		jo_simd_binop(op, pa + oa, ia, pb + ob, ib, po + row * inner, inner);
+		for(int d = rank - 2; d >= 0; d--) {
+			if(++index[d] < shape[d]) {
+				break;
+			}
+			index[d] = 0;
+		}
+	}
+	return true;
+}
+
+// folds op over the arguments left to right, with broadcasting
+static node_idx_t tensor_binop(env_ptr_t env, list_ptr_t args, int op, const char *name) {
+	list_t::iterator it = args->begin();
+	tensor_t acc;
+	if(!it || !node_to_tensor(env, *it++, acc)) {
+		warnf("%s: expected tensors or numbers\n", name);
+		return NIL_NODE;
+	}
+	for(; it; it++) {
+		tensor_t b, out;
+		if(!node_to_tensor(env, *it, b)) {
+			warnf("%s: expected tensors or numbers\n", name);
+			return NIL_NODE;
+		}
+		if(!tensor_broadcast(op, acc, b, out)) {
+			warnf("%s: shapes can't be broadcast together\n", name);
+			return NIL_NODE;
+		}
+		acc = out;
+	}
+	return new_node_tensor_or_float(acc);
+}
+
+static double tensor_reduce_init(int op) {
+	switch(op) {
+	case TENSOR_MAX: return -INFINITY;
+	case TENSOR_MIN: return INFINITY;
+	}
+	return 0;
+}
+
+static double tensor_reduce_step(int op, double acc, double x) {
+	switch(op) {
+	case TENSOR_MAX: return x > acc ? x : acc;
+	case TENSOR_MIN: return x < acc ? x : acc;
+	}
+	return acc + x;
+}
+
+// reduces the whole tensor, or along one axis when one is given
+static node_idx_t tensor_reduce(env_ptr_t env, list_ptr_t args, int op, const char *name) {
+	list_t::iterator it = args->begin();
+	tensor_t t;
+	if(!it || !node_to_tensor(env, *it++, t)) {
+		warnf("%s: expected a tensor\n", name);
+		return NIL_NODE;
+	}
+	if(!it) {
+		size_t n = t.size();
+		double acc;
+		if((op == TENSOR_SUM || op == TENSOR_MEAN) && t.is_contiguous()) {
+			acc = jo_simd_sum(t.ptr(), n);
+		} else {
+			acc = tensor_reduce_init(op);
+			t.each([&](const size_t *index, double x) { acc = tensor_reduce_step(op, acc, x); });
+		}
+		return new_node_float(op == TENSOR_MEAN ? acc / n : acc);
+	}
+	int axis = get_node(*it++)->as_int();
+	if(axis < 0) {
+		axis += t.rank;
+	}
+	if(axis < 0 || axis >= t.rank) {
+		warnf("%s: axis out of range\n", name);
+		return NIL_NODE;
+	}
+	size_t shape[TENSOR_MAX_RANK];
+	for(int d = 0, o = 0; d < t.rank; d++) {
+		if(d != axis) {
+			shape[o++] = t.shape[d];
+		}
+	}
+	tensor_t out(t.rank - 1, shape);
+	double *po = out.ptr();
+	size_t out_size = out.size();
+	for(size_t i = 0; i < out_size; i++) {
+		po[i] = tensor_reduce_init(op);
+	}
+	t.each([&](const size_t *index, double x) {
+		size_t off = 0;
+		for(int d = 0, o = 0; d < t.rank; d++) {
+			if(d != axis) {
+				off += index[d] * out.strides[o++];
+			}
+		}
+		po[off] = tensor_reduce_step(op, po[off], x);
+	});
+	if(op == TENSOR_MEAN) {
+		for(size_t i = 0; i < out_size; i++) {
+			po[i] /= t.shape[axis];
+		}
+	}
+	return new_node_tensor_or_float(out);
+}
+
+// (tensor coll)
+// Returns a tensor holding the numbers in coll, which are nested
+// seqs (vectors, lists, vector-of or tensors) of equal length at each
+// level. The shape follows the nesting.
+static node_idx_t native_tensor(env_ptr_t env, list_ptr_t args) {
+	tensor_t t;
+	if(!node_to_tensor(env, args->first_value(), t) || t.rank == 0) {
+		warnf("tensor: expected nested seqs of numbers, of the same length at each level\n");
+		return NIL_NODE;
+	}
+	return new_node_tensor(new tensor_t(t));
+}
+
+// shape given as a seq of ints
+static bool tensor_shape_arg(env_ptr_t env, node_idx_t idx, size_t *shape, int &rank) {
+	rank = 0;
+	if(!get_node(idx)->is_seq()) {
+		return false;
+	}
+	for(seq_iterator_t it(env, idx); it; it.next()) {
+		int dim = get_node(it.val)->as_int();
+		if(rank == TENSOR_MAX_RANK || dim < 0) {
+			return false;
+		}
+		shape[rank++] = dim;
+	}
+	return rank > 0;
+}
+
+static node_idx_t tensor_filled(env_ptr_t env, list_ptr_t args, double value, const char *name) {
+	size_t shape[TENSOR_MAX_RANK];
+	int rank;
+	if(!tensor_shape_arg(env, args->first_value(), shape, rank)) {
+		warnf("%s: expected a shape, like [2 3]\n", name);
+		return NIL_NODE;
+	}
+	tensor_t *t = new tensor_t(rank, shape);
+	double *p = t->ptr();
+	for(size_t i = 0, n = t->size(); i < n; i++) {
+		p[i] = value;
+	}
+	return new_node_tensor(t);
+}
+
+// (tensor/zeros shape)
+// Returns a tensor of the given shape, such as [2 3], filled with 0.
+static node_idx_t native_zeros(env_ptr_t env, list_ptr_t args) { return tensor_filled(env, args, 0, "tensor/zeros"); }
+
+// (tensor/ones shape)
+// Returns a tensor of the given shape, such as [2 3], filled with 1.
+static node_idx_t native_ones(env_ptr_t env, list_ptr_t args) { return tensor_filled(env, args, 1, "tensor/ones"); }
+
+// (tensor? x)
+// Returns true if x is a tensor
+static node_idx_t native_is_tensor(env_ptr_t env, list_ptr_t args) {
+	return new_node_bool(get_node(args->first_value())->is_tensor());
+}
+
+// (tensor/shape t)
+// Returns the dimensions of tensor t as a vector of ints.
+static node_idx_t native_shape(env_ptr_t env, list_ptr_t args) {
+	tensor_t t;
+	if(!node_to_tensor(env, args->first_value(), t)) {
+		return NIL_NODE;
+	}
+	vector_ptr_t ret = new_vector();
+	for(int d = 0; d < t.rank; d++) {
+		ret->push_back_inplace(new_node_int((int)t.shape[d]));
+	}
+	return new_node_vector(ret);
+}
+
+// (tensor/reshape t shape)
+// Returns the elements of t, in row-major order, as a tensor of the
+// given shape. Both must hold the same number of elements.
+static node_idx_t native_reshape(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	tensor_t t;
+	size_t shape[TENSOR_MAX_RANK];
+	int rank;
+	if(!node_to_tensor(env, *it++, t) || !it || !tensor_shape_arg(env, *it++, shape, rank)) {
+		warnf("tensor/reshape: expected a tensor and a shape\n");
+		return NIL_NODE;
+	}
+	tensor_t *ret = new tensor_t(t.contiguous());
+	size_t size = ret->size();
+	ret->rank = rank;
+	for(int d = 0; d < rank; d++) {
+		ret->shape[d] = shape[d];
+	}
+	if(ret->size() != size) {
+		delete ret;
+		warnf("tensor/reshape: the new shape must hold as many elements as the old\n");
+		return NIL_NODE;
+	}
+	ret->set_row_major_strides();
+	return new_node_tensor(ret);
+}
+
+// (tensor/transpose t)
+// Returns t with its axes reversed, so rows become columns. This is a
+// view sharing t's elements, not a copy.
+static node_idx_t native_transpose(env_ptr_t env, list_ptr_t args) {
+	tensor_t t;
+	if(!node_to_tensor(env, args->first_value(), t) || t.rank == 0) {
+		warnf("tensor/transpose: expected a tensor\n");
+		return NIL_NODE;
+	}
+	tensor_t *ret = new tensor_t(t);
+	for(int d = 0; d < t.rank; d++) {
+		ret->shape[d] = t.shape[t.rank - 1 - d];
+		ret->strides[d] = t.strides[t.rank - 1 - d];
+	}
+	return new_node_tensor(ret);
+}
+
+// (tensor/add a b & more)
+// Element-wise sum of tensors or numbers, broadcasting as needed.
+static node_idx_t native_tensor_add(env_ptr_t env, list_ptr_t args) { return tensor_binop(env, args, JO_SIMD_ADD, "tensor/add"); }
+
+// (tensor/sub a b & more)
+// Element-wise difference of tensors or numbers, broadcasting as needed.
+static node_idx_t native_tensor_sub(env_ptr_t env, list_ptr_t args) { return tensor_binop(env, args, JO_SIMD_SUB, "tensor/sub"); }
+
+// (tensor/mul a b & more)
+// Element-wise product of tensors or numbers, broadcasting as needed.
+static node_idx_t native_tensor_mul(env_ptr_t env, list_ptr_t args) { return tensor_binop(env, args, JO_SIMD_MUL, "tensor/mul"); }
+
+// (tensor/div a b & more)
+// Element-wise quotient of tensors or numbers, broadcasting as needed.
+static node_idx_t native_tensor_div(env_ptr_t env, list_ptr_t args) { return tensor_binop(env, args, JO_SIMD_DIV, "tensor/div"); }
+
+// (tensor/sum t)(tensor/sum t axis)
+// Sum of all elements of t, or a tensor of the sums along axis.
+static node_idx_t native_tensor_sum(env_ptr_t env, list_ptr_t args) { return tensor_reduce(env, args, TENSOR_SUM, "tensor/sum"); }
+
+// (tensor/mean t)(tensor/mean t axis)
+// Mean of all elements of t, or a tensor of the means along axis.
+static node_idx_t native_tensor_mean(env_ptr_t env, list_ptr_t args) { return tensor_reduce(env, args, TENSOR_MEAN, "tensor/mean"); }
+
+// (tensor/amax t)(tensor/amax t axis)
+// Largest element of t, or a tensor of the largest along axis.
+static node_idx_t native_tensor_amax(env_ptr_t env, list_ptr_t args) { return tensor_reduce(env, args, TENSOR_MAX, "tensor/amax"); }
+
+// (tensor/amin t)(tensor/amin t axis)
+// Smallest element of t, or a tensor of the smallest along axis.
+static node_idx_t native_tensor_amin(env_ptr_t env, list_ptr_t args) { return tensor_reduce(env, args, TENSOR_MIN, "tensor/amin"); }
+
+// (matmul a b)(Math/matmul a b)
+// Matrix product of 2-d tensors a and b. A 1-d a is taken as a row,
+// a 1-d b as a column, and that dimension is dropped from the result.
+// Large products are blocked for cache and split across cores.
+static node_idx_t native_matmul(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	tensor_t a, b;
+	if(!node_to_tensor(env, *it++, a) || !it || !node_to_tensor(env, *it++, b) || a.rank < 1 || a.rank > 2 || b.rank < 1 || b.rank > 2) {
+		warnf("matmul: expected 1-d or 2-d tensors\n");
+		return NIL_NODE;
+	}
+	a = a.contiguous();
+	b = b.contiguous();
+	bool row = a.rank == 1, col = b.rank == 1;
+	if(row) {
+		a.rank = 2;
+		a.shape[1] = a.shape[0];
+		a.shape[0] = 1;
+		a.set_row_major_strides();
+	}
+	if(col) {
+		b.rank = 2;
+		b.shape[1] = 1;
+		b.set_row_major_strides();
+	}
+	if(a.shape[1] != b.shape[0]) {
+		warnf("matmul: inner dimensions differ\n");
+		return NIL_NODE;
+	}
+	size_t shape[2] = {a.shape[0], b.shape[1]};
+	tensor_t c(2, shape);
+	jo_gemm(shape[0], shape[1], a.shape[1], a.ptr(), a.shape[1], b.ptr(), b.shape[1], c.ptr(), shape[1]);
+	if(row || col) {
+		// drop the dimension the 1-d argument stood for
+		c.rank = 1;
+		c.shape[0] = row ? shape[1] : shape[0];
+		if(row && col) {
+			c.rank = 0;
+		}
+		c.set_row_major_strides();
+	}
+	return new_node_tensor_or_float(c);
+}
+
+// (tensor/dot a b)
+// Dot product of 1-d tensors (or seqs) a and b. For 2-d arguments it
+// is the matrix product, as matmul.
+static node_idx_t native_dot(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	tensor_t a, b;
+	if(!node_to_tensor(env, *it++, a) || !it || !node_to_tensor(env, *it++, b)) {
+		warnf("tensor/dot: expected two tensors\n");
+		return NIL_NODE;
+	}
+	if(a.rank != 1 || b.rank != 1) {
+		return native_matmul(env, args);
+	}
+	if(a.shape[0] != b.shape[0]) {
+		warnf("tensor/dot: lengths differ\n");
+		return NIL_NODE;
+	}
+	size_t n = a.shape[0];
+	if(a.strides[0] == 1 && b.strides[0] == 1) {
+		return new_node_float(jo_simd_dot(a.ptr(), b.ptr(), n));
+	}
+	double sum = 0;
+	for(size_t i = 0; i < n; i++) {
+		sum += a.ptr()[i * a.strides[0]] * b.ptr()[i * b.strides[0]];
+	}
+	return new_node_float(sum);
+}
+
+void jo_lisp_tensor_init(env_ptr_t env) {
+	env->set("tensor", new_node_native_function("tensor", &native_tensor, false));
+	env->set("tensor?", new_node_native_function("tensor?", &native_is_tensor, false));
+	env->set("tensor/zeros", new_node_native_function("tensor/zeros", &native_zeros, false));
+	env->set("tensor/ones", new_node_native_function("tensor/ones", &native_ones, false));
+	env->set("tensor/shape", new_node_native_function("tensor/shape", &native_shape, false));
+	env->set("tensor/reshape", new_node_native_function("tensor/reshape", &native_reshape, false));
+	env->set("tensor/transpose", new_node_native_function("tensor/transpose", &native_transpose, false));
+	env->set("tensor/add", new_node_native_function("tensor/add", &native_tensor_add, false));
+	env->set("tensor/sub", new_node_native_function("tensor/sub", &native_tensor_sub, false));
+	env->set("tensor/mul", new_node_native_function("tensor/mul", &native_tensor_mul, false));
+	env->set("tensor/div", new_node_native_function("tensor/div", &native_tensor_div, false));
+	env->set("tensor/sum", new_node_native_function("tensor/sum", &native_tensor_sum, false));
+	env->set("tensor/mean", new_node_native_function("tensor/mean", &native_tensor_mean, false));
+	env->set("tensor/amax", new_node_native_function("tensor/amax", &native_tensor_amax, false));
+	env->set("tensor/amin", new_node_native_function("tensor/amin", &native_tensor_amin, false));
+	env->set("tensor/dot", new_node_native_function("tensor/dot", &native_dot, false));
+	env->set("matmul", new_node_native_function("matmul", &native_matmul, false));
+}
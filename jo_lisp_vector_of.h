@@ -0,0 +1,48 @@
+#pragma once
+
+#include "jo_stdcpp.h"
+
+// Vectors of a single primitive type. The numbers sit unboxed in the leaves, 32 to a leaf,
+// instead of as a node each, so a million doubles take megabytes rather than a hundred.
+// They are boxed only on the way out (nth, seq). count, conj, assoc and friends work on
+// them like any vector, reduce with + * Math/min Math/max and map with the Math functions
+// run straight over the raw numbers.
+
+// :long and :short are held as :int, which is as wide as the interpreter's integers
+static int vector_of_kind(node_idx_t t) {
+	jo_string name = get_node_string(t);
+	if(name == "double" || name == "float") {
+		return VECTOR_OF_DOUBLE;
+	}
+	if(name == "int" || name == "long" || name == "short") {
+		return VECTOR_OF_INT;
+	}
+	if(name == "byte") {
+		return VECTOR_OF_BYTE;
+	}
+	return -1;
+}
+
+// (vector-of t)(vector-of t & elements)
+// Creates a new vector of a single primitive type t, where t is one
+// of :int :long :float :double :byte.  The
+// resulting vector complies with the interface of vectors in general,
+// but stores the values unboxed internally.
+// Optionally takes one or more elements to populate the vector.
+static node_idx_t native_vector_of(env_ptr_t env, list_ptr_t args) {
+	list_t::iterator it = args->begin();
+	int kind = vector_of_kind(*it++);
+	if(kind < 0) {
+		warnf("vector-of: expected one of :int :long :float :double :byte\n");
+		return NIL_NODE;
+	}
+	vector_of_ptr_t nums = new vector_of_t(kind);
+	for(; it; it++) {
+		nums->push_back_inplace(get_node(*it)->as_float());
+	}
+	return new_node_vector_of(nums);
+}
+
+void jo_lisp_vector_of_init(env_ptr_t env) {
+	env->set("vector-of", new_node_native_function("vector-of", &native_vector_of, false));
+}
@@ -38,6 +38,7 @@
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #ifdef _MSC_VER
 #include <conio.h>
@@ -50,11 +51,15 @@
 #include <mach/mach_time.h>
 #include <unistd.h>
 #include <termios.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #define jo_strdup strdup
 #define jo_chdir chdir
 #else
 #include <unistd.h>
 #include <termios.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #define jo_strdup strdup
 #define jo_chdir chdir
 #endif
@@ -239,6 +244,79 @@ static int jo_spit_file(const char *path, const char *data)
     return jo_spit_file(path, data, strlen(data));
 }
 
+// A whole file, read-only, memory mapped where the platform allows and read in otherwise.
+// The bytes are not 0 terminated.
+struct jo_mmap_file {
+    const char *data;
+    size_t size;
+    bool mapped;
+#ifdef _MSC_VER
+    HANDLE file, mapping;
+#endif
+
+    jo_mmap_file() : data(), size(), mapped() {}
+    ~jo_mmap_file() { close(); }
+
+    bool open(const char *path) {
+        close();
+#ifdef _MSC_VER
+        file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if(file != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER fsize;
+            GetFileSizeEx(file, &fsize);
+            size = (size_t)fsize.QuadPart;
+            mapping = size ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+            data = mapping ? (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+            if(data) {
+                mapped = true;
+                return true;
+            }
+            if(mapping) CloseHandle(mapping);
+            CloseHandle(file);
+        }
+#else
+        int fd = ::open(path, O_RDONLY);
+        if(fd >= 0) {
+            struct stat st;
+            if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(p != MAP_FAILED) {
+                    ::close(fd);
+                    data = (const char *)p;
+                    size = (size_t)st.st_size;
+                    mapped = true;
+                    return true;
+                }
+            }
+            ::close(fd);
+        }
+#endif
+        // empty files, pipes and devices can't be mapped
+        data = (const char *)jo_slurp_file(path, &size);
+        return data != NULL;
+    }
+
+    void close() {
+        if(!data) {
+            return;
+        }
+        if(!mapped) {
+            free((void *)data);
+        } else {
+#ifdef _MSC_VER
+            UnmapViewOfFile(data);
+            CloseHandle(mapping);
+            CloseHandle(file);
+#else
+            munmap((void *)data, size);
+#endif
+        }
+        data = NULL;
+        size = 0;
+        mapped = false;
+    }
+};
+
 static int jo_tolower(int c)
 {
     if(c >= 'A' && c <= 'Z') return c + 32;
@@ -251,6 +329,15 @@ static int jo_toupper(int c)
     return c;
 }
 
+static bool jo_isatty(FILE *fp)
+{
+#ifdef _MSC_VER
+    return _isatty(_fileno(fp)) != 0;
+#else
+    return isatty(fileno(fp)) != 0;
+#endif
+}
+
 static int jo_isspace(int c)
 {
     return (c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r');
@@ -421,6 +508,61 @@ void jo_random_shuffle(T *begin, T *end) {
     }
 }
 
+// writes v in decimal to buf, which needs room for 21 chars, and returns the length
+static int jo_format_int(char *buf, long long v) {
+    char tmp[24];
+    int n = 0;
+    unsigned long long u = v < 0 ? 0ull - (unsigned long long)v : (unsigned long long)v;
+    do {
+        tmp[n++] = (char)('0' + u % 10);
+        u /= 10;
+    } while(u);
+    int len = 0;
+    if(v < 0) {
+        buf[len++] = '-';
+    }
+    while(n) {
+        buf[len++] = tmp[--n];
+    }
+    buf[len] = 0;
+    return len;
+}
+
+enum {
+    JO_FORMAT_FLOAT_MAX = 320,
+};
+
+// writes v to buf the way printf's "%f" does, and returns the length. buf needs room for
+// JO_FORMAT_FLOAT_MAX chars. Numbers under a million are done by hand, unless they are so
+// near a tie that rounding them could disagree with printf, which does the rest.
+static int jo_format_float(char *buf, double v) {
+    double a = v < 0 ? -v : v;
+    if(a < 1e6) {
+        // a*1e6 < 2^40, so it is within 2^-12 of exact
+        double scaled = a * 1e6;
+        double whole = floor(scaled);
+        double frac = scaled - whole;
+        if(frac < 0.499 || frac > 0.501) {
+            unsigned long long n = (unsigned long long)whole + (frac > 0.5);
+            int len = 0;
+            if(signbit(v)) {
+                buf[len++] = '-';
+            }
+            len += jo_format_int(buf + len, (long long)(n / 1000000));
+            buf[len++] = '.';
+            unsigned long long decimals = n % 1000000;
+            for(int i = 5; i >= 0; i--) {
+                buf[len + i] = (char)('0' + decimals % 10);
+                decimals /= 10;
+            }
+            len += 6;
+            buf[len] = 0;
+            return len;
+        }
+    }
+    return snprintf(buf, JO_FORMAT_FLOAT_MAX, "%f", v);
+}
+
 struct jo_string {
     char *str;
     
@@ -469,6 +611,15 @@ struct jo_string {
         return *this;
     }
 
+    jo_string &operator=(jo_string &&s) {
+        if(this != &s) {
+            free(str);
+            str = s.str;
+            s.str = NULL;
+        }
+        return *this;
+    }
+
     jo_string &operator+=(const char *s) {
         size_t l0 = strlen(str);
         size_t l1 = strlen(s);
@@ -814,6 +965,59 @@ struct jo_stringstream {
     }
 };
 
+// bytes appended with memcpy, for building output. Unlike jo_vector, clear keeps the
+// memory for the next round.
+struct jo_byte_buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+
+    jo_byte_buffer() : data(), size(), capacity() {}
+    ~jo_byte_buffer() { free(data); }
+
+    bool reserve(size_t n) {
+        if(n <= capacity) {
+            return true;
+        }
+        size_t c = capacity ? capacity : 256;
+        while(c < n) {
+            c *= 2;
+        }
+        char *p = (char *)realloc(data, c);
+        if(!p) {
+            // malloc failed!
+            return false;
+        }
+        data = p;
+        capacity = c;
+        return true;
+    }
+
+    void write(const void *s, size_t n) {
+        if(!n) {
+            return;
+        }
+        if(size + n > capacity && !reserve(size + n)) {
+            return;
+        }
+        memcpy(data + size, s, n);
+        size += n;
+    }
+
+    void put(char c) {
+        if(size == capacity && !reserve(size + 1)) {
+            return;
+        }
+        data[size++] = c;
+    }
+
+    void clear() { size = 0; }
+
+private:
+    jo_byte_buffer(const jo_byte_buffer &);
+    jo_byte_buffer &operator=(const jo_byte_buffer &);
+};
+
 template<typename T> static inline T jo_min(T a, T b) { return a < b ? a : b; }
 template<typename T> static inline T jo_max(T a, T b) { return a > b ? a : b; }
 
@@ -883,7 +1087,7 @@ struct jo_vector {
                 return;
             }
             if(ptr) {
-                memcpy(newptr, ptr, ptr_size*sizeof(T));
+                memcpy((void*)newptr, (const void*)ptr, ptr_size*sizeof(T));
                 //memset(ptr, 0xFE, ptr_size*sizeof(T));
                 free(ptr);
             }
@@ -927,7 +1131,7 @@ struct jo_vector {
                 return;
             }
             if(ptr) {
-                memcpy(newptr, ptr, ptr_size*sizeof(T));
+                memcpy((void*)newptr, (const void*)ptr, ptr_size*sizeof(T));
                 //memset(ptr, 0xFE, ptr_size*sizeof(T));
                 free(ptr);
             }
@@ -945,7 +1149,7 @@ struct jo_vector {
         }
 
         // insert begin/middle means we need to move the data past where to the right, and insert how_many there...
-        memmove(ptr + where_at + how_many, ptr + where_at, sizeof(T)*(ptr_size - where_at));
+        memmove((void*)(ptr + where_at + how_many), (const void*)(ptr + where_at), sizeof(T)*(ptr_size - where_at));
         for(size_t i = where_at; i < where_at + how_many; ++i) {
             new(ptr+i) T(what[i - where_at]);
         }
@@ -1153,7 +1357,40 @@ static inline double jo_time() {
 
 #ifdef _MSC_VER
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
 #define jo_mutex std::mutex
+#define jo_condition_variable std::condition_variable_any
+
+static inline void jo_condition_variable_wait_for(jo_condition_variable &cv, jo_mutex &mutex, double seconds) {
+    cv.wait_for(mutex, std::chrono::duration<double>(seconds));
+}
+
+class jo_thread {
+    std::thread thread;
+public:
+    jo_thread(void (*fn)(void *), void *arg) : thread(fn, arg) {}
+    void join() { thread.join(); }
+};
+
+static inline int jo_hardware_concurrency() { return (int)std::thread::hardware_concurrency(); }
+
+static inline int jo_atomic_add(volatile int *ptr, int value) { return (int)_InterlockedExchangeAdd((volatile long *)ptr, value) + value; }
+static inline int jo_atomic_load(volatile int *ptr) { return (int)_InterlockedOr((volatile long *)ptr, 0); }
+static inline void jo_atomic_store(volatile int *ptr, int value) { _InterlockedExchange((volatile long *)ptr, value); }
+static inline size_t jo_atomic_load(volatile size_t *ptr) { return (size_t)_InterlockedOr64((volatile __int64 *)ptr, 0); }
+static inline void jo_atomic_store(volatile size_t *ptr, size_t value) { _InterlockedExchange64((volatile __int64 *)ptr, (__int64)value); }
+
+#include <shared_mutex>
+class jo_rwlock {
+    std::shared_mutex mutex;
+public:
+    void lock_shared() { mutex.lock_shared(); }
+    void unlock_shared() { mutex.unlock_shared(); }
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+};
 #else
 #include <pthread.h>
 class jo_mutex {
@@ -1163,6 +1400,69 @@ public:
     ~jo_mutex() { pthread_mutex_destroy(&mutex); }
     void lock() { pthread_mutex_lock(&mutex); }
     void unlock() { pthread_mutex_unlock(&mutex); }
+    pthread_mutex_t *native_handle() { return &mutex; }
+};
+
+class jo_condition_variable {
+    pthread_cond_t cond;
+public:
+    jo_condition_variable() { pthread_cond_init(&cond, nullptr); }
+    ~jo_condition_variable() { pthread_cond_destroy(&cond); }
+    void wait(jo_mutex &mutex) { pthread_cond_wait(&cond, mutex.native_handle()); }
+    void notify_one() { pthread_cond_signal(&cond); }
+    void notify_all() { pthread_cond_broadcast(&cond); }
+    pthread_cond_t *native_handle() { return &cond; }
+};
+
+static inline void jo_condition_variable_wait_for(jo_condition_variable &cv, jo_mutex &mutex, double seconds) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long long ns = ts.tv_nsec + (long long)(seconds * 1000000000.0);
+    ts.tv_sec += (time_t)(ns / 1000000000);
+    ts.tv_nsec = (long)(ns % 1000000000);
+    pthread_cond_timedwait(cv.native_handle(), mutex.native_handle(), &ts);
+}
+
+class jo_thread {
+    pthread_t thread;
+    struct start_t {
+        void (*fn)(void *);
+        void *arg;
+    };
+    static void *start(void *p) {
+        start_t s = *(start_t *)p;
+        delete (start_t *)p;
+        s.fn(s.arg);
+        return 0;
+    }
+public:
+    jo_thread(void (*fn)(void *), void *arg) {
+        start_t *s = new start_t;
+        s->fn = fn;
+        s->arg = arg;
+        pthread_create(&thread, nullptr, &start, s);
+    }
+    void join() { pthread_join(thread, nullptr); }
+};
+
+static inline int jo_hardware_concurrency() { return (int)sysconf(_SC_NPROCESSORS_ONLN); }
+
+static inline int jo_atomic_add(volatile int *ptr, int value) { return __atomic_add_fetch(ptr, value, __ATOMIC_ACQ_REL); }
+static inline int jo_atomic_load(volatile int *ptr) { return __atomic_load_n(ptr, __ATOMIC_ACQUIRE); }
+static inline void jo_atomic_store(volatile int *ptr, int value) { __atomic_store_n(ptr, value, __ATOMIC_RELEASE); }
+static inline size_t jo_atomic_load(volatile size_t *ptr) { return __atomic_load_n(ptr, __ATOMIC_ACQUIRE); }
+static inline void jo_atomic_store(volatile size_t *ptr, size_t value) { __atomic_store_n(ptr, value, __ATOMIC_RELEASE); }
+
+// many readers or one writer
+class jo_rwlock {
+    pthread_rwlock_t lock_;
+public:
+    jo_rwlock() { pthread_rwlock_init(&lock_, nullptr); }
+    ~jo_rwlock() { pthread_rwlock_destroy(&lock_); }
+    void lock_shared() { pthread_rwlock_rdlock(&lock_); }
+    void unlock_shared() { pthread_rwlock_unlock(&lock_); }
+    void lock() { pthread_rwlock_wrlock(&lock_); }
+    void unlock() { pthread_rwlock_unlock(&lock_); }
 };
 #endif
 
@@ -1173,6 +1473,20 @@ public:
     ~jo_lock_guard() { mutex.unlock(); }
 };
 
+class jo_shared_lock_guard {
+    jo_rwlock& lock;
+public:
+    jo_shared_lock_guard(jo_rwlock& lock) : lock(lock) { lock.lock_shared(); }
+    ~jo_shared_lock_guard() { lock.unlock_shared(); }
+};
+
+class jo_unique_lock_guard {
+    jo_rwlock& lock;
+public:
+    jo_unique_lock_guard(jo_rwlock& lock) : lock(lock) { lock.lock(); }
+    ~jo_unique_lock_guard() { lock.unlock(); }
+};
+
 // Maintains a linked list of blocks of objects which can be allocated from
 // and deallocated to.
 // Allocates single objects from blocks of 32 objects. Only frees memory when an entire block is free.
@@ -1274,6 +1588,308 @@ struct jo_pool_alloc {
     }
 };
 
+// Small object allocator for container nodes.
+// Each thread keeps a free list per 16 byte size class, so allocating and freeing never takes a lock.
+// Free lists refill from, and spill back to, a global pool a whole batch at a time, which lets
+// blocks freed on one thread be reused by another. A thread that exits hands back all it holds,
+// so threads coming and going don't leak. Memory is carved from 64k slabs and never
+// returned to the system. Builds with address sanitizer go straight to malloc so it can still see misuse.
+struct jo_slab {
+    enum {
+        GRANULARITY = 16,
+        NUM_CLASSES = 64, // up to 1024 bytes
+        MAX_SIZE = GRANULARITY * NUM_CLASSES,
+        BATCH_SIZE = 64,
+        SLAB_SIZE = 64 * 1024,
+    };
+
+    struct item_t {
+        item_t *next;
+    };
+
+    struct cache_t {
+        item_t *head;
+        int count;
+    };
+
+    struct pool_t {
+        jo_mutex mutex;
+        jo_vector<cache_t> batches; // BATCH_SIZE items each, but for those of exited threads
+    };
+
+    // Hands this thread's blocks back to the global pools when it exits. Its destructor is
+    // registered the first time the thread allocates or frees, so no thread is missed.
+    struct thread_caches_t {
+        cache_t classes[NUM_CLASSES];
+
+        ~thread_caches_t() {
+            for(int c = 0; c < NUM_CLASSES; ++c) {
+                while(classes[c].count >= BATCH_SIZE) {
+                    spill(classes[c], c, BATCH_SIZE);
+                }
+                if(classes[c].count) {
+                    spill(classes[c], c, classes[c].count);
+                }
+            }
+        }
+    };
+
+    static pool_t *pools() {
+        // never destroyed, blocks may still be freed during static destruction
+        static pool_t *p = new pool_t[NUM_CLASSES];
+        return p;
+    }
+
+    static cache_t *caches() {
+        static thread_local thread_caches_t c;
+        return c.classes;
+    }
+
+    static int size_class(size_t size) { return (int)((size + GRANULARITY - 1) / GRANULARITY) - 1; }
+
+    static void refill(int c) {
+        cache_t &cache = caches()[c];
+        pool_t &pool = pools()[c];
+        {
+            jo_lock_guard lock(pool.mutex);
+            if(pool.batches.size()) {
+                cache = pool.batches.back();
+                pool.batches.pop_back();
+                return;
+            }
+        }
+        size_t item_size = (size_t)(c + 1) * GRANULARITY;
+        size_t num_items = SLAB_SIZE / item_size;
+        char *slab = (char *)malloc(SLAB_SIZE);
+        item_t *head = 0;
+        for(size_t i = num_items; i-- > 0; ) {
+            item_t *it = (item_t *)(slab + i * item_size);
+            it->next = head;
+            head = it;
+        }
+        cache.head = head;
+        cache.count = (int)num_items;
+    }
+
+    // moves the first n items of a free list of this thread to the pool
+    static void spill(cache_t &cache, int c, int n) {
+        cache_t batch = {cache.head, n};
+        item_t *last = batch.head;
+        for(int i = 1; i < n; ++i) {
+            last = last->next;
+        }
+        cache.head = last->next;
+        cache.count -= n;
+        last->next = 0;
+        pool_t &pool = pools()[c];
+        jo_lock_guard lock(pool.mutex);
+        pool.batches.push_back(batch);
+    }
+
+    static void *alloc(size_t size) {
+#ifndef __SANITIZE_ADDRESS__
+        if(size <= MAX_SIZE) {
+            int c = size_class(size);
+            cache_t &cache = caches()[c];
+            if(!cache.head) {
+                refill(c);
+            }
+            item_t *it = cache.head;
+            cache.head = it->next;
+            cache.count--;
+            return it;
+        }
+#endif
+        return malloc(size);
+    }
+
+    static void free(void *ptr, size_t size) {
+#ifndef __SANITIZE_ADDRESS__
+        if(ptr && size <= MAX_SIZE) {
+            int c = size_class(size);
+            cache_t &cache = caches()[c];
+            item_t *it = (item_t *)ptr;
+            it->next = cache.head;
+            cache.head = it;
+            if(++cache.count >= 2 * BATCH_SIZE) {
+                spill(cache, c, BATCH_SIZE);
+            }
+            return;
+        }
+#endif
+        ::free(ptr);
+    }
+};
+
+// Derive from this to have new/delete go through jo_slab
+struct jo_slab_allocated {
+    static void *operator new(size_t size) { return jo_slab::alloc(size); }
+    static void operator delete(void *ptr, size_t size) { jo_slab::free(ptr, size); }
+};
+
+// Work-stealing thread pool.
+// Each worker owns a deque of tasks. Workers push and pop their own work at the back (LIFO, cache warm)
+// and when they run dry they steal from the front of the other workers' deques (FIFO, oldest work first).
+// Threads outside of the pool (or workers blocked waiting on a result) can help out by calling try_run_one().
+struct jo_work_stealing_pool {
+    struct task_t {
+        void (*fn)(void *);
+        void *arg;
+    };
+
+    struct worker_t {
+        jo_mutex mutex;
+        task_t *tasks; // ring buffer
+        int capacity;
+        int head;
+        int count;
+        int index;
+        jo_work_stealing_pool *pool;
+        jo_thread *thread;
+
+        worker_t() : mutex(), tasks(0), capacity(0), head(0), count(0), index(0), pool(0), thread(0) {}
+        ~worker_t() { free(tasks); }
+
+        void push_back(const task_t &t) {
+            jo_lock_guard lock(mutex);
+            if(count == capacity) {
+                int new_capacity = capacity ? capacity * 2 : 64;
+                task_t *new_tasks = (task_t *)malloc(new_capacity * sizeof(task_t));
+                for(int i = 0; i < count; ++i) {
+                    new_tasks[i] = tasks[(head + i) % capacity];
+                }
+                free(tasks);
+                tasks = new_tasks;
+                capacity = new_capacity;
+                head = 0;
+            }
+            tasks[(head + count) % capacity] = t;
+            count++;
+        }
+
+        bool pop_back(task_t &t) {
+            jo_lock_guard lock(mutex);
+            if(count == 0) {
+                return false;
+            }
+            count--;
+            t = tasks[(head + count) % capacity];
+            return true;
+        }
+
+        bool pop_front(task_t &t) {
+            jo_lock_guard lock(mutex);
+            if(count == 0) {
+                return false;
+            }
+            t = tasks[head];
+            head = (head + 1) % capacity;
+            count--;
+            return true;
+        }
+    };
+
+    worker_t *workers;
+    int num_workers;
+    volatile int pending;
+    volatile int next_victim;
+    volatile bool quit;
+    jo_mutex sleep_mutex;
+    jo_condition_variable sleep_cv;
+
+    // the worker the calling thread is, if any
+    static worker_t *&current_worker() {
+        static thread_local worker_t *w = 0;
+        return w;
+    }
+
+    static void worker_main(void *arg) {
+        worker_t *w = (worker_t *)arg;
+        jo_work_stealing_pool *pool = w->pool;
+        current_worker() = w;
+        while(!pool->quit) {
+            if(pool->try_run_one()) {
+                continue;
+            }
+            jo_lock_guard lock(pool->sleep_mutex);
+            while(jo_atomic_load(&pool->pending) == 0 && !pool->quit) {
+                pool->sleep_cv.wait(pool->sleep_mutex);
+            }
+        }
+    }
+
+    jo_work_stealing_pool(int n) : workers(0), num_workers(n < 1 ? 1 : n), pending(0), next_victim(0), quit(false), sleep_mutex(), sleep_cv() {
+        workers = new worker_t[num_workers];
+        for(int i = 0; i < num_workers; ++i) {
+            workers[i].index = i;
+            workers[i].pool = this;
+        }
+        for(int i = 0; i < num_workers; ++i) {
+            workers[i].thread = new jo_thread(&worker_main, &workers[i]);
+        }
+    }
+
+    ~jo_work_stealing_pool() {
+        {
+            jo_lock_guard lock(sleep_mutex);
+            quit = true;
+            sleep_cv.notify_all();
+        }
+        for(int i = 0; i < num_workers; ++i) {
+            workers[i].thread->join();
+            delete workers[i].thread;
+        }
+        delete [] workers;
+    }
+
+    bool is_worker() const {
+        worker_t *w = current_worker();
+        return w && w->pool == this;
+    }
+
+    void submit(void (*fn)(void *), void *arg) {
+        task_t t = {fn, arg};
+        worker_t *w = current_worker();
+        if(!w || w->pool != this) {
+            // spread outside work around, workers will steal it back as needed
+            w = &workers[(unsigned)jo_atomic_add(&next_victim, 1) % num_workers];
+        }
+        w->push_back(t);
+        jo_atomic_add(&pending, 1);
+        jo_lock_guard lock(sleep_mutex);
+        sleep_cv.notify_one();
+    }
+
+    // Runs a single queued task on the calling thread, if there is one.
+    bool try_run_one() {
+        task_t t;
+        worker_t *self = current_worker();
+        if(self && self->pool != this) {
+            self = 0;
+        }
+        bool found = self && self->pop_back(t);
+        if(!found) {
+            unsigned start = self ? self->index + 1 : (unsigned)jo_atomic_load(&next_victim);
+            for(int i = 0; i < num_workers && !found; ++i) {
+                found = workers[(start + i) % (unsigned)num_workers].pop_front(t);
+            }
+        }
+        if(!found) {
+            return false;
+        }
+        jo_atomic_add(&pending, -1);
+        t.fn(t.arg);
+        return true;
+    }
+};
+
+// One pool for the whole process, a worker per core, so that work which nests, like a matrix
+// product inside a parallel map, shares the cores instead of oversubscribing them.
+static jo_work_stealing_pool *jo_shared_pool() {
+    static jo_work_stealing_pool *pool = new jo_work_stealing_pool(jo_hardware_concurrency());
+    return pool;
+}
+
 template<typename T>
 class jo_set {
     T *ptr;
@@ -2058,11 +2674,25 @@ template<typename T>
 struct jo_shared_ptr {
     T* ptr;
     int* ref_count;
+
+    // ref counts are atomic, so pointers may be copied and released from several threads at once
+    static void retain(int *rc) { if(rc) jo_atomic_add(rc, 1); }
+    static void release(T *p, int *rc) {
+        if(rc && jo_atomic_add(rc, -1) == 0) {
+            delete p;
+            jo_slab::free(rc, sizeof(int));
+        }
+    }
+    static int *new_ref_count() {
+        int *rc = (int *)jo_slab::alloc(sizeof(int));
+        *rc = 1;
+        return rc;
+    }
     
     jo_shared_ptr() : ptr(nullptr), ref_count(nullptr) {}
-    jo_shared_ptr(T* ptr) : ptr(ptr), ref_count(new int(1)) {}
+    jo_shared_ptr(T* ptr) : ptr(ptr), ref_count(new_ref_count()) {}
     jo_shared_ptr(const jo_shared_ptr& other) : ptr(other.ptr), ref_count(other.ref_count) {
-        if(ref_count) (*ref_count)++;
+        retain(ref_count);
     }
     jo_shared_ptr(jo_shared_ptr&& other) : ptr(other.ptr), ref_count(other.ref_count) {
         other.ptr = nullptr;
@@ -2071,13 +2701,8 @@ struct jo_shared_ptr {
     
     jo_shared_ptr& operator=(const jo_shared_ptr& other) {
         if (this != &other) {
-            if(other.ref_count) (*other.ref_count)++;
-            if(ref_count) {
-                if(--(*ref_count) == 0) {
-                    delete ptr;
-                    delete ref_count;
-                }
-            }
+            retain(other.ref_count);
+            release(ptr, ref_count);
             ptr = other.ptr;
             ref_count = other.ref_count;
         }
@@ -2086,12 +2711,7 @@ struct jo_shared_ptr {
     
     jo_shared_ptr& operator=(jo_shared_ptr&& other) {
         if (this != &other) {
-            if(ref_count) {
-                if(--(*ref_count) == 0) {
-                    delete ptr;
-                    delete ref_count;
-                }
-            }
+            release(ptr, ref_count);
             ptr = other.ptr;
             ref_count = other.ref_count;
             other.ptr = nullptr;
@@ -2101,13 +2721,8 @@ struct jo_shared_ptr {
     }
     
     ~jo_shared_ptr() {
-        if(ref_count) {
-            if(--(*ref_count) == 0) {
-                delete ptr;
-                delete ref_count;
-                ptr = 0;
-            }
-        }
+        release(ptr, ref_count);
+        ptr = 0;
     }
 
     T& operator*() { return *ptr; }
@@ -2122,6 +2737,69 @@ struct jo_shared_ptr {
     operator bool() const { return ptr != nullptr; }
 };
 
+// Base for objects which carry their own reference count, for use with jo_intrusive_ptr.
+// Keeping the count in the object saves an allocation per object and keeps it on the same cache line.
+struct jo_refcounted {
+    volatile int ref_count;
+
+    jo_refcounted() : ref_count(0) {}
+    // copies are new objects, so they start unreferenced
+    jo_refcounted(const jo_refcounted &) : ref_count(0) {}
+    jo_refcounted &operator=(const jo_refcounted &) { return *this; }
+};
+
+// Like jo_shared_ptr, but T must derive from jo_refcounted
+template<typename T>
+struct jo_intrusive_ptr {
+    T* ptr;
+
+    static void retain(T *p) { if(p) jo_atomic_add(&p->ref_count, 1); }
+    static void release(T *p) {
+        if(p && jo_atomic_add(&p->ref_count, -1) == 0) {
+            delete p;
+        }
+    }
+
+    jo_intrusive_ptr() : ptr(nullptr) {}
+    jo_intrusive_ptr(T* ptr) : ptr(ptr) { retain(ptr); }
+    jo_intrusive_ptr(const jo_intrusive_ptr& other) : ptr(other.ptr) { retain(ptr); }
+    jo_intrusive_ptr(jo_intrusive_ptr&& other) : ptr(other.ptr) { other.ptr = nullptr; }
+
+    jo_intrusive_ptr& operator=(const jo_intrusive_ptr& other) {
+        if (this != &other) {
+            retain(other.ptr);
+            release(ptr);
+            ptr = other.ptr;
+        }
+        return *this;
+    }
+
+    jo_intrusive_ptr& operator=(jo_intrusive_ptr&& other) {
+        if (this != &other) {
+            release(ptr);
+            ptr = other.ptr;
+            other.ptr = nullptr;
+        }
+        return *this;
+    }
+
+    ~jo_intrusive_ptr() {
+        release(ptr);
+        ptr = 0;
+    }
+
+    T& operator*() { return *ptr; }
+    T* operator->() { return ptr; }
+    const T& operator*() const { return *ptr; }
+    const T* operator->() const { return ptr; }
+
+    bool operator==(const jo_intrusive_ptr& other) const { return ptr == other.ptr; }
+    bool operator!=(const jo_intrusive_ptr& other) const { return ptr != other.ptr; }
+
+    bool operator!() const { return ptr == nullptr; }
+    operator bool() const { return ptr != nullptr; }
+};
+
 // jo_unqiue_ptr
 template<typename T>
 struct jo_unique_ptr {
@@ -2415,216 +3093,491 @@ public:
 
 // Persistent Vector implementation (vector that supports versioning)
 // For use in purely functional languages
+// A relaxed radix balanced (RRB) trie of leaves plus a separate tail leaf, so appends are usually O(1)
+// and everything else is O(log32 n).
+// Nodes built by appending are dense (every leaf full) and are indexed by radix alone. Concatenation and
+// slicing can leave partly filled nodes, which carry a table of cumulative child sizes instead. That makes
+// concat, subvec and push_front O(log n) and structure sharing, rather than copying elements.
+// Elements dropped off the front are skipped with head_offset rather than moved.
+// The _inplace variants mutate nodes which nothing else references, and copy the rest.
 template<typename T>
-struct jo_persistent_vector
+struct jo_persistent_vector : jo_slab_allocated
 {
-    struct node {
-        jo_shared_ptr<node> children[32];
+    // sizes[i] is the number of elements in children 0..i
+    struct size_table : jo_slab_allocated {
+        size_t sizes[32];
+    };
+
+    struct node : jo_refcounted, jo_slab_allocated {
+        jo_intrusive_ptr<node> children[32];
         T elements[32];
+        size_table *table; // only in relaxed nodes
+        int count; // children or elements in use
 
-        node() : children(), elements() {}
+        node() : children(), elements(), table(), count() {}
 
-        ~node() {
+        node(const node &other) : jo_refcounted(), children(), elements(), table(), count(other.count) {
             for (int i = 0; i < 32; ++i) {
-                children[i] = NULL;
+                children[i] = other.children[i];
+                elements[i] = other.elements[i];
+            }
+            if(other.table) {
+                table = new size_table(*other.table);
             }
         }
 
-        node(const jo_shared_ptr<node> other) : children(), elements() {
-            if(other.ptr) {
-                for (int i = 0; i < 32; ++i) {
-                    children[i] = other->children[i];
-                    elements[i] = other->elements[i];
-                }
-            }
+        ~node() {
+            delete table;
         }
     };
 
-    jo_shared_ptr<node> head;
-    jo_shared_ptr<node> tail;
-    size_t head_offset;
+    typedef jo_intrusive_ptr<node> node_ptr;
+
+    node_ptr head; // root of the trie
+    node_ptr tail; // tail->count is always tail_length
+    size_t head_offset; // elements dropped from the front
     size_t tail_length;
     size_t length;
-    size_t depth;
+    size_t shift; // 5 * number of levels above the leaves
 
-    jo_persistent_vector() {
-        head = tail = new node();
-        head_offset = 0;
-        tail_length = 0;
-        length = 0;
-        depth = 0;
-    }
+    jo_persistent_vector() : head(new node()), tail(new node()), head_offset(0), tail_length(0), length(0), shift(5) {}
 
-    jo_persistent_vector(size_t initial_size) {
-        head = tail = new node();
-        head_offset = 0;
-        tail_length = 0;
-        length = 0;
-        depth = 0;
+    jo_persistent_vector(size_t initial_size) : head(new node()), tail(new node()), head_offset(0), tail_length(0), length(0), shift(5) {
         for (size_t i = 0; i < initial_size; ++i) {
             push_back_inplace(T());
         }
     }
 
-    jo_persistent_vector(const jo_persistent_vector &other) {
+    jo_persistent_vector(const jo_persistent_vector &other) : head(other.head), tail(other.tail), head_offset(other.head_offset),
+        tail_length(other.tail_length), length(other.length), shift(other.shift) {}
+
+    jo_persistent_vector &operator=(const jo_persistent_vector &other) {
         head = other.head;
         tail = other.tail;
         head_offset = other.head_offset;
         tail_length = other.tail_length;
         length = other.length;
-        depth = other.depth;
+        shift = other.shift;
+        return *this;
     }
 
     jo_persistent_vector *clone() const {
         return new jo_persistent_vector(*this);
     }
 
-    void append_tail() {
-        size_t tail_offset = length + head_offset - tail_length;
-        size_t shift = 5 * (depth + 1);
-        size_t max_size = 1 << (5 * shift);
+    // total elements stored, including the ones dropped off the front
+    size_t count_all() const { return head_offset + length; }
+    size_t tail_offset() const { return count_all() - tail_length; }
 
-        // check for root overflow, and if so expand tree by 1 level
-        if(length >= max_size) {
-            node *new_root = new node();
-            new_root->children[0] = head;
-            head = new_root;
-            ++depth;
-            shift = 5 * (depth + 1);
+    // number of elements under n, which sits level bits above the leaves
+    static size_t tree_size(const node *n, size_t level) {
+        if(level == 0) {
+            return n->count;
+        }
+        if(n->table) {
+            return n->count ? n->table->sizes[n->count - 1] : 0;
+        }
+        if(n->count == 0) {
+            return 0;
         }
+        return ((size_t)(n->count - 1) << level) + tree_size(n->children[n->count - 1].ptr, level - 5);
+    }
 
-        // Set up our tree traversal. We subtract 5 from level each time
-        // in order to get all the way down to the level above where we want to
-        // insert this tail node.
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = head;
-        size_t index = 0;
-        size_t key = tail_offset;
-        for(size_t level = shift; level > 0; level -= 5) {
-            index = (key >> level) & 31;
-            cur = prev->children[index];
-            // we are at the end of our tree, insert tail node
-            if(!cur && level - 5 == 0) {
-                prev->children[index] = tail;
-                break;
+    // Decides if n can be indexed by radix alone: all children dense, every one but the last complete,
+    // and all leaves full. Otherwise gives it a size table.
+    static void fix_sizes(node *n, size_t level) {
+        size_t sizes[32];
+        size_t total = 0;
+        bool dense = true;
+        for(int i = 0; i < n->count; ++i) {
+            const node *child = n->children[i].ptr;
+            size_t child_size = tree_size(child, level - 5);
+            total += child_size;
+            sizes[i] = total;
+            if(child->table || (level == 5 && child_size != 32) || (i + 1 < n->count && child_size != ((size_t)1 << level))) {
+                dense = false;
             }
-            // found a null node
-            if(!cur) {
-                cur = new node();
-                prev->children[index] = cur;
+        }
+        if(dense) {
+            delete n->table;
+            n->table = 0;
+            return;
+        }
+        if(!n->table) {
+            n->table = new size_table();
+        }
+        for(int i = 0; i < n->count; ++i) {
+            n->table->sizes[i] = sizes[i];
+        }
+    }
+
+    // which child of n holds index i (relative to n), and the index that child starts at
+    static int child_index(const node *n, size_t level, size_t i, size_t &start) {
+        int s = (int)(i >> level);
+        if(n->table) {
+            while(n->table->sizes[s] <= i) {
+                ++s;
             }
-            prev = cur;
+            start = s ? n->table->sizes[s - 1] : 0;
+        } else {
+            start = (size_t)s << level;
         }
+        return s;
+    }
 
-        // Make our new tail
-        tail = new node();
-        tail_length = 0;
+    // the leaf holding underlying index i, where it starts and how many elements it has
+    const node *leaf_for(size_t i, size_t &start, size_t &count) const {
+        size_t toff = tail_offset();
+        if(i >= toff) {
+            start = toff;
+            count = tail_length;
+            return tail.ptr;
+        }
+        const node *n = head.ptr;
+        start = 0;
+        for(size_t level = shift; level > 0; level -= 5) {
+            size_t child_start;
+            int s = child_index(n, level, i - start, child_start);
+            start += child_start;
+            n = n->children[s].ptr;
+        }
+        count = n->count;
+        return n;
     }
 
-    jo_persistent_vector *append(const T &value) const {
-        // Create a copy of our root node from which we will base our append
-        jo_persistent_vector *copy = new jo_persistent_vector(*this);
+    static node_ptr editable(const node_ptr &n, bool edit) {
+        return edit && n->ref_count == 1 ? n : node_ptr(new node(*n));
+    }
 
-        // do we have space?
-        if(copy->tail_length >= 32) {
-            copy->append_tail();
+    static node_ptr new_path(size_t level, const node_ptr &leaf) {
+        if(level == 0) {
+            return leaf;
         }
-
-        copy->tail->elements[copy->tail_length] = value;
-        copy->tail_length++;
-        copy->length++;
-        return copy;
+        node_ptr ret = new node();
+        ret->children[0] = new_path(level - 5, leaf);
+        ret->count = 1;
+        if(leaf->count != 32) {
+            fix_sizes(ret.ptr, level);
+        }
+        return ret;
     }
 
-    // append inplace
-    jo_persistent_vector *append_inplace(const T &value) {
-        // do we have space?
-        if(tail_length >= 32) {
-            append_tail();
+    // adds leaf at the right edge of n, or returns null if there is no room under n
+    static node_ptr push_leaf(size_t level, const node_ptr &n, const node_ptr &leaf, bool edit) {
+        edit = edit && n->ref_count == 1;
+        int last = n->count - 1;
+        node_ptr child;
+        if(level > 5 && last >= 0) {
+            child = push_leaf(level - 5, n->children[last], leaf, edit);
+        }
+        if(!child && n->count == 32) {
+            return node_ptr();
         }
+        node_ptr ret = editable(n, edit);
+        if(child) {
+            ret->children[last] = child;
+        } else {
+            ret->children[ret->count++] = new_path(level - 5, leaf);
+        }
+        if(ret->table) {
+            int i = ret->count - 1;
+            ret->table->sizes[i] = (i ? ret->table->sizes[i - 1] : 0) + tree_size(ret->children[i].ptr, level - 5);
+        } else if(leaf->count != 32) {
+            fix_sizes(ret.ptr, level);
+        }
+        return ret;
+    }
 
-        tail->elements[tail_length] = value;
-        tail_length++;
-        length++;
-        return this;
+    // removes the rightmost leaf under n into leaf, returns null if n is left empty
+    static node_ptr pop_leaf(size_t level, const node_ptr &n, bool edit, node_ptr &leaf) {
+        edit = edit && n->ref_count == 1;
+        int last = n->count - 1;
+        node_ptr child;
+        if(level == 5) {
+            leaf = n->children[last];
+        } else {
+            child = pop_leaf(level - 5, n->children[last], edit, leaf);
+        }
+        if(!child && last == 0) {
+            return node_ptr();
+        }
+        node_ptr ret = editable(n, edit);
+        if(child) {
+            ret->children[last] = child;
+            if(ret->table) {
+                ret->table->sizes[last] -= leaf->count;
+            }
+        } else {
+            ret->children[last] = node_ptr();
+            ret->count--;
+        }
+        return ret;
     }
 
-    jo_persistent_vector *assoc(size_t index, const T &value) const {
-        index += head_offset;
+    static node_ptr do_assoc(size_t level, const node_ptr &n, size_t i, const T &value, bool edit) {
+        edit = edit && n->ref_count == 1;
+        node_ptr ret = editable(n, edit);
+        if(level == 0) {
+            ret->elements[i] = value;
+        } else {
+            size_t start;
+            int s = child_index(n.ptr, level, i, start);
+            ret->children[s] = do_assoc(level - 5, n->children[s], i - start, value, edit);
+        }
+        return ret;
+    }
 
-        int shift = 5 * depth;
-        size_t tail_offset = length + head_offset - tail_length;
+    // the first m elements under n
+    static node_ptr slice_right(size_t level, const node_ptr &n, size_t m) {
+        if(m >= tree_size(n.ptr, level)) {
+            return n;
+        }
+        node_ptr ret = new node();
+        if(level == 0) {
+            for(size_t i = 0; i < m; ++i) {
+                ret->elements[i] = n->elements[i];
+            }
+            ret->count = (int)m;
+            return ret;
+        }
+        size_t start;
+        int s = child_index(n.ptr, level, m - 1, start);
+        for(int i = 0; i < s; ++i) {
+            ret->children[i] = n->children[i];
+        }
+        ret->children[s] = slice_right(level - 5, n->children[s], m - start);
+        ret->count = s + 1;
+        fix_sizes(ret.ptr, level);
+        return ret;
+    }
 
-        if(index >= length + head_offset) {
-            return append(value);
+    // all but the first m elements under n
+    static node_ptr slice_left(size_t level, const node_ptr &n, size_t m) {
+        if(m == 0) {
+            return n;
+        }
+        node_ptr ret = new node();
+        if(level == 0) {
+            for(int i = (int)m; i < n->count; ++i) {
+                ret->elements[ret->count++] = n->elements[i];
+            }
+            return ret;
         }
+        size_t start;
+        int s = child_index(n.ptr, level, m, start);
+        ret->children[ret->count++] = slice_left(level - 5, n->children[s], m - start);
+        for(int i = s + 1; i < n->count; ++i) {
+            ret->children[ret->count++] = n->children[i];
+        }
+        fix_sizes(ret.ptr, level);
+        return ret;
+    }
 
-        // Create a copy of our root node from which we will base our append
-        jo_persistent_vector *copy = new jo_persistent_vector(*this);
+    // Merges the children of left (but its last), centre and right (but its first), all sitting at level,
+    // so that no more than 2 nodes beyond the minimum are used. This bounds the extra search steps when
+    // indexing relaxed nodes. Returns a node one level up holding the 1 or 2 resulting nodes.
+    static node_ptr rebalance(const node *left, const node *centre, const node *right, size_t level) {
+        enum { EXTRAS = 2 };
+        node_ptr all[64];
+        int counts[64];
+        int n = 0;
+        if(left) {
+            for(int i = 0; i < left->count - 1; ++i) {
+                all[n++] = left->children[i];
+            }
+        }
+        for(int i = 0; i < centre->count; ++i) {
+            all[n++] = centre->children[i];
+        }
+        if(right) {
+            for(int i = 1; i < right->count; ++i) {
+                all[n++] = right->children[i];
+            }
+        }
 
-        // traverse duplicating the way down.
-        if(shift == 0) {
-            copy->head = new node(copy->head);
-            copy->head->elements[index] = value;
-            copy->tail = copy->head;
-            return copy;
+        // plan how many slots each node gets
+        int total = 0;
+        for(int i = 0; i < n; ++i) {
+            counts[i] = all[i]->count;
+            total += counts[i];
+        }
+        int optimal = (total + 31) / 32;
+        int num = n;
+        for(int i = 0; num > optimal + EXTRAS; ) {
+            while(counts[i] > 32 - 1) {
+                ++i;
+            }
+            // spread the short node over the ones after it
+            int remaining = counts[i];
+            do {
+                int min_size = jo_min(remaining + counts[i + 1], 32);
+                counts[i] = min_size;
+                remaining = remaining + counts[i + 1] - min_size;
+                ++i;
+            } while(remaining > 0);
+            for(int j = i; j < num - 1; ++j) {
+                counts[j] = counts[j + 1];
+            }
+            --num;
+            --i;
+        }
+
+        // carry it out, reusing the nodes that come through untouched
+        size_t child_level = level - 5;
+        node_ptr out[64];
+        int src = 0, src_at = 0;
+        for(int i = 0; i < num; ++i) {
+            if(src_at == 0 && all[src]->count == counts[i]) {
+                out[i] = all[src++];
+                continue;
+            }
+            node_ptr nn = new node();
+            while(nn->count < counts[i]) {
+                const node *from = all[src].ptr;
+                int take = jo_min(counts[i] - nn->count, from->count - src_at);
+                for(int j = 0; j < take; ++j) {
+                    if(child_level == 0) {
+                        nn->elements[nn->count++] = from->elements[src_at++];
+                    } else {
+                        nn->children[nn->count++] = from->children[src_at++];
+                    }
+                }
+                if(src_at == from->count) {
+                    ++src;
+                    src_at = 0;
+                }
+            }
+            if(child_level > 0) {
+                fix_sizes(nn.ptr, child_level);
+            }
+            out[i] = nn;
         }
 
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = copy->head;
-        size_t key = index;
-        for (int level = shift; level > 0; level -= 5) {
-            size_t i = (key >> level) & 31;
-            // copy nodes as we traverse
-            cur = new node(prev->children[i]);
-            prev->children[i] = cur;
-            prev = cur;
+        node_ptr ret = new node();
+        for(int i = 0; i < num; i += 32) {
+            node_ptr parent = new node();
+            for(int j = i; j < num && j < i + 32; ++j) {
+                parent->children[parent->count++] = out[j];
+            }
+            fix_sizes(parent.ptr, level);
+            ret->children[ret->count++] = parent;
         }
-        prev->elements[key & 31] = value;
+        fix_sizes(ret.ptr, level + 5);
+        return ret;
+    }
 
-        // if we modified the tail, set it
-        if(index >= tail_offset) {
-            copy->tail = prev;
+    // concatenates the trees under left and right, returning a node one level above the higher of the two
+    static node_ptr concat_sub_tree(const node_ptr &left, size_t left_level, const node_ptr &right, size_t right_level) {
+        if(left_level > right_level) {
+            node_ptr centre = concat_sub_tree(left->children[left->count - 1], left_level - 5, right, right_level);
+            return rebalance(left.ptr, centre.ptr, 0, left_level);
+        }
+        if(left_level < right_level) {
+            node_ptr centre = concat_sub_tree(left, left_level, right->children[0], right_level - 5);
+            return rebalance(0, centre.ptr, right.ptr, right_level);
         }
+        if(left_level == 0) {
+            node_ptr ret = new node();
+            ret->children[0] = left;
+            ret->children[1] = right;
+            ret->count = 2;
+            fix_sizes(ret.ptr, 5);
+            return ret;
+        }
+        node_ptr centre = concat_sub_tree(left->children[left->count - 1], left_level - 5, right->children[0], right_level - 5);
+        return rebalance(left.ptr, centre.ptr, right.ptr, left_level);
+    }
 
-        return copy;
+    // root/root_shift becomes the concatenation of itself and other
+    static void concat_trees(node_ptr &root, size_t &root_shift, const node_ptr &other, size_t other_shift) {
+        if(other->count == 0) {
+            return;
+        }
+        if(root->count == 0) {
+            root = other;
+            root_shift = other_shift;
+            return;
+        }
+        root = concat_sub_tree(root, root_shift, other, other_shift);
+        root_shift = jo_max(root_shift, other_shift) + 5;
+        collapse(root, root_shift);
     }
 
-    jo_persistent_vector *assoc_inplace(size_t index, const T &value) {
-        index += head_offset;
+    // drops roots with a single child
+    static void collapse(node_ptr &root, size_t &root_shift) {
+        while(root_shift > 5 && root->count == 1) {
+            node_ptr child = root->children[0];
+            root = child;
+            root_shift -= 5;
+        }
+    }
 
-        int shift = 5 * depth;
-        size_t tail_offset = length + head_offset - tail_length;
+    void reset() {
+        head = new node();
+        tail = new node();
+        head_offset = 0;
+        tail_length = 0;
+        length = 0;
+        shift = 5;
+    }
 
-        if(index >= length + head_offset) {
-            return append_inplace(value);
+    // appends a full tail to the trie, growing a level if the root is full
+    void push_tail_leaf(const node_ptr &leaf) {
+        node_ptr new_root = push_leaf(shift, head, leaf, true);
+        if(new_root) {
+            head = new_root;
+            return;
         }
+        new_root = new node();
+        new_root->children[0] = head;
+        new_root->children[1] = new_path(shift, leaf);
+        new_root->count = 2;
+        shift += 5;
+        fix_sizes(new_root.ptr, shift);
+        head = new_root;
+    }
 
-        // traverse duplicating the way down.
-        if(shift == 0) {
-            head = new node(head);
-            head->elements[index] = value;
-            tail = head;
+    jo_persistent_vector *append(const T &value) const {
+        jo_persistent_vector *copy = new jo_persistent_vector(*this);
+        return copy->append_inplace(value);
+    }
+
+    // append inplace
+    jo_persistent_vector *append_inplace(const T &value) {
+        // room in the tail?
+        if(tail_length < 32) {
+            tail = editable(tail, true);
+            tail->elements[tail_length++] = value;
+            tail->count = (int)tail_length;
+            length++;
             return this;
         }
+        push_tail_leaf(tail);
+        tail = new node();
+        tail->elements[0] = value;
+        tail->count = 1;
+        tail_length = 1;
+        length++;
+        return this;
+    }
 
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = head;
-        size_t key = index;
-        for (int level = shift; level > 0; level -= 5) {
-            size_t i = (key >> level) & 31;
-            // copy nodes as we traverse
-            cur = new node(prev->children[i]);
-            prev->children[i] = cur;
-            prev = cur;
-        }
-        prev->elements[key & 31] = value;
+    jo_persistent_vector *assoc(size_t index, const T &value) const {
+        jo_persistent_vector *copy = new jo_persistent_vector(*this);
+        return copy->assoc_inplace(index, value);
+    }
 
-        // if we modified the tail, set it
-        if(index >= tail_offset) {
-            tail = prev;
+    jo_persistent_vector *assoc_inplace(size_t index, const T &value) {
+        if(index >= length) {
+            return append_inplace(value);
         }
-
+        size_t i = index + head_offset;
+        size_t toff = tail_offset();
+        if(i >= toff) {
+            tail = editable(tail, true);
+            tail->elements[i - toff] = value;
+            return this;
+        }
+        head = do_assoc(shift, head, i, value, true);
         return this;
     }
 
@@ -2650,18 +3603,48 @@ struct jo_persistent_vector
 
     jo_persistent_vector *conj(const jo_persistent_vector &other) const {
         jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        // loop through other, and append to copy
-        for(size_t i = 0; i < other.length; ++i) {
-            copy->append_inplace(other[i]);
-        }
-        return copy;
+        return copy->conj_inplace(other);
     }
 
+    // concatenation, O(log n) once other is bigger than a leaf
     jo_persistent_vector *conj_inplace(const jo_persistent_vector &other) {
-        // loop through other, and append to copy
-        for(size_t i = 0; i < other.length; ++i) {
-            append_inplace(other[i]);
+        if(other.length <= 32) {
+            for(iterator it = other.begin(); it; ++it) {
+                append_inplace(*it);
+            }
+            return this;
         }
+        if(length == 0) {
+            *this = other;
+            return this;
+        }
+        // our tail joins our trie
+        if(tail_length == 32) {
+            push_tail_leaf(tail);
+        } else {
+            node_ptr tail_tree = new_path(5, tail);
+            concat_trees(head, shift, tail_tree, 5);
+        }
+        // other's trie, less what it dropped off the front, follows it
+        node_ptr other_head = other.head;
+        size_t other_shift = other.shift;
+        size_t other_toff = other.tail_offset();
+        node_ptr other_tail = other.tail;
+        size_t other_tail_length = other.tail_length;
+        if(other.head_offset >= other_toff) {
+            other_head = new node();
+            other_shift = 5;
+            other_tail = slice_left(0, other.tail, other.head_offset - other_toff);
+            other_tail_length = other_tail->count;
+        } else if(other.head_offset > 0) {
+            other_head = slice_left(other_shift, other_head, other.head_offset);
+            collapse(other_head, other_shift);
+        }
+        concat_trees(head, shift, other_head, other_shift);
+        // and other's tail is our tail
+        tail = other_tail;
+        tail_length = other_tail_length;
+        length += other.length;
         return this;
     }
 
@@ -2674,15 +3657,9 @@ struct jo_persistent_vector
     }
 
     jo_persistent_vector *resize(size_t new_size) const {
-        if(new_size == length) {
-            return new jo_persistent_vector(*this);
-        }
-
         if(new_size < length) {
             return subvec(0, new_size);
         }
-
-        // This could be faster...
         jo_persistent_vector *copy = new jo_persistent_vector(*this);
         for(size_t i = length; i < new_size; ++i) {
             copy->append_inplace(T());
@@ -2691,97 +3668,78 @@ struct jo_persistent_vector
     }
 
     jo_persistent_vector *push_front(const T &value) const {
-        assert(head_offset > 0);
         jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        copy->head_offset--;
-        copy->length++;
-        copy->assoc_inplace(0, value);
-        return copy;
+        return copy->push_front_inplace(value);
     }
 
+    // O(1) if something was dropped off the front before, otherwise O(log n) by concatenation
     jo_persistent_vector *push_front_inplace(const T &value) {
-        assert(head_offset > 0);
-        head_offset--;
-        length++;
-        assoc_inplace(0, value);
+        if(head_offset > 0) {
+            head_offset--;
+            length++;
+            size_t toff = tail_offset();
+            if(head_offset >= toff) {
+                tail = editable(tail, true);
+                tail->elements[head_offset - toff] = value;
+            } else {
+                head = do_assoc(shift, head, head_offset, value, true);
+            }
+            return this;
+        }
+        jo_persistent_vector copy;
+        copy.append_inplace(value);
+        copy.conj_inplace(*this);
+        *this = copy;
         return this;
     }
-    
-    jo_persistent_vector *pop_back() const {
-        size_t shift = 5 * (depth + 1);
-        size_t tail_offset = length + head_offset - tail_length;
 
-        // Create a copy of our root node from which we will base our append
+    jo_persistent_vector *pop_back() const {
         jo_persistent_vector *copy = new jo_persistent_vector(*this);
-
-        // Is it in the tail?
-        if(length + head_offset == tail_offset) {
-            // copy the tail (since we are changing the data)
-            copy->tail = new node(*copy->tail);
-            copy->tail_length--;
-            copy->length--;
-            return copy;
-        }
-
-        // traverse duplicating the way down.
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = copy->head;
-        size_t key = length + head_offset - 1;
-        for (size_t level = shift; level > 0; level -= 5) {
-            size_t index = (key >> level) & 0x1f;
-            // copy nodes as we traverse
-            cur = new node(prev->children[index]);
-            prev->children[index] = cur;
-            prev = cur;
-        }
-        prev->elements[key & 0x1f] = T();
-        copy->tail_length--;
-        copy->length--;
-        return copy;
+        return copy->pop_back_inplace();
     }
 
     jo_persistent_vector *pop_back_inplace() {
-        if(length == 0) {
+        if(length <= 1) {
+            reset();
             return this;
         }
-
-        size_t shift = 5 * (depth + 1);
-        size_t tail_offset = length + head_offset - tail_length;
-
-        // Is it in the tail?
-        if(length + head_offset == tail_offset) {
-            // copy the tail (since we are changing the data)
-            tail = new node(*tail);
-            tail_length--;
+        if(tail_length > 1) {
+            tail = editable(tail, true);
+            tail->elements[--tail_length] = T();
+            tail->count = (int)tail_length;
             length--;
             return this;
         }
-
-        // traverse duplicating the way down.
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = head;
-        size_t key = length + head_offset - 1;
-        for (size_t level = shift; level > 0; level -= 5) {
-            size_t index = (key >> level) & 0x1f;
-            // copy nodes as we traverse
-            cur = new node(prev->children[index]);
-            prev->children[index] = cur;
-            prev = cur;
-        }
-        prev->elements[key & 31] = T();
-        tail_length--;
+        // the tail is about to be empty, the last leaf of the trie becomes the new tail
+        pop_tail_leaf();
         length--;
         return this;
     }
 
+    // replaces the tail with the last leaf of the trie
+    void pop_tail_leaf() {
+        node_ptr new_tail;
+        node_ptr new_root = pop_leaf(shift, head, true, new_tail);
+        if(!new_root) {
+            new_root = new node();
+            shift = 5;
+        }
+        collapse(new_root, shift);
+        head = new_root;
+        tail = new_tail;
+        tail_length = new_tail->count;
+    }
+
     jo_persistent_vector *pop_front() const {
         jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        copy->head_offset++;
-        copy->length--;
-        return copy;
+        return copy->pop_front_inplace();
     }
 
     jo_persistent_vector *pop_front_inplace() {
+        if(length <= 1) {
+            reset();
+            return this;
+        }
         head_offset++;
         length--;
         return this;
@@ -2797,62 +3755,58 @@ struct jo_persistent_vector
 
     jo_persistent_vector *drop(size_t n) const {
         jo_persistent_vector *copy = new jo_persistent_vector(*this);
+        if(n >= length) {
+            copy->reset();
+            return copy;
+        }
         copy->head_offset += n;
         copy->length -= n;
         return copy;
     }
 
-    T &operator[] (size_t index) {
-        index += head_offset;
-
-        size_t shift = 5 * (depth + 1);
-        size_t tail_offset = length + head_offset - tail_length;
+    jo_persistent_vector *take(size_t n) const {
+        jo_persistent_vector *copy = new jo_persistent_vector(*this);
+        return copy->take_inplace(n);
+    }
 
-        // Is it in the tail?
-        if(index >= tail_offset) {
-            return tail->elements[index - tail_offset];
+    // keeps the first n elements, O(log n)
+    jo_persistent_vector *take_inplace(size_t n) {
+        if(n >= length) {
+            return this;
         }
-
-        // traverse 
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = head;
-        size_t key = index;
-        for (size_t level = shift; level > 0; level -= 5) {
-            size_t index = (key >> level) & 0x1f;
-            cur = prev->children[index];
-            if(!cur) {
-                return tail->elements[key - tail_offset];
+        if(n == 0) {
+            reset();
+            return this;
+        }
+        size_t keep = head_offset + n;
+        size_t toff = tail_offset();
+        if(keep > toff) {
+            tail = editable(tail, true);
+            for(size_t i = keep - toff; i < tail_length; ++i) {
+                tail->elements[i] = T();
             }
-            prev = cur;
+            tail_length = keep - toff;
+            tail->count = (int)tail_length;
+            length = n;
+            return this;
         }
-        return prev->elements[key & 0x1f];
+        head = slice_right(shift, head, keep);
+        length = n;
+        tail_length = 0;
+        pop_tail_leaf();
+        return this;
     }
 
-    const T &operator[] (size_t index) const {
-        index += head_offset;
-
-        size_t shift = 5 * (depth + 1);
-        size_t tail_offset = length + head_offset - tail_length;
-
-        // Is it in the tail?
-        if(index >= tail_offset) {
-            return tail->elements[index - tail_offset];
-        }
-
-        // traverse
+    T &operator[] (size_t index) {
+        size_t start, count;
+        node *leaf = (node *)leaf_for(index + head_offset, start, count);
+        return leaf->elements[index + head_offset - start];
+    }
 
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = head;
-        size_t key = index;
-        for (size_t level = shift; level > 0; level -= 5) {
-            size_t index = (key >> level) & 0x1f;
-            cur = prev->children[index];
-            if(!cur) {
-                return tail->elements[key - tail_offset];
-            }
-            prev = cur;
-        }
-        return prev->elements[key & 0x1f];
+    const T &operator[] (size_t index) const {
+        size_t start, count;
+        const node *leaf = leaf_for(index + head_offset, start, count);
+        return leaf->elements[index + head_offset - start];
     }
 
     T &nth(size_t index) {
@@ -2871,49 +3825,23 @@ struct jo_persistent_vector
         return new jo_persistent_vector();
     }
 
-    // reverse the order of the vector. Requires swapping two elements at a time, ending when we reach the middle
-    jo_persistent_vector *reverse() {
-        jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        size_t middle = length / 2;
-        for(size_t i = 0; i < middle; i++) {
-            T temp = copy->nth(i);
-            copy->set(i, copy->nth(length - i - 1));
-            copy->set(length - i - 1, temp);
+    jo_persistent_vector *reverse() const {
+        jo_persistent_vector *copy = new jo_persistent_vector();
+        for(size_t i = length; i-- > 0; ) {
+            copy->append_inplace((*this)[i]);
         }
         return copy;
     }
 
+    // index of the first element equal to value, or size() if none
     size_t find(const T &value) const {
-        size_t shift = 5 * (depth + 1);
-        size_t tail_offset = length + head_offset - tail_length;
-
-        // Is it in the tail?
-        if(tail_length > 0) {
-            for(size_t i = 0; i < tail_length; ++i) {
-                if(tail->elements[i] == value) {
-                    return tail_offset + i;
-                }
-            }
-        }
-
-        // traverse
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = head;
-        size_t key = 0;
-        for (size_t level = shift; level > 0; level -= 5) {
-            size_t index = (key >> level) & 0x1f;
-            cur = prev->children[index];
-            if(!cur) {
-                return tail_offset + key;
-            }
-            prev = cur;
-        }
-        for (size_t i = 0; i < 32; ++i) {
-            if(prev->elements[i] == value) {
-                return key + i;
+        size_t i = 0;
+        for(iterator it = begin(); it; ++it, ++i) {
+            if(*it == value) {
+                return i;
             }
         }
-        return tail_offset + key;
+        return length;
     }
 
     bool contains(const T &value) const {
@@ -2923,49 +3851,87 @@ struct jo_persistent_vector
     // find with lambda for comparison
     template<typename F>
     size_t find(const F &f) const {
-        size_t shift = 5 * (depth + 1);
-        size_t tail_offset = length + head_offset - tail_length;
-
-        // Is it in the tail?
-        if(tail_length > 0) {
-            for(size_t i = 0; i < tail_length; ++i) {
-                if(f(tail->elements[i])) {
-                    return tail_offset + i;
-                }
+        size_t i = 0;
+        for(iterator it = begin(); it; ++it, ++i) {
+            if(f(*it)) {
+                return i;
             }
         }
+        return length;
+    }
 
-        // traverse
-        jo_shared_ptr<node> cur = NULL;
-        jo_shared_ptr<node> prev = head;
-        size_t key = 0;
-        for (size_t level = shift; level > 0; level -= 5) {
-            size_t index = (key >> level) & 0x1f;
-            cur = prev->children[index];
-            if(!cur) {
-                return tail_offset + key;
+    // contains with lambda for comparison
+    template<typename F>
+    bool contains(const F &f) const {
+        return find(f) != length;
+    }
+
+    // 1 if equal, 0 if not, -1 if the trees are shaped differently and can't be walked side by side.
+    // base is the index a starts at, elements before skip were dropped off the front and don't count.
+    template<typename F>
+    static int equal_nodes(const node *a, const node *b, size_t level, size_t base, size_t skip, const F &eq) {
+        if(a == b) {
+            return 1;
+        }
+        if(a->count != b->count || !a->table != !b->table) {
+            return -1;
+        }
+        if(level == 0) {
+            for(int i = 0; i < a->count; ++i) {
+                if(base + i >= skip && !eq(a->elements[i], b->elements[i])) {
+                    return 0;
+                }
             }
-            prev = cur;
+            return 1;
         }
-        for (size_t i = 0; i < 32; ++i) {
-            if(f(prev->elements[i])) {
-                return key + i;
+        for(int i = 0; i < a->count; ++i) {
+            if(a->table && a->table->sizes[i] != b->table->sizes[i]) {
+                return -1;
+            }
+            size_t start = i == 0 ? 0 : a->table ? a->table->sizes[i - 1] : (size_t)i << level;
+            int r = equal_nodes(a->children[i].ptr, b->children[i].ptr, level - 5, base + start, skip, eq);
+            if(r <= 0) {
+                return r;
             }
         }
-        return tail_offset + key;
+        return 1;
     }
 
-    // contains with lambda for comparison
+    // Element-wise equality. When both vectors have the same shape, as with one derived from the
+    // other by assoc, subtrees they share are skipped by pointer, so only the edited paths get compared.
     template<typename F>
-    bool contains(const F &f) const {
-        return find(f) != length;
+    bool equals(const jo_persistent_vector &other, const F &eq) const {
+        if(length != other.length) {
+            return false;
+        }
+        if(shift == other.shift && head_offset == other.head_offset && tail_length == other.tail_length) {
+            int r = equal_nodes(head.ptr, other.head.ptr, shift, 0, head_offset, eq);
+            if(r == 0) {
+                return false;
+            }
+            if(r == 1) {
+                return equal_nodes(tail.ptr, other.tail.ptr, 0, tail_offset(), head_offset, eq) == 1;
+            }
+        }
+        iterator a = begin(), b = other.begin();
+        for(; a; ++a, ++b) {
+            if(!eq(*a, *b)) {
+                return false;
+            }
+        }
+        return true;
     }
 
+    // O(log n), shares everything but the edges with this
     jo_persistent_vector *subvec(size_t start, size_t end) const {
-        jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        copy->head_offset += start;
-        copy->length = end - start;
-        return copy;
+        if(end > length) {
+            end = length;
+        }
+        if(start >= end) {
+            return new jo_persistent_vector();
+        }
+        jo_persistent_vector *copy = drop(start);
+        return copy->take_inplace(end - start);
     }
 
     void print() const {
@@ -2979,12 +3945,12 @@ struct jo_persistent_vector
         printf("]");
     }
 
-    // iterator
+    // iterator, remembers the leaf it is in so stepping is O(1)
     class iterator {
     public:
-        iterator() : vec(NULL), index(0) {}
-        iterator(const jo_persistent_vector *vec, size_t index) : vec(vec), index(index) {}
-        iterator(const iterator &other) : vec(other.vec), index(other.index) {}
+        iterator() : vec(NULL), index(0), leaf(NULL), leaf_start(0), leaf_end(0) {}
+        iterator(const jo_persistent_vector *vec, size_t index) : vec(vec), index(index), leaf(NULL), leaf_start(0), leaf_end(0) {}
+        iterator(const iterator &other) : vec(other.vec), index(other.index), leaf(other.leaf), leaf_start(other.leaf_start), leaf_end(other.leaf_end) {}
         iterator &operator++() {
             ++index;
             return *this;
@@ -3001,13 +3967,19 @@ struct jo_persistent_vector
             return vec != other.vec || index != other.index;
         }
         operator bool() const {
-            return index < vec->size();
+            return vec && index < vec->size();
         }
         const T &operator*() const {
-            return (*vec)[index];
+            size_t i = index + vec->head_offset;
+            if(!leaf || i < leaf_start || i >= leaf_end) {
+                size_t count;
+                leaf = vec->leaf_for(i, leaf_start, count);
+                leaf_end = leaf_start + count;
+            }
+            return leaf->elements[i - leaf_start];
         }
         const T *operator->() const {
-            return &(*vec)[index];
+            return &**this;
         }
         iterator operator+(size_t offset) const {
             return iterator(vec, index + offset);
@@ -3026,18 +3998,21 @@ struct jo_persistent_vector
         size_t operator-(const iterator &other) const {
             return index - other.index;
         }
-        size_t operator-(const iterator &other) {
-            return index - other.index;
-        }
         iterator &operator=(const iterator &other) {
             vec = other.vec;
             index = other.index;
+            leaf = other.leaf;
+            leaf_start = other.leaf_start;
+            leaf_end = other.leaf_end;
             return *this;
         }
 
-    private:
         const jo_persistent_vector *vec;
         size_t index;
+    private:
+        mutable const node *leaf;
+        mutable size_t leaf_start;
+        mutable size_t leaf_end;
     };
 
     iterator begin() const {
@@ -3073,48 +4048,42 @@ struct jo_persistent_vector
     }
 
     jo_persistent_vector *erase(size_t index) const {
-        jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        // @ This could be faster
-        // iterate through values and just copy everything except that item
-        for(size_t i = 0; i < index; ++i) {
-            copy->push_back_inplace((*this)[i]);
-        }
-        for(size_t i = index + 1; i < size(); ++i) {
-            copy->push_back_inplace((*this)[i]);
-        }
-        return copy;
+        return erase(index, index + 1);
     }
 
+    // the elements before start followed by the ones from end on, O(log n)
     jo_persistent_vector *erase(size_t start, size_t end) const {
-        jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        // @ This could be faster
-        // iterate through values and just copy everything except that item
-        for(size_t i = 0; i < start; ++i) {
-            copy->push_back_inplace((*this)[i]);
+        if(end > length) {
+            end = length;
         }
-        for(size_t i = end; i < size(); ++i) {
-            copy->push_back_inplace((*this)[i]);
+        if(start >= end) {
+            return clone();
+        }
+        jo_persistent_vector *copy = take(start);
+        if(end < length) {
+            jo_persistent_vector after(*this);
+            after.head_offset += end;
+            after.length -= end;
+            copy->conj_inplace(after);
         }
         return copy;
     }
 
-    jo_persistent_vector *erase_value(const T &value) const {
-        jo_persistent_vector *copy = new jo_persistent_vector(*this);
-        // iterate through values and just copy everything except that item
-        for(size_t i = 0; i < size(); ++i) {
-            if((*this)[i] != value) {
-                copy->push_back_inplace((*this)[i]);
+    jo_persistent_vector *erase_value(const T &value) const {
+        jo_persistent_vector *copy = new jo_persistent_vector();
+        for(iterator it = begin(); it; ++it) {
+            if(*it != value) {
+                copy->push_back_inplace(*it);
             }
         }
         return copy;
     }
 
     jo_persistent_vector *erase_value_inplace(const T &value) {
-        jo_persistent_vector copy(*this);
-        // iterate through values and just copy everything except that item
-        for(size_t i = 0; i < size(); ++i) {
-            if((*this)[i] != value) {
-                copy.push_back_inplace((*this)[i]);
+        jo_persistent_vector copy;
+        for(iterator it = begin(); it; ++it) {
+            if(*it != value) {
+                copy.push_back_inplace(*it);
             }
         }
         *this = copy;
@@ -3459,13 +4428,13 @@ struct jo_persistent_vector_bidirectional {
 
 // A persistent (non-destructive) linked list implementation.
 template<typename T>
-struct jo_persistent_list {
-    struct node {
-        jo_shared_ptr<node> next;
+struct jo_persistent_list : jo_slab_allocated {
+    struct node : jo_refcounted, jo_slab_allocated {
+        jo_intrusive_ptr<node> next;
         T value;
-        node() : value(), next() {}
-        node(const T &value, jo_shared_ptr<node> next) : value(value), next(next) {}
-        node(const node &other) : value(other.value), next(other.next) {}
+        node() : next(), value() {}
+        node(const T &value, jo_intrusive_ptr<node> next) : next(next), value(value) {}
+        node(const node &other) : next(other.next), value(other.value) {}
         node &operator=(const node &other) {
             value = other.value;
             next = other.next;
@@ -3475,8 +4444,8 @@ struct jo_persistent_list {
         bool operator!=(const node &other) const { return !(*this == other); }
     };
 
-    jo_shared_ptr<node> head;
-    jo_shared_ptr<node> tail;
+    jo_intrusive_ptr<node> head;
+    jo_intrusive_ptr<node> tail;
     size_t length;
 
     jo_persistent_list() : head(NULL), tail(NULL), length(0) {}
@@ -3512,7 +4481,7 @@ struct jo_persistent_list {
     // makes a new list in reverse order of the current one
     jo_persistent_list *reverse() const {
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur) {
             copy->head = new node(cur->value, copy->head);
             if(!copy->tail) {
@@ -3526,10 +4495,10 @@ struct jo_persistent_list {
 
     // This is a destructive operation.
     jo_persistent_list *reverse_inplace() {
-        jo_shared_ptr<node> cur = head;
-        jo_shared_ptr<node> prev = NULL;
+        jo_intrusive_ptr<node> cur = head;
+        jo_intrusive_ptr<node> prev = NULL;
         while(cur) {
-            jo_shared_ptr<node> next = cur->next;
+            jo_intrusive_ptr<node> next = cur->next;
             cur->next = prev;
             prev = cur;
             cur = next;
@@ -3541,9 +4510,9 @@ struct jo_persistent_list {
 
     jo_persistent_list *clone() const {
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
-        jo_shared_ptr<node> cur_copy = NULL;
-        jo_shared_ptr<node> prev = NULL;
+        jo_intrusive_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur_copy = NULL;
+        jo_intrusive_ptr<node> prev = NULL;
         copy->head = NULL;
         while(cur) {
             cur_copy = new node(cur->value, NULL);
@@ -3563,9 +4532,9 @@ struct jo_persistent_list {
     // Clone up to and including the given index and link the rest of the list to the new list.
     jo_persistent_list *clone(int depth) const {
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
-        jo_shared_ptr<node> cur_copy = NULL;
-        jo_shared_ptr<node> prev = NULL;
+        jo_intrusive_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur_copy = NULL;
+        jo_intrusive_ptr<node> prev = NULL;
         while(cur && depth >= 0) {
             cur_copy = new node(cur->value, NULL);
             if(prev) {
@@ -3638,9 +4607,9 @@ struct jo_persistent_list {
 
     jo_persistent_list *assoc(size_t index, const T &value) const {
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
-        jo_shared_ptr<node> cur_copy = NULL;
-        jo_shared_ptr<node> prev = NULL;
+        jo_intrusive_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur_copy = NULL;
+        jo_intrusive_ptr<node> prev = NULL;
         while(cur && index >= 0) {
             cur_copy = new node(cur->value, NULL);
             if(prev) {
@@ -3663,11 +4632,11 @@ struct jo_persistent_list {
         return copy;
     }
 
-    jo_persistent_list *erase_node(jo_shared_ptr<node> at) const {
+    jo_persistent_list *erase_node(jo_intrusive_ptr<node> at) const {
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
-        jo_shared_ptr<node> cur_copy = NULL;
-        jo_shared_ptr<node> prev = NULL;
+        jo_intrusive_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur_copy = NULL;
+        jo_intrusive_ptr<node> prev = NULL;
         while(cur && cur != at) {
             cur_copy = new node(cur->value, NULL);
             if(prev) {
@@ -3706,7 +4675,7 @@ struct jo_persistent_list {
     }
 
     const T &nth(int index) const {
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur && index > 0) {
             cur = cur->next;
             index--;
@@ -3758,15 +4727,16 @@ struct jo_persistent_list {
 
     jo_persistent_list *drop(int index) const {
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
-        while(cur && index > 0) {
+        jo_intrusive_ptr<node> cur = head;
+        int dropped = 0;
+        while(cur && dropped < index) {
             cur = cur->next;
-            index--;
+            dropped++;
         }
         if(cur) {
-            copy->head = cur->next;
+            copy->head = cur;
             copy->tail = tail;
-            copy->length = length - index;
+            copy->length = length - dropped;
         }
         return copy;
     }
@@ -3790,7 +4760,7 @@ struct jo_persistent_list {
             head = new node(value, NULL);
             tail = head;
         } else {
-            jo_shared_ptr<node> new_head = new node(value, head);
+            jo_intrusive_ptr<node> new_head = new node(value, head);
             head = new_head;
         }
         length++;
@@ -3821,7 +4791,7 @@ struct jo_persistent_list {
     }
 
     jo_persistent_list *subvec(int start, int end) const {
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur && start > 0) {
             cur = cur->next;
             start--;
@@ -3836,7 +4806,7 @@ struct jo_persistent_list {
     }
 
     bool contains(const T &value) const {
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur) {
             if(cur->value == value) {
                 return true;
@@ -3849,7 +4819,7 @@ struct jo_persistent_list {
     // contains with lambda for comparison
     template<typename F>
     bool contains(const F &f) const {
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur) {
             if(f(cur->value)) {
                 return true;
@@ -3860,8 +4830,8 @@ struct jo_persistent_list {
     }
 
     jo_persistent_list *erase(const T &value) {
-        jo_shared_ptr<node> cur = head;
-        jo_shared_ptr<node> prev = NULL;
+        jo_intrusive_ptr<node> cur = head;
+        jo_intrusive_ptr<node> prev = NULL;
         while(cur) {
             if(cur->value == value) {
                 return erase_node(cur);
@@ -3874,7 +4844,7 @@ struct jo_persistent_list {
 
     jo_persistent_list *take(int N) const {
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur && N > 0) {
             copy->push_back_inplace(cur->value);
             cur = cur->next;
@@ -3891,7 +4861,7 @@ struct jo_persistent_list {
     jo_persistent_list *shuffle() const {
         // convert to jo_vector
         jo_vector<T> v;
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur) {
             v.push_back(cur->value);
             cur = cur->next;
@@ -3909,7 +4879,7 @@ struct jo_persistent_list {
     // return items with a random probability of p
     jo_persistent_list *random_sample(float p) const { 
         jo_persistent_list *copy = new jo_persistent_list();
-        jo_shared_ptr<node> cur = head;
+        jo_intrusive_ptr<node> cur = head;
         while(cur) {
             if(jo_random_float() < p) {
                 copy->push_back_inplace(cur->value);
@@ -3921,10 +4891,10 @@ struct jo_persistent_list {
 
     // iterator
     class iterator {
-        jo_shared_ptr<node> cur;
+        jo_intrusive_ptr<node> cur;
     public:
         iterator() : cur(NULL) {}
-        iterator(jo_shared_ptr<node> cur) : cur(cur) {}
+        iterator(jo_intrusive_ptr<node> cur) : cur(cur) {}
         iterator(const iterator &other) : cur(other.cur) {}
         iterator &operator=(const iterator &other) {
             cur = other.cur;
@@ -4047,24 +5017,313 @@ template<> size_t jo_hash_value(const char *value) {
 }
 template<> size_t jo_hash_value(const jo_string &value) { return jo_hash_value(value.c_str()); }
 
-// jo_persistent_unordered_map is a persistent hash map
-// that uses a persistent vector as the underlying data structure
-// for the map.
+static inline int jo_popcount(unsigned x) {
+#ifdef _MSC_VER
+    return (int)__popcnt(x);
+#else
+    return __builtin_popcount(x);
+#endif
+}
+
+// jo_persistent_unordered_map is a persistent hash map, implemented as a
+// hash array mapped trie (HAMT). Each level of the trie consumes 5 bits of
+// the key's hash. Nodes only store the slots in use, with a 32 bit bitmap
+// saying which hash fragments those are. Keys with identical hashes share a
+// collision node. assoc and erase copy just the path from the root to the
+// changed slot, so everything else is shared with the original map.
+// The _inplace variants mutate nodes which nothing else references.
 template<typename K, typename V>
-class jo_persistent_unordered_map {
-    // the way this works is that you make your hash value of K and
-    // then use that as an index into the vector.
+class jo_persistent_unordered_map : public jo_slab_allocated {
+public:
     typedef jo_triple<K, V, bool> entry_t;
-    // vec is used to store the keys and values
-    jo_persistent_vector< entry_t > vec;
-    // number of entries actually used in the hash table
+
+private:
+    struct hnode;
+    typedef jo_intrusive_ptr<hnode> hnode_ptr;
+
+    struct slot_t {
+        K key;
+        V value;
+        hnode_ptr child; // if set, this slot is a sub-trie and key/value are unused
+        slot_t() : key(), value(), child() {}
+    };
+
+    struct hnode : jo_refcounted, jo_slab_allocated {
+        unsigned bitmap; // which of the 32 hash fragments are present, unused for collision nodes
+        unsigned hash; // the hash shared by all entries of a collision node
+        int count;
+        bool collision;
+        slot_t *slots;
+
+        hnode(int count) : bitmap(), hash(), count(count), collision(), slots(alloc_slots(count)) {}
+        hnode(const hnode &other) : jo_refcounted(), bitmap(other.bitmap), hash(other.hash), count(other.count), collision(other.collision), slots(alloc_slots(other.count)) {
+            for(int i = 0; i < count; ++i) {
+                slots[i] = other.slots[i];
+            }
+        }
+        ~hnode() { free_slots(slots, count); }
+
+        static slot_t *alloc_slots(int n) {
+            if(n == 0) {
+                return 0;
+            }
+            slot_t *s = (slot_t *)jo_slab::alloc(n * sizeof(slot_t));
+            for(int i = 0; i < n; ++i) {
+                new(s+i) slot_t();
+            }
+            return s;
+        }
+
+        static void free_slots(slot_t *s, int n) {
+            if(!s) {
+                return;
+            }
+            for(int i = 0; i < n; ++i) {
+                s[i].~slot_t();
+            }
+            jo_slab::free(s, n * sizeof(slot_t));
+        }
+
+        void insert_slot(int index) {
+            slot_t *s = alloc_slots(count + 1);
+            for(int i = 0; i < index; ++i) {
+                s[i] = slots[i];
+            }
+            for(int i = index; i < count; ++i) {
+                s[i+1] = slots[i];
+            }
+            free_slots(slots, count);
+            slots = s;
+            count++;
+        }
+
+        void remove_slot(int index) {
+            slot_t *s = alloc_slots(count - 1);
+            for(int i = 0; i < index; ++i) {
+                s[i] = slots[i];
+            }
+            for(int i = index + 1; i < count; ++i) {
+                s[i-1] = slots[i];
+            }
+            free_slots(slots, count);
+            slots = s;
+            count--;
+        }
+    };
+
+    struct default_eq {
+        bool operator()(const K &a, const K &b) const { return a == b; }
+    };
+
+    static unsigned hash_of(const K &key) {
+        size_t h = jo_hash_value(key);
+        return (unsigned)(h ^ (h >> 16 >> 16));
+    }
+
+    static int fragment(unsigned hash, int shift) { return (hash >> shift) & 31; }
+
+    template<typename F>
+    static const slot_t *find_slot(const hnode *n, const K &key, unsigned hash, const F &eq) {
+        for(int shift = 0; n; shift += 5) {
+            if(n->collision) {
+                if(n->hash != hash) {
+                    return 0;
+                }
+                for(int i = 0; i < n->count; ++i) {
+                    if(eq(n->slots[i].key, key)) {
+                        return &n->slots[i];
+                    }
+                }
+                return 0;
+            }
+            unsigned bit = 1u << fragment(hash, shift);
+            if(!(n->bitmap & bit)) {
+                return 0;
+            }
+            const slot_t &s = n->slots[jo_popcount(n->bitmap & (bit - 1))];
+            if(s.child) {
+                n = s.child.ptr;
+                continue;
+            }
+            return eq(s.key, key) ? &s : 0;
+        }
+        return 0;
+    }
+
+    // a node holding just two entries, as deep as it needs to be to tell them apart
+    static hnode_ptr make_pair(int shift, unsigned h1, const K &k1, const V &v1, unsigned h2, const K &k2, const V &v2) {
+        if(h1 == h2) {
+            hnode *n = new hnode(2);
+            n->collision = true;
+            n->hash = h1;
+            n->slots[0].key = k1;
+            n->slots[0].value = v1;
+            n->slots[1].key = k2;
+            n->slots[1].value = v2;
+            return n;
+        }
+        int f1 = fragment(h1, shift);
+        int f2 = fragment(h2, shift);
+        if(f1 == f2) {
+            hnode *n = new hnode(1);
+            n->bitmap = 1u << f1;
+            n->slots[0].child = make_pair(shift + 5, h1, k1, v1, h2, k2, v2);
+            return n;
+        }
+        hnode *n = new hnode(2);
+        n->bitmap = (1u << f1) | (1u << f2);
+        int i1 = f1 < f2 ? 0 : 1;
+        n->slots[i1].key = k1;
+        n->slots[i1].value = v1;
+        n->slots[1-i1].key = k2;
+        n->slots[1-i1].value = v2;
+        return n;
+    }
+
+    // edit allows mutating n (and below) if nothing else references it
+    template<typename F>
+    static hnode_ptr assoc_node(const hnode_ptr &n, int shift, unsigned hash, const K &key, const V &value, const F &eq, bool edit, bool &added) {
+        if(!n) {
+            hnode *r = new hnode(1);
+            r->bitmap = 1u << fragment(hash, shift);
+            r->slots[0].key = key;
+            r->slots[0].value = value;
+            added = true;
+            return r;
+        }
+        edit = edit && n->ref_count == 1;
+        if(n->collision) {
+            if(n->hash != hash) {
+                // push the collision node one level down, under a bitmap node
+                hnode_ptr wrap = new hnode(1);
+                wrap->bitmap = 1u << fragment(n->hash, shift);
+                wrap->slots[0].child = n;
+                return assoc_node(wrap, shift, hash, key, value, eq, true, added);
+            }
+            for(int i = 0; i < n->count; ++i) {
+                if(eq(n->slots[i].key, key)) {
+                    if(n->slots[i].value == value) {
+                        return n;
+                    }
+                    hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+                    r->slots[i].value = value;
+                    return r;
+                }
+            }
+            hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+            r->insert_slot(r->count);
+            r->slots[r->count-1].key = key;
+            r->slots[r->count-1].value = value;
+            added = true;
+            return r;
+        }
+        unsigned bit = 1u << fragment(hash, shift);
+        int idx = jo_popcount(n->bitmap & (bit - 1));
+        if(!(n->bitmap & bit)) {
+            hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+            r->insert_slot(idx);
+            r->bitmap |= bit;
+            r->slots[idx].key = key;
+            r->slots[idx].value = value;
+            added = true;
+            return r;
+        }
+        const slot_t &s = n->slots[idx];
+        if(s.child) {
+            hnode_ptr c = assoc_node(s.child, shift + 5, hash, key, value, eq, edit, added);
+            if(c == s.child) {
+                return n;
+            }
+            hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+            r->slots[idx].child = c;
+            return r;
+        }
+        if(eq(s.key, key)) {
+            if(s.value == value) {
+                return n;
+            }
+            hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+            r->slots[idx].value = value;
+            return r;
+        }
+        hnode_ptr c = make_pair(shift + 5, hash_of(s.key), s.key, s.value, hash, key, value);
+        hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+        r->slots[idx].key = K();
+        r->slots[idx].value = V();
+        r->slots[idx].child = c;
+        added = true;
+        return r;
+    }
+
+    // returns an empty pointer once the node has nothing left in it
+    template<typename F>
+    static hnode_ptr erase_node(const hnode_ptr &n, int shift, unsigned hash, const K &key, const F &eq, bool edit, bool &removed) {
+        edit = edit && n->ref_count == 1;
+        if(n->collision) {
+            if(n->hash != hash) {
+                return n;
+            }
+            for(int i = 0; i < n->count; ++i) {
+                if(eq(n->slots[i].key, key)) {
+                    removed = true;
+                    if(n->count == 1) {
+                        return hnode_ptr();
+                    }
+                    hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+                    r->remove_slot(i);
+                    return r;
+                }
+            }
+            return n;
+        }
+        unsigned bit = 1u << fragment(hash, shift);
+        if(!(n->bitmap & bit)) {
+            return n;
+        }
+        int idx = jo_popcount(n->bitmap & (bit - 1));
+        const slot_t &s = n->slots[idx];
+        if(s.child) {
+            hnode_ptr c = erase_node(s.child, shift + 5, hash, key, eq, edit, removed);
+            if(c == s.child) {
+                return n;
+            }
+            hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+            if(!c) {
+                r->remove_slot(idx);
+                r->bitmap &= ~bit;
+                return r->count ? r : hnode_ptr();
+            }
+            if(c->count == 1 && !c->slots[0].child) {
+                // a lone entry moves up into this node
+                r->slots[idx].key = c->slots[0].key;
+                r->slots[idx].value = c->slots[0].value;
+                r->slots[idx].child = hnode_ptr();
+            } else {
+                r->slots[idx].child = c;
+            }
+            return r;
+        }
+        if(!eq(s.key, key)) {
+            return n;
+        }
+        removed = true;
+        if(n->count == 1) {
+            return hnode_ptr();
+        }
+        hnode_ptr r = edit ? n : hnode_ptr(new hnode(*n));
+        r->remove_slot(idx);
+        r->bitmap &= ~bit;
+        return r;
+    }
+
+    hnode_ptr root;
     size_t length;
 
 public:
-    jo_persistent_unordered_map() : vec(16), length() {}
-    jo_persistent_unordered_map(const jo_persistent_unordered_map &other) : vec(other.vec), length(other.length) {}
+    jo_persistent_unordered_map() : root(), length() {}
+    jo_persistent_unordered_map(const jo_persistent_unordered_map &other) : root(other.root), length(other.length) {}
     jo_persistent_unordered_map &operator=(const jo_persistent_unordered_map &other) {
-        vec = other.vec;
+        root = other.root;
         length = other.length;
         return *this;
     }
@@ -4073,242 +5332,605 @@ public:
         return length;
     }
 
-    // iterator
+    // depth first walk over the trie
     class iterator {
-        typename jo_persistent_vector< entry_t >::iterator cur;
+        enum { MAX_DEPTH = 10 };
+        hnode_ptr root; // keeps the trie alive while iterating
+        const hnode *nodes[MAX_DEPTH];
+        int index[MAX_DEPTH];
+        int depth;
+        entry_t cur;
+
+        // move down or along until we are on an entry
+        void settle() {
+            while(depth > 0) {
+                const hnode *n = nodes[depth-1];
+                int i = index[depth-1];
+                if(i >= n->count) {
+                    if(--depth > 0) {
+                        index[depth-1]++;
+                    }
+                    continue;
+                }
+                const slot_t &s = n->slots[i];
+                if(s.child) {
+                    nodes[depth] = s.child.ptr;
+                    index[depth] = 0;
+                    depth++;
+                    continue;
+                }
+                cur = entry_t(s.key, s.value, true);
+                return;
+            }
+            cur = entry_t();
+        }
     public:
-        iterator(const typename jo_persistent_vector< entry_t >::iterator &it) : cur(it) {
-            // find first non-erased entry
-            while(cur && !cur->third) {
-                cur++;
+        iterator() : root(), depth(0), cur() {}
+        iterator(const hnode_ptr &r) : root(r), depth(0), cur() {
+            if(r) {
+                nodes[0] = r.ptr;
+                index[0] = 0;
+                depth = 1;
+                settle();
+            }
+        }
+        iterator &operator++() {
+            if(depth) {
+                index[depth-1]++;
+                settle();
+            }
+            return *this;
+        }
+        iterator operator++(int) {
+            iterator ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const iterator &other) const {
+            if(depth != other.depth) {
+                return false;
+            }
+            return depth == 0 || (nodes[depth-1] == other.nodes[depth-1] && index[depth-1] == other.index[depth-1]);
+        }
+        bool operator!=(const iterator &other) const {
+            return !(*this == other);
+        }
+        const entry_t &operator*() const {
+            return cur;
+        }
+        const entry_t *operator->() const {
+            return &cur;
+        }
+        iterator operator+(int i) const {
+            iterator ret = *this;
+            while(i-- > 0 && ret) {
+                ++ret;
+            }
+            return ret;
+        }
+        operator bool() const {
+            return depth > 0;
+        }
+    };
+
+    iterator begin() const {
+        return iterator(root);
+    }
+
+    iterator end() const {
+        return iterator();
+    }
+
+    // remove a value from the map
+    template<typename F>
+    jo_persistent_unordered_map *erase(const K &key, F eq) const {
+        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map(*this);
+        copy->erase_inplace(key, eq);
+        return copy;
+    }
+
+    jo_persistent_unordered_map *erase(const K &key) const {
+        return erase(key, default_eq());
+    }
+
+    jo_persistent_unordered_map *erase(const iterator &it) const {
+        return erase(it->first);
+    }
+
+    template<typename F>
+    jo_persistent_unordered_map *erase_inplace(const K &key, F eq) {
+        if(!root) {
+            return this;
+        }
+        bool removed = false;
+        root = erase_node(root, 0, hash_of(key), key, eq, true, removed);
+        if(removed) {
+            --length;
+        }
+        return this;
+    }
+
+    jo_persistent_unordered_map *erase_inplace(const K &key) {
+        return erase_inplace(key, default_eq());
+    }
+
+    // insert a new value into the map, if the value already exists, replaces it
+    template<typename F>
+    jo_persistent_unordered_map *assoc(const K &key, const V &value, F eq) const {
+        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map(*this);
+        copy->assoc_inplace(key, value, eq);
+        return copy;
+    }
+
+    jo_persistent_unordered_map *assoc(const K &key, const V &value) const {
+        return assoc(key, value, default_eq());
+    }
+
+    template<typename F>
+    jo_persistent_unordered_map *assoc_inplace(const K &key, const V &value, F eq) {
+        bool added = false;
+        root = assoc_node(root, 0, hash_of(key), key, value, eq, true, added);
+        if(added) {
+            ++length;
+        }
+        return this;
+    }
+
+    jo_persistent_unordered_map *assoc_inplace(const K &key, const V &value) {
+        return assoc_inplace(key, value, default_eq());
+    }
+
+    // find a value in the map
+    template<typename F>
+    entry_t find(const K &key, const F &eq) const {
+        const slot_t *s = find_slot(root.ptr, key, hash_of(key), eq);
+        if(!s) {
+            return entry_t();
+        }
+        return entry_t(s->key, s->value, true);
+    }
+
+    entry_t find(const K &key) const {
+        return find(key, default_eq());
+    }
+
+    template<typename F>
+    V get(const K &key, const F &eq) const {
+        const slot_t *s = find_slot(root.ptr, key, hash_of(key), eq);
+        return s ? s->value : V();
+    }
+
+    V get(const K &key) const {
+        return get(key, default_eq());
+    }
+
+    // 1 if equal, 0 if not, -1 if the tries are shaped differently and can't be walked side by side
+    template<typename KF, typename VF>
+    static int equal_nodes(const hnode *a, const hnode *b, const KF &key_eq, const VF &value_eq) {
+        if(a == b) {
+            return 1;
+        }
+        if(!a || !b || a->collision || b->collision || a->bitmap != b->bitmap || a->count != b->count) {
+            return -1;
+        }
+        for(int i = 0; i < a->count; ++i) {
+            const slot_t &sa = a->slots[i];
+            const slot_t &sb = b->slots[i];
+            if(!sa.child != !sb.child) {
+                return -1;
+            }
+            if(sa.child) {
+                int r = equal_nodes(sa.child.ptr, sb.child.ptr, key_eq, value_eq);
+                if(r <= 0) {
+                    return r;
+                }
+            } else if(!key_eq(sa.key, sb.key) || !value_eq(sa.value, sb.value)) {
+                // equal keys hash alike, so an equal key in b could only have been in this slot
+                return 0;
+            }
+        }
+        return 1;
+    }
+
+    // Same keys mapping to equal values. Sub-tries the two maps share are skipped without looking
+    // inside, so comparing a map against an edited copy of itself costs O(log n) per edit.
+    template<typename KF, typename VF>
+    bool equals(const jo_persistent_unordered_map &other, const KF &key_eq, const VF &value_eq) const {
+        if(length != other.length) {
+            return false;
+        }
+        int r = equal_nodes(root.ptr, other.root.ptr, key_eq, value_eq);
+        if(r >= 0) {
+            return r == 1;
+        }
+        for(iterator it = begin(); it; ++it) {
+            entry_t e = other.find(it->first, key_eq);
+            if(!e.third || !value_eq(it->second, e.second)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // conj
+    jo_persistent_unordered_map *conj(jo_persistent_unordered_map *other) const {
+        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map(*this);
+        for(iterator it = other->begin(); it; ++it) {
+            copy->assoc_inplace(it->first, it->second);
+        }
+        return copy;
+    }
+};
+
+// jo_persistent_sorted_map is a persistent ordered map, implemented as an
+// AVL tree. assoc and erase copy the nodes on the path from the root to the
+// changed key (and any node a rotation touches), so everything else is shared
+// with the original map. Keys are ordered by a less-than functor passed to
+// each call, in the same way the hash map takes its equality functor.
+// Iterators can start at any key and walk in either direction, so a range
+// query costs O(log n + k).
+// The _inplace variants mutate nodes which nothing else references.
+template<typename K, typename V>
+class jo_persistent_sorted_map : public jo_slab_allocated {
+public:
+    typedef jo_triple<K, V, bool> entry_t;
+
+private:
+    struct tnode;
+    typedef jo_intrusive_ptr<tnode> tnode_ptr;
+
+    struct tnode : jo_refcounted, jo_slab_allocated {
+        K key;
+        V value;
+        tnode_ptr left;
+        tnode_ptr right;
+        int height;
+
+        tnode(const K &key, const V &value) : key(key), value(value), left(), right(), height(1) {}
+        tnode(const tnode &other) : jo_refcounted(), key(other.key), value(other.value), left(other.left), right(other.right), height(other.height) {}
+    };
+
+    struct default_lt {
+        bool operator()(const K &a, const K &b) const { return a < b; }
+    };
+
+    static int height_of(const tnode_ptr &n) {
+        return n ? n->height : 0;
+    }
+
+    static void update_height(tnode *n) {
+        n->height = 1 + jo_max(height_of(n->left), height_of(n->right));
+    }
+
+    // only safe to mutate if nothing else shares n
+    static tnode_ptr editable(const tnode_ptr &n, bool edit) {
+        return edit && n->ref_count == 1 ? n : tnode_ptr(new tnode(*n));
+    }
+
+    // r must already be owned by the caller
+    static tnode_ptr rotate_right(tnode_ptr r, bool edit) {
+        tnode_ptr l = editable(r->left, edit);
+        r->left = l->right;
+        update_height(r.ptr);
+        l->right = r;
+        update_height(l.ptr);
+        return l;
+    }
+
+    static tnode_ptr rotate_left(tnode_ptr r, bool edit) {
+        tnode_ptr rr = editable(r->right, edit);
+        r->right = rr->left;
+        update_height(r.ptr);
+        rr->left = r;
+        update_height(rr.ptr);
+        return rr;
+    }
+
+    // r must already be owned by the caller
+    static tnode_ptr balance(tnode_ptr r, bool edit) {
+        update_height(r.ptr);
+        int bf = height_of(r->left) - height_of(r->right);
+        if(bf > 1) {
+            if(height_of(r->left->left) < height_of(r->left->right)) {
+                r->left = rotate_left(editable(r->left, edit), edit);
+            }
+            return rotate_right(r, edit);
+        }
+        if(bf < -1) {
+            if(height_of(r->right->right) < height_of(r->right->left)) {
+                r->right = rotate_right(editable(r->right, edit), edit);
+            }
+            return rotate_left(r, edit);
+        }
+        return r;
+    }
+
+    template<typename F>
+    static tnode_ptr assoc_node(const tnode_ptr &n, const K &key, const V &value, const F &lt, bool edit, bool &added) {
+        if(!n) {
+            added = true;
+            return tnode_ptr(new tnode(key, value));
+        }
+        edit = edit && n->ref_count == 1;
+        if(lt(key, n->key)) {
+            tnode_ptr c = assoc_node(n->left, key, value, lt, edit, added);
+            tnode_ptr r = edit ? n : tnode_ptr(new tnode(*n));
+            r->left = c;
+            return balance(r, edit);
+        }
+        if(lt(n->key, key)) {
+            tnode_ptr c = assoc_node(n->right, key, value, lt, edit, added);
+            tnode_ptr r = edit ? n : tnode_ptr(new tnode(*n));
+            r->right = c;
+            return balance(r, edit);
+        }
+        tnode_ptr r = edit ? n : tnode_ptr(new tnode(*n));
+        r->value = value;
+        return r;
+    }
+
+    // unlinks the smallest node of n, handing back its key and value
+    static tnode_ptr erase_min(const tnode_ptr &n, bool edit, K &key, V &value) {
+        edit = edit && n->ref_count == 1;
+        if(!n->left) {
+            key = n->key;
+            value = n->value;
+            return n->right;
+        }
+        tnode_ptr c = erase_min(n->left, edit, key, value);
+        tnode_ptr r = edit ? n : tnode_ptr(new tnode(*n));
+        r->left = c;
+        return balance(r, edit);
+    }
+
+    template<typename F>
+    static tnode_ptr erase_node(const tnode_ptr &n, const K &key, const F &lt, bool edit, bool &removed) {
+        if(!n) {
+            return n;
+        }
+        edit = edit && n->ref_count == 1;
+        if(lt(key, n->key)) {
+            tnode_ptr c = erase_node(n->left, key, lt, edit, removed);
+            if(!removed) {
+                return n;
+            }
+            tnode_ptr r = edit ? n : tnode_ptr(new tnode(*n));
+            r->left = c;
+            return balance(r, edit);
+        }
+        if(lt(n->key, key)) {
+            tnode_ptr c = erase_node(n->right, key, lt, edit, removed);
+            if(!removed) {
+                return n;
+            }
+            tnode_ptr r = edit ? n : tnode_ptr(new tnode(*n));
+            r->right = c;
+            return balance(r, edit);
+        }
+        removed = true;
+        if(!n->left) {
+            return n->right;
+        }
+        if(!n->right) {
+            return n->left;
+        }
+        // the successor takes this node's place
+        K succ_key;
+        V succ_value;
+        tnode_ptr c = erase_min(n->right, edit, succ_key, succ_value);
+        tnode_ptr r = edit ? n : tnode_ptr(new tnode(*n));
+        r->key = succ_key;
+        r->value = succ_value;
+        r->right = c;
+        return balance(r, edit);
+    }
+
+    tnode_ptr root;
+    size_t length;
+
+public:
+    jo_persistent_sorted_map() : root(), length() {}
+    jo_persistent_sorted_map(const jo_persistent_sorted_map &other) : root(other.root), length(other.length) {}
+    jo_persistent_sorted_map &operator=(const jo_persistent_sorted_map &other) {
+        root = other.root;
+        length = other.length;
+        return *this;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+    // in order walk, ascending or descending. The stack holds the nodes
+    // still to be visited on the way back up, the top one is the current entry.
+    class iterator {
+        enum { MAX_DEPTH = 64 };
+        tnode_ptr root; // keeps the tree alive while iterating
+        const tnode *stack[MAX_DEPTH];
+        int depth;
+        bool reverse;
+        entry_t cur;
+
+        void push_edge(const tnode *n) {
+            while(n) {
+                stack[depth++] = n;
+                n = reverse ? n->right.ptr : n->left.ptr;
             }
         }
-        iterator() : cur() {}
+
+        void settle() {
+            cur = depth ? entry_t(stack[depth-1]->key, stack[depth-1]->value, true) : entry_t();
+        }
+
+        friend class jo_persistent_sorted_map;
+    public:
+        iterator() : root(), depth(0), reverse(false), cur() {}
+        iterator(const tnode_ptr &r, bool reverse) : root(r), depth(0), reverse(reverse), cur() {
+            push_edge(r.ptr);
+            settle();
+        }
         iterator &operator++() {
-            if(cur) do {
-                cur++;
-            } while(cur && !cur->third);
+            if(depth) {
+                const tnode *n = stack[--depth];
+                push_edge(reverse ? n->left.ptr : n->right.ptr);
+                settle();
+            }
             return *this;
         }
         iterator operator++(int) {
             iterator ret = *this;
-            if(cur) do {
-                cur++;
-            } while(cur && !cur->third);
+            ++*this;
             return ret;
         }
         bool operator==(const iterator &other) const {
-            return cur == other.cur;
+            if(depth != other.depth) {
+                return false;
+            }
+            return depth == 0 || stack[depth-1] == other.stack[depth-1];
         }
         bool operator!=(const iterator &other) const {
-            return cur != other.cur;
+            return !(*this == other);
         }
         const entry_t &operator*() const {
-            return *cur;
+            return cur;
         }
         const entry_t *operator->() const {
-            return &*cur;
-        }
-        iterator operator+(int i) const {
-            iterator ret = *this;
-            ret.cur += i;
-            return ret;
+            return &cur;
         }
         operator bool() const {
-            return cur;
+            return depth > 0;
         }
     };
 
-    iterator begin() {
-        return iterator(vec.begin());
+    iterator begin() const {
+        return iterator(root, false);
     }
 
-    iterator end() {
-        return iterator(vec.end());
+    iterator rbegin() const {
+        return iterator(root, true);
     }
 
-    jo_persistent_unordered_map *resize(size_t new_size) const {
-        //printf("resize\n");
-        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map();
-        copy->vec = jo_persistent_vector< entry_t >(new_size);
-        for(iterator it = begin(); it; ++it) {
-            int index = jo_hash_value(it->first) % new_size;
-            while(copy->vec[index].third) {
-                index = (index + 1) % new_size;
+    iterator end() const {
+        return iterator();
+    }
+
+    // ascending from the first key >= key (or > key if not inclusive)
+    template<typename F>
+    iterator begin_at(const K &key, bool inclusive, const F &lt) const {
+        iterator it;
+        it.root = root;
+        for(const tnode *n = root.ptr; n;) {
+            if(inclusive ? !lt(n->key, key) : lt(key, n->key)) {
+                it.stack[it.depth++] = n;
+                n = n->left.ptr;
+            } else {
+                n = n->right.ptr;
             }
-            copy->vec.assoc_inplace(index, entry_t(it->first, it->second, true));
         }
-        return copy;
+        it.settle();
+        return it;
     }
 
-    jo_persistent_unordered_map *resize_inplace(size_t new_size) {
-        jo_persistent_vector<entry_t> new_vec(new_size);
-        for(iterator it = begin(); it; ++it) {
-            int index = jo_hash_value(it->first) % new_size;
-            while(new_vec[index].third) {
-                index = (index + 1) % new_size;
+    // descending from the last key <= key (or < key if not inclusive)
+    template<typename F>
+    iterator rbegin_at(const K &key, bool inclusive, const F &lt) const {
+        iterator it;
+        it.root = root;
+        it.reverse = true;
+        for(const tnode *n = root.ptr; n;) {
+            if(inclusive ? !lt(key, n->key) : lt(n->key, key)) {
+                it.stack[it.depth++] = n;
+                n = n->right.ptr;
+            } else {
+                n = n->left.ptr;
             }
-            new_vec.assoc_inplace(index, entry_t(it->first, it->second, true));
         }
-        vec = new_vec;
-        return this;
+        it.settle();
+        return it;
     }
 
-    // remove a value from the map
-    jo_persistent_unordered_map *erase(const K &key) const {
-        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map(*this);
-        int index = jo_hash_value(key) % vec.size();
-        while(copy->vec[index].third) {
-            if(copy->vec[index].first == key) {
-                copy->vec.assoc_inplace(index, entry_t(copy->vec[index].first, V(), true));
-                return copy;
-            }
-            index = (index + 1) % vec.size();
-        } 
+    template<typename F>
+    jo_persistent_sorted_map *assoc(const K &key, const V &value, F lt) const {
+        jo_persistent_sorted_map *copy = new jo_persistent_sorted_map(*this);
+        copy->assoc_inplace(key, value, lt);
         return copy;
     }
 
-    // insert a new value into the map, if the value already exists, replaces it
-    jo_persistent_unordered_map *assoc(const K &key, const V &value) const {
-        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map(*this);
-        if(copy->vec.size() - copy->length < copy->vec.size() / 8) {
-            copy->resize_inplace(copy->vec.size() * 2);
-        }
-        int index = jo_hash_value(key) % vec.size();
-        while(copy->vec[index].third) {
-            if(copy->vec[index].first == key) {
-                copy->vec.assoc_inplace(index, entry_t(key, value, true));
-                return copy;
-            }
-            index = (index + 1) % vec.size();
-        } 
-        copy->vec.assoc_inplace(index, entry_t(key, value, true));
-        ++copy->length;
-        return copy;
+    jo_persistent_sorted_map *assoc(const K &key, const V &value) const {
+        return assoc(key, value, default_lt());
     }
 
-    // assoc with lambda for equality
     template<typename F>
-    jo_persistent_unordered_map *assoc(const K &key, const V &value, F eq) const {
-        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map(*this);
-        if(copy->vec.size() - copy->length < copy->vec.size() / 8) {
-            copy->resize_inplace(copy->vec.size() * 2);
-        }
-        int index = jo_hash_value(key) % vec.size();
-        while(copy->vec[index].third) {
-            if(eq(copy->vec[index].first, key)) {
-                copy->vec.assoc_inplace(index, entry_t(key, value, true));
-                return copy;
-            }
-            index = (index + 1) % vec.size();
-        } 
-        copy->vec.assoc_inplace(index, entry_t(key, value, true));
-        ++copy->length;
-        return copy;
+    jo_persistent_sorted_map *assoc_inplace(const K &key, const V &value, F lt) {
+        bool added = false;
+        root = assoc_node(root, key, value, lt, true, added);
+        if(added) {
+            length++;
+        }
+        return this;
     }
 
-    jo_persistent_unordered_map *assoc_inplace(const K &key, const V &value) {
-        if(vec.size() - length < vec.size() / 8) {
-            resize_inplace(vec.size() * 2);
-        }
-        int index = jo_hash_value(key) % vec.size();
-        while(vec[index].third) {
-            if(vec[index].first == key) {
-                vec.assoc_inplace(index, entry_t(key, value, true));
-                return this;
-            }
-            index = (index + 1) % vec.size();
-        } 
-        vec.assoc_inplace(index, entry_t(key, value, true));
-        ++length;
-        return this;
+    jo_persistent_sorted_map *assoc_inplace(const K &key, const V &value) {
+        return assoc_inplace(key, value, default_lt());
     }
 
-    // assoc_inplace with lambda for equality
-    template<typename F>   
-    jo_persistent_unordered_map *assoc_inplace(const K &key, const V &value, F eq) {
-        if(vec.size() - length < vec.size() / 8) {
-            resize_inplace(vec.size() * 2);
-        }
-        int index = jo_hash_value(key) % vec.size();
-        while(vec[index].third) {
-            if(eq(vec[index].first, key)) {
-                vec.assoc_inplace(index, entry_t(key, value, true));
-                return this;
-            }
-            index = (index + 1) % vec.size();
-        } 
-        vec.assoc_inplace(index, entry_t(key, value, true));
-        ++length;
-        return this;
+    template<typename F>
+    jo_persistent_sorted_map *erase(const K &key, F lt) const {
+        jo_persistent_sorted_map *copy = new jo_persistent_sorted_map(*this);
+        copy->erase_inplace(key, lt);
+        return copy;
     }
 
-    // remove a value from the map
-    jo_persistent_unordered_map *erase(const iterator &it) const {
-        return erase(it.cur->first);
+    jo_persistent_sorted_map *erase(const K &key) const {
+        return erase(key, default_lt());
     }
 
-    // find a value in the map
-    entry_t find(const K &key) {
-        size_t index = jo_hash_value(key) % vec.size();
-        while(vec[index].third) {
-            if(vec[index].first == key) {
-                return vec[index];
-            }
-            index = (index + 1) % vec.size();
-        } 
-        return entry_t();
+    template<typename F>
+    jo_persistent_sorted_map *erase_inplace(const K &key, F lt) {
+        bool removed = false;
+        root = erase_node(root, key, lt, true, removed);
+        if(removed) {
+            length--;
+        }
+        return this;
+    }
+
+    jo_persistent_sorted_map *erase_inplace(const K &key) {
+        return erase_inplace(key, default_lt());
     }
 
-    // find using lambda
     template<typename F>
-    entry_t find(const K &key, const F &f) {
-        size_t index = jo_hash_value(key) % vec.size();
-        while(vec[index].third) {
-            if(f(vec[index].first, key)) {
-                return vec[index];
-            }
-            index = (index + 1) % vec.size();
-        } 
+    entry_t find(const K &key, F lt) const {
+        for(const tnode *n = root.ptr; n;) {
+            if(lt(key, n->key)) {
+                n = n->left.ptr;
+            } else if(lt(n->key, key)) {
+                n = n->right.ptr;
+            } else {
+                return entry_t(n->key, n->value, true);
+            }
+        }
         return entry_t();
     }
 
-    V get(const K &key) const {
-        size_t index = jo_hash_value(key) % vec.size();
-        auto it = vec.begin() + index;
-        while(it && it->first != key && it->third) {
-            it++;
-        }
-        if(!it) {
-            return V();
-        }
-        return it->second;
+    entry_t find(const K &key) const {
+        return find(key, default_lt());
     }
 
     template<typename F>
-    V get(const K &key, const F &f) const {
-        size_t index = jo_hash_value(key) % vec.size();
-        auto it = vec.begin() + index;
-        while(it && !f(it->first, key) && it->third) {
-            it++;
-        }
-        if(!it) {
-            return V();
-        }
-        return it->second;
+    bool contains(const K &key, F lt) const {
+        return find(key, lt).third;
     }
 
-    // conj
-    jo_persistent_unordered_map *conj(jo_persistent_unordered_map *other) const {
-        jo_persistent_unordered_map *copy = new jo_persistent_unordered_map(*this);
-        for(auto it = other->vec.begin(); it != other->vec.end(); ++it) {
-            if(it->third) {
-                copy->assoc_inplace(it->first, it->second);
-            }
-        }
-        return copy;
+    // smallest entry
+    entry_t first() const {
+        return *begin();
     }
 
+    // largest entry
+    entry_t last() const {
+        return *rbegin();
+    }
 };
 
 
@@ -4722,6 +6344,571 @@ struct jo_float {
     */
 };
 
+// SIMD kernels over arrays of doubles. AVX2 is used when the compiler targets it, or with
+// gcc/clang on x86 when the CPU reports it at runtime. Otherwise SSE2 on x86, and plain loops
+// everywhere else. Each kernel gives the same results on every path, bar rounding in sums.
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#include <immintrin.h>
+#define JO_SIMD_SSE2 1
+#if defined(__AVX2__) && defined(__FMA__)
+#define JO_SIMD_AVX2 1
+#define JO_SIMD_TARGET_AVX2
+#elif defined(__GNUC__)
+#define JO_SIMD_AVX2 1
+#define JO_SIMD_AVX2_RUNTIME 1
+#define JO_SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+enum {
+    JO_SIMD_ADD,
+    JO_SIMD_SUB,
+    JO_SIMD_MUL,
+    JO_SIMD_DIV,
+};
+
+static inline bool jo_simd_has_avx2() {
+#if defined(JO_SIMD_AVX2_RUNTIME)
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+#elif defined(JO_SIMD_AVX2)
+    return true;
+#else
+    return false;
+#endif
+}
+
+static inline double jo_simd_op(int op, double a, double b) {
+    switch(op) {
+    case JO_SIMD_ADD: return a + b;
+    case JO_SIMD_SUB: return a - b;
+    case JO_SIMD_MUL: return a * b;
+    case JO_SIMD_DIV: return a / b;
+    }
+    return 0;
+}
+
+// out[i] = x[i*sx] op y[i*sy], for i below n. A stride of 0 broadcasts a single value.
+static void jo_simd_binop_scalar(int op, const double *x, size_t sx, const double *y, size_t sy, double *out, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        out[i] = jo_simd_op(op, x[i*sx], y[i*sy]);
+    }
+}
+
+static double jo_simd_sum_scalar(const double *x, size_t n) {
+    double sum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        sum += x[i];
+    }
+    return sum;
+}
+
+static double jo_simd_dot_scalar(const double *x, const double *y, size_t n) {
+    double sum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+// y[i] += a * x[i]
+static void jo_simd_axpy_scalar(double a, const double *x, double *y, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        y[i] += a * x[i];
+    }
+}
+
+#ifdef JO_SIMD_SSE2
+static void jo_simd_binop_sse2(int op, const double *x, size_t sx, const double *y, size_t sy, double *out, size_t n) {
+    __m128d xs = _mm_set1_pd(*x), ys = _mm_set1_pd(*y);
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128d a = sx ? _mm_loadu_pd(x + i) : xs;
+        __m128d b = sy ? _mm_loadu_pd(y + i) : ys;
+        __m128d r;
+        switch(op) {
+        case JO_SIMD_ADD: r = _mm_add_pd(a, b); break;
+        case JO_SIMD_SUB: r = _mm_sub_pd(a, b); break;
+        case JO_SIMD_MUL: r = _mm_mul_pd(a, b); break;
+        default:          r = _mm_div_pd(a, b); break;
+        }
+        _mm_storeu_pd(out + i, r);
+    }
+    for(; i < n; ++i) {
+        out[i] = jo_simd_op(op, x[i*sx], y[i*sy]);
+    }
+}
+
+static double jo_simd_sum_sse2(const double *x, size_t n) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(x + i));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(x + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    return lanes[0] + lanes[1] + jo_simd_sum_scalar(x + i, n - i);
+}
+
+static double jo_simd_dot_sse2(const double *x, const double *y, size_t n) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+    return lanes[0] + lanes[1] + jo_simd_dot_scalar(x + i, y + i, n - i);
+}
+
+static void jo_simd_axpy_sse2(double a, const double *x, double *y, size_t n) {
+    __m128d av = _mm_set1_pd(a);
+    size_t i = 0;
+    for(; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(av, _mm_loadu_pd(x + i))));
+    }
+    jo_simd_axpy_scalar(a, x + i, y + i, n - i);
+}
+#endif
+
+#ifdef JO_SIMD_AVX2
+JO_SIMD_TARGET_AVX2 static void jo_simd_binop_avx2(int op, const double *x, size_t sx, const double *y, size_t sy, double *out, size_t n) {
+    __m256d xs = _mm256_set1_pd(*x), ys = _mm256_set1_pd(*y);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256d a = sx ? _mm256_loadu_pd(x + i) : xs;
+        __m256d b = sy ? _mm256_loadu_pd(y + i) : ys;
+        __m256d r;
+        switch(op) {
+        case JO_SIMD_ADD: r = _mm256_add_pd(a, b); break;
+        case JO_SIMD_SUB: r = _mm256_sub_pd(a, b); break;
+        case JO_SIMD_MUL: r = _mm256_mul_pd(a, b); break;
+        default:          r = _mm256_div_pd(a, b); break;
+        }
+        _mm256_storeu_pd(out + i, r);
+    }
+    for(; i < n; ++i) {
+        out[i] = jo_simd_op(op, x[i*sx], y[i*sy]);
+    }
+}
+
+JO_SIMD_TARGET_AVX2 static double jo_simd_sum_avx2(const double *x, size_t n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(x + i));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(x + i + 4));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+    double sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for(; i < n; ++i) {
+        sum += x[i];
+    }
+    return sum;
+}
+
+JO_SIMD_TARGET_AVX2 static double jo_simd_dot_avx2(const double *x, const double *y, size_t n) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), s1);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(s0, s1));
+    double sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for(; i < n; ++i) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+JO_SIMD_TARGET_AVX2 static void jo_simd_axpy_avx2(double a, const double *x, double *y, size_t n) {
+    __m256d av = _mm256_set1_pd(a);
+    size_t i = 0;
+    for(; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(av, _mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+    for(; i < n; ++i) {
+        y[i] += a * x[i];
+    }
+}
+#endif
+
+// strides other than 0 and 1 take the plain loop
+static void jo_simd_binop(int op, const double *x, size_t sx, const double *y, size_t sy, double *out, size_t n) {
+    if(n == 0) {
+        return;
+    }
+    if(sx > 1 || sy > 1) {
+        jo_simd_binop_scalar(op, x, sx, y, sy, out, n);
+        return;
+    }
+#ifdef JO_SIMD_AVX2
+    if(jo_simd_has_avx2()) {
+        jo_simd_binop_avx2(op, x, sx, y, sy, out, n);
+        return;
+    }
+#endif
+#ifdef JO_SIMD_SSE2
+    jo_simd_binop_sse2(op, x, sx, y, sy, out, n);
+#else
+    jo_simd_binop_scalar(op, x, sx, y, sy, out, n);
+#endif
+}
+
+static double jo_simd_sum(const double *x, size_t n) {
+#ifdef JO_SIMD_AVX2
+    if(jo_simd_has_avx2()) {
+        return jo_simd_sum_avx2(x, n);
+    }
+#endif
+#ifdef JO_SIMD_SSE2
+    return jo_simd_sum_sse2(x, n);
+#else
+    return jo_simd_sum_scalar(x, n);
+#endif
+}
+
+static double jo_simd_dot(const double *x, const double *y, size_t n) {
+#ifdef JO_SIMD_AVX2
+    if(jo_simd_has_avx2()) {
+        return jo_simd_dot_avx2(x, y, n);
+    }
+#endif
+#ifdef JO_SIMD_SSE2
+    return jo_simd_dot_sse2(x, y, n);
+#else
+    return jo_simd_dot_scalar(x, y, n);
+#endif
+}
+
+static void jo_simd_axpy(double a, const double *x, double *y, size_t n) {
+#ifdef JO_SIMD_AVX2
+    if(jo_simd_has_avx2()) {
+        jo_simd_axpy_avx2(a, x, y, n);
+        return;
+    }
+#endif
+#ifdef JO_SIMD_SSE2
+    jo_simd_axpy_sse2(a, x, y, n);
+#else
+    jo_simd_axpy_scalar(a, x, y, n);
+#endif
+}
+
+// Byte scanning, for the reader. A block of 16 (SSE2) or 32 (AVX2) bytes is compared against
+// each byte of a small set at once, and the first hit found from the movemask bits, rather
+// than classifying bytes one at a time.
+
+static inline int jo_ctz32(unsigned x) {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (int)i;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+static inline bool jo_byte_in(unsigned char c, const char *set, int n) {
+    for(int i = 0; i < n; ++i) {
+        if(c == (unsigned char)set[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// mask of the bytes in the block which are in the set, or out of it when invert
+#ifdef JO_SIMD_SSE2
+static inline unsigned jo_simd_match16(const char *p, const __m128i *set, int n, bool invert) {
+    __m128i block = _mm_loadu_si128((const __m128i *)p), hit = _mm_setzero_si128();
+    for(int i = 0; i < n; ++i) {
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, set[i]));
+    }
+    unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+    return invert ? ~mask & 0xFFFF : mask;
+}
+
+static const char *jo_simd_find_sse2(const char *p, const char *end, const char *chars, int n, bool invert) {
+    __m128i set[16];
+    for(int i = 0; i < n; ++i) {
+        set[i] = _mm_set1_epi8(chars[i]);
+    }
+    for(; end - p >= 16; p += 16) {
+        unsigned mask = jo_simd_match16(p, set, n, invert);
+        if(mask) {
+            return p + jo_ctz32(mask);
+        }
+    }
+    for(; p < end && jo_byte_in((unsigned char)*p, chars, n) == invert; ++p) {}
+    return p;
+}
+
+static size_t jo_simd_count_sse2(const char *p, const char *end, char c) {
+    __m128i cv = _mm_set1_epi8(c);
+    size_t count = 0;
+    for(; end - p >= 16; p += 16) {
+        count += jo_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), cv)));
+    }
+    for(; p < end; ++p) {
+        count += *p == c;
+    }
+    return count;
+}
+#endif
+
+#ifdef JO_SIMD_AVX2
+JO_SIMD_TARGET_AVX2 static const char *jo_simd_find_avx2(const char *p, const char *end, const char *chars, int n, bool invert) {
+    __m256i set[16];
+    for(int i = 0; i < n; ++i) {
+        set[i] = _mm256_set1_epi8(chars[i]);
+    }
+    for(; end - p >= 32; p += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)p), hit = _mm256_setzero_si256();
+        for(int i = 0; i < n; ++i) {
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(block, set[i]));
+        }
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if(invert) {
+            mask = ~mask;
+        }
+        if(mask) {
+            return p + jo_ctz32(mask);
+        }
+    }
+    for(; p < end && jo_byte_in((unsigned char)*p, chars, n) == invert; ++p) {}
+    return p;
+}
+
+JO_SIMD_TARGET_AVX2 static size_t jo_simd_count_avx2(const char *p, const char *end, char c) {
+    __m256i cv = _mm256_set1_epi8(c);
+    size_t count = 0;
+    for(; end - p >= 32; p += 32) {
+        count += jo_popcount((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), cv)));
+    }
+    for(; p < end; ++p) {
+        count += *p == c;
+    }
+    return count;
+}
+#endif
+
+static const char *jo_simd_find(const char *p, const char *end, const char *chars, int n, bool invert) {
+#ifdef JO_SIMD_AVX2
+    if(jo_simd_has_avx2()) {
+        return jo_simd_find_avx2(p, end, chars, n, invert);
+    }
+#endif
+#ifdef JO_SIMD_SSE2
+    return jo_simd_find_sse2(p, end, chars, n, invert);
+#else
+    for(; p < end && jo_byte_in((unsigned char)*p, chars, n) == invert; ++p) {}
+    return p;
+#endif
+}
+
+// first byte in [p, end) which is one of the n (at most 16) chars, or end
+static const char *jo_simd_find_first_of(const char *p, const char *end, const char *chars, int n) {
+    return jo_simd_find(p, end, chars, n, false);
+}
+
+// first byte in [p, end) which is none of the n (at most 16) chars, or end
+static const char *jo_simd_find_first_not_of(const char *p, const char *end, const char *chars, int n) {
+    return jo_simd_find(p, end, chars, n, true);
+}
+
+// how many times c occurs in [p, end)
+static size_t jo_simd_count(const char *p, const char *end, char c) {
+#ifdef JO_SIMD_AVX2
+    if(jo_simd_has_avx2()) {
+        return jo_simd_count_avx2(p, end, c);
+    }
+#endif
+#ifdef JO_SIMD_SSE2
+    return jo_simd_count_sse2(p, end, c);
+#else
+    size_t count = 0;
+    for(; p < end; ++p) {
+        count += *p == c;
+    }
+    return count;
+#endif
+}
+
+// C += A B, with A m x k, B k x n and C m x n, all row-major with the given row strides.
+// C is cut into MC x NC output tiles which the caller and jo_shared_pool workers take in turn. For each KC deep slice a
+// tile packs its block of A into MR row strips and of B into NR column strips, so the
+// MR x NR micro kernel streams both from cache with its accumulators held in registers.
+enum {
+    JO_GEMM_MR = 6,
+    JO_GEMM_NR = 8,
+    JO_GEMM_MC = 96,
+    JO_GEMM_KC = 256,
+    JO_GEMM_NC = 256,
+};
+
+// below this many multiply-adds a second thread costs more than it saves
+#define JO_GEMM_THREAD_MIN (128.0*128.0*128.0)
+
+static void jo_gemm_pack_a(const double *a, size_t lda, size_t mc, size_t kc, double *out) {
+    for(size_t i = 0; i < mc; i += JO_GEMM_MR) {
+        size_t rows = mc - i < JO_GEMM_MR ? mc - i : JO_GEMM_MR;
+        for(size_t p = 0; p < kc; ++p) {
+            for(size_t r = 0; r < JO_GEMM_MR; ++r) {
+                *out++ = r < rows ? a[(i + r)*lda + p] : 0;
+            }
+        }
+    }
+}
+
+static void jo_gemm_pack_b(const double *b, size_t ldb, size_t kc, size_t nc, double *out) {
+    for(size_t j = 0; j < nc; j += JO_GEMM_NR) {
+        size_t cols = nc - j < JO_GEMM_NR ? nc - j : JO_GEMM_NR;
+        for(size_t p = 0; p < kc; ++p) {
+            const double *row = b + p*ldb + j;
+            for(size_t c = 0; c < JO_GEMM_NR; ++c) {
+                *out++ = c < cols ? row[c] : 0;
+            }
+        }
+    }
+}
+
+// ab = the MR x NR product of a packed strip of A and one of B
+static void jo_gemm_micro_scalar(size_t kc, const double *a, const double *b, double *ab) {
+    double acc[JO_GEMM_MR*JO_GEMM_NR] = {};
+    for(size_t p = 0; p < kc; ++p, a += JO_GEMM_MR, b += JO_GEMM_NR) {
+        for(size_t r = 0; r < JO_GEMM_MR; ++r) {
+            for(size_t c = 0; c < JO_GEMM_NR; ++c) {
+                acc[r*JO_GEMM_NR + c] += a[r] * b[c];
+            }
+        }
+    }
+    memcpy(ab, acc, sizeof(acc));
+}
+
+#ifdef JO_SIMD_AVX2
+JO_SIMD_TARGET_AVX2 static void jo_gemm_micro_avx2(size_t kc, const double *a, const double *b, double *ab) {
+    __m256d c00 = _mm256_setzero_pd(), c01 = c00, c10 = c00, c11 = c00, c20 = c00, c21 = c00;
+    __m256d c30 = c00, c31 = c00, c40 = c00, c41 = c00, c50 = c00, c51 = c00;
+    for(size_t p = 0; p < kc; ++p, a += JO_GEMM_MR, b += JO_GEMM_NR) {
+        __m256d b0 = _mm256_loadu_pd(b), b1 = _mm256_loadu_pd(b + 4), ar;
+        ar = _mm256_broadcast_sd(a + 0); c00 = _mm256_fmadd_pd(ar, b0, c00); c01 = _mm256_fmadd_pd(ar, b1, c01);
+        ar = _mm256_broadcast_sd(a + 1); c10 = _mm256_fmadd_pd(ar, b0, c10); c11 = _mm256_fmadd_pd(ar, b1, c11);
+        ar = _mm256_broadcast_sd(a + 2); c20 = _mm256_fmadd_pd(ar, b0, c20); c21 = _mm256_fmadd_pd(ar, b1, c21);
+        ar = _mm256_broadcast_sd(a + 3); c30 = _mm256_fmadd_pd(ar, b0, c30); c31 = _mm256_fmadd_pd(ar, b1, c31);
+        ar = _mm256_broadcast_sd(a + 4); c40 = _mm256_fmadd_pd(ar, b0, c40); c41 = _mm256_fmadd_pd(ar, b1, c41);
+        ar = _mm256_broadcast_sd(a + 5); c50 = _mm256_fmadd_pd(ar, b0, c50); c51 = _mm256_fmadd_pd(ar, b1, c51);
+    }
+    _mm256_storeu_pd(ab + 0, c00); _mm256_storeu_pd(ab + 4, c01);
+    _mm256_storeu_pd(ab + 8, c10); _mm256_storeu_pd(ab + 12, c11);
+    _mm256_storeu_pd(ab + 16, c20); _mm256_storeu_pd(ab + 20, c21);
+    _mm256_storeu_pd(ab + 24, c30); _mm256_storeu_pd(ab + 28, c31);
+    _mm256_storeu_pd(ab + 32, c40); _mm256_storeu_pd(ab + 36, c41);
+    _mm256_storeu_pd(ab + 40, c50); _mm256_storeu_pd(ab + 44, c51);
+}
+#endif
+
+struct jo_gemm_t {
+    size_t m, n, k;
+    const double *a, *b;
+    double *c;
+    size_t lda, ldb, ldc;
+    int tiles_n, tiles;
+    volatile int next;
+    volatile int helpers; // pool tasks not yet finished
+};
+
+static void jo_gemm_tile(const jo_gemm_t &g, int tile, double *pa, double *pb) {
+    size_t i0 = (size_t)(tile / g.tiles_n) * JO_GEMM_MC, j0 = (size_t)(tile % g.tiles_n) * JO_GEMM_NC;
+    size_t mc = g.m - i0 < JO_GEMM_MC ? g.m - i0 : JO_GEMM_MC;
+    size_t nc = g.n - j0 < JO_GEMM_NC ? g.n - j0 : JO_GEMM_NC;
+    bool avx2 = jo_simd_has_avx2();
+    for(size_t p0 = 0; p0 < g.k; p0 += JO_GEMM_KC) {
+        size_t kc = g.k - p0 < JO_GEMM_KC ? g.k - p0 : JO_GEMM_KC;
+        jo_gemm_pack_b(g.b + p0*g.ldb + j0, g.ldb, kc, nc, pb);
+        jo_gemm_pack_a(g.a + i0*g.lda + p0, g.lda, mc, kc, pa);
+        // one strip of B stays in L1 while every strip of A passes over it
+        for(size_t j = 0; j < nc; j += JO_GEMM_NR) {
+            size_t cols = nc - j < JO_GEMM_NR ? nc - j : JO_GEMM_NR;
+            for(size_t i = 0; i < mc; i += JO_GEMM_MR) {
+                size_t rows = mc - i < JO_GEMM_MR ? mc - i : JO_GEMM_MR;
+                double ab[JO_GEMM_MR*JO_GEMM_NR];
+#ifdef JO_SIMD_AVX2
+                if(avx2) {
+                    jo_gemm_micro_avx2(kc, pa + i*kc, pb + j*kc, ab);
+                } else
+#endif
+                jo_gemm_micro_scalar(kc, pa + i*kc, pb + j*kc, ab);
+                double *c = g.c + (i0 + i)*g.ldc + j0 + j;
+                for(size_t r = 0; r < rows; ++r) {
+                    for(size_t col = 0; col < cols; ++col) {
+                        c[r*g.ldc + col] += ab[r*JO_GEMM_NR + col];
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void jo_gemm_worker(void *arg) {
+    jo_gemm_t *g = (jo_gemm_t *)arg;
+    double *pa = new double[JO_GEMM_MC*JO_GEMM_KC];
+    double *pb = new double[JO_GEMM_KC*JO_GEMM_NC];
+    for(int tile; (tile = jo_atomic_add(&g->next, 1) - 1) < g->tiles; ) {
+        jo_gemm_tile(*g, tile, pa, pb);
+    }
+    delete[] pa;
+    delete[] pb;
+}
+
+static void jo_gemm_helper(void *arg) {
+    jo_gemm_t *g = (jo_gemm_t *)arg;
+    jo_gemm_worker(g);
+    jo_atomic_add(&g->helpers, -1);
+}
+
+// threads = 0 picks one per core for large enough products. Threads past the caller are
+// tasks on jo_shared_pool, which only help if a worker is free, so none are started here.
+static void jo_gemm(size_t m, size_t n, size_t k, const double *a, size_t lda, const double *b, size_t ldb, double *c, size_t ldc, int threads = 0) {
+    if(m == 0 || n == 0 || k == 0) {
+        return;
+    }
+    jo_gemm_t g;
+    g.m = m; g.n = n; g.k = k;
+    g.a = a; g.b = b; g.c = c;
+    g.lda = lda; g.ldb = ldb; g.ldc = ldc;
+    g.tiles_n = (int)((n + JO_GEMM_NC - 1) / JO_GEMM_NC);
+    g.tiles = (int)((m + JO_GEMM_MC - 1) / JO_GEMM_MC) * g.tiles_n;
+    g.next = 0;
+    g.helpers = 0;
+    if(threads <= 0) {
+        threads = (double)m*n*k < JO_GEMM_THREAD_MIN ? 1 : jo_hardware_concurrency();
+    }
+    if(threads > g.tiles) {
+        threads = g.tiles;
+    }
+    jo_work_stealing_pool *pool = threads > 1 ? jo_shared_pool() : 0;
+    if(pool) {
+        g.helpers = threads - 1 < pool->num_workers ? threads - 1 : pool->num_workers;
+        for(int i = g.helpers; i > 0; --i) {
+            pool->submit(&jo_gemm_helper, &g);
+        }
+    }
+    jo_gemm_worker(&g);
+    // every tile is taken, but helpers may still be on theirs, or not have started at all
+    while(jo_atomic_load(&g.helpers)) {
+        if(!pool->try_run_one()) {
+            jo_sleep(0);
+        }
+    }
+}
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
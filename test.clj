@@ -125,7 +125,11 @@
     (is (= s1        (rest (cons 65 s1))))
     (is (= 11        (count s1)))
     (is (true?       (string? s1)))
-    (is (false?      (string? 42)))))
+    (is (false?      (string? 42)))
+    (is (= "ome"     (subs s1 1 4)))
+    (is (= "String"  (subs s1 5)))
+    (is (= ""        (subs s1 11)))
+    (is (= nil       (subs s1 3 20)))))
 (defn if-test []
   (is (= 2     (if 1
                  2)))
@@ -196,6 +200,302 @@
 (defn count-test []
   (is (= 0  (count (list ))))
   (is (= 4  (count (list 1 2 3 4)))))
+(defn map-test []
+  (is (= 1     (get {:a 1 :b 2} :a)))
+  (is (= 2     (:b {:a 1 :b 2})))
+  (is (= nil   (get (dissoc {:a 1 :b 2} :a) :a)))
+  (is (= 1     (count (dissoc {:a 1 :b 2} :a))))
+  (is (= 3     (count (assoc {:a 1 :b 2} :c 3))))
+  (is (= 2     (count {:a 1 :b 2})))
+  (is (= 1000  (count (reduce (fn [m x] (assoc m x x)) {} (range 1000)))))
+  (is (= 999   (get (reduce (fn [m x] (assoc m x x)) {} (range 1000)) 999)))
+  (is (= {:a 1 :b 2}   (assoc {:b 2} :a 1)))
+  (is (= false         (= {:a 1} {:b 1})))
+  (is (= false         (= {:a 1} [1])))
+  (is (= false         (= (assoc (into {} (map (fn [i] [i i]) (range 1000))) 7 8) (into {} (map (fn [i] [i i]) (range 1000)))))))
+(defn future-test []
+  (is (= 3         @(future (+ 1 2))))
+  (is (= 5         (deref (future-call (fn [] 5)))))
+  (is (= 7         @(future @(future 7))))
+  (is (= :timeout  (deref (promise) 10 :timeout)))
+  (def f (future 1))
+  (is (= 1         @f))
+  (is (= true      (future? f)))
+  (is (= false     (future? (promise)))))
+(defn promise-test []
+  (def p (promise))
+  (is (= false (realized? p)))
+  (deliver p 42)
+  (deliver p 43)
+  (is (= 42    @p)))
+(defn pmap-test []
+  (is (= (list 2 3 4 5 6)  (pmap inc (list 1 2 3 4 5))))
+  (is (= (list 11 22 33)   (pmap + (list 1 2 3) (list 10 20 30))))
+  (is (= (list 1 2 3)      (take 3 (pmap inc (range 100)))))
+  (is (= (list 1 2)        (pcalls (fn [] 1) (fn [] 2)))))
+(defn vector-test []
+  (is (vector?           [1 2 3]))
+  (is (vector?           (vector 1 2 3)))
+  (is (vector?           (vec (list 1 2 3))))
+  (is (= [1 2 3]         (vec (list 1 2 3))))
+  (is (= 3               (count [1 2 3])))
+  (is (= 2               (nth [1 2 3] 1)))
+  (is (= nil             (nth [1 2 3] 3)))
+  (is (= 3               (peek [1 2 3])))
+  (is (= [1 2]           (pop [1 2 3])))
+  (is (= [1 2 3 4]       (conj [1 2 3] 4)))
+  (is (= [1 :x 3]        (assoc [1 2 3] 1 :x)))
+  (is (= 3               (last [1 2 3])))
+  (is (= 1               (first [1 2 3])))
+  (is (= [2 3]           (rest [1 2 3])))
+  (is (= (list 0 1 2)    (cons 0 [1 2])))
+  (is (= 2               ([1 2 3] 1)))
+  (is (= nil             (get [1 2 3] 3)))
+  (is (= [2 3]           (subvec [1 2 3 4] 1 3)))
+  (is (= (list 2 3 4)    (map inc [1 2 3])))
+  (is (= 6               (reduce + [1 2 3])))
+  (is (= 10              (apply + [1 2 3 4])))
+  (is (= 3               (let [x 1 y 2] [x y] (+ x y))))
+  (is (= [1 2 3 4]       (into [1 2] (list 3 4))))
+  (is (= 2000            (count (reduce conj [] (range 2000)))))
+  (is (= 1999            (nth (reduce conj [] (range 2000)) 1999)))
+  (is (= [1 2 3 4]       (catvec [1 2] [3] [4])))
+  (is (= [1 2 3 4]       (into [1 2] [3 4])))
+  (is (= 3000            (count (catvec (vec (range 1000)) (vec (range 2000))))))
+  (is (= 1000            (nth (subvec (catvec (vec (range 1000)) (vec (range 2000))) 900 2500) 1100)))
+  (is (= false           (= (vec (range 5000)) (assoc (vec (range 5000)) 2500 :x))))
+  (is (= (vec (range 5000)) (assoc (vec (range 5000)) 2500 2500)))
+  (is (= (subvec (vec (range 100)) 40) (range 40 100)))
+  (is (= (vec (range 1 100)) (subvec (assoc (vec (range 100)) 0 :x) 1))))
+(defn transient-test []
+  (is (= [1 2 3]         (persistent! (conj! (transient [1 2]) 3))))
+  (is (= [1 :x]          (persistent! (assoc! (transient [1 2]) 1 :x))))
+  (is (= [1]             (persistent! (pop! (transient [1 2])))))
+  (is (= 2               (get (persistent! (assoc! (transient {}) :a 1 :b 2)) :b)))
+  (is (= nil             (get (persistent! (dissoc! (transient {:a 1 :b 2}) :a)) :a)))
+  (is (= 1               (count (persistent! (conj! (transient {}) [:a 1])))))
+  (is (= 3               (count (into {:a 1} [[:b 2] [:c 3]]))))
+  (is (= 5000            (count (persistent! (reduce (fn [m x] (assoc! m x x)) (transient {}) (range 5000))))))
+  (is (= 4999            (nth (persistent! (reduce conj! (transient []) (range 5000))) 4999)))
+  (def v [1 2 3])
+  (def tv (transient v))
+  (conj! tv 4)
+  (is (= [1 2 3]         v))
+  (is (= [1 2 3 4]       (persistent! tv)))
+  (is (= nil             (conj! tv 5))))
+(defn set-test []
+  (is (set?              #{1 2 3}))
+  (is (= 3               (count #{1 2 3 3})))
+  (is (= #{1 2 3}        (set (list 3 2 1 2))))
+  (is (= #{1 2 3}        (hash-set 1 2 3)))
+  (is (= #{1 2 3}        (conj #{1 2} 3)))
+  (is (= #{1 3}          (disj #{1 2 3} 2)))
+  (is (= false           (= #{1 2} #{1 3})))
+  (is (contains?         #{1 2 3} 2))
+  (is (= false           (contains? #{1 2 3} 4)))
+  (is (contains?         {:a 1} :a))
+  (is (contains?         [1 2 3] 2))
+  (is (= 2               (#{1 2 3} 2)))
+  (is (= nil             (#{1 2 3} 4)))
+  (is (= 2               (get #{1 2 3} 2)))
+  (is (= (list 2 3)      (filter #{2 3} (list 1 2 3 4))))
+  (is (= #{1 2 3}        (into #{} [1 2 3 2 1])))
+  (is (= #{1 2}          (persistent! (disj! (conj! (transient #{1}) 2 3) 3))))
+  (is (= (list 1 2 3)    (distinct [1 2 1 3 2])))
+  (is (= 1000            (count (distinct (concat (range 1000) (range 1000))))))
+  (is (= 2               (count (set [[1 2] [1 2] (list 1 2) [2 1]]))))
+  (is (contains?         #{[1 2.0] "ab"} [1 2]))
+  (is (= false           (= (hash-set [1 2]) (hash-set [1 3]))))
+  (is (= 2               (count (into (list) #{1 2}))))
+  (is (= #{1 2}          (set (into (list) #{1 2}))))
+  (is (= #{1 3}          (set (filter odd? #{1 2 3}))))
+  (is (= (list)          (filter odd? #{2 4}))))
+
+(defn sorted-test []
+  (is (sorted?                 (sorted-map 1 :a)))
+  (is (= [1 3 5 7 9]           (sorted-set 9 3 7 1 5 3)))
+  (is (= [4 3 2 1]             (sorted-set-by > 1 2 3 4)))
+  (is (= [:a :b :c]            (sorted-set :c :a :b)))
+  (is (= [[1 :a] [2 :b]]       (sorted-map 2 :b 1 :a)))
+  (is (= [1 :a]                (first (sorted-map 2 :b 1 :a))))
+  (is (= [2 :b]                (last (sorted-map 2 :b 1 :a))))
+  (is (= :b                    (get (sorted-map 2 :b 1 :a) 2)))
+  (is (= :b                    ((sorted-map 2 :b 1 :a) 2)))
+  (is (contains?               (sorted-set 1 2 3) 2))
+  (is (= [1 2 3 4]             (conj (sorted-set 3 1 4) 2)))
+  (is (= [1 4]                 (disj (sorted-set 3 1 4) 3)))
+  (is (= [[0 :z] [1 :a]]       (assoc (sorted-map 1 :a) 0 :z)))
+  (is (= [[:a 1] [:c 3]]       (dissoc (into (sorted-map) {:c 3 :b 2 :a 1}) :b)))
+  (is (= [2 3]                 (subseq (sorted-set 1 2 3 4 5) >= 2 < 4)))
+  (is (= [4 5]                 (subseq (sorted-set 1 2 3 4 5) > 3)))
+  (is (= [4 3 2]               (rsubseq (sorted-set 1 2 3 4 5) > 1 <= 4)))
+  (is (= [2 1]                 (rsubseq (sorted-set 1 2 3 4 5) < 3)))
+  (is (= [[3 :c]]              (subseq (sorted-map 1 :a 2 :b 3 :c) > 2)))
+  (is (= [2 3 4]               (map inc (sorted-set 3 1 2))))
+  (is (= 6                     (reduce + (sorted-set 1 2 3))))
+  (is (= (list 1 3)            (filter odd? (sorted-set 3 2 1))))
+  (is (= (list [1 :a])         (filter (fn [e] (= 1 (first e))) (sorted-map 2 :b 1 :a))))
+  (is (= (list 3 2 1)          (into (list) (sorted-set 2 1 3))))
+  (is (= #{1 2}                (sorted-set 1 2)))
+  (is (= (sorted-set 1 2)      #{1 2}))
+  (is (= false                 (= (sorted-set 1 2) #{1 3})))
+  (is (= (sorted-set 1 2)      (sorted-set-by > 1 2)))
+  (is (= (sorted-map 1 :a)     (hash-map 1 :a)))
+  (is (= false                 (= (sorted-map 1 :a) (hash-map 1 :b))))
+  (is (= false                 (= (sorted-map 1 :a) #{1})))
+  (is (contains?               (hash-set (sorted-set 1 2)) #{2 1})))
+
+(defn vector-of-test []
+  (is (vector?                 (vector-of :double 1 2 3)))
+  (is (= [1.0 2.0 3.0]         (vector-of :double 1 2 3)))
+  (is (= 3                     (count (vector-of :int 1 2 3))))
+  (is (= 2                     (nth (vector-of :int 1 2 3) 1)))
+  (is (= [1 2 3 4]             (conj (vector-of :int 1 2) 3 4)))
+  (is (= [1 9 3]               (assoc (vector-of :int 1 2 3) 1 9)))
+  (is (= [1 2 44]              (into (vector-of :byte) [1 2 300])))
+  (is (= [2 3]                 (rest (vector-of :long 1 2 3))))
+  (is (= [1 2]                 (pop (vector-of :int 1 2 3))))
+  (is (= 3                     (peek (vector-of :int 1 2 3))))
+  (is (= 2.5                   (peek (vector-of :double 1 2.5))))
+  (is (= [2 3]                 (subvec (vector-of :int 1 2 3) 1)))
+  (is (= [2.0]                 (subvec (vector-of :double 1 2 3) 1 2)))
+  (is (= [1 2 44]              (conj (pop (vector-of :byte 1 2 3)) 300)))
+  (is (= [2 44]                (conj (subvec (vector-of :byte 1 2 3) 1 2) 300)))
+  (is (= 499500.0              (reduce + (into (vector-of :double) (range 1000)))))
+  (is (= 12                    (reduce * 2 (vector-of :int 1 2 3))))
+  (is (= 9                     (reduce Math/max (vector-of :int 4 9 1))))
+  (is (= 6                     (reduce (fn [a b] (+ a b)) (vector-of :int 1 2 3))))
+  (is (= [1.0 2.0 3.0]         (map Math/sqrt (vector-of :int 1 4 9))))
+  (is (= [2 5 10]              (map inc (vector-of :int 1 4 9))))
+  (is (= false                 (= (vector-of :double 1 2) (vector-of :double 1 3)))))
+
+(defn tensor-test []
+  (is (tensor?                 (tensor [[1 2] [3 4]])))
+  (is (= [[1 2] [3 4]]         (tensor [[1 2] [3 4]])))
+  (is (= [2 3]                 (tensor/shape (tensor/zeros [2 3]))))
+  (is (= 2                     (count (tensor/ones [2 3]))))
+  (is (= [3 4]                 (nth (tensor [[1 2] [3 4]]) 1)))
+  (is (= [[11 12] [13 14]]     (tensor/add (tensor [[1 2] [3 4]]) 10)))
+  (is (= [[11 22] [13 24]]     (tensor/add (tensor [[1 2] [3 4]]) [10 20])))
+  (is (= [[2 4] [6 8]]         (tensor/mul 2 (tensor [[1 2] [3 4]]))))
+  (is (= [0.5 1.0]             (tensor/div [1 2] 2)))
+  (is (= [-1 -1]               (tensor/sub [1 2] [2 3])))
+  (is (= 10.0                  (tensor/sum (tensor [[1 2] [3 4]]))))
+  (is (= [4 6]                 (tensor/sum (tensor [[1 2] [3 4]]) 0)))
+  (is (= [1.5 3.5]             (tensor/mean (tensor [[1 2] [3 4]]) 1)))
+  (is (= 4.0                   (tensor/amax (tensor [[1 2] [3 4]]))))
+  (is (= [1 3]                 (tensor/amin (tensor [[1 2] [3 4]]) 1)))
+  (is (= 11.0                  (tensor/dot [1 2] [3 4])))
+  (is (= 5                     ((fn [sum n] (/ sum n)) 10 2)))
+  (is (= 7                     (let [shape 3 dot 4] (+ shape dot))))
+  (is (= [[19 22] [43 50]]     (matmul (tensor [[1 2] [3 4]]) (tensor [[5 6] [7 8]]))))
+  (is (= [5 11]                (matmul (tensor [[1 2] [3 4]]) [1 2])))
+  (is (= [[19 22] [43 50]]     (Math/matmul (tensor [[1 2] [3 4]]) (tensor [[5 6] [7 8]]))))
+  (is (= 7800000.0             (tensor/sum (Math/matmul (tensor/ones [300 200]) (tensor/ones [200 130])))))
+  (is (= [[1 3] [2 4]]         (tensor/transpose (tensor [[1 2] [3 4]]))))
+  (is (= [[1 2 3] [4 5 6]]     (tensor/reshape (tensor [1 2 3 4 5 6]) [2 3])))
+  (is (= [[1.0 2.0] [3.0 4.0]] (Math/sqrt (tensor [[1 4] [9 16]]))))
+  (is (= [[1.0 2.0] [3.0 4.0]] (map Math/sqrt (tensor [[1 4] [9 16]])))))
+
+; a scratch file, out of the way of the tree the tests run in
+(defn tmp-path [name] (str (if (-d "/tmp") "/tmp" (System/getenv "TEMP")) "/" name))
+
+(defn freeze-test []
+  (is (= 42                    (thaw (freeze 42))))
+  (is (= -70000                (thaw (freeze -70000))))
+  (is (= 1.5                   (thaw (freeze 1.5))))
+  (is (= nil                   (thaw (freeze nil))))
+  (is (= "hello"               (thaw (freeze "hello"))))
+  (is (= :key                  (thaw (freeze :key))))
+  (is (= '(1 (2 3) [4])        (thaw (freeze '(1 (2 3) [4])))))
+  (is (= {:a 1 "b" [true false]} (thaw (freeze {:a 1 "b" [true false]}))))
+  (is (= #{1 2 3}              (thaw (freeze #{1 2 3}))))
+  (is (= [0 1 2 3 4]           (thaw (freeze (take 5 (range))))))
+  (is (= 14                    (count (freeze (let [v [1 2]] [v v])))))
+  (is (= [[1 2] [1 2]]         (thaw (freeze (let [v [1 2]] [v v])))))
+  (is (= [1 "two" {:three 3}]  (thaw (vec (freeze [1 "two" {:three 3}])))))
+  (is (= (sorted-map 1 2)      (thaw (freeze (sorted-map 1 2)))))
+  (is (= [1 :a]                (first (thaw (freeze (sorted-map 2 :b 1 :a 3 :c))))))
+  (is (= [1 2 3]               (vec (thaw (freeze (sorted-set 3 1 2))))))
+  (is (= true                  (sorted? (thaw (freeze (sorted-set 3 1 2))))))
+  (is (= (hash-map :s (sorted-set 1 2)) (thaw (freeze (hash-map :s (sorted-set 2 1))))))
+  (is (= [1.5 -2.0]            (thaw (freeze (vector-of :double 1.5 -2)))))
+  (is (= [-70000 3]            (thaw (freeze (vector-of :int -70000 3)))))
+  (is (= [1 255]               (thaw (freeze (vector-of :byte 1 255)))))
+  (is (= [1 44]                (conj (thaw (freeze (vector-of :byte 1))) 300)))
+  (is (= [2 3]                 (tensor/shape (thaw (freeze (tensor [[1 2 3] [4 5 6]]))))))
+  (is (= 21.0                  (tensor/sum (thaw (freeze (tensor [[1 2 3] [4 5 6]]))))))
+  (is (freeze-to-file (tmp-path "jo-freeze-test.bin") (hash-map :xs (range 100) :name "jo")))
+  (is (= (hash-map :xs (range 100) :name "jo") (thaw-from-file (tmp-path "jo-freeze-test.bin")))))
+
+; names an image defines can be shadowed and redefined by the script run on it
+(defn image-test []
+  (let [first-run (tmp-path "jo-image-1.clj") second-run (tmp-path "jo-image-2.clj")
+        img (tmp-path "jo-image.img") out (tmp-path "jo-image.txt")]
+    (spit first-run "(def a 5) (def x 1)")
+    (spit second-run (str "(defn g [a] a) (def x 2) (spit \"" out "\" (str (g 3) x a))"))
+    (is (= 0                   (System/exec "./jo --snapshot" img first-run)))
+    (is (= 0                   (System/exec "./jo --image" img second-run)))
+    (is (= "325"               (slurp out)))))
+
+(defn io-test []
+  (is (spit (tmp-path "jo-io-test.txt") "one
+two
+three"))
+  (is (= ["one" "two" "three"] (vec (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (is (= 3                     (count (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (is (= "two"                 (second (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (is (= 5                     (count (range 5))))
+  (let [r (reader (tmp-path "jo-io-test.txt"))]
+    (is (= "one"               (read-line r)))
+    (is (= ["two" "three"]     (vec (line-seq r))))
+    (is (= "two"               (read-line r))))
+  (is (= "one|two|three"       (reduce (fn [a l] (str a "|" l)) (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (is (= 11                    (reduce (fn [n l] (+ n (count l))) 0 (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (is (= ["two" "three"]       (vec (rest (line-seq (reader (tmp-path "jo-io-test.txt")))))))
+  (let [s (line-seq (reader (tmp-path "jo-io-test.txt")))]
+    (is (= 3                   (count s)))
+    (is (= "one"               (first s))))
+  (is (spit (tmp-path "jo-io-test.txt") ""))
+  (is (= 0                     (count (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (is (= 7                     (reduce + 7 (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (is (spit (tmp-path "jo-io-test.txt") "a"))
+  (is (spit (tmp-path "jo-io-test.txt") "b" :append true))
+  (is (= "ab"                  (slurp (tmp-path "jo-io-test.txt"))))
+  (is (spit (tmp-path "jo-io-test.txt") (range 5)))
+  (is (= "01234"               (slurp (tmp-path "jo-io-test.txt"))))
+  (is (spit (tmp-path "jo-io-test.txt") (range 60 70)))
+  (is (= "60616263646566676869" (slurp (tmp-path "jo-io-test.txt"))))
+  (is (spit (tmp-path "jo-io-test.txt") (map (fn [x] (* x 1000)) (range 3))))
+  (is (= "010002000"           (slurp (tmp-path "jo-io-test.txt"))))
+  (is (spit (tmp-path "jo-io-test.txt") [[65 66] "c" (list 1 "d") :e]))
+  (is (= "[65 66]c(1 \"d\"):e" (slurp (tmp-path "jo-io-test.txt"))))
+  (is (spit (tmp-path "jo-io-test.txt") (hash-map :a [1 2])))
+  (is (= "{:a [1 2]}"          (slurp (tmp-path "jo-io-test.txt"))))
+  (is (spit (tmp-path "jo-io-test.txt") (sorted-set 3 1 2)))
+  (is (= "#{1 2 3}"            (slurp (tmp-path "jo-io-test.txt"))))
+  (is (spit (tmp-path "jo-io-test.txt") 66))
+  (is (= "66"                  (slurp (tmp-path "jo-io-test.txt"))))
+  (is (= 42                    (with-open [w (writer (tmp-path "jo-io-test.txt"))]
+                                 (write-line w "x" 1)
+                                 (write w ["y" "z"])
+                                 42)))
+  (is (with-open [w (writer (tmp-path "jo-io-test.txt") :append true)]
+        (write-line w)
+        (flush w)))
+  (is (= ["x1" "yz"]           (vec (line-seq (reader (tmp-path "jo-io-test.txt"))))))
+  (let [w (writer (tmp-path "jo-io-test.txt"))]
+    (write w "done")
+    (is (close w)))
+  (is (= "done"                (slurp (tmp-path "jo-io-test.txt")))))
+
+(defn print-test []
+  (is (= "ab"                  (with-out-str (print "a") (print "b"))))
+  (is (= "hi 42 -7 1.500000"   (with-out-str (print "hi" " " 42 " " -7 " " 1.5))))
+  (is (= "x
+"                              (with-out-str (println "x"))))
+  (is (= "x[y]"                (with-out-str (print "x") (print (str "[" (with-out-str (print "y")) "]")))))
+  (is (= ""                    (with-out-str 1 2))))
 
 (string-test)
 (if-test)
@@ -212,6 +512,20 @@
 (nth-test)
 ;(nthrest-test)
 (count-test)
+(map-test)
+(future-test)
+(promise-test)
+(pmap-test)
+(vector-test)
+(transient-test)
+(set-test)
+(sorted-test)
+(vector-of-test)
+(tensor-test)
+(freeze-test)
+(io-test)
+(image-test)
+(print-test)
 
 ;(doall (map println (range 1 4)))
 
@@ -0,0 +1,45 @@
+; Multi-threaded stress test for the runtime core: node allocation, ref counting and env access
+; from many futures at once. Prints nothing but "done" when everything is ok.
+
+(defn sum-squares [n] (reduce + (map (fn [x] (* x x)) (range n))))
+(def expected (sum-squares 300))
+
+; lots of threads allocating nodes and lists at the same time
+(def futs (doall (map (fn [i] (future (sum-squares 300))) (range 64))))
+(dotimes [i 64]
+  (when-not (= expected @(nth futs i)) (println "FAIL sum-squares in future " i)))
+
+; closures and a shared env captured by many threads
+(defn make-adder [n] (fn [x] (+ x n)))
+(def add5 (make-adder 5))
+(def adds (doall (map (fn [i] (future (reduce + (map add5 (range 100))))) (range 32))))
+(dotimes [i 32]
+  (when-not (= 5450 @(nth adds i)) (println "FAIL shared closure " i)))
+
+; concurrent defs into the global env while other threads read it
+(def defs (doall (map (fn [i] (future (def shared-var i) (+ (sum-squares 50) shared-var))) (range 32))))
+(dotimes [i 32] @(nth defs i))
+(when-not (number? shared-var) (println "FAIL concurrent def"))
+
+; nested futures and pmap inside futures
+(def nested (doall (map (fn [i] (future (reduce + (pmap inc (range 50))))) (range 16))))
+(dotimes [i 16]
+  (when-not (= 1275 @(nth nested i)) (println "FAIL nested pmap " i)))
+
+(when-not (= (map (fn [x] (* x x)) (range 500)) (pmap (fn [x] (* x x)) (range 500))) (println "FAIL pmap vs map"))
+
+; many threads hashing the same fresh keys, which each caches in the key node
+(def keys3 (vec (map (fn [i] [i (str "k" i) [i]]) (range 300))))
+(def hashers (doall (map (fn [i] (future (count (apply hash-set keys3)))) (range 16))))
+(dotimes [i 16]
+  (when-not (= 300 @(nth hashers i)) (println "FAIL shared key hashing " i)))
+(when (= (nth keys3 3) (nth keys3 4)) (println "FAIL cached hash equality"))
+(when-not (= (nth keys3 3) [3 "k3" [3]]) (println "FAIL cached hash equality"))
+
+; matrix products big enough to split into tiles, run from futures and pmap on the same pool
+(def products (doall (map (fn [i] (future (tensor/sum (matmul (tensor/ones [200 300]) (tensor/ones [300 250]))))) (range 8))))
+(dotimes [i 8]
+  (when-not (= 15000000.0 @(nth products i)) (println "FAIL matmul in future " i)))
+(when-not (= [15000000.0 15000000.0 15000000.0 15000000.0] (pmap (fn [_] (tensor/sum (matmul (tensor/ones [200 300]) (tensor/ones [300 250])))) (range 4))) (println "FAIL matmul in pmap"))
+
+(println "done")